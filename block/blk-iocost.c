@@ -2019,6 +2019,24 @@ static void ioc_cpd_free(struct blkcg_policy_data *cpd)
 	kfree(container_of(cpd, struct ioc_cgrp, cpd));
 }
 
+/**
+ * blkcg_iocost_dfl_weight - default io.weight of a cgroup
+ * @blkcg: blkcg of interest
+ *
+ * Writeback uses this to share the dirty limit between cgroups the way
+ * their IO is shared.  Per-device weights aren't looked at, a bdi doesn't
+ * know its request_queue.
+ */
+u32 blkcg_iocost_dfl_weight(struct blkcg *blkcg)
+{
+	struct blkcg_policy_data *cpd;
+
+	cpd = blkcg_to_cpd(blkcg, &blkcg_policy_iocost);
+	if (!cpd)
+		return CGROUP_WEIGHT_DFL;
+	return READ_ONCE(container_of(cpd, struct ioc_cgrp, cpd)->dfl_weight);
+}
+
 static struct blkg_policy_data *ioc_pd_alloc(gfp_t gfp, struct request_queue *q,
 					     struct blkcg *blkcg)
 {
@@ -91,6 +91,10 @@ static int g_submit_queues = 1;
 module_param_named(submit_queues, g_submit_queues, int, 0444);
 MODULE_PARM_DESC(submit_queues, "Number of submission queues");
 
+static int g_poll_queues;
+module_param_named(poll_queues, g_poll_queues, int, 0444);
+MODULE_PARM_DESC(poll_queues, "Number of IOPOLL submission queues");
+
 static int g_home_node = NUMA_NO_NODE;
 module_param_named(home_node, g_home_node, int, 0444);
 MODULE_PARM_DESC(home_node, "Home node for the device");
@@ -284,6 +288,7 @@ CONFIGFS_ATTR(nullb_device_, NAME);
 NULLB_DEVICE_ATTR(size, ulong);
 NULLB_DEVICE_ATTR(completion_nsec, ulong);
 NULLB_DEVICE_ATTR(submit_queues, uint);
+NULLB_DEVICE_ATTR(poll_queues, uint);
 NULLB_DEVICE_ATTR(home_node, uint);
 NULLB_DEVICE_ATTR(queue_mode, uint);
 NULLB_DEVICE_ATTR(blocksize, uint);
@@ -398,6 +403,7 @@ static struct configfs_attribute *nullb_device_attrs[] = {
 	&nullb_device_attr_size,
 	&nullb_device_attr_completion_nsec,
 	&nullb_device_attr_submit_queues,
+	&nullb_device_attr_poll_queues,
 	&nullb_device_attr_home_node,
 	&nullb_device_attr_queue_mode,
 	&nullb_device_attr_blocksize,
@@ -467,7 +473,7 @@ nullb_group_drop_item(struct config_group *group, struct config_item *item)
 
 static ssize_t memb_group_features_show(struct config_item *item, char *page)
 {
-	return snprintf(page, PAGE_SIZE, "memory_backed,discard,bandwidth,cache,badblocks,zoned,zone_size\n");
+	return snprintf(page, PAGE_SIZE, "memory_backed,discard,bandwidth,cache,badblocks,zoned,zone_size,poll_queues\n");
 }
 
 CONFIGFS_ATTR_RO(memb_group_, features);
@@ -519,6 +525,7 @@ static struct nullb_device *null_alloc_dev(void)
 	dev->size = g_gb * 1024;
 	dev->completion_nsec = g_completion_nsec;
 	dev->submit_queues = g_submit_queues;
+	dev->poll_queues = g_poll_queues;
 	dev->home_node = g_home_node;
 	dev->queue_mode = g_queue_mode;
 	dev->blocksize = g_bs;
@@ -1185,6 +1192,16 @@ static inline blk_status_t null_handle_memory_backed(struct nullb_cmd *cmd,
 
 static inline void nullb_complete_cmd(struct nullb_cmd *cmd)
 {
+	struct nullb_queue *nq = cmd->nq;
+
+	/* Polled queues never raise a completion, null_poll() reaps them */
+	if (nq->polled) {
+		spin_lock(&nq->poll_lock);
+		list_add_tail(&cmd->list, &nq->poll_list);
+		spin_unlock(&nq->poll_lock);
+		return;
+	}
+
 	/* Complete IO by inline, softirq or timer */
 	switch (cmd->nq->dev->irqmode) {
 	case NULL_IRQ_SOFTIRQ:
@@ -1360,10 +1377,61 @@ static blk_status_t null_queue_rq(struct blk_mq_hw_ctx *hctx,
 	return null_handle_cmd(cmd, sector, nr_sectors, req_op(bd->rq));
 }
 
+static int null_poll(struct blk_mq_hw_ctx *hctx)
+{
+	struct nullb_queue *nq = hctx->driver_data;
+	struct nullb_cmd *cmd, *next;
+	LIST_HEAD(list);
+	int nr = 0;
+
+	spin_lock(&nq->poll_lock);
+	list_splice_init(&nq->poll_list, &list);
+	spin_unlock(&nq->poll_lock);
+
+	list_for_each_entry_safe(cmd, next, &list, list) {
+		list_del_init(&cmd->list);
+		end_cmd(cmd);
+		nr++;
+	}
+
+	return nr;
+}
+
+static int null_map_queues(struct blk_mq_tag_set *set)
+{
+	struct nullb *nullb = set->driver_data;
+	unsigned int submit_queues = g_submit_queues;
+	unsigned int poll_queues = g_poll_queues;
+	struct blk_mq_queue_map *map;
+
+	if (nullb) {
+		submit_queues = nullb->dev->submit_queues;
+		poll_queues = nullb->dev->poll_queues;
+	}
+
+	map = &set->map[HCTX_TYPE_DEFAULT];
+	map->nr_queues = submit_queues;
+	map->queue_offset = 0;
+	blk_mq_map_queues(map);
+
+	if (set->nr_maps > HCTX_TYPE_POLL) {
+		set->map[HCTX_TYPE_READ].nr_queues = 0;
+
+		map = &set->map[HCTX_TYPE_POLL];
+		map->nr_queues = poll_queues;
+		map->queue_offset = submit_queues;
+		blk_mq_map_queues(map);
+	}
+
+	return 0;
+}
+
 static const struct blk_mq_ops null_mq_ops = {
 	.queue_rq       = null_queue_rq,
 	.complete	= null_complete_rq,
 	.timeout	= null_timeout_rq,
+	.poll		= null_poll,
+	.map_queues	= null_map_queues,
 };
 
 static void cleanup_queue(struct nullb_queue *nq)
@@ -1449,6 +1517,8 @@ static void null_init_queue(struct nullb *nullb, struct nullb_queue *nq)
 	init_waitqueue_head(&nq->wait);
 	nq->queue_depth = nullb->queue_depth;
 	nq->dev = nullb->dev;
+	spin_lock_init(&nq->poll_lock);
+	INIT_LIST_HEAD(&nq->poll_list);
 }
 
 static void null_init_queues(struct nullb *nullb)
@@ -1464,6 +1534,7 @@ static void null_init_queues(struct nullb *nullb)
 		nq = &nullb->queues[i];
 		hctx->driver_data = nq;
 		null_init_queue(nullb, nq);
+		nq->polled = hctx->type == HCTX_TYPE_POLL;
 		nullb->nr_queues++;
 	}
 }
@@ -1496,7 +1567,8 @@ static int setup_commands(struct nullb_queue *nq)
 
 static int setup_queues(struct nullb *nullb)
 {
-	nullb->queues = kcalloc(nullb->dev->submit_queues,
+	nullb->queues = kcalloc(nullb->dev->submit_queues +
+				nullb->dev->poll_queues,
 				sizeof(struct nullb_queue),
 				GFP_KERNEL);
 	if (!nullb->queues)
@@ -1557,9 +1629,18 @@ static int null_gendisk_register(struct nullb *nullb)
 
 static int null_init_tag_set(struct nullb *nullb, struct blk_mq_tag_set *set)
 {
+	unsigned int poll_queues;
+
 	set->ops = &null_mq_ops;
 	set->nr_hw_queues = nullb ? nullb->dev->submit_queues :
 						g_submit_queues;
+	poll_queues = nullb ? nullb->dev->poll_queues : g_poll_queues;
+	if (poll_queues) {
+		set->nr_hw_queues += poll_queues;
+		set->nr_maps = 3;
+	} else {
+		set->nr_maps = 1;
+	}
 	set->queue_depth = nullb ? nullb->dev->hw_queue_depth :
 						g_hw_queue_depth;
 	set->numa_node = nullb ? nullb->dev->home_node : g_home_node;
@@ -1567,7 +1648,7 @@ static int null_init_tag_set(struct nullb *nullb, struct blk_mq_tag_set *set)
 	set->flags = BLK_MQ_F_SHOULD_MERGE;
 	if (g_no_sched)
 		set->flags |= BLK_MQ_F_NO_SCHED;
-	set->driver_data = NULL;
+	set->driver_data = nullb;
 
 	if ((nullb && nullb->dev->blocking) || g_blocking)
 		set->flags |= BLK_MQ_F_BLOCKING;
@@ -1588,6 +1669,11 @@ static void null_validate_conf(struct nullb_device *dev)
 	else if (dev->submit_queues == 0)
 		dev->submit_queues = 1;
 
+	/* only blk-mq can poll, and not through per-node contexts */
+	if (dev->queue_mode != NULL_Q_MQ || dev->use_per_node_hctx)
+		dev->poll_queues = 0;
+	dev->poll_queues = min(dev->poll_queues, nr_cpu_ids);
+
 	dev->queue_mode = min_t(unsigned int, dev->queue_mode, NULL_Q_MQ);
 	dev->irqmode = min_t(unsigned int, dev->irqmode, NULL_IRQ_TIMER);
 
@@ -1786,6 +1872,11 @@ static int __init null_init(void)
 	else if (g_submit_queues <= 0)
 		g_submit_queues = 1;
 
+	if (g_queue_mode != NULL_Q_MQ || g_use_per_node_hctx || g_poll_queues < 0)
+		g_poll_queues = 0;
+	else if (g_poll_queues > nr_cpu_ids)
+		g_poll_queues = nr_cpu_ids;
+
 	if (g_queue_mode == NULL_Q_MQ && shared_tags) {
 		ret = null_init_tag_set(NULL, &tag_set);
 		if (ret)
@@ -910,6 +910,7 @@ static void handle_tx_zerocopy(struct vhost_net *net, struct socket *sock)
 			ubuf->ctx = nvq->ubufs;
 			ubuf->desc = nvq->upend_idx;
 			refcount_set(&ubuf->refcnt, 1);
+			ubuf->flags = 0;
 			msg.msg_control = &ctl;
 			ctl.type = TUN_MSG_UBUF;
 			ctl.ptr = ubuf;
@@ -32,6 +32,7 @@
 #include <linux/bit_spinlock.h>
 #include <linux/rculist_bl.h>
 #include <linux/list_lru.h>
+#include <linux/sched/mm.h>
 #include "internal.h"
 #include "mount.h"
 
@@ -74,6 +75,13 @@
 int sysctl_vfs_cache_pressure __read_mostly = 100;
 EXPORT_SYMBOL_GPL(sysctl_vfs_cache_pressure);
 
+/*
+ * Maximum number of unused negative dentries per superblock, 0 means no
+ * limit. Above it, __d_alloc() recycles the oldest ones itself instead of
+ * leaving them all to the memory shrinker.
+ */
+unsigned long sysctl_negative_dentry_limit __read_mostly;
+
 __cacheline_aligned_in_smp DEFINE_SEQLOCK(rename_lock);
 
 EXPORT_SYMBOL(rename_lock);
@@ -322,15 +330,54 @@ static inline void __d_set_inode_and_type(struct dentry *dentry,
 	WRITE_ONCE(dentry->d_flags, flags);
 }
 
+/*
+ * Account an unused negative dentry both globally and against the
+ * per-superblock count that sysctl_negative_dentry_limit applies to.
+ */
+static inline void d_negative_inc(struct dentry *dentry)
+{
+	this_cpu_inc(nr_dentry_negative);
+	percpu_counter_inc(&dentry->d_sb->s_nr_dentry_negative);
+}
+
+static inline void d_negative_dec(struct dentry *dentry)
+{
+	this_cpu_dec(nr_dentry_negative);
+	percpu_counter_dec(&dentry->d_sb->s_nr_dentry_negative);
+}
+
+/*
+ * Unused negative dentries sit on their own LRU, so that recycling them
+ * does not have to walk past the positive ones.
+ */
+static inline struct list_lru *d_lru_list(struct dentry *dentry)
+{
+	if (d_is_negative(dentry))
+		return &dentry->d_sb->s_dentry_negative_lru;
+	return &dentry->d_sb->s_dentry_lru;
+}
+
+/* On the superblock LRU, not on a shrink list */
+static inline bool d_on_sb_lru(struct dentry *dentry)
+{
+	return (dentry->d_flags & (DCACHE_LRU_LIST | DCACHE_SHRINK_LIST)) ==
+		DCACHE_LRU_LIST;
+}
+
 static inline void __d_clear_type_and_inode(struct dentry *dentry)
 {
 	unsigned flags = READ_ONCE(dentry->d_flags);
+	bool on_lru = d_on_sb_lru(dentry);
 
+	if (on_lru)
+		WARN_ON_ONCE(!list_lru_del(d_lru_list(dentry), &dentry->d_lru));
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	WRITE_ONCE(dentry->d_flags, flags);
 	dentry->d_inode = NULL;
-	if (dentry->d_flags & DCACHE_LRU_LIST)
-		this_cpu_inc(nr_dentry_negative);
+	if (on_lru) {
+		d_negative_inc(dentry);
+		WARN_ON_ONCE(!list_lru_add(d_lru_list(dentry), &dentry->d_lru));
+	}
 }
 
 static void dentry_free(struct dentry *dentry)
@@ -400,8 +447,8 @@ static void d_lru_add(struct dentry *dentry)
 	dentry->d_flags |= DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
 	if (d_is_negative(dentry))
-		this_cpu_inc(nr_dentry_negative);
-	WARN_ON_ONCE(!list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
+		d_negative_inc(dentry);
+	WARN_ON_ONCE(!list_lru_add(d_lru_list(dentry), &dentry->d_lru));
 }
 
 static void d_lru_del(struct dentry *dentry)
@@ -410,8 +457,8 @@ static void d_lru_del(struct dentry *dentry)
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
 	if (d_is_negative(dentry))
-		this_cpu_dec(nr_dentry_negative);
-	WARN_ON_ONCE(!list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
+		d_negative_dec(dentry);
+	WARN_ON_ONCE(!list_lru_del(d_lru_list(dentry), &dentry->d_lru));
 }
 
 static void d_shrink_del(struct dentry *dentry)
@@ -442,7 +489,7 @@ static void d_lru_isolate(struct list_lru_one *lru, struct dentry *dentry)
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
 	if (d_is_negative(dentry))
-		this_cpu_dec(nr_dentry_negative);
+		d_negative_dec(dentry);
 	list_lru_isolate(lru, &dentry->d_lru);
 }
 
@@ -452,7 +499,7 @@ static void d_lru_shrink_move(struct list_lru_one *lru, struct dentry *dentry,
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags |= DCACHE_SHRINK_LIST;
 	if (d_is_negative(dentry))
-		this_cpu_dec(nr_dentry_negative);
+		d_negative_dec(dentry);
 	list_lru_isolate_move(lru, &dentry->d_lru, list);
 }
 
@@ -1196,14 +1243,80 @@ static enum lru_status dentry_lru_isolate(struct list_head *item,
 long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc)
 {
 	LIST_HEAD(dispose);
+	unsigned long nr_neg, nr_all;
 	long freed;
 
+	/* Split the scan between both LRUs in proportion to their sizes */
+	nr_neg = list_lru_shrink_count(&sb->s_dentry_negative_lru, sc);
+	nr_all = nr_neg + list_lru_shrink_count(&sb->s_dentry_lru, sc);
+	nr_neg = nr_all ? mult_frac(sc->nr_to_scan, nr_neg, nr_all) : 0;
+
+	sc->nr_to_scan -= nr_neg;
 	freed = list_lru_shrink_walk(&sb->s_dentry_lru, sc,
 				     dentry_lru_isolate, &dispose);
+	sc->nr_to_scan += nr_neg;
+	freed += list_lru_shrink_walk(&sb->s_dentry_negative_lru, sc,
+				      dentry_lru_isolate, &dispose);
 	shrink_dentry_list(&dispose);
 	return freed;
 }
 
+/* Number of negative LRU entries looked at per __d_alloc() over the limit */
+#define NEGATIVE_DENTRY_SCAN	128
+
+static enum lru_status dentry_negative_lru_isolate(struct list_head *item,
+		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
+{
+	struct list_head *freeable = arg;
+	struct dentry	*dentry = container_of(item, struct dentry, d_lru);
+
+	/* See dentry_lru_isolate() for the locking */
+	if (!spin_trylock(&dentry->d_lock))
+		return LRU_SKIP;
+
+	/* In-use dentries come off the LRU, as in dentry_lru_isolate() */
+	if (dentry->d_lockref.count) {
+		d_lru_isolate(lru, dentry);
+		spin_unlock(&dentry->d_lock);
+		return LRU_REMOVED;
+	}
+
+	if (dentry->d_flags & DCACHE_REFERENCED) {
+		dentry->d_flags &= ~DCACHE_REFERENCED;
+		spin_unlock(&dentry->d_lock);
+		return LRU_ROTATE;
+	}
+
+	d_lru_shrink_move(lru, dentry, freeable);
+	spin_unlock(&dentry->d_lock);
+
+	return LRU_REMOVED;
+}
+
+/*
+ * Recycle the least recently used negative dentries of @sb once it holds
+ * more than sysctl_negative_dentry_limit of them. Called on dentry
+ * allocation, so that probes for nonexistent names cannot grow the dcache
+ * without bounds before memory pressure kicks in.
+ */
+static void prune_negative_dentries(struct super_block *sb)
+{
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+	LIST_HEAD(dispose);
+
+	if (likely(!limit))
+		return;
+	if (percpu_counter_read_positive(&sb->s_nr_dentry_negative) <= limit)
+		return;
+	/* Killing dentries may recurse into the filesystem, like reclaim */
+	if (!(current_gfp_context(GFP_KERNEL) & __GFP_FS))
+		return;
+
+	list_lru_walk(&sb->s_dentry_negative_lru, dentry_negative_lru_isolate,
+		      &dispose, NEGATIVE_DENTRY_SCAN);
+	shrink_dentry_list(&dispose);
+}
+
 static enum lru_status dentry_lru_isolate_shrink(struct list_head *item,
 		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
 {
@@ -1239,8 +1352,11 @@ void shrink_dcache_sb(struct super_block *sb)
 
 		list_lru_walk(&sb->s_dentry_lru,
 			dentry_lru_isolate_shrink, &dispose, 1024);
+		list_lru_walk(&sb->s_dentry_negative_lru,
+			dentry_lru_isolate_shrink, &dispose, 1024);
 		shrink_dentry_list(&dispose);
-	} while (list_lru_count(&sb->s_dentry_lru) > 0);
+	} while (list_lru_count(&sb->s_dentry_lru) > 0 ||
+		 list_lru_count(&sb->s_dentry_negative_lru) > 0);
 }
 EXPORT_SYMBOL(shrink_dcache_sb);
 
@@ -1688,6 +1804,8 @@ struct dentry *__d_alloc(struct super_block *sb, const struct qstr *name)
 	char *dname;
 	int err;
 
+	prune_negative_dentries(sb);
+
 	dentry = kmem_cache_alloc(dentry_cache, GFP_KERNEL);
 	if (!dentry)
 		return NULL;
@@ -1917,18 +2035,25 @@ static unsigned d_flags_for_inode(struct inode *inode)
 static void __d_instantiate(struct dentry *dentry, struct inode *inode)
 {
 	unsigned add_flags = d_flags_for_inode(inode);
+	bool on_lru;
 	WARN_ON(d_in_lookup(dentry));
 
 	spin_lock(&dentry->d_lock);
 	/*
-	 * Decrement negative dentry count if it was in the LRU list.
+	 * Decrement negative dentry count if it was in the LRU list, and
+	 * move it over to the LRU of positive dentries.
 	 */
-	if (dentry->d_flags & DCACHE_LRU_LIST)
-		this_cpu_dec(nr_dentry_negative);
+	on_lru = d_on_sb_lru(dentry);
+	if (on_lru) {
+		d_negative_dec(dentry);
+		WARN_ON_ONCE(!list_lru_del(d_lru_list(dentry), &dentry->d_lru));
+	}
 	hlist_add_head(&dentry->d_u.d_alias, &inode->i_dentry);
 	raw_write_seqcount_begin(&dentry->d_seq);
 	__d_set_inode_and_type(dentry, inode, add_flags);
 	raw_write_seqcount_end(&dentry->d_seq);
+	if (on_lru)
+		WARN_ON_ONCE(!list_lru_add(d_lru_list(dentry), &dentry->d_lru));
 	fsnotify_update_flags(dentry);
 	spin_unlock(&dentry->d_lock);
 }
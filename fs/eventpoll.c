@@ -18,6 +18,7 @@
 #include <linux/poll.h>
 #include <linux/string.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/hash.h>
 #include <linux/spinlock.h>
 #include <linux/syscalls.h>
@@ -41,22 +42,32 @@
 
 /*
  * LOCKING:
- * There are three level of locking required by epoll :
+ * There are three levels of locking required by epoll :
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->lock (rwlock)
+ * 3) ep->tree_mtx (mutex)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a rwlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
- * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
- * user space) we could end up sleeping due a copy_to_user(), so
+ * The poll callback might be triggered from a wake_up() that in turn
+ * might be called from IRQ context, so it cannot take either mutex.
+ * Instead it takes no lock at all: an item that becomes ready is
+ * claimed by the callback with a cmpxchg() on epi->rdlnode.next and
+ * pushed onto ep->rdllhead, a lockless multi-producer llist. Everything
+ * else, including ep->rdllist, is only ever touched with ep->mtx held;
+ * the consumers move items from ep->rdllhead to ep->rdllist in bulk
+ * (see ep_ready_flush()). During the event transfer loop (from kernel
+ * to user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
- * during epoll_ctl(EPOLL_CTL_DEL) and during eventpoll_release_file().
+ * during epoll_ctl(EPOLL_CTL_MOD) and during eventpoll_release_file().
+ * The RB tree is protected by ep->tree_mtx instead, so that the common
+ * epoll_ctl(EPOLL_CTL_ADD) and epoll_ctl(EPOLL_CTL_DEL) only take that
+ * one and do not wait for an event transfer loop to finish. Only adding
+ * an item that needs the loop and path checks below, or one with
+ * EPOLLWAKEUP, takes ep->mtx. A removed item that is still queued, or
+ * that the ->mtx holder is delivering (ep->busy_item), is taken off the
+ * ready lists under ep->mtx (see ep_unqueue_sync()).
  * Then we also need a global mutex to serialize eventpoll_release_file()
  * and ep_free().
  * This mutex is acquired by ep_free() during the epoll file
@@ -80,7 +91,7 @@
  * of epoll file descriptors, we use the current recursion depth as
  * the lockdep subkey.
  * It is possible to drop the "ep->mtx" and to use the global
- * mutex "epmutex" (together with "ep->lock") to have it working,
+ * mutex "epmutex" to have it working,
  * but having "ep->mtx" will make the interface more scalable.
  * Events that require holding "epmutex" are very rare, while for
  * normal operations the epoll private "ep->mtx" will guarantee
@@ -100,8 +111,6 @@
 
 #define EP_MAX_EVENTS (INT_MAX / sizeof(struct epoll_event))
 
-#define EP_UNACTIVE_PTR ((void *) -1L)
-
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
 
 struct epoll_filefd {
@@ -146,10 +155,10 @@ struct epitem {
 	struct list_head rdllink;
 
 	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
+	 * Links this item to "struct eventpoll"->rdllhead. While the item
+	 * is not queued, rdlnode.next points back at rdlnode itself.
 	 */
-	struct epitem *next;
+	struct llist_node rdlnode;
 
 	/* The file descriptor information this item refers to */
 	struct epoll_filefd ffd;
@@ -187,28 +196,27 @@ struct eventpoll {
 	 */
 	struct mutex mtx;
 
+	/* Protects the RB tree, taken after ->mtx */
+	struct mutex tree_mtx;
+
 	/* Wait queue used by sys_epoll_wait() */
 	wait_queue_head_t wq;
 
 	/* Wait queue used by file->poll() */
 	wait_queue_head_t poll_wait;
 
-	/* List of ready file descriptors */
+	/* List of ready file descriptors, protected by ->mtx */
 	struct list_head rdllist;
 
-	/* Lock which protects rdllist and ovflist */
-	rwlock_t lock;
+	/* Items made ready by ep_poll_callback(), not yet in rdllist */
+	struct llist_head rdllhead;
+
+	/* Item the ->mtx holder is delivering, see ep_unqueue_sync() */
+	struct epitem *busy_item;
 
 	/* RB tree root used to store monitored fd structs */
 	struct rb_root_cached rbr;
 
-	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transferring ready events to userspace w/out
-	 * holding ->lock.
-	 */
-	struct epitem *ovflist;
-
 	/* wakeup_source used when ep_scan_ready_list is running */
 	struct wakeup_source *ws;
 
@@ -223,6 +231,11 @@ struct eventpoll {
 #ifdef CONFIG_NET_RX_BUSY_POLL
 	/* used to track busy poll napi_id */
 	unsigned int napi_id;
+	/* busy poll timeout, zero means the global sysctl */
+	u32 busy_poll_usecs;
+	/* busy poll packet budget */
+	u16 busy_poll_budget;
+	bool prefer_busy_poll;
 #endif
 };
 
@@ -329,10 +342,99 @@ static inline int ep_cmp_ffd(struct epoll_filefd *p1,
 	        (p1->file < p2->file ? -1 : p1->fd - p2->fd));
 }
 
-/* Tells us if the item is currently linked */
+/*
+ * Tells us if the item is currently queued, either on ep->rdllhead or on
+ * one of the ->mtx protected ready lists.
+ */
 static inline int ep_is_linked(struct epitem *epi)
 {
-	return !list_empty(&epi->rdllink);
+	return READ_ONCE(epi->rdlnode.next) != &epi->rdlnode;
+}
+
+/*
+ * Takes ownership of queueing @epi. Only one of the concurrent callers,
+ * be it ep_poll_callback() or a ->mtx holder, wins and has to put the
+ * item on a ready list.
+ */
+static inline bool ep_claim_item(struct epitem *epi)
+{
+	return !ep_is_linked(epi) &&
+		cmpxchg(&epi->rdlnode.next, &epi->rdlnode, NULL) == &epi->rdlnode;
+}
+
+/*
+ * Takes @epi off the ->mtx protected ready list it is on and marks it as
+ * no longer queued, so that ep_poll_callback() may queue it again.
+ * Must be called with "mtx" held.
+ */
+static inline void ep_unqueue_item(struct epitem *epi)
+{
+	list_del_init(&epi->rdllink);
+	smp_store_release(&epi->rdlnode.next, &epi->rdlnode);
+}
+
+/*
+ * Moves the items queued by ep_poll_callback() onto ep->rdllist, in the
+ * order they became ready. Must be called with "mtx" held.
+ */
+static void ep_ready_flush(struct eventpoll *ep)
+{
+	struct llist_node *first;
+	struct epitem *epi, *tmp;
+
+	if (llist_empty(&ep->rdllhead))
+		return;
+
+	first = llist_reverse_order(llist_del_all(&ep->rdllhead));
+	/*
+	 * The ->next pointers are left as they are: the items stay queued
+	 * (ep_is_linked()) until ep_unqueue_item() resets them.
+	 */
+	llist_for_each_entry_safe(epi, tmp, first, rdlnode)
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+}
+
+/*
+ * Tells the removal paths that the ->mtx holder looks at @epi (or at
+ * nothing when @epi is NULL) from now on. Release ordering makes the
+ * queueing done for the previous item visible before the switch.
+ */
+static inline void ep_set_busy_item(struct eventpoll *ep, struct epitem *epi)
+{
+	smp_store_release(&ep->busy_item, epi);
+}
+
+/*
+ * Called for an item that is out of the RB tree and that no poll callback
+ * can queue anymore. Makes sure that it is on none of the ready lists and
+ * that no ->mtx holder is delivering it, so that it can be freed. ep->mtx
+ * is only taken if one of those is the case.
+ */
+static void ep_unqueue_sync(struct eventpoll *ep, struct epitem *epi,
+			    bool ep_locked)
+{
+	if (!ep_locked) {
+		/*
+		 * The ->mtx holder publishes the item in ->busy_item before
+		 * it unqueues it, and requeues it before it moves on. So
+		 * either the item looks queued, or the acquire below finds
+		 * it busy or orders the second look after any requeueing.
+		 */
+		if (!ep_is_linked(epi)) {
+			smp_rmb();
+			if (smp_load_acquire(&ep->busy_item) != epi &&
+			    !ep_is_linked(epi))
+				return;
+		}
+		mutex_lock(&ep->mtx);
+	}
+
+	ep_ready_flush(ep);
+	if (ep_is_linked(epi))
+		ep_unqueue_item(epi);
+
+	if (!ep_locked)
+		mutex_unlock(&ep->mtx);
 }
 
 static inline struct eppoll_entry *ep_pwq_from_wait(wait_queue_entry_t *p)
@@ -376,19 +478,42 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
 static inline int ep_events_available(struct eventpoll *ep)
 {
 	return !list_empty_careful(&ep->rdllist) ||
-		READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR;
+		!llist_empty(&ep->rdllhead);
 }
 
 #ifdef CONFIG_NET_RX_BUSY_POLL
+/*
+ * Busy poll is on for this instance if it has its own timeout set with
+ * EPIOCSPARAMS, or if it is globally on.
+ */
+static bool ep_busy_loop_on(struct eventpoll *ep)
+{
+	return !!READ_ONCE(ep->busy_poll_usecs) || net_busy_loop_on();
+}
+
+static bool ep_busy_loop_timeout(struct eventpoll *ep,
+				 unsigned long start_time)
+{
+	unsigned long bp_usec = READ_ONCE(ep->busy_poll_usecs);
+
+	if (bp_usec) {
+		unsigned long end_time = start_time + bp_usec;
+		unsigned long now = busy_loop_current_time();
+
+		return time_after(now, end_time);
+	}
+	return busy_loop_timeout(start_time);
+}
+
 static bool ep_busy_loop_end(void *p, unsigned long start_time)
 {
 	struct eventpoll *ep = p;
 
-	return ep_events_available(ep) || busy_loop_timeout(start_time);
+	return ep_events_available(ep) || ep_busy_loop_timeout(ep, start_time);
 }
 
 /*
- * Busy poll if globally on and supporting sockets found && no events,
+ * Busy poll if on and supporting sockets found && no events,
  * busy loop will return if need_resched or ep_events_available.
  *
  * we must do our busy polling with irqs enabled
@@ -396,9 +521,14 @@ static bool ep_busy_loop_end(void *p, unsigned long start_time)
 static void ep_busy_loop(struct eventpoll *ep, int nonblock)
 {
 	unsigned int napi_id = READ_ONCE(ep->napi_id);
+	u16 budget = READ_ONCE(ep->busy_poll_budget);
+
+	if (!budget)
+		budget = BUSY_POLL_BUDGET;
 
-	if ((napi_id >= MIN_NAPI_ID) && net_busy_loop_on())
-		napi_busy_loop(napi_id, nonblock ? NULL : ep_busy_loop_end, ep);
+	if ((napi_id >= MIN_NAPI_ID) && ep_busy_loop_on(ep))
+		napi_busy_loop(napi_id, nonblock ? NULL : ep_busy_loop_end, ep,
+			       READ_ONCE(ep->prefer_busy_poll), budget);
 }
 
 static inline void ep_reset_busy_poll_napi_id(struct eventpoll *ep)
@@ -418,7 +548,8 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 	struct sock *sk;
 	int err;
 
-	if (!net_busy_loop_on())
+	ep = epi->ep;
+	if (!ep_busy_loop_on(ep))
 		return;
 
 	sock = sock_from_file(epi->ffd.file, &err);
@@ -430,7 +561,6 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 		return;
 
 	napi_id = READ_ONCE(sk->sk_napi_id);
-	ep = epi->ep;
 
 	/* Non-NAPI IDs can be rejected
 	 *	or
@@ -459,6 +589,53 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 
 #endif /* CONFIG_NET_RX_BUSY_POLL */
 
+static long ep_eventpoll_ioctl(struct file *file, unsigned int cmd,
+			       unsigned long arg)
+{
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	struct eventpoll *ep = file->private_data;
+	void __user *uarg = (void __user *)arg;
+	struct epoll_params epoll_params;
+
+	switch (cmd) {
+	case EPIOCSPARAMS:
+		if (copy_from_user(&epoll_params, uarg, sizeof(epoll_params)))
+			return -EFAULT;
+
+		/* pad byte must be zero */
+		if (epoll_params.__pad)
+			return -EINVAL;
+
+		if (epoll_params.busy_poll_usecs > S32_MAX)
+			return -EINVAL;
+
+		if (epoll_params.prefer_busy_poll > 1)
+			return -EINVAL;
+
+		if (epoll_params.busy_poll_budget > NAPI_POLL_WEIGHT &&
+		    !capable(CAP_NET_ADMIN))
+			return -EPERM;
+
+		WRITE_ONCE(ep->busy_poll_usecs, epoll_params.busy_poll_usecs);
+		WRITE_ONCE(ep->busy_poll_budget, epoll_params.busy_poll_budget);
+		WRITE_ONCE(ep->prefer_busy_poll, epoll_params.prefer_busy_poll);
+		return 0;
+	case EPIOCGPARAMS:
+		memset(&epoll_params, 0, sizeof(epoll_params));
+		epoll_params.busy_poll_usecs = READ_ONCE(ep->busy_poll_usecs);
+		epoll_params.busy_poll_budget = READ_ONCE(ep->busy_poll_budget);
+		epoll_params.prefer_busy_poll = READ_ONCE(ep->prefer_busy_poll);
+		if (copy_to_user(uarg, &epoll_params, sizeof(epoll_params)))
+			return -EFAULT;
+		return 0;
+	default:
+		return -ENOIOCTLCMD;
+	}
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
 /**
  * ep_call_nested - Perform a bound (possibly) nested call, by checking
  *                  that the recursion limit is not exceeded, and that
@@ -670,7 +847,6 @@ static __poll_t ep_scan_ready_list(struct eventpoll *ep,
 {
 	__poll_t res;
 	int pwake = 0;
-	struct epitem *epi, *nepi;
 	LIST_HEAD(txlist);
 
 	lockdep_assert_irqs_enabled();
@@ -685,59 +861,27 @@ static __poll_t ep_scan_ready_list(struct eventpoll *ep,
 
 	/*
 	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * empty list. The poll callback never touches ep->rdllist, it
+	 * queues on ep->rdllhead instead, so the "sproc" callback can
+	 * walk "txlist" without any further locking.
 	 */
-	write_lock_irq(&ep->lock);
+	ep_ready_flush(ep);
 	list_splice_init(&ep->rdllist, &txlist);
-	WRITE_ONCE(ep->ovflist, NULL);
-	write_unlock_irq(&ep->lock);
 
 	/*
 	 * Now call the callback function.
 	 */
 	res = (*sproc)(ep, &txlist, priv);
+	ep_set_busy_item(ep, NULL);
 
-	write_lock_irq(&ep->lock);
-	/*
-	 * During the time we spent inside the "sproc" callback, some
-	 * other events might have been queued by the poll callback.
-	 * We re-insert them inside the main ready-list here.
-	 */
-	for (nepi = READ_ONCE(ep->ovflist); (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * We need to check if the item is already in the list.
-		 * During the "sproc" callback execution time, items are
-		 * queued into ->ovflist but the "txlist" might already
-		 * contain them, and the list_splice() below takes care of them.
-		 */
-		if (!ep_is_linked(epi)) {
-			/*
-			 * ->ovflist is LIFO, so we have to reverse it in order
-			 * to keep in FIFO.
-			 */
-			list_add(&epi->rdllink, &ep->rdllist);
-			ep_pm_stay_awake(epi);
-		}
-	}
 	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
-	 */
-	WRITE_ONCE(ep->ovflist, EP_UNACTIVE_PTR);
-
-	/*
-	 * Quickly re-inject items left on "txlist".
+	 * Quickly re-inject items left on "txlist". Items "sproc" put back
+	 * on ep->rdllist go after them.
 	 */
 	list_splice(&txlist, &ep->rdllist);
 	__pm_relax(ep->ws);
 
-	if (!list_empty(&ep->rdllist)) {
+	if (ep_events_available(ep)) {
 		/*
 		 * Wake up (if active) both the eventpoll wait list and
 		 * the ->poll() wait list (delayed after we release the lock).
@@ -747,7 +891,6 @@ static __poll_t ep_scan_ready_list(struct eventpoll *ep,
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
-	write_unlock_irq(&ep->lock);
 
 	if (!ep_locked)
 		mutex_unlock(&ep->mtx);
@@ -765,11 +908,19 @@ static void epi_rcu_free(struct rcu_head *head)
 	kmem_cache_free(epi_cache, epi);
 }
 
+static void ep_rbtree_erase(struct eventpoll *ep, struct epitem *epi)
+{
+	mutex_lock(&ep->tree_mtx);
+	rb_erase_cached(&epi->rbn, &ep->rbr);
+	mutex_unlock(&ep->tree_mtx);
+}
+
 /*
- * Removes a "struct epitem" from the eventpoll RB tree and deallocates
- * all the associated resources. Must be called with "mtx" held.
+ * Deallocates a "struct epitem" the caller has taken out of the eventpoll
+ * RB tree, and all the associated resources. @ep_locked tells whether the
+ * caller holds "mtx".
  */
-static int ep_remove(struct eventpoll *ep, struct epitem *epi)
+static int ep_remove(struct eventpoll *ep, struct epitem *epi, bool ep_locked)
 {
 	struct file *file = epi->ffd.file;
 
@@ -785,20 +936,19 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 	list_del_rcu(&epi->fllink);
 	spin_unlock(&file->f_lock);
 
-	rb_erase_cached(&epi->rbn, &ep->rbr);
-
-	write_lock_irq(&ep->lock);
-	if (ep_is_linked(epi))
-		list_del_init(&epi->rdllink);
-	write_unlock_irq(&ep->lock);
+	/*
+	 * The poll hooks are gone, so the item can no longer be queued
+	 * behind our back, only by a ->mtx holder that is delivering it.
+	 */
+	ep_unqueue_sync(ep, epi, ep_locked);
 
-	wakeup_source_unregister(ep_wakeup_source(epi));
+	/* Nobody else can get at the item anymore */
+	wakeup_source_unregister(rcu_dereference_protected(epi->ws, 1));
 	/*
 	 * At this point it is safe to free the eventpoll item. Use the union
 	 * field epi->rcu, since we are trying to minimize the size of
-	 * 'struct epitem'. The 'rbn' field is no longer in use. Protected by
-	 * ep->mtx. The rcu read side, reverse_path_check_proc(), does not make
-	 * use of the rbn field.
+	 * 'struct epitem'. The 'rbn' field is no longer in use. The rcu read
+	 * side, reverse_path_check_proc(), does not make use of the rbn field.
 	 */
 	call_rcu(&epi->rcu, epi_rcu_free);
 
@@ -840,19 +990,21 @@ static void ep_free(struct eventpoll *ep)
 	 * Walks through the whole tree by freeing each "struct epitem". At this
 	 * point we are sure no poll callbacks will be lingering around, and also by
 	 * holding "epmutex" we can be sure that no file cleanup code will hit
-	 * us during this operation. So we can avoid the lock on "ep->lock".
+	 * us during this operation. So we can avoid draining ep->rdllhead.
 	 * We do not need to lock ep->mtx, either, we only do it to prevent
 	 * a lockdep warning.
 	 */
 	mutex_lock(&ep->mtx);
 	while ((rbp = rb_first_cached(&ep->rbr)) != NULL) {
 		epi = rb_entry(rbp, struct epitem, rbn);
-		ep_remove(ep, epi);
+		ep_rbtree_erase(ep, epi);
+		ep_remove(ep, epi, true);
 		cond_resched();
 	}
 	mutex_unlock(&ep->mtx);
 
 	mutex_unlock(&epmutex);
+	mutex_destroy(&ep->tree_mtx);
 	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
 	wakeup_source_unregister(ep->ws);
@@ -909,17 +1061,25 @@ static __poll_t ep_read_events_proc(struct eventpoll *ep, struct list_head *head
 	depth++;
 
 	list_for_each_entry_safe(epi, tmp, head, rdllink) {
+		/*
+		 * Unqueue before polling, so that an event racing with the
+		 * poll below queues the item again. Pairs with the smp_mb()
+		 * in ep_poll_callback().
+		 */
+		ep_set_busy_item(ep, epi);
+		ep_unqueue_item(epi);
+		smp_mb();
 		if (ep_item_poll(epi, &pt, depth)) {
+			if (ep_claim_item(epi))
+				list_add(&epi->rdllink, head);
 			return EPOLLIN | EPOLLRDNORM;
-		} else {
-			/*
-			 * Item has been dropped into the ready list by the poll
-			 * callback, but it's not actually ready, as far as
-			 * caller requested events goes. We can remove it here.
-			 */
-			__pm_relax(ep_wakeup_source(epi));
-			list_del_init(&epi->rdllink);
 		}
+		/*
+		 * Item has been dropped into the ready list by the poll
+		 * callback, but it's not actually ready, as far as
+		 * caller requested events goes. We can leave it out here.
+		 */
+		__pm_relax(ep_wakeup_source(epi));
 	}
 
 	return 0;
@@ -947,7 +1107,7 @@ static void ep_show_fdinfo(struct seq_file *m, struct file *f)
 	struct eventpoll *ep = f->private_data;
 	struct rb_node *rbp;
 
-	mutex_lock(&ep->mtx);
+	mutex_lock(&ep->tree_mtx);
 	for (rbp = rb_first_cached(&ep->rbr); rbp; rbp = rb_next(rbp)) {
 		struct epitem *epi = rb_entry(rbp, struct epitem, rbn);
 		struct inode *inode = file_inode(epi->ffd.file);
@@ -961,7 +1121,7 @@ static void ep_show_fdinfo(struct seq_file *m, struct file *f)
 		if (seq_has_overflowed(m))
 			break;
 	}
-	mutex_unlock(&ep->mtx);
+	mutex_unlock(&ep->tree_mtx);
 }
 #endif
 
@@ -971,6 +1131,8 @@ static const struct file_operations eventpoll_fops = {
 	.show_fdinfo	= ep_show_fdinfo,
 #endif
 	.release	= ep_eventpoll_release,
+	.unlocked_ioctl	= ep_eventpoll_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
 	.poll		= ep_eventpoll_poll,
 	.llseek		= noop_llseek,
 };
@@ -1002,7 +1164,8 @@ void eventpoll_release_file(struct file *file)
 	list_for_each_entry_safe(epi, next, &file->f_ep_links, fllink) {
 		ep = epi->ep;
 		mutex_lock_nested(&ep->mtx, 0);
-		ep_remove(ep, epi);
+		ep_rbtree_erase(ep, epi);
+		ep_remove(ep, epi, true);
 		mutex_unlock(&ep->mtx);
 	}
 	mutex_unlock(&epmutex);
@@ -1021,12 +1184,12 @@ static int ep_alloc(struct eventpoll **pep)
 		goto free_uid;
 
 	mutex_init(&ep->mtx);
-	rwlock_init(&ep->lock);
+	mutex_init(&ep->tree_mtx);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
+	init_llist_head(&ep->rdllhead);
 	ep->rbr = RB_ROOT_CACHED;
-	ep->ovflist = EP_UNACTIVE_PTR;
 	ep->user = user;
 
 	*pep = ep;
@@ -1040,8 +1203,8 @@ static int ep_alloc(struct eventpoll **pep)
 
 /*
  * Search the file inside the eventpoll tree. The RB tree operations
- * are protected by the "mtx" mutex, and ep_find() must be called with
- * "mtx" held.
+ * are protected by the "tree_mtx" mutex, and ep_find() must be called with
+ * "tree_mtx" held.
  */
 static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
 {
@@ -1099,112 +1262,32 @@ struct file *get_epoll_tfile_raw_ptr(struct file *file, int tfd,
 
 	ep = file->private_data;
 
-	mutex_lock(&ep->mtx);
+	mutex_lock(&ep->tree_mtx);
 	epi = ep_find_tfd(ep, tfd, toff);
 	if (epi)
 		file_raw = epi->ffd.file;
 	else
 		file_raw = ERR_PTR(-ENOENT);
-	mutex_unlock(&ep->mtx);
+	mutex_unlock(&ep->tree_mtx);
 
 	return file_raw;
 }
 #endif /* CONFIG_CHECKPOINT_RESTORE */
 
-/**
- * Adds a new entry to the tail of the list in a lockless way, i.e.
- * multiple CPUs are allowed to call this function concurrently.
- *
- * Beware: it is necessary to prevent any other modifications of the
- *         existing list until all changes are completed, in other words
- *         concurrent list_add_tail_lockless() calls should be protected
- *         with a read lock, where write lock acts as a barrier which
- *         makes sure all list_add_tail_lockless() calls are fully
- *         completed.
- *
- *        Also an element can be locklessly added to the list only in one
- *        direction i.e. either to the tail either to the head, otherwise
- *        concurrent access will corrupt the list.
- *
- * Returns %false if element has been already added to the list, %true
- * otherwise.
- */
-static inline bool list_add_tail_lockless(struct list_head *new,
-					  struct list_head *head)
-{
-	struct list_head *prev;
-
-	/*
-	 * This is simple 'new->next = head' operation, but cmpxchg()
-	 * is used in order to detect that same element has been just
-	 * added to the list from another CPU: the winner observes
-	 * new->next == new.
-	 */
-	if (cmpxchg(&new->next, new, head) != new)
-		return false;
-
-	/*
-	 * Initially ->next of a new element must be updated with the head
-	 * (we are inserting to the tail) and only then pointers are atomically
-	 * exchanged.  XCHG guarantees memory ordering, thus ->next should be
-	 * updated before pointers are actually swapped and pointers are
-	 * swapped before prev->next is updated.
-	 */
-
-	prev = xchg(&head->prev, new);
-
-	/*
-	 * It is safe to modify prev->next and new->prev, because a new element
-	 * is added only to the tail and new->next is updated before XCHG.
-	 */
-
-	prev->next = new;
-	new->prev = prev;
-
-	return true;
-}
-
-/**
- * Chains a new epi entry to the tail of the ep->ovflist in a lockless way,
- * i.e. multiple CPUs are allowed to call this function concurrently.
- *
- * Returns %false if epi element has been already chained, %true otherwise.
- */
-static inline bool chain_epi_lockless(struct epitem *epi)
-{
-	struct eventpoll *ep = epi->ep;
-
-	/* Fast preliminary check */
-	if (epi->next != EP_UNACTIVE_PTR)
-		return false;
-
-	/* Check that the same epi has not been just chained from another CPU */
-	if (cmpxchg(&epi->next, EP_UNACTIVE_PTR, NULL) != EP_UNACTIVE_PTR)
-		return false;
-
-	/* Atomically exchange tail */
-	epi->next = xchg(&ep->ovflist, epi);
-
-	return true;
-}
-
 /*
  * This is the callback that is passed to the wait queue wakeup
  * mechanism. It is called by the stored file descriptors when they
  * have events to report.
  *
- * This callback takes a read lock in order not to content with concurrent
- * events from another file descriptors, thus all modifications to ->rdllist
- * or ->ovflist are lockless.  Read lock is paired with the write lock from
- * ep_scan_ready_list(), which stops all list modifications and guarantees
- * that lists state is seen correctly.
+ * This callback takes no eventpoll lock, so that events from different
+ * file descriptors do not contend with each other nor with the consumers
+ * holding ->mtx. A ready item is pushed onto ep->rdllhead, which the
+ * consumers drain with ep_ready_flush().
  *
  * Another thing worth to mention is that ep_poll_callback() can be called
  * concurrently for the same @epi from different CPUs if poll table was inited
- * with several wait queues entries.  Plural wakeup from different CPUs of a
- * single wait queue is serialized by wq.lock, but the case when multiple wait
- * queues are used should be detected accordingly.  This is detected using
- * cmpxchg() operation.
+ * with several wait queues entries, and it also races with the ->mtx holders
+ * requeueing the item. Only the winner of ep_claim_item() queues it.
  */
 static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, void *key)
 {
@@ -1212,11 +1295,8 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
 	__poll_t pollflags = key_to_poll(key);
-	unsigned long flags;
 	int ewake = 0;
 
-	read_lock_irqsave(&ep->lock, flags);
-
 	ep_set_busy_poll_napi_id(epi);
 
 	/*
@@ -1226,7 +1306,7 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
 	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+		goto out;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -1235,21 +1315,22 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	 * test for "key" != NULL before the event match test.
 	 */
 	if (pollflags && !(pollflags & epi->event.events))
-		goto out_unlock;
+		goto out;
 
 	/*
-	 * If we are transferring events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happen during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * Pairs with the smp_mb() in ep_send_events_proc() and
+	 * ep_read_events_proc(): either they see the event when they poll
+	 * the item again after unqueueing it, or we see it unqueued here.
 	 */
-	if (READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR) {
-		if (chain_epi_lockless(epi))
-			ep_pm_stay_awake_rcu(epi);
-	} else if (!ep_is_linked(epi)) {
-		/* In the usual case, add event to ready list. */
-		if (list_add_tail_lockless(&epi->rdllink, &ep->rdllist))
-			ep_pm_stay_awake_rcu(epi);
+	smp_mb();
+	if (ep_claim_item(epi)) {
+		/*
+		 * Activate the wakeup source before the item is visible: a
+		 * consumer may deliver it and __pm_relax() right after the
+		 * llist_add().
+		 */
+		ep_pm_stay_awake_rcu(epi);
+		llist_add(&epi->rdlnode, &ep->rdllhead);
 	}
 
 	/*
@@ -1278,13 +1359,10 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
-out_unlock:
-	read_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
+out:
 	if (!(epi->event.events & EPOLLEXCLUSIVE))
 		ewake = 1;
 
@@ -1490,10 +1568,14 @@ static noinline void ep_destroy_wakeup_source(struct epitem *epi)
 }
 
 /*
- * Must be called with "mtx" held.
+ * Adds an item for @tfile to the tree of @ep. @ep_locked tells whether the
+ * caller holds "mtx", which is needed for EPOLLWAKEUP. Without @full_check,
+ * -EAGAIN asks the caller to retry with the checks because a loop check is
+ * walking @ep.
  */
 static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
-		     struct file *tfile, int fd, int full_check)
+		     struct file *tfile, int fd, int full_check,
+		     bool ep_locked)
 {
 	int error, pwake = 0;
 	__poll_t revents;
@@ -1517,7 +1599,7 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 	ep_set_ffd(&epi->ffd, tfile, fd);
 	epi->event = *event;
 	epi->nwait = 0;
-	epi->next = EP_UNACTIVE_PTR;
+	epi->rdlnode.next = &epi->rdlnode;
 	if (epi->event.events & EPOLLWAKEUP) {
 		error = ep_create_wakeup_source(epi);
 		if (error)
@@ -1526,15 +1608,25 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 		RCU_INIT_POINTER(epi->ws, NULL);
 	}
 
+	/*
+	 * The tree stays locked until the item is complete, so that
+	 * epoll_ctl(EPOLL_CTL_DEL) cannot find it half way.
+	 */
+	mutex_lock(&ep->tree_mtx);
+	error = -EEXIST;
+	if (ep_find(ep, tfile, fd))
+		goto error_unlock;
+	/* See ep_loop_check_proc(), which sets ep->gen with tree_mtx held */
+	error = -EAGAIN;
+	if (!full_check && ep->gen == READ_ONCE(loop_check_gen))
+		goto error_unlock;
+
 	/* Add the current item to the list of active epoll hook for this file */
 	spin_lock(&tfile->f_lock);
 	list_add_tail_rcu(&epi->fllink, &tfile->f_ep_links);
 	spin_unlock(&tfile->f_lock);
 
-	/*
-	 * Add the current item to the RB tree. All RB tree operations are
-	 * protected by "mtx", and ep_insert() is called with "mtx" held.
-	 */
+	/* Add the current item to the RB tree */
 	ep_rbtree_insert(ep, epi);
 
 	/* now check if we've created too many backpaths */
@@ -1564,16 +1656,16 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 	if (epi->nwait < 0)
 		goto error_unregister;
 
-	/* We have to drop the new item inside our item list to keep track of it */
-	write_lock_irq(&ep->lock);
-
 	/* record NAPI ID of new item if present */
 	ep_set_busy_poll_napi_id(epi);
 
-	/* If the file is already "ready" we drop it inside the ready list */
-	if (revents && !ep_is_linked(epi)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
-		ep_pm_stay_awake(epi);
+	/*
+	 * If the file is already "ready" we queue it just like the poll
+	 * callback does, ep->rdllist is not ours to touch without "mtx".
+	 */
+	if (revents && ep_claim_item(epi)) {
+		ep_pm_stay_awake_rcu(epi);
+		llist_add(&epi->rdlnode, &ep->rdllhead);
 
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
@@ -1582,9 +1674,8 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 			pwake++;
 	}
 
-	write_unlock_irq(&ep->lock);
-
 	atomic_long_inc(&ep->user->epoll_watches);
+	mutex_unlock(&ep->tree_mtx);
 
 	/* We have to call this outside the lock */
 	if (pwake)
@@ -1600,19 +1691,16 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 	spin_unlock(&tfile->f_lock);
 
 	rb_erase_cached(&epi->rbn, &ep->rbr);
+error_unlock:
+	mutex_unlock(&ep->tree_mtx);
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue, and a ->mtx holder may be delivering it.
 	 */
-	write_lock_irq(&ep->lock);
-	if (ep_is_linked(epi))
-		list_del_init(&epi->rdllink);
-	write_unlock_irq(&ep->lock);
+	ep_unqueue_sync(ep, epi, ep_locked);
 
-	wakeup_source_unregister(ep_wakeup_source(epi));
+	wakeup_source_unregister(rcu_dereference_protected(epi->ws, 1));
 
 error_create_wakeup_source:
 	kmem_cache_free(epi_cache, epi);
@@ -1654,9 +1742,8 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi,
 	 * 1) Flush epi changes above to other CPUs.  This ensures
 	 *    we do not miss events from ep_poll_callback if an
 	 *    event occurs immediately after we call f_op->poll().
-	 *    We need this because we did not take ep->lock while
-	 *    changing epi above (but ep_poll_callback does take
-	 *    ep->lock).
+	 *    We need this because ep_poll_callback reads epi
+	 *    without any lock.
 	 *
 	 * 2) We also need to ensure we do not miss _past_ events
 	 *    when calling f_op->poll().  This barrier also
@@ -1674,19 +1761,15 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi,
 	 * If the item is "hot" and it is not registered inside the ready
 	 * list, push it inside.
 	 */
-	if (ep_item_poll(epi, &pt, 1)) {
-		write_lock_irq(&ep->lock);
-		if (!ep_is_linked(epi)) {
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-			ep_pm_stay_awake(epi);
-
-			/* Notify waiting tasks that events are available */
-			if (waitqueue_active(&ep->wq))
-				wake_up(&ep->wq);
-			if (waitqueue_active(&ep->poll_wait))
-				pwake++;
-		}
-		write_unlock_irq(&ep->lock);
+	if (ep_item_poll(epi, &pt, 1) && ep_claim_item(epi)) {
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+		ep_pm_stay_awake(epi);
+
+		/* Notify waiting tasks that events are available */
+		if (waitqueue_active(&ep->wq))
+			wake_up(&ep->wq);
+		if (waitqueue_active(&ep->poll_wait))
+			pwake++;
 	}
 
 	/* We have to call this outside the lock */
@@ -1736,13 +1819,21 @@ static __poll_t ep_send_events_proc(struct eventpoll *ep, struct list_head *head
 			__pm_relax(ws);
 		}
 
-		list_del_init(&epi->rdllink);
+		/*
+		 * Unqueue the item before polling it, so that an event
+		 * arriving from now on queues it again instead of being
+		 * lost. Pairs with the smp_mb() in ep_poll_callback().
+		 * epoll_ctl(EPOLL_CTL_DEL) waits for us while it is busy.
+		 */
+		ep_set_busy_item(ep, epi);
+		ep_unqueue_item(epi);
+		smp_mb();
 
 		/*
 		 * If the event mask intersect the caller-requested one,
 		 * deliver the event to userspace. Again, ep_scan_ready_list()
-		 * is holding ep->mtx, so no operations coming from userspace
-		 * can change the item.
+		 * is holding ep->mtx and the item is busy, so no operations
+		 * coming from userspace can change or free it.
 		 */
 		revents = ep_item_poll(epi, &pt, 1);
 		if (!revents)
@@ -1750,8 +1841,10 @@ static __poll_t ep_send_events_proc(struct eventpoll *ep, struct list_head *head
 
 		if (__put_user(revents, &uevent->events) ||
 		    __put_user(epi->event.data, &uevent->data)) {
-			list_add(&epi->rdllink, head);
-			ep_pm_stay_awake(epi);
+			if (ep_claim_item(epi)) {
+				list_add(&epi->rdllink, head);
+				ep_pm_stay_awake(epi);
+			}
 			if (!esed->res)
 				esed->res = -EFAULT;
 			return 0;
@@ -1768,12 +1861,15 @@ static __poll_t ep_send_events_proc(struct eventpoll *ep, struct list_head *head
 			 * epoll_wait() will check again the events
 			 * availability. At this point, no one can insert
 			 * into ep->rdllist besides us. The epoll_ctl()
-			 * callers are locked out by
-			 * ep_scan_ready_list() holding "mtx" and the
-			 * poll callback will queue them in ep->ovflist.
+			 * callers that need "mtx" are locked out by
+			 * ep_scan_ready_list() holding it, the others and
+			 * the poll callback queue in ep->rdllhead, in which
+			 * case the item is already claimed.
 			 */
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-			ep_pm_stay_awake(epi);
+			if (ep_claim_item(epi)) {
+				list_add_tail(&epi->rdllink, &ep->rdllist);
+				ep_pm_stay_awake(epi);
+			}
 		}
 	}
 
@@ -1839,16 +1935,14 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 	} else if (timeout == 0) {
 		/*
 		 * Avoid the unnecessary trip to the wait queue loop, if the
-		 * caller specified a non blocking operation. We still need
-		 * lock because we could race and not see an epi being added
-		 * to the ready list while in irq callback. Thus incorrectly
-		 * returning 0 back to userspace.
+		 * caller specified a non blocking operation. An epi being
+		 * added by the irq callback right now is published by the
+		 * llist_add() cmpxchg, so it is either seen here or it
+		 * happened after this call.
 		 */
 		timed_out = 1;
 
-		write_lock_irq(&ep->lock);
 		eavail = ep_events_available(ep);
-		write_unlock_irq(&ep->lock);
 
 		goto send_events;
 	}
@@ -1878,13 +1972,13 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * chance to harvest new event. Otherwise wakeup can be
 		 * lost. This is also good performance-wise, because on
 		 * normal wakeup path no need to call __remove_wait_queue()
-		 * explicitly, thus ep->lock is not taken, which halts the
+		 * explicitly, thus ep->wq.lock is not taken, which halts the
 		 * event delivery.
 		 */
 		init_wait(&wait);
-		write_lock_irq(&ep->lock);
+		spin_lock_irq(&ep->wq.lock);
 		__add_wait_queue_exclusive(&ep->wq, &wait);
-		write_unlock_irq(&ep->lock);
+		spin_unlock_irq(&ep->wq.lock);
 
 		/*
 		 * We don't want to sleep if the ep_poll_callback() sends us
@@ -1924,9 +2018,9 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 	__set_current_state(TASK_RUNNING);
 
 	if (!list_empty_careful(&wait.entry)) {
-		write_lock_irq(&ep->lock);
+		spin_lock_irq(&ep->wq.lock);
 		__remove_wait_queue(&ep->wq, &wait);
-		write_unlock_irq(&ep->lock);
+		spin_unlock_irq(&ep->wq.lock);
 	}
 
 send_events:
@@ -1966,7 +2060,7 @@ static int ep_loop_check_proc(void *priv, void *cookie, int call_nests)
 	struct rb_node *rbp;
 	struct epitem *epi;
 
-	mutex_lock_nested(&ep->mtx, call_nests + 1);
+	mutex_lock_nested(&ep->tree_mtx, call_nests + 1);
 	ep->gen = loop_check_gen;
 	for (rbp = rb_first_cached(&ep->rbr); rbp; rbp = rb_next(rbp)) {
 		epi = rb_entry(rbp, struct epitem, rbn);
@@ -1995,7 +2089,7 @@ static int ep_loop_check_proc(void *priv, void *cookie, int call_nests)
 			}
 		}
 	}
-	mutex_unlock(&ep->mtx);
+	mutex_unlock(&ep->tree_mtx);
 
 	return error;
 }
@@ -2158,6 +2252,29 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	 */
 	ep = f.file->private_data;
 
+	/*
+	 * Removing an item, and adding one that neither needs the checks
+	 * below nor a wakeup source, only take "tree_mtx": they do not
+	 * wait for an event transfer loop holding "mtx".
+	 */
+	if (op == EPOLL_CTL_DEL) {
+		mutex_lock(&ep->tree_mtx);
+		epi = ep_find(ep, tf.file, fd);
+		if (epi)
+			rb_erase_cached(&epi->rbn, &ep->rbr);
+		mutex_unlock(&ep->tree_mtx);
+
+		error = epi ? ep_remove(ep, epi, false) : -ENOENT;
+		goto error_tgt_fput;
+	}
+	if (op == EPOLL_CTL_ADD && !(epds.events & EPOLLWAKEUP) &&
+	    list_empty(&f.file->f_ep_links) && !is_file_epoll(tf.file)) {
+		epds.events |= EPOLLERR | EPOLLHUP;
+		error = ep_insert(ep, &epds, tf.file, fd, 0, false);
+		if (error != -EAGAIN)
+			goto error_tgt_fput;
+	}
+
 	/*
 	 * When we insert an epoll file descriptor, inside another epoll file
 	 * descriptor, there is the change of creating closed loops, which are
@@ -2173,6 +2290,7 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	 * deep wakeup paths from forming in parallel through multiple
 	 * EPOLL_CTL_ADD operations.
 	 */
+retry:
 	mutex_lock_nested(&ep->mtx, 0);
 	if (op == EPOLL_CTL_ADD) {
 		if (!list_empty(&f.file->f_ep_links) ||
@@ -2198,34 +2316,35 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		}
 	}
 
-	/*
-	 * Try to lookup the file inside our RB tree, Since we grabbed "mtx"
-	 * above, we can be sure to be able to use the item looked up by
-	 * ep_find() till we release the mutex.
-	 */
-	epi = ep_find(ep, tf.file, fd);
-
 	error = -EINVAL;
 	switch (op) {
 	case EPOLL_CTL_ADD:
-		if (!epi) {
-			epds.events |= EPOLLERR | EPOLLHUP;
-			error = ep_insert(ep, &epds, tf.file, fd, full_check);
-		} else
-			error = -EEXIST;
-		break;
-	case EPOLL_CTL_DEL:
-		if (epi)
-			error = ep_remove(ep, epi);
-		else
-			error = -ENOENT;
+		epds.events |= EPOLLERR | EPOLLHUP;
+		error = ep_insert(ep, &epds, tf.file, fd, full_check, true);
+		if (error == -EAGAIN) {
+			/* a loop check reached @ep since we looked, redo it */
+			mutex_unlock(&ep->mtx);
+			goto retry;
+		}
 		break;
 	case EPOLL_CTL_MOD:
+		/*
+		 * Try to lookup the file inside our RB tree. Marking the item
+		 * busy before "tree_mtx" is dropped makes a concurrent
+		 * epoll_ctl(EPOLL_CTL_DEL) wait on "mtx" before freeing it.
+		 */
+		mutex_lock(&ep->tree_mtx);
+		epi = ep_find(ep, tf.file, fd);
+		if (epi)
+			ep_set_busy_item(ep, epi);
+		mutex_unlock(&ep->tree_mtx);
+
 		if (epi) {
 			if (!(epi->event.events & EPOLLEXCLUSIVE)) {
 				epds.events |= EPOLLERR | EPOLLHUP;
 				error = ep_modify(ep, epi, &epds);
 			}
+			ep_set_busy_item(ep, NULL);
 		} else
 			error = -ENOENT;
 		break;
@@ -137,6 +137,7 @@ static int ext4_readdir(struct file *file, struct dir_context *ctx)
 			 * critical that it gets flushed back to the disk.
 			 */
 			ext4_clear_inode_flag(inode, EXT4_INODE_INDEX);
+			ext4_set_inode_flags(inode);
 		}
 	}
 
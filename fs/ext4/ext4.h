@@ -922,6 +922,7 @@ do {									       \
 #endif /* defined(__KERNEL__) || defined(__linux__) */
 
 #include "extents_status.h"
+#include "fast_commit.h"
 
 /*
  * Lock subclasses for i_data_sem in the ext4_inode_info structure.
@@ -1007,6 +1008,14 @@ struct ext4_inode_info {
 	 * by other means, so we have i_data_sem.
 	 */
 	struct rw_semaphore i_data_sem;
+	/*
+	 * i_htree_sem protects the layout of a directory: which block a
+	 * name lives in.  Lookups, unlinks and creates that fit in their
+	 * htree leaf take it shared; adds that split a leaf, grow the
+	 * index or scan a linear directory take it exclusive.  It nests
+	 * inside the journal handle.
+	 */
+	struct rw_semaphore i_htree_sem;
 	/*
 	 * i_mmap_sem is for serializing page faults with truncate / punch hole
 	 * operations. We have to make sure that new page cannot be faulted in
@@ -1084,6 +1093,12 @@ struct ext4_inode_info {
 	tid_t i_sync_tid;
 	tid_t i_datasync_tid;
 
+	/*
+	 * Transaction which made a change to the inode that cannot be
+	 * described by a fast commit.
+	 */
+	tid_t i_fc_ineligible_tid;
+
 #ifdef CONFIG_QUOTA
 	struct dquot *i_dquot[MAXQUOTAS];
 #endif
@@ -1148,6 +1163,7 @@ struct ext4_inode_info {
 #define EXT4_MOUNT_JOURNAL_CHECKSUM	0x800000 /* Journal checksums */
 #define EXT4_MOUNT_JOURNAL_ASYNC_COMMIT	0x1000000 /* Journal Async Commit */
 #define EXT4_MOUNT_WARN_ON_ERROR	0x2000000 /* Trigger WARN_ON on error */
+#define EXT4_MOUNT_FAST_COMMIT		0x4000000 /* Fast commits for fsync */
 #define EXT4_MOUNT_DELALLOC		0x8000000 /* Delalloc support */
 #define EXT4_MOUNT_DATA_ERR_ABORT	0x10000000 /* Abort on file data write */
 #define EXT4_MOUNT_BLOCK_VALIDITY	0x20000000 /* Block validity checking */
@@ -1441,6 +1457,7 @@ struct ext4_sb_info {
 	u32 s_max_batch_time;
 	u32 s_min_batch_time;
 	struct block_device *journal_bdev;
+	struct ext4_fc_replay_state s_fc_replay_state;
 #ifdef CONFIG_QUOTA
 	/* Names of quota files with journalled quota */
 	char __rcu *s_qf_names[EXT4_MAXQUOTAS];
@@ -1478,11 +1495,18 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_optimize_scan;
 	unsigned int s_max_dir_size_kb;
 	/* where last allocation was done - for stream allocation */
 	unsigned long s_mb_last_group;
 	unsigned long s_mb_last_start;
 
+	/* groups by order of their largest free extent and average fragment */
+	struct list_head *s_mb_largest_free_orders;
+	rwlock_t *s_mb_largest_free_orders_locks;
+	struct list_head *s_mb_avg_fragment_size;
+	rwlock_t *s_mb_avg_fragment_size_locks;
+
 	/* stats for buddy allocator */
 	atomic_t s_bal_reqs;	/* number of reqs with len > 1 */
 	atomic_t s_bal_success;	/* we found long enough chunks */
@@ -1670,6 +1694,8 @@ enum {
 	EXT4_STATE_EXT_PRECACHED,	/* extents have been precached */
 	EXT4_STATE_LUSTRE_EA_INODE,	/* Lustre-style ea_inode */
 	EXT4_STATE_VERITY_IN_PROGRESS,	/* building fs-verity Merkle tree */
+	EXT4_STATE_ES_REFERENCED,	/* es tree used since last shrink */
+	EXT4_STATE_PARALLEL_CREATE,	/* dir was S_PARALLEL_CREATE once */
 };
 
 #define EXT4_INODE_BIT_FNS(name, field, offset)				\
@@ -1763,6 +1789,8 @@ static inline bool ext4_verity_in_progress(struct inode *inode)
 #define EXT4_FEATURE_COMPAT_RESIZE_INODE	0x0010
 #define EXT4_FEATURE_COMPAT_DIR_INDEX		0x0020
 #define EXT4_FEATURE_COMPAT_SPARSE_SUPER2	0x0200
+/* Not upstream's fast_commit (0x0400), see fast_commit.h */
+#define EXT4_FEATURE_COMPAT_FAST_COMMIT		0x80000000
 
 #define EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT4_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
@@ -1864,6 +1892,7 @@ EXT4_FEATURE_COMPAT_FUNCS(xattr,		EXT_ATTR)
 EXT4_FEATURE_COMPAT_FUNCS(resize_inode,		RESIZE_INODE)
 EXT4_FEATURE_COMPAT_FUNCS(dir_index,		DIR_INDEX)
 EXT4_FEATURE_COMPAT_FUNCS(sparse_super2,	SPARSE_SUPER2)
+EXT4_FEATURE_COMPAT_FUNCS(fast_commit,		FAST_COMMIT)
 
 EXT4_FEATURE_RO_COMPAT_FUNCS(sparse_super,	SPARSE_SUPER)
 EXT4_FEATURE_RO_COMPAT_FUNCS(large_file,	LARGE_FILE)
@@ -2582,6 +2611,12 @@ static inline  unsigned char get_dtype(struct super_block *sb, int filetype)
 extern int ext4_check_all_de(struct inode *dir, struct buffer_head *bh,
 			     void *buf, int buf_size);
 
+/* fast_commit.c */
+extern void ext4_fc_mark_ineligible(struct inode *inode, handle_t *handle);
+extern int ext4_fc_commit(journal_t *journal, tid_t commit_tid,
+			  struct inode *inode);
+extern void ext4_fc_init(struct super_block *sb, journal_t *journal);
+
 /* fsync.c */
 extern int ext4_sync_file(struct file *, loff_t, loff_t, int);
 
@@ -3105,7 +3140,12 @@ struct ext4_group_info {
 	ext4_grpblk_t	bb_free;	/* total free blocks */
 	ext4_grpblk_t	bb_fragments;	/* nr of freespace fragments */
 	ext4_grpblk_t	bb_largest_free_order;/* order of largest frag in BG */
+	ext4_grpblk_t	bb_avg_fragment_size_order;	/* order of average
+							 * fragment in BG */
+	ext4_group_t	bb_group;	/* Group number */
 	struct          list_head bb_prealloc_list;
+	struct          list_head bb_largest_free_order_node;
+	struct          list_head bb_avg_fragment_size_node;
 #ifdef DOUBLE_CHECK
 	void            *bb_bitmap;
 #endif
@@ -3259,6 +3299,7 @@ extern int ext4_inlinedir_to_tree(struct file *dir_file,
 extern struct buffer_head *ext4_find_inline_entry(struct inode *dir,
 					struct ext4_filename *fname,
 					struct ext4_dir_entry_2 **res_dir,
+					__u32 *res_ino,
 					int *has_inline_data);
 extern int ext4_delete_inline_entry(handle_t *handle,
 				    struct inode *dir,
@@ -3445,6 +3486,39 @@ extern const struct fsverity_operations ext4_verityops;
  */
 #define BH_BITMAP_UPTODATE BH_JBDPrivateStart
 
+/*
+ * Serializes changes to, and searches of, one directory block.  Unlinks
+ * (FS_PARALLEL_UNLINK) and O_EXCL creates in indexed directories
+ * (S_PARALLEL_CREATE) only hold the directory's i_rwsem shared, so they
+ * run in parallel as long as they touch different leaf blocks.  Searches
+ * take the lock shared.  The locks are hashed by buffer_head and nobody
+ * holds two at once, so a collision only costs concurrency.
+ */
+#define EXT4_DIRBLOCK_HASH_SZ	61
+#define ext4_dirblock_lock(bh)	(&ext4__dirblock_lock[((unsigned long)(bh)) %\
+						      EXT4_DIRBLOCK_HASH_SZ])
+extern struct rw_semaphore ext4__dirblock_lock[EXT4_DIRBLOCK_HASH_SZ];
+
+static inline void ext4_lock_dirblock(struct buffer_head *bh)
+{
+	down_write(ext4_dirblock_lock(bh));
+}
+
+static inline void ext4_unlock_dirblock(struct buffer_head *bh)
+{
+	up_write(ext4_dirblock_lock(bh));
+}
+
+static inline void ext4_lock_dirblock_shared(struct buffer_head *bh)
+{
+	down_read(ext4_dirblock_lock(bh));
+}
+
+static inline void ext4_unlock_dirblock_shared(struct buffer_head *bh)
+{
+	up_read(ext4_dirblock_lock(bh));
+}
+
 static inline int bitmap_uptodate(struct buffer_head *bh)
 {
 	return (buffer_uptodate(bh) &&
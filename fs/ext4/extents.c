@@ -167,6 +167,8 @@ int __ext4_ext_dirty(const char *where, unsigned int line, handle_t *handle,
 
 	WARN_ON(!rwsem_is_locked(&EXT4_I(inode)->i_data_sem));
 	if (path->p_bh) {
+		/* A fast commit only logs the inode, not the extent block */
+		ext4_fc_mark_ineligible(inode, handle);
 		ext4_extent_block_csum_set(inode, ext_block_hdr(path->p_bh));
 		/* path points to block */
 		err = __ext4_handle_dirty_metadata(where, line, handle,
@@ -118,7 +118,10 @@
  *   --	memory consumption
  *      Fragmented extent tree will make extent status tree cost too much
  *      memory.  Hence, we will reclaim written/unwritten/hole extents from
- *      the tree under a heavy memory pressure.
+ *      the tree under a heavy memory pressure.  Runs of logically
+ *      contiguous written extents are also packed into a single node
+ *      (struct ext4_es_packed) when they are cached from disk or kept by
+ *      the shrinker, at roughly a third of the size per extent.
  *
  *
  * ==========================================================================
@@ -142,8 +145,52 @@
  */
 
 static struct kmem_cache *ext4_es_cachep;
+static struct kmem_cache *ext4_es_packed_cachep;
 static struct kmem_cache *ext4_pending_cachep;
 
+/*
+ * A packed node stands in the tree for up to ES_PACKED_NR logically
+ * contiguous written extents.  Its extent_status spans all of them and
+ * has EXTENT_STATUS_WRITTEN | EXTENT_STATUS_PACKED status, so code that
+ * only tests the type of tree nodes needs no change; its own pblk is
+ * unused.  The extents are kept as (len, pblk) pieces in logical order.
+ *
+ * A run is packed only once it has ES_PACKED_MIN members, so that the
+ * packed node is smaller than the nodes it replaces.
+ */
+#define ES_PACKED_NR	16
+#define ES_PACKED_MIN	8
+
+struct ext4_es_piece {
+	__u32 len;
+	__u32 pblk_lo;
+	__u32 pblk_hi;
+};
+
+struct ext4_es_packed {
+	struct extent_status es;
+	unsigned int nr;
+	struct ext4_es_piece piece[ES_PACKED_NR];
+};
+
+static inline struct ext4_es_packed *ext4_es_packed(struct extent_status *es)
+{
+	return container_of(es, struct ext4_es_packed, es);
+}
+
+static inline ext4_fsblk_t ext4_es_piece_pblock(struct ext4_es_piece *p)
+{
+	return ((ext4_fsblk_t)p->pblk_hi << 32) | p->pblk_lo;
+}
+
+static inline void ext4_es_piece_store(struct ext4_es_piece *p,
+				       ext4_lblk_t len, ext4_fsblk_t pblk)
+{
+	p->len = len;
+	p->pblk_lo = (__u32)pblk;
+	p->pblk_hi = (__u32)(pblk >> 32);
+}
+
 static int __es_insert_extent(struct inode *inode, struct extent_status *newes);
 static int __es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
 			      ext4_lblk_t end, int *reserved);
@@ -160,11 +207,19 @@ int __init ext4_init_es(void)
 					   0, (SLAB_RECLAIM_ACCOUNT), NULL);
 	if (ext4_es_cachep == NULL)
 		return -ENOMEM;
+	ext4_es_packed_cachep = kmem_cache_create("ext4_extent_status_packed",
+					   sizeof(struct ext4_es_packed),
+					   0, (SLAB_RECLAIM_ACCOUNT), NULL);
+	if (ext4_es_packed_cachep == NULL) {
+		kmem_cache_destroy(ext4_es_cachep);
+		return -ENOMEM;
+	}
 	return 0;
 }
 
 void ext4_exit_es(void)
 {
+	kmem_cache_destroy(ext4_es_packed_cachep);
 	kmem_cache_destroy(ext4_es_cachep);
 }
 
@@ -186,9 +241,14 @@ static void ext4_es_print_tree(struct inode *inode)
 	while (node) {
 		struct extent_status *es;
 		es = rb_entry(node, struct extent_status, rb_node);
-		printk(KERN_DEBUG " [%u/%u) %llu %x",
-		       es->es_lblk, es->es_len,
-		       ext4_es_pblock(es), ext4_es_status(es));
+		if (ext4_es_is_packed(es))
+			printk(KERN_DEBUG " [%u/%u) packed %u %x",
+			       es->es_lblk, es->es_len,
+			       ext4_es_packed(es)->nr, ext4_es_status(es));
+		else
+			printk(KERN_DEBUG " [%u/%u) %llu %x",
+			       es->es_lblk, es->es_len,
+			       ext4_es_pblock(es), ext4_es_status(es));
 		node = rb_next(node);
 	}
 	printk(KERN_DEBUG "\n");
@@ -203,6 +263,37 @@ static inline ext4_lblk_t ext4_es_end(struct extent_status *es)
 	return es->es_lblk + es->es_len - 1;
 }
 
+/*
+ * Copy the extent of tree node @es that covers @lblk to @out, or its first
+ * one if @es starts after @lblk.  Only packed nodes hold more than one.
+ */
+static void ext4_es_get(struct extent_status *es, ext4_lblk_t lblk,
+			struct extent_status *out)
+{
+	struct ext4_es_packed *pk;
+	ext4_lblk_t start;
+	unsigned int i;
+
+	if (!ext4_es_is_packed(es)) {
+		out->es_lblk = es->es_lblk;
+		out->es_len = es->es_len;
+		out->es_pblk = es->es_pblk;
+		return;
+	}
+
+	pk = ext4_es_packed(es);
+	start = es->es_lblk;
+	for (i = 0; i + 1 < pk->nr; i++) {
+		if (lblk < start + pk->piece[i].len)
+			break;
+		start += pk->piece[i].len;
+	}
+	out->es_lblk = start;
+	out->es_len = pk->piece[i].len;
+	ext4_es_store_pblock_status(out, ext4_es_piece_pblock(&pk->piece[i]),
+				ext4_es_status(es) & ~EXTENT_STATUS_PACKED);
+}
+
 /*
  * search through the tree for an delayed extent with a given offset.  If
  * it can't be found, try to find next extent.
@@ -296,9 +387,7 @@ static void __es_find_extent_range(struct inode *inode,
 
 	if (es1 && matching_fn(es1)) {
 		tree->cache_es = es1;
-		es->es_lblk = es1->es_lblk;
-		es->es_len = es1->es_len;
-		es->es_pblk = es1->es_pblk;
+		ext4_es_get(es1, lblk, es);
 	}
 
 }
@@ -441,6 +530,16 @@ static void ext4_es_list_del(struct inode *inode)
 	spin_unlock(&sbi->s_es_lock);
 }
 
+/*
+ * Tell the shrinker the inode's extents are in use.  Test first so that
+ * hot lookups don't keep dirtying the cacheline.
+ */
+static inline void ext4_es_mark_inode_referenced(struct inode *inode)
+{
+	if (!ext4_test_inode_state(inode, EXT4_STATE_ES_REFERENCED))
+		ext4_set_inode_state(inode, EXT4_STATE_ES_REFERENCED);
+}
+
 static struct extent_status *
 ext4_es_alloc_extent(struct inode *inode, ext4_lblk_t lblk, ext4_lblk_t len,
 		     ext4_fsblk_t pblk)
@@ -469,6 +568,36 @@ ext4_es_alloc_extent(struct inode *inode, ext4_lblk_t lblk, ext4_lblk_t len,
 	return es;
 }
 
+/*
+ * Allocate a packed node with the given status and count it like any other
+ * node.  Packing is opportunistic, so don't dip into the atomic reserves.
+ */
+static struct ext4_es_packed *
+ext4_es_alloc_packed(struct inode *inode, ext4_lblk_t lblk, unsigned int status)
+{
+	struct ext4_es_packed *pk;
+
+	pk = kmem_cache_alloc(ext4_es_packed_cachep,
+			      GFP_NOWAIT | __GFP_NOWARN);
+	if (pk == NULL)
+		return NULL;
+	pk->es.es_lblk = lblk;
+	pk->es.es_len = 0;
+	ext4_es_store_pblock_status(&pk->es, 0,
+				    status | EXTENT_STATUS_PACKED);
+	pk->nr = 0;
+
+	/* packed nodes are written, hence always reclaimable */
+	if (!EXT4_I(inode)->i_es_shk_nr++)
+		ext4_es_list_add(inode);
+	percpu_counter_inc(&EXT4_SB(inode->i_sb)->s_es_stats.es_stats_shk_cnt);
+
+	EXT4_I(inode)->i_es_all_nr++;
+	percpu_counter_inc(&EXT4_SB(inode->i_sb)->s_es_stats.es_stats_all_cnt);
+
+	return pk;
+}
+
 static void ext4_es_free_extent(struct inode *inode, struct extent_status *es)
 {
 	EXT4_I(inode)->i_es_all_nr--;
@@ -483,7 +612,10 @@ static void ext4_es_free_extent(struct inode *inode, struct extent_status *es)
 					s_es_stats.es_stats_shk_cnt);
 	}
 
-	kmem_cache_free(ext4_es_cachep, es);
+	if (ext4_es_is_packed(es))
+		kmem_cache_free(ext4_es_packed_cachep, ext4_es_packed(es));
+	else
+		kmem_cache_free(ext4_es_cachep, es);
 }
 
 /*
@@ -492,6 +624,7 @@ static void ext4_es_free_extent(struct inode *inode, struct extent_status *es)
  *  - logical block number is contiguous
  *  - physical block number is contiguous
  *  - status is equal
+ *  - neither is packed
  */
 static int ext4_es_can_be_merged(struct extent_status *es1,
 				 struct extent_status *es2)
@@ -499,6 +632,9 @@ static int ext4_es_can_be_merged(struct extent_status *es1,
 	if (ext4_es_type(es1) != ext4_es_type(es2))
 		return 0;
 
+	if (ext4_es_is_packed(es1) || ext4_es_is_packed(es2))
+		return 0;
+
 	if (((__u64) es1->es_len) + es2->es_len > EXT_MAX_BLOCKS) {
 		pr_warn("ES assertion failed when merging extents. "
 			"The sum of lengths of es1 (%d) and es2 (%d) "
@@ -572,6 +708,178 @@ ext4_es_try_to_merge_right(struct inode *inode, struct extent_status *es)
 	return es;
 }
 
+static inline int ext4_es_can_be_packed(struct extent_status *es)
+{
+	return ext4_es_type(es) == EXTENT_STATUS_WRITTEN &&
+	       !ext4_es_is_packed(es);
+}
+
+/*
+ * Fold written extent @es into the packed node just before it, or pack the
+ * run of written extents that it ends once the run is ES_PACKED_MIN long.
+ * Returns the node that now covers @es.
+ */
+static struct extent_status *
+ext4_es_try_to_pack(struct inode *inode, struct extent_status *es)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct extent_status *first = es, *es1;
+	struct ext4_es_packed *pk;
+	struct ext4_es_piece *p;
+	struct rb_node *node;
+	unsigned int status = EXTENT_STATUS_WRITTEN;
+	bool last;
+	int n = 1;
+
+	if (!ext4_es_can_be_packed(es))
+		return es;
+
+	node = rb_prev(&es->rb_node);
+	es1 = node ? rb_entry(node, struct extent_status, rb_node) : NULL;
+	if (es1 && ext4_es_is_packed(es1) &&
+	    ext4_es_end(es1) + 1 == es->es_lblk) {
+		pk = ext4_es_packed(es1);
+		p = &pk->piece[pk->nr - 1];
+		if (ext4_es_piece_pblock(p) + p->len == ext4_es_pblock(es) &&
+		    (__u64)p->len + es->es_len <= EXT_MAX_BLOCKS)
+			p->len += es->es_len;
+		else if (pk->nr < ES_PACKED_NR)
+			ext4_es_piece_store(&pk->piece[pk->nr++], es->es_len,
+					    ext4_es_pblock(es));
+		else
+			return es;
+		es1->es_len += es->es_len;
+		if (ext4_es_is_referenced(es))
+			ext4_es_set_referenced(es1);
+		rb_erase(&es->rb_node, &tree->root);
+		ext4_es_free_extent(inode, es);
+		tree->cache_es = es1;
+		return es1;
+	}
+
+	while (n < ES_PACKED_MIN) {
+		node = rb_prev(&first->rb_node);
+		if (!node)
+			break;
+		es1 = rb_entry(node, struct extent_status, rb_node);
+		if (!ext4_es_can_be_packed(es1) ||
+		    ext4_es_end(es1) + 1 != first->es_lblk)
+			break;
+		first = es1;
+		n++;
+	}
+	if (n < ES_PACKED_MIN)
+		return es;
+
+	for (es1 = first; es1 != es; ) {
+		if (ext4_es_is_referenced(es1))
+			status |= EXTENT_STATUS_REFERENCED;
+		node = rb_next(&es1->rb_node);
+		es1 = rb_entry(node, struct extent_status, rb_node);
+	}
+	if (ext4_es_is_referenced(es))
+		status |= EXTENT_STATUS_REFERENCED;
+
+	pk = ext4_es_alloc_packed(inode, first->es_lblk, status);
+	if (!pk)
+		return es;
+
+	es1 = first;
+	do {
+		last = es1 == es;
+		node = rb_next(&es1->rb_node);
+		p = &pk->piece[pk->nr++];
+		ext4_es_piece_store(p, es1->es_len, ext4_es_pblock(es1));
+		pk->es.es_len += es1->es_len;
+		if (es1 == first)
+			rb_replace_node(&es1->rb_node, &pk->es.rb_node,
+					&tree->root);
+		else
+			rb_erase(&es1->rb_node, &tree->root);
+		ext4_es_free_extent(inode, es1);
+		if (!last)
+			es1 = rb_entry(node, struct extent_status, rb_node);
+	} while (!last);
+
+	tree->cache_es = &pk->es;
+	return &pk->es;
+}
+
+/*
+ * Drop the blocks of packed node @es before @lblk, which must lie inside it
+ * and not at its start.
+ */
+static void ext4_es_packed_trim_head(struct extent_status *es, ext4_lblk_t lblk)
+{
+	struct ext4_es_packed *pk = ext4_es_packed(es);
+	ext4_lblk_t start = es->es_lblk;
+	unsigned int i = 0, cut;
+
+	while (start + pk->piece[i].len <= lblk)
+		start += pk->piece[i++].len;
+	if (i) {
+		memmove(pk->piece, pk->piece + i,
+			(pk->nr - i) * sizeof(pk->piece[0]));
+		pk->nr -= i;
+	}
+	cut = lblk - start;
+	if (cut)
+		ext4_es_piece_store(&pk->piece[0], pk->piece[0].len - cut,
+				ext4_es_piece_pblock(&pk->piece[0]) + cut);
+	es->es_len -= lblk - es->es_lblk;
+	es->es_lblk = lblk;
+}
+
+/*
+ * Drop the blocks of packed node @es after @end, which must lie inside it
+ * and not at its end.
+ */
+static void ext4_es_packed_trim_tail(struct extent_status *es, ext4_lblk_t end)
+{
+	struct ext4_es_packed *pk = ext4_es_packed(es);
+	ext4_lblk_t start = es->es_lblk;
+	unsigned int i = 0;
+
+	while (start + pk->piece[i].len <= end)
+		start += pk->piece[i++].len;
+	pk->piece[i].len = end - start + 1;
+	pk->nr = i + 1;
+	es->es_len = end - es->es_lblk + 1;
+}
+
+/*
+ * Punch [@lblk, @end] out of the middle of packed node @es, moving what
+ * follows it to a new packed node.  Leaves @es untouched on failure.
+ */
+static int ext4_es_packed_split(struct inode *inode, struct extent_status *es,
+				ext4_lblk_t lblk, ext4_lblk_t end)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct ext4_es_packed *pk = ext4_es_packed(es), *right;
+	struct rb_node **p, *parent;
+
+	right = ext4_es_alloc_packed(inode, es->es_lblk,
+			ext4_es_status(es) & ~EXTENT_STATUS_PACKED);
+	if (!right)
+		return -ENOMEM;
+	right->es.es_len = es->es_len;
+	right->nr = pk->nr;
+	memcpy(right->piece, pk->piece, pk->nr * sizeof(pk->piece[0]));
+	ext4_es_packed_trim_head(&right->es, end + 1);
+	ext4_es_packed_trim_tail(es, lblk - 1);
+
+	/* link it as the in-order successor of @es */
+	parent = &es->rb_node;
+	p = &es->rb_node.rb_right;
+	while (*p) {
+		parent = *p;
+		p = &(*p)->rb_left;
+	}
+	rb_link_node(&right->es.rb_node, parent, p);
+	rb_insert_color(&right->es.rb_node, &tree->root);
+	return 0;
+}
+
 #ifdef ES_AGGRESSIVE_TEST
 #include "ext4_extents.h"	/* Needed when ES_AGGRESSIVE_TEST is defined */
 
@@ -794,6 +1102,7 @@ static int __es_insert_extent(struct inode *inode, struct extent_status *newes)
 
 out:
 	tree->cache_es = es;
+	ext4_es_mark_inode_referenced(inode);
 	return 0;
 }
 
@@ -886,8 +1195,8 @@ void ext4_es_cache_extent(struct inode *inode, ext4_lblk_t lblk,
 	write_lock(&EXT4_I(inode)->i_es_lock);
 
 	es = __es_tree_search(&EXT4_I(inode)->i_es_tree.root, lblk);
-	if (!es || es->es_lblk > end)
-		__es_insert_extent(inode, &newes);
+	if ((!es || es->es_lblk > end) && !__es_insert_extent(inode, &newes))
+		ext4_es_try_to_pack(inode, EXT4_I(inode)->i_es_tree.cache_es);
 	write_unlock(&EXT4_I(inode)->i_es_lock);
 }
 
@@ -943,13 +1252,15 @@ int ext4_es_lookup_extent(struct inode *inode, ext4_lblk_t lblk,
 	stats = &EXT4_SB(inode->i_sb)->s_es_stats;
 	if (found) {
 		BUG_ON(!es1);
-		es->es_lblk = es1->es_lblk;
-		es->es_len = es1->es_len;
-		es->es_pblk = es1->es_pblk;
+		ext4_es_get(es1, lblk, es);
 		if (!ext4_es_is_referenced(es1))
 			ext4_es_set_referenced(es1);
+		ext4_es_mark_inode_referenced(inode);
 		percpu_counter_inc(&stats->es_stats_cache_hits);
-		if (next_lblk) {
+		if (next_lblk && ext4_es_end(es) < ext4_es_end(es1)) {
+			/* more extents packed in the same node */
+			*next_lblk = ext4_es_end(es) + 1;
+		} else if (next_lblk) {
 			node = rb_next(&es1->rb_node);
 			if (node) {
 				es1 = rb_entry(node, struct extent_status,
@@ -1317,7 +1628,22 @@ static int __es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
 
 	len1 = lblk > es->es_lblk ? lblk - es->es_lblk : 0;
 	len2 = ext4_es_end(es) > end ? ext4_es_end(es) - end : 0;
-	if (len1 > 0)
+	if (ext4_es_is_packed(es) && len2 > 0) {
+		/* packed extents are written, nothing to count_rsvd() */
+		if (len1 > 0) {
+			err = ext4_es_packed_split(inode, es, lblk, end);
+			if ((err == -ENOMEM) &&
+			    __es_shrink(EXT4_SB(inode->i_sb), 128,
+					EXT4_I(inode)))
+				goto retry;
+		} else {
+			ext4_es_packed_trim_head(es, end + 1);
+		}
+		goto out;
+	}
+	if (len1 > 0 && ext4_es_is_packed(es))
+		ext4_es_packed_trim_tail(es, lblk - 1);
+	else if (len1 > 0)
 		es->es_len = len1;
 	if (len2 > 0) {
 		if (len1 > 0) {
@@ -1388,11 +1714,16 @@ static int __es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
 		if (count_reserved)
 			count_rsvd(inode, es->es_lblk, orig_len - len1,
 				   es, &rc);
-		es->es_lblk = end + 1;
-		es->es_len = len1;
-		if (ext4_es_is_written(es) || ext4_es_is_unwritten(es)) {
-			block = es->es_pblk + orig_len - len1;
-			ext4_es_store_pblock(es, block);
+		if (ext4_es_is_packed(es)) {
+			ext4_es_packed_trim_head(es, end + 1);
+		} else {
+			es->es_lblk = end + 1;
+			es->es_len = len1;
+			if (ext4_es_is_written(es) ||
+			    ext4_es_is_unwritten(es)) {
+				block = es->es_pblk + orig_len - len1;
+				ext4_es_store_pblock(es, block);
+			}
 		}
 	}
 
@@ -1469,11 +1800,25 @@ static int __es_shrink(struct ext4_sb_info *sbi, int nr_to_scan,
 		/* Move the inode to the tail */
 		list_move_tail(&ei->i_es_list, &sbi->s_es_list);
 
+		/*
+		 * On the first pass give inodes whose extents were looked up
+		 * since the last scan a second chance, so that cold inodes
+		 * are shrunk before hot ones.  Within an inode the extent
+		 * referenced bits do the same for ranges.
+		 */
+		if (!retried && ext4_test_inode_state(&ei->vfs_inode,
+						EXT4_STATE_ES_REFERENCED)) {
+			ext4_clear_inode_state(&ei->vfs_inode,
+					       EXT4_STATE_ES_REFERENCED);
+			nr_skipped++;
+			continue;
+		}
+
 		/*
 		 * Normally we try hard to avoid shrinking precached inodes,
 		 * but we will as a last resort.
 		 */
-		if (!retried && ext4_test_inode_state(&ei->vfs_inode,
+		if (retried < 2 && ext4_test_inode_state(&ei->vfs_inode,
 						EXT4_STATE_EXT_PRECACHED)) {
 			nr_skipped++;
 			continue;
@@ -1500,9 +1845,10 @@ static int __es_shrink(struct ext4_sb_info *sbi, int nr_to_scan,
 
 	/*
 	 * If we skipped any inodes, and we weren't able to make any
-	 * forward progress, try again to scan precached inodes.
+	 * forward progress, try again including recently used inodes,
+	 * and then precached ones.
 	 */
-	if ((nr_shrunk == 0) && nr_skipped && !retried) {
+	if ((nr_shrunk == 0) && nr_skipped && retried < 2) {
 		retried++;
 		goto retry;
 	}
@@ -1663,7 +2009,8 @@ void ext4_es_unregister_shrinker(struct ext4_sb_info *sbi)
  * most *nr_to_scan extents, update *nr_to_scan accordingly.
  *
  * Return 0 if we hit end of tree / interval, 1 if we exhausted nr_to_scan.
- * Increment *nr_shrunk by the number of reclaimed extents. Also update
+ * Increment *nr_shrunk by the number of reclaimed extents, counting those
+ * freed by merging kept extents with their right neighbour. Also update
  * ei->i_es_shrink_lblk to where we should continue scanning.
  */
 static int es_do_reclaim_extents(struct ext4_inode_info *ei, ext4_lblk_t end,
@@ -1673,6 +2020,7 @@ static int es_do_reclaim_extents(struct ext4_inode_info *ei, ext4_lblk_t end,
 	struct ext4_es_tree *tree = &ei->i_es_tree;
 	struct extent_status *es;
 	struct rb_node *node;
+	unsigned int shk_nr;
 
 	es = __es_tree_search(&tree->root, ei->i_es_shrink_lblk);
 	if (!es)
@@ -1691,15 +2039,30 @@ static int es_do_reclaim_extents(struct ext4_inode_info *ei, ext4_lblk_t end,
 		 * fiemap, bigallic, and seek_data/hole need to use it.
 		 */
 		if (ext4_es_is_delayed(es))
-			goto next;
-		if (ext4_es_is_referenced(es)) {
-			ext4_es_clear_referenced(es);
-			goto next;
-		}
+			goto keep;
+		if (ext4_es_is_referenced(es))
+			goto keep;
 
 		rb_erase(&es->rb_node, &tree->root);
 		ext4_es_free_extent(inode, es);
 		(*nr_shrunk)++;
+		goto next;
+keep:
+		/*
+		 * Compact what we keep: removals and status conversions can
+		 * leave contiguous entries that were never merged back, and
+		 * each of them costs a full extent_status.  Runs of written
+		 * extents get packed.  The referenced bit is cleared only
+		 * after merging, so it isn't taken back from the neighbour.
+		 */
+		shk_nr = ei->i_es_shk_nr;
+		es = ext4_es_try_to_merge_right(inode, es);
+		if (!ext4_es_is_delayed(es)) {
+			ext4_es_clear_referenced(es);
+			es = ext4_es_try_to_pack(inode, es);
+		}
+		*nr_shrunk += shk_nr - ei->i_es_shk_nr;
+		node = rb_next(&es->rb_node);
 next:
 		if (!node)
 			goto out_wrap;
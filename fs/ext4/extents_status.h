@@ -36,6 +36,7 @@ enum {
 	ES_DELAYED_B,
 	ES_HOLE_B,
 	ES_REFERENCED_B,
+	ES_PACKED_B,
 	ES_FLAGS
 };
 
@@ -47,6 +48,8 @@ enum {
 #define EXTENT_STATUS_DELAYED	(1 << ES_DELAYED_B)
 #define EXTENT_STATUS_HOLE	(1 << ES_HOLE_B)
 #define EXTENT_STATUS_REFERENCED	(1 << ES_REFERENCED_B)
+/* Tree node holding a run of written extents, never seen outside the tree */
+#define EXTENT_STATUS_PACKED	(1 << ES_PACKED_B)
 
 #define ES_TYPE_MASK	((ext4_fsblk_t)(EXTENT_STATUS_WRITTEN | \
 			  EXTENT_STATUS_UNWRITTEN | \
@@ -204,6 +207,11 @@ static inline int ext4_es_is_referenced(struct extent_status *es)
 	return (ext4_es_status(es) & EXTENT_STATUS_REFERENCED) != 0;
 }
 
+static inline int ext4_es_is_packed(struct extent_status *es)
+{
+	return (ext4_es_status(es) & EXTENT_STATUS_PACKED) != 0;
+}
+
 static inline ext4_fsblk_t ext4_es_pblock(struct extent_status *es)
 {
 	return es->es_pblk & ~ES_MASK;
@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  linux/fs/ext4/fast_commit.c
+ *
+ *  ext4 fast commits
+ *
+ * fsync() of a file normally forces a commit of the whole running
+ * transaction, and with it every metadata change made by every other
+ * process.  When the only thing that fsync() needs to make durable is the
+ * on-disk inode itself (timestamps, size, the extent root of an overwritten
+ * file, ...), ext4 instead logs a copy of that inode into the journal's
+ * fast commit area with a single block write.  On recovery the copies
+ * belonging to the transaction right after the last committed one are
+ * written back into the inode table.
+ *
+ * Any change which touches more than the inode (block or inode allocation,
+ * directory entries, xattr or extent tree blocks, the orphan list, ...)
+ * makes the inode ineligible for the rest of its transaction and fsync()
+ * falls back to a full commit.
+ *
+ * Fast commits are off unless the file system is mounted with the
+ * fast_commit option.  The feature bits they set are private to this
+ * kernel (see fast_commit.h), so e2fsck, debugfs and tune2fs refuse the
+ * file system while they are on.  A mount without the option, which
+ * also replays any fast commits left by a crash, clears them again.
+ */
+
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/crc32.h>
+#include <linux/slab.h>
+
+#include "ext4.h"
+#include "ext4_jbd2.h"
+
+/* Space needed in a fast commit block besides the raw inode */
+#define EXT4_FC_OVERHEAD	(3 * sizeof(struct ext4_fc_tl) +	\
+				 sizeof(struct ext4_fc_head) +		\
+				 sizeof(struct ext4_fc_inode) +		\
+				 sizeof(struct ext4_fc_tail))
+
+/*
+ * Record that @inode was changed under @handle in a way a fast commit
+ * cannot describe.  A later fsync() of the same transaction then does a
+ * full commit.
+ */
+void ext4_fc_mark_ineligible(struct inode *inode, handle_t *handle)
+{
+	if (!inode || !ext4_handle_valid(handle) || !handle->h_transaction)
+		return;
+
+	WRITE_ONCE(EXT4_I(inode)->i_fc_ineligible_tid,
+		   handle->h_transaction->t_tid);
+}
+
+static bool ext4_fc_eligible(journal_t *journal, struct inode *inode,
+			     tid_t commit_tid)
+{
+	struct super_block *sb = inode->i_sb;
+
+	if (!test_opt(sb, FAST_COMMIT) ||
+	    !jbd2_has_feature_fast_commit(journal))
+		return false;
+	if (!S_ISREG(inode->i_mode) || ext4_has_inline_data(inode) ||
+	    ext4_should_journal_data(inode))
+		return false;
+	if (EXT4_INODE_SIZE(sb) + EXT4_FC_OVERHEAD > sb->s_blocksize)
+		return false;
+	return READ_ONCE(EXT4_I(inode)->i_fc_ineligible_tid) != commit_tid;
+}
+
+static u8 *ext4_fc_add_tl(u8 *dst, u16 tag, u16 len)
+{
+	struct ext4_fc_tl tl;
+
+	tl.fc_tag = cpu_to_le16(tag);
+	tl.fc_len = cpu_to_le16(len);
+	memcpy(dst, &tl, sizeof(tl));
+	return dst + sizeof(tl);
+}
+
+static int ext4_fc_write_inode(journal_t *journal, struct inode *inode,
+			       tid_t commit_tid)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	int inode_len = EXT4_INODE_SIZE(sb);
+	struct ext4_fc_head head;
+	struct ext4_fc_tail tail;
+	struct ext4_iloc iloc;
+	struct buffer_head *bh;
+	__le32 ino = cpu_to_le32(inode->i_ino);
+	u8 *raw, *dst;
+	int ret;
+
+	raw = kmalloc(inode_len, GFP_NOFS);
+	if (!raw)
+		return -ENOMEM;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		goto out;
+	spin_lock(&ei->i_raw_lock);
+	memcpy(raw, ext4_raw_inode(&iloc), inode_len);
+	spin_unlock(&ei->i_raw_lock);
+	brelse(iloc.bh);
+
+	/*
+	 * Changes which make the inode ineligible mark it before they touch
+	 * the raw inode, so the copy may contain a part of one of them.
+	 */
+	if (READ_ONCE(ei->i_fc_ineligible_tid) == commit_tid) {
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	/* File data may have gone to another device than the journal */
+	if (journal->j_fs_dev != journal->j_dev &&
+	    (journal->j_flags & JBD2_BARRIER)) {
+		ret = blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+		if (ret)
+			goto out;
+	}
+
+	ret = jbd2_fc_get_buf(journal, &bh);
+	if (ret)
+		goto out;
+
+	lock_buffer(bh);
+	dst = bh->b_data;
+	memset(dst, 0, bh->b_size);
+
+	head.fc_magic = cpu_to_le32(EXT4_FC_MAGIC);
+	head.fc_features = cpu_to_le32(EXT4_FC_SUPPORTED_FEATURES);
+	head.fc_tid = cpu_to_le32(commit_tid);
+	dst = ext4_fc_add_tl(dst, EXT4_FC_TAG_HEAD, sizeof(head));
+	memcpy(dst, &head, sizeof(head));
+	dst += sizeof(head);
+
+	dst = ext4_fc_add_tl(dst, EXT4_FC_TAG_INODE,
+			     sizeof(struct ext4_fc_inode) + inode_len);
+	memcpy(dst, &ino, sizeof(ino));
+	dst += sizeof(ino);
+	memcpy(dst, raw, inode_len);
+	dst += inode_len;
+
+	dst = ext4_fc_add_tl(dst, EXT4_FC_TAG_TAIL, sizeof(tail));
+	tail.fc_tid = cpu_to_le32(commit_tid);
+	memcpy(dst, &tail.fc_tid, sizeof(tail.fc_tid));
+	dst += sizeof(tail.fc_tid);
+	tail.fc_crc = cpu_to_le32(crc32_le(~0, bh->b_data,
+					   dst - (u8 *)bh->b_data));
+	memcpy(dst, &tail.fc_crc, sizeof(tail.fc_crc));
+
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	get_bh(bh);
+	submit_bh(REQ_OP_WRITE, REQ_SYNC | REQ_PREFLUSH | REQ_FUA, bh);
+	wait_on_buffer(bh);
+	if (unlikely(!buffer_uptodate(bh)))
+		ret = -EIO;
+	brelse(bh);
+out:
+	kfree(raw);
+	return ret;
+}
+
+/*
+ * Make the changes of transaction @commit_tid to @inode durable, with a
+ * fast commit if possible and with a full commit otherwise.
+ */
+int ext4_fc_commit(journal_t *journal, tid_t commit_tid, struct inode *inode)
+{
+	int ret;
+
+	if (!ext4_fc_eligible(journal, inode, commit_tid))
+		goto full_commit;
+
+	ret = jbd2_fc_begin_commit(journal, commit_tid);
+	if (ret == -EALREADY)
+		return 0;
+	if (ret)
+		goto full_commit;
+
+	ret = ext4_fc_write_inode(journal, inode, commit_tid);
+	jbd2_fc_end_commit(journal);
+	if (!ret)
+		return 0;
+
+full_commit:
+	return jbd2_complete_transaction(journal, commit_tid);
+}
+
+/*
+ * Walk the records of a fast commit block.  Returns the number of the
+ * inode records if the block is complete and belongs to @tid, or a
+ * negative error otherwise.  With @replay set the inodes are written back.
+ */
+static int ext4_fc_walk_block(struct super_block *sb, u8 *start, tid_t tid,
+			      int (*replay)(struct super_block *, u32,
+					    u8 *, int))
+{
+	u8 *cur = start, *end = start + sb->s_blocksize;
+	struct ext4_fc_head head;
+	struct ext4_fc_tail tail;
+	struct ext4_fc_tl tl;
+	bool seen_head = false;
+	int nr_inodes = 0, ret;
+	u16 len;
+	u8 *val;
+
+	while (cur + sizeof(tl) <= end) {
+		memcpy(&tl, cur, sizeof(tl));
+		len = le16_to_cpu(tl.fc_len);
+		val = cur + sizeof(tl);
+		if (val + len > end)
+			return -EFSBADCRC;
+
+		switch (le16_to_cpu(tl.fc_tag)) {
+		case EXT4_FC_TAG_HEAD:
+			if (cur != start || len != sizeof(head))
+				return -EFSBADCRC;
+			memcpy(&head, val, sizeof(head));
+			if (le32_to_cpu(head.fc_magic) != EXT4_FC_MAGIC)
+				return -EFSBADCRC;
+			if (le32_to_cpu(head.fc_tid) != tid)
+				return -ESTALE;
+			if (le32_to_cpu(head.fc_features) &
+			    ~EXT4_FC_SUPPORTED_FEATURES)
+				return -EOPNOTSUPP;
+			seen_head = true;
+			break;
+		case EXT4_FC_TAG_INODE:
+			if (!seen_head ||
+			    len < sizeof(struct ext4_fc_inode) +
+				  EXT4_GOOD_OLD_INODE_SIZE ||
+			    len > sizeof(struct ext4_fc_inode) +
+				  EXT4_INODE_SIZE(sb))
+				return -EFSBADCRC;
+			if (replay) {
+				__le32 ino;
+
+				memcpy(&ino, val, sizeof(ino));
+				ret = replay(sb, le32_to_cpu(ino),
+					     val + sizeof(ino),
+					     len - sizeof(ino));
+				if (ret)
+					return ret;
+			}
+			nr_inodes++;
+			break;
+		case EXT4_FC_TAG_PAD:
+			break;
+		case EXT4_FC_TAG_TAIL:
+			if (!seen_head || len != sizeof(tail))
+				return -EFSBADCRC;
+			memcpy(&tail, val, sizeof(tail));
+			if (le32_to_cpu(tail.fc_tid) != tid)
+				return -EFSBADCRC;
+			if (le32_to_cpu(tail.fc_crc) !=
+			    crc32_le(~0, start, val + sizeof(tail.fc_tid) - start))
+				return -EFSBADCRC;
+			return nr_inodes;
+		default:
+			return -EFSBADCRC;
+		}
+		cur = val + len;
+	}
+	return -EFSBADCRC;
+}
+
+/* Write back one logged inode into the inode table */
+static int ext4_fc_replay_inode(struct super_block *sb, u32 ino, u8 *raw,
+				int len)
+{
+	struct ext4_group_desc *gdp;
+	struct buffer_head *bh;
+	ext4_fsblk_t block;
+	int inodes_per_block, inode_offset, err;
+
+	if (ino < EXT4_FIRST_INO(sb) ||
+	    ino > le32_to_cpu(EXT4_SB(sb)->s_es->s_inodes_count))
+		return -EFSCORRUPTED;
+
+	gdp = ext4_get_group_desc(sb, (ino - 1) / EXT4_INODES_PER_GROUP(sb),
+				  NULL);
+	if (!gdp)
+		return -EFSCORRUPTED;
+
+	inodes_per_block = EXT4_SB(sb)->s_inodes_per_block;
+	inode_offset = (ino - 1) % EXT4_INODES_PER_GROUP(sb);
+	block = ext4_inode_table(sb, gdp) + (inode_offset / inodes_per_block);
+
+	bh = sb_bread(sb, block);
+	if (!bh)
+		return -EIO;
+
+	lock_buffer(bh);
+	memcpy(bh->b_data + (inode_offset % inodes_per_block) *
+	       EXT4_INODE_SIZE(sb), raw, len);
+	unlock_buffer(bh);
+	mark_buffer_dirty(bh);
+	err = sync_dirty_buffer(bh);
+	brelse(bh);
+
+	ext4_debug("fast commit replayed inode %u\n", ino);
+	return err;
+}
+
+/*
+ * Fast commit recovery callback.  The scan pass counts the blocks which
+ * belong to @expected_tid; the first block that does not ends the fast
+ * commit log.  The replay pass writes back the inodes of those blocks.
+ */
+static int ext4_fc_replay(journal_t *journal, struct buffer_head *bh,
+			  enum passtype pass, int off, tid_t expected_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_fc_replay_state *state = &EXT4_SB(sb)->s_fc_replay_state;
+	int ret;
+
+	if (pass == PASS_SCAN) {
+		if (off == 0) {
+			state->fc_replay_num_blks = 0;
+			state->fc_replayed_blks = 0;
+		}
+		if (ext4_fc_walk_block(sb, bh->b_data, expected_tid, NULL) < 0)
+			return JBD2_FC_REPLAY_STOP;
+		state->fc_replay_num_blks++;
+		return JBD2_FC_REPLAY_CONTINUE;
+	}
+
+	if (pass != PASS_REPLAY ||
+	    state->fc_replayed_blks >= state->fc_replay_num_blks)
+		return JBD2_FC_REPLAY_STOP;
+
+	ret = ext4_fc_walk_block(sb, bh->b_data, expected_tid,
+				 ext4_fc_replay_inode);
+	if (ret < 0) {
+		ext4_msg(sb, KERN_ERR, "fast commit replay failed (%d)", ret);
+		return ret;
+	}
+	state->fc_replayed_blks++;
+	return JBD2_FC_REPLAY_CONTINUE;
+}
+
+void ext4_fc_init(struct super_block *sb, journal_t *journal)
+{
+	journal->j_fc_replay_callback = ext4_fc_replay;
+}
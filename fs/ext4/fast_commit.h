@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef __FAST_COMMIT_H__
+#define __FAST_COMMIT_H__
+
+/*
+ * On-disk format of the ext4 fast commit blocks.
+ *
+ * A fast commit occupies a single block of the journal's fast commit area
+ * and is a sequence of tag-length-value records:
+ *
+ *	HEAD	magic, features and tid of the running transaction
+ *	INODE	inode number followed by the raw on-disk inode
+ *	TAIL	tid again and crc32 of the block up to the crc field
+ *
+ * Unused space after the tail is padded with zeroes.
+ *
+ * This is not the fast commit format of upstream ext4 and e2fsprogs, so
+ * the feature bits, the tags and the head magic are all distinct from
+ * theirs: neither side can mistake the other's blocks for its own.
+ */
+
+#define EXT4_FC_MAGIC		0x4946C3E4	/* "inode fast commit, ext4" */
+
+#define EXT4_FC_TAG_HEAD	0x8001
+#define EXT4_FC_TAG_INODE	0x8002
+#define EXT4_FC_TAG_PAD		0x8003
+#define EXT4_FC_TAG_TAIL	0x8004
+
+#define EXT4_FC_SUPPORTED_FEATURES	0x0
+
+/* Tag and length of every record */
+struct ext4_fc_tl {
+	__le16 fc_tag;
+	__le16 fc_len;
+};
+
+/* Value of EXT4_FC_TAG_HEAD */
+struct ext4_fc_head {
+	__le32 fc_magic;
+	__le32 fc_features;
+	__le32 fc_tid;
+};
+
+/* Value of EXT4_FC_TAG_INODE */
+struct ext4_fc_inode {
+	__le32 fc_ino;
+	__u8 fc_raw_inode[0];
+};
+
+/* Value of EXT4_FC_TAG_TAIL */
+struct ext4_fc_tail {
+	__le32 fc_tid;
+	__le32 fc_crc;
+};
+
+/* Fast commit replay state, valid while the journal is being recovered */
+struct ext4_fc_replay_state {
+	int fc_replay_num_blks;		/* Valid blocks found by the scan */
+	int fc_replayed_blks;		/* Blocks replayed so far */
+};
+
+#endif /* __FAST_COMMIT_H__ */
@@ -1631,6 +1631,7 @@ int ext4_try_create_inline_dir(handle_t *handle, struct inode *parent,
 struct buffer_head *ext4_find_inline_entry(struct inode *dir,
 					struct ext4_filename *fname,
 					struct ext4_dir_entry_2 **res_dir,
+					__u32 *res_ino,
 					int *has_inline_data)
 {
 	int ret;
@@ -1672,6 +1673,8 @@ struct buffer_head *ext4_find_inline_entry(struct inode *dir,
 	brelse(iloc.bh);
 	iloc.bh = NULL;
 out_find:
+	if (iloc.bh && res_ino)
+		*res_ino = le32_to_cpu((*res_dir)->inode);
 	up_read(&EXT4_I(dir)->xattr_sem);
 	return iloc.bh;
 }
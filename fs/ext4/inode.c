@@ -4815,9 +4815,18 @@ void ext4_set_inode_flags(struct inode *inode)
 		new_fl |= S_CASEFOLD;
 	if (flags & EXT4_VERITY_FL)
 		new_fl |= S_VERITY;
+	if (S_ISDIR(inode->i_mode) && (flags & EXT4_INDEX_FL) &&
+	    ext4_has_feature_dir_index(inode->i_sb)) {
+		new_fl |= S_PARALLEL_CREATE;
+		/*
+		 * Never cleared: a create that saw S_PARALLEL_CREATE may
+		 * still hold i_rwsem shared after an htree fallback drops it.
+		 */
+		ext4_set_inode_state(inode, EXT4_STATE_PARALLEL_CREATE);
+	}
 	inode_set_flags(inode, new_fl,
 			S_SYNC|S_APPEND|S_IMMUTABLE|S_NOATIME|S_DIRSYNC|S_DAX|
-			S_ENCRYPTED|S_CASEFOLD|S_VERITY);
+			S_ENCRYPTED|S_CASEFOLD|S_VERITY|S_PARALLEL_CREATE);
 }
 
 static blkcnt_t ext4_inode_blocks(struct ext4_inode *raw_inode,
@@ -5650,6 +5659,7 @@ int ext4_setattr(struct dentry *dentry, struct iattr *attr)
 			error = PTR_ERR(handle);
 			goto err_out;
 		}
+		ext4_fc_mark_ineligible(inode, handle);
 
 		/* dquot_transfer() calls back ext4_get_inode_usage() which
 		 * counts xattr inode references.
@@ -5717,6 +5727,7 @@ int ext4_setattr(struct dentry *dentry, struct iattr *attr)
 				error = PTR_ERR(handle);
 				goto out_mmap_sem;
 			}
+			ext4_fc_mark_ineligible(inode, handle);
 			if (ext4_handle_valid(handle) && shrink) {
 				error = ext4_orphan_add(handle, inode);
 				orphan = 1;
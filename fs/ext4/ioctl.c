@@ -165,6 +165,8 @@ static long swap_inode_boot_loader(struct super_block *sb,
 		err = -EINVAL;
 		goto err_out;
 	}
+	ext4_fc_mark_ineligible(inode, handle);
+	ext4_fc_mark_ineligible(inode_bl, handle);
 
 	/* Protect extent tree against block allocations via delalloc */
 	ext4_double_down_write_data_sem(inode, inode_bl);
@@ -375,6 +377,7 @@ static int ext4_ioctl_setflags(struct inode *inode,
 		err = PTR_ERR(handle);
 		goto flags_out;
 	}
+	ext4_fc_mark_ineligible(inode, handle);
 	if (IS_SYNC(inode))
 		ext4_handle_sync(handle);
 	err = ext4_reserve_inode_write(handle, inode, &iloc);
@@ -484,6 +487,7 @@ static int ext4_ioctl_setproject(struct file *filp, __u32 projid)
 		EXT4_QUOTA_DEL_BLOCKS(sb) + 3);
 	if (IS_ERR(handle))
 		return PTR_ERR(handle);
+	ext4_fc_mark_ineligible(inode, handle);
 
 	err = ext4_reserve_inode_write(handle, inode, &iloc);
 	if (err)
@@ -898,6 +902,7 @@ long ext4_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			err = PTR_ERR(handle);
 			goto unlock_out;
 		}
+		ext4_fc_mark_ineligible(inode, handle);
 		err = ext4_reserve_inode_write(handle, inode, &iloc);
 		if (err == 0) {
 			inode->i_ctime = current_time(inode);
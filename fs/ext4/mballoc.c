@@ -686,25 +686,111 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 	}
 }
 
+/*
+ * Move a group from the list of order @old to the list of order @new.
+ * Order -1 means the group is on no list.  Called with the group locked.
+ */
+static void mb_move_group_list(struct list_head *node, struct list_head *lists,
+			       rwlock_t *locks, int old, int new)
+{
+	if (old >= 0) {
+		write_lock(&locks[old]);
+		list_del_init(node);
+		write_unlock(&locks[old]);
+	}
+	if (new >= 0) {
+		write_lock(&locks[new]);
+		list_add_tail(node, &lists[new]);
+		write_unlock(&locks[new]);
+	}
+}
+
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the list of groups with that order.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_largest_free_order;
 	int i;
-	int bits;
 
 	grp->bb_largest_free_order = -1; /* uninit */
 
-	bits = sb->s_blocksize_bits + 1;
-	for (i = bits; i >= 0; i--) {
+	for (i = MB_NUM_ORDERS(sb) - 1; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
 			grp->bb_largest_free_order = i;
 			break;
 		}
 	}
+
+	if (grp->bb_largest_free_order != old)
+		mb_move_group_list(&grp->bb_largest_free_order_node,
+				   sbi->s_mb_largest_free_orders,
+				   sbi->s_mb_largest_free_orders_locks,
+				   old, grp->bb_largest_free_order);
+}
+
+/* Order of the list a group with average fragment size @len belongs to */
+static int mb_avg_fragment_size_order(struct super_block *sb,
+				      ext4_grpblk_t len)
+{
+	int order = fls(len) - 1;
+
+	if (order < 0)
+		return 0;
+	if (order >= MB_NUM_ORDERS(sb))
+		order = MB_NUM_ORDERS(sb) - 1;
+	return order;
+}
+
+/*
+ * Keep the group on the list of groups with the same order of average
+ * free fragment size.
+ */
+static void
+mb_update_avg_fragment_size(struct super_block *sb, struct ext4_group_info *grp)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_avg_fragment_size_order;
+	int new = -1;
+
+	if (grp->bb_fragments)
+		new = mb_avg_fragment_size_order(sb,
+					grp->bb_free / grp->bb_fragments);
+	if (new == old)
+		return;
+
+	grp->bb_avg_fragment_size_order = new;
+	mb_move_group_list(&grp->bb_avg_fragment_size_node,
+			   sbi->s_mb_avg_fragment_size,
+			   sbi->s_mb_avg_fragment_size_locks, old, new);
+}
+
+/*
+ * List a group whose buddy hasn't been loaded by the free count of its
+ * descriptor, as if that were one free extent, so that the allocator can
+ * find it through the lists before anything has loaded its buddy.  Its
+ * real orders replace these estimates in ext4_mb_generate_buddy().
+ */
+static void mb_list_uninit_group(struct super_block *sb,
+				 struct ext4_group_info *grp)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int order;
+
+	if (!grp->bb_free)
+		return;
+	order = mb_avg_fragment_size_order(sb, grp->bb_free);
+	grp->bb_largest_free_order = order;
+	grp->bb_avg_fragment_size_order = order;
+	mb_move_group_list(&grp->bb_largest_free_order_node,
+			   sbi->s_mb_largest_free_orders,
+			   sbi->s_mb_largest_free_orders_locks, -1, order);
+	mb_move_group_list(&grp->bb_avg_fragment_size_node,
+			   sbi->s_mb_avg_fragment_size,
+			   sbi->s_mb_avg_fragment_size_locks, -1, order);
 }
 
 static noinline_for_stack
@@ -754,6 +840,7 @@ void ext4_mb_generate_buddy(struct super_block *sb,
 					EXT4_GROUP_INFO_BBITMAP_CORRUPT);
 	}
 	mb_set_largest_free_order(sb, grp);
+	mb_update_avg_fragment_size(sb, grp);
 
 	clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state));
 
@@ -1487,6 +1574,7 @@ static void mb_free_blocks(struct inode *inode, struct ext4_buddy *e4b,
 
 done:
 	mb_set_largest_free_order(sb, e4b->bd_info);
+	mb_update_avg_fragment_size(sb, e4b->bd_info);
 	mb_check_buddy(e4b);
 }
 
@@ -1622,6 +1710,7 @@ static int mb_mark_used(struct ext4_buddy *e4b, struct ext4_free_extent *ex)
 		e4b->bd_info->bb_counters[ord]++;
 	}
 	mb_set_largest_free_order(e4b->bd_sb, e4b->bd_info);
+	mb_update_avg_fragment_size(e4b->bd_sb, e4b->bd_info);
 
 	ext4_set_bits(e4b->bd_bitmap, ex->fe_start, len0);
 	mb_check_buddy(e4b);
@@ -2105,6 +2194,134 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Check without the group lock whether a group found on one of the
+ * per-order lists may satisfy the request at criteria @cr.
+ */
+static bool ext4_mb_listed_group_ok(struct ext4_allocation_context *ac,
+				    struct ext4_group_info *grp,
+				    ext4_group_t ngroups, int cr)
+{
+	int flex_size = ext4_flex_bg_size(EXT4_SB(ac->ac_sb));
+
+	if (grp->bb_group >= ngroups || grp->bb_free < ac->ac_g_ex.fe_len)
+		return false;
+	if (EXT4_MB_GRP_BBITMAP_CORRUPT(grp))
+		return false;
+
+	/* Avoid using the first bg of a flexgroup for data files */
+	if (cr == 0 && (ac->ac_flags & EXT4_MB_HINT_DATA) &&
+	    (flex_size >= EXT4_FLEX_SIZE_DIR_ALLOC_SCHEME) &&
+	    ((grp->bb_group % flex_size) == 0))
+		return false;
+
+	/*
+	 * A group whose buddy isn't loaded yet is listed by the free count of
+	 * its descriptor, an upper bound for both orders.  Loading it in
+	 * ext4_mb_good_group() moves it to the lists it really belongs to.
+	 */
+	if (EXT4_MB_GRP_NEED_INIT(grp))
+		return true;
+
+	if (cr == 0)
+		return grp->bb_largest_free_order >= ac->ac_2order;
+
+	return grp->bb_fragments &&
+	       grp->bb_free / grp->bb_fragments >= ac->ac_g_ex.fe_len;
+}
+
+/*
+ * Instead of scanning the groups one after another, take the first
+ * suitable group from the lists of groups whose largest free extent
+ * (criteria 0) or average free fragment (criteria 1) is large enough for
+ * the request.  Returns false if there is no such group.
+ */
+static bool ext4_mb_choose_listed_group(struct ext4_allocation_context *ac,
+					ext4_group_t ngroups, int cr,
+					ext4_group_t *group)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_group_info *iter, *grp = NULL;
+	struct list_head *list;
+	rwlock_t *lock;
+	int order;
+
+	if (cr == 0)
+		order = ac->ac_2order;
+	else
+		order = mb_avg_fragment_size_order(sb, ac->ac_g_ex.fe_len);
+
+	for (; order < MB_NUM_ORDERS(sb) && !grp; order++) {
+		if (cr == 0) {
+			list = &sbi->s_mb_largest_free_orders[order];
+			lock = &sbi->s_mb_largest_free_orders_locks[order];
+		} else {
+			list = &sbi->s_mb_avg_fragment_size[order];
+			lock = &sbi->s_mb_avg_fragment_size_locks[order];
+		}
+		if (list_empty(list))
+			continue;
+
+		read_lock(lock);
+		if (cr == 0) {
+			list_for_each_entry(iter, list,
+					    bb_largest_free_order_node) {
+				if (ext4_mb_listed_group_ok(ac, iter, ngroups,
+							    cr)) {
+					grp = iter;
+					break;
+				}
+			}
+		} else {
+			list_for_each_entry(iter, list,
+					    bb_avg_fragment_size_node) {
+				if (ext4_mb_listed_group_ok(ac, iter, ngroups,
+							    cr)) {
+					grp = iter;
+					break;
+				}
+			}
+		}
+		read_unlock(lock);
+	}
+
+	if (!grp)
+		return false;
+	*group = grp->bb_group;
+	return true;
+}
+
+/*
+ * A group picked from the lists did not satisfy the request; move it to
+ * the tail of its list so that the next pick looks at another group.
+ * Called with the group locked.
+ */
+static void ext4_mb_rotate_listed_group(struct super_block *sb,
+					struct ext4_group_info *grp, int cr)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int order;
+
+	if (cr == 0) {
+		order = grp->bb_largest_free_order;
+		if (order < 0)
+			return;
+		write_lock(&sbi->s_mb_largest_free_orders_locks[order]);
+		list_move_tail(&grp->bb_largest_free_order_node,
+			       &sbi->s_mb_largest_free_orders[order]);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[order]);
+	} else {
+		order = grp->bb_avg_fragment_size_order;
+		if (order < 0)
+			return;
+		write_lock(&sbi->s_mb_avg_fragment_size_locks[order]);
+		list_move_tail(&grp->bb_avg_fragment_size_node,
+			       &sbi->s_mb_avg_fragment_size[order]);
+		write_unlock(&sbi->s_mb_avg_fragment_size_locks[order]);
+	}
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
@@ -2114,6 +2331,7 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 	struct ext4_sb_info *sbi;
 	struct super_block *sb;
 	struct ext4_buddy e4b;
+	bool use_lists, listed;
 
 	sb = ac->ac_sb;
 	sbi = EXT4_SB(sb);
@@ -2178,20 +2396,39 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 		 * from the goal value specified
 		 */
 		group = ac->ac_g_ex.fe_group;
+		use_lists = cr < 2 && sbi->s_mb_optimize_scan;
 
 		for (i = 0; i < ngroups; group++, i++) {
 			int ret = 0;
 			cond_resched();
 			/*
-			 * Artificially restricted ngroups for non-extent
-			 * files makes group > ngroups possible on first loop.
+			 * Even with the lists, try the goal group first, to
+			 * keep the locality the goal was chosen for.
 			 */
-			if (group >= ngroups)
+			listed = use_lists && i > 0;
+			if (listed) {
+				if (!ext4_mb_choose_listed_group(ac, ngroups,
+								 cr, &group))
+					break;
+			} else if (group >= ngroups) {
+				/*
+				 * Artificially restricted ngroups for
+				 * non-extent files makes group > ngroups
+				 * possible on first loop.
+				 */
 				group = 0;
+			}
 
 			/* This now checks without needing the buddy page */
 			ret = ext4_mb_good_group(ac, group, cr);
 			if (ret <= 0) {
+				if (listed) {
+					ext4_lock_group(sb, group);
+					ext4_mb_rotate_listed_group(sb,
+						ext4_get_group_info(sb, group),
+						cr);
+					ext4_unlock_group(sb, group);
+				}
 				if (!first_err)
 					first_err = ret;
 				continue;
@@ -2209,6 +2446,9 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			 */
 			ret = ext4_mb_good_group(ac, group, cr);
 			if (ret <= 0) {
+				if (listed)
+					ext4_mb_rotate_listed_group(sb,
+							e4b.bd_info, cr);
 				ext4_unlock_group(sb, group);
 				ext4_mb_unload_buddy(&e4b);
 				if (!first_err)
@@ -2225,6 +2465,10 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			else
 				ext4_mb_complex_scan_group(ac, &e4b);
 
+			if (listed && ac->ac_status == AC_STATUS_CONTINUE)
+				ext4_mb_rotate_listed_group(sb, e4b.bd_info,
+							    cr);
+
 			ext4_unlock_group(sb, group);
 			ext4_mb_unload_buddy(&e4b);
 
@@ -2451,7 +2695,12 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	INIT_LIST_HEAD(&meta_group_info[i]->bb_prealloc_list);
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_avg_fragment_size_node);
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_avg_fragment_size_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
+	mb_list_uninit_group(sb, meta_group_info[i]);
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2612,6 +2861,30 @@ int ext4_mb_init(struct super_block *sb)
 		goto out;
 	}
 
+	sbi->s_mb_largest_free_orders =
+		kmalloc_array(MB_NUM_ORDERS(sb), sizeof(struct list_head),
+			      GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc_array(MB_NUM_ORDERS(sb), sizeof(rwlock_t), GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size =
+		kmalloc_array(MB_NUM_ORDERS(sb), sizeof(struct list_head),
+			      GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size_locks =
+		kmalloc_array(MB_NUM_ORDERS(sb), sizeof(rwlock_t), GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders ||
+	    !sbi->s_mb_largest_free_orders_locks ||
+	    !sbi->s_mb_avg_fragment_size ||
+	    !sbi->s_mb_avg_fragment_size_locks) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+		INIT_LIST_HEAD(&sbi->s_mb_avg_fragment_size[i]);
+		rwlock_init(&sbi->s_mb_avg_fragment_size_locks[i]);
+	}
+
 	ret = ext4_groupinfo_create_slab(sb->s_blocksize);
 	if (ret < 0)
 		goto out;
@@ -2643,6 +2916,8 @@ int ext4_mb_init(struct super_block *sb)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = ext4_get_groups_count(sb) >=
+				  MB_DEFAULT_LINEAR_SCAN_THRESHOLD;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2695,6 +2970,14 @@ int ext4_mb_init(struct super_block *sb)
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
 out:
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
+	kfree(sbi->s_mb_avg_fragment_size);
+	sbi->s_mb_avg_fragment_size = NULL;
+	kfree(sbi->s_mb_avg_fragment_size_locks);
+	sbi->s_mb_avg_fragment_size_locks = NULL;
 	kfree(sbi->s_mb_offsets);
 	sbi->s_mb_offsets = NULL;
 	kfree(sbi->s_mb_maxs);
@@ -2751,6 +3034,10 @@ int ext4_mb_release(struct super_block *sb)
 		kvfree(group_info);
 		rcu_read_unlock();
 	}
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	kfree(sbi->s_mb_avg_fragment_size);
+	kfree(sbi->s_mb_avg_fragment_size_locks);
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
 	iput(sbi->s_buddy_cache);
@@ -4504,6 +4791,7 @@ ext4_fsblk_t ext4_mb_new_blocks(handle_t *handle,
 	might_sleep();
 	sb = ar->inode->i_sb;
 	sbi = EXT4_SB(sb);
+	ext4_fc_mark_ineligible(ar->inode, handle);
 
 	trace_ext4_request_blocks(ar);
 
@@ -4750,6 +5038,7 @@ void ext4_free_blocks(handle_t *handle, struct inode *inode,
 	int ret;
 
 	might_sleep();
+	ext4_fc_mark_ineligible(inode, handle);
 	if (bh) {
 		if (block)
 			BUG_ON(block != bh->b_blocknr);
@@ -77,6 +77,16 @@ do {									\
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * File systems with at least this many groups pick groups for the first two
+ * criteria from the per-order group lists instead of scanning them linearly.
+ * We can tune it via /sys/fs/ext4/<partition>/mb_optimize_scan
+ */
+#define MB_DEFAULT_LINEAR_SCAN_THRESHOLD	16
+
+/* Number of buddy orders, the bitmap included */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* this links the free block information from sb_info */
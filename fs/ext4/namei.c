@@ -295,7 +295,7 @@ static int ext4_htree_next_block(struct inode *dir, __u32 hash,
 				 __u32 *start_hash);
 static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 		struct ext4_filename *fname,
-		struct ext4_dir_entry_2 **res_dir);
+		struct ext4_dir_entry_2 **res_dir, __u32 *res_ino);
 static int ext4_dx_add_entry(handle_t *handle, struct ext4_filename *fname,
 			     struct inode *dir, struct inode *inode);
 
@@ -1025,6 +1025,8 @@ static int htree_dirblock_to_tree(struct file *dir_file,
 		}
 	}
 #endif
+	/* Leaf inserts under a shared i_htree_sem split entries in place */
+	ext4_lock_dirblock_shared(bh);
 	for (; de < top; de = ext4_next_entry(de, dir->i_sb->s_blocksize)) {
 		if (ext4_check_dir_entry(dir, NULL, de, bh,
 				bh->b_data, bh->b_size,
@@ -1071,6 +1073,7 @@ static int htree_dirblock_to_tree(struct file *dir_file,
 		count++;
 	}
 errout:
+	ext4_unlock_dirblock_shared(bh);
 	brelse(bh);
 #ifdef CONFIG_FS_ENCRYPTION
 	fscrypt_fname_free_buffer(&fname_crypto_str);
@@ -1079,16 +1082,8 @@ static int htree_dirblock_to_tree(struct file *dir_file,
 }
 
 
-/*
- * This function fills a red-black tree with information from a
- * directory.  We start scanning the directory in hash order, starting
- * at start_hash and start_minor_hash.
- *
- * This function returns the number of entries inserted into the tree,
- * or a negative error code.
- */
-int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
-			 __u32 start_minor_hash, __u32 *next_hash)
+static int __ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
+				  __u32 start_minor_hash, __u32 *next_hash)
 {
 	struct dx_hash_info hinfo;
 	struct ext4_dir_entry_2 *de;
@@ -1194,14 +1189,48 @@ int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 	return (err);
 }
 
+/*
+ * This function fills a red-black tree with information from a
+ * directory.  We start scanning the directory in hash order, starting
+ * at start_hash and start_minor_hash.
+ *
+ * This function returns the number of entries inserted into the tree,
+ * or a negative error code.
+ */
+int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
+			 __u32 start_minor_hash, __u32 *next_hash)
+{
+	struct inode *dir = file_inode(dir_file);
+	int ret;
+
+	/* Keep leaf splits from moving entries between blocks under us */
+	down_read(&EXT4_I(dir)->i_htree_sem);
+	ret = __ext4_htree_fill_tree(dir_file, start_hash, start_minor_hash,
+				     next_hash);
+	up_read(&EXT4_I(dir)->i_htree_sem);
+	return ret;
+}
+
+/*
+ * The entry's inode number is read under the dirblock lock: once it is
+ * dropped a parallel unlink may zero it or merge the entry away.
+ */
 static inline int search_dirblock(struct buffer_head *bh,
 				  struct inode *dir,
 				  struct ext4_filename *fname,
 				  unsigned int offset,
-				  struct ext4_dir_entry_2 **res_dir)
+				  struct ext4_dir_entry_2 **res_dir,
+				  __u32 *res_ino)
 {
-	return ext4_search_dir(bh, bh->b_data, dir->i_sb->s_blocksize, dir,
-			       fname, offset, res_dir);
+	int ret;
+
+	ext4_lock_dirblock_shared(bh);
+	ret = ext4_search_dir(bh, bh->b_data, dir->i_sb->s_blocksize, dir,
+			      fname, offset, res_dir);
+	if (ret == 1 && res_ino)
+		*res_ino = le32_to_cpu((*res_dir)->inode);
+	ext4_unlock_dirblock_shared(bh);
+	return ret;
 }
 
 /*
@@ -1438,7 +1467,9 @@ static int is_dx_internal_node(struct inode *dir, ext4_lblk_t block,
  * finds an entry in the specified directory with the wanted name. It
  * returns the cache buffer in which the entry was found, and the entry
  * itself (as a parameter - res_dir). It does NOT read the inode of the
- * entry - you'll have to do that yourself if you want to.
+ * entry - you'll have to do that yourself if you want to.  If res_ino is
+ * not NULL the entry's inode number is stored there, read while the
+ * block could not change.
  *
  * The returned buffer_head has ->b_count elevated.  The caller is expected
  * to brelse() it when appropriate.
@@ -1446,6 +1477,7 @@ static int is_dx_internal_node(struct inode *dir, ext4_lblk_t block,
 static struct buffer_head *__ext4_find_entry(struct inode *dir,
 					     struct ext4_filename *fname,
 					     struct ext4_dir_entry_2 **res_dir,
+					     __u32 *res_ino,
 					     int *inlined)
 {
 	struct super_block *sb;
@@ -1468,7 +1500,7 @@ static struct buffer_head *__ext4_find_entry(struct inode *dir,
 
 	if (ext4_has_inline_data(dir)) {
 		int has_inline_data = 1;
-		ret = ext4_find_inline_entry(dir, fname, res_dir,
+		ret = ext4_find_inline_entry(dir, fname, res_dir, res_ino,
 					     &has_inline_data);
 		if (has_inline_data) {
 			if (inlined)
@@ -1488,7 +1520,7 @@ static struct buffer_head *__ext4_find_entry(struct inode *dir,
 		goto restart;
 	}
 	if (is_dx(dir)) {
-		ret = ext4_dx_find_entry(dir, fname, res_dir);
+		ret = ext4_dx_find_entry(dir, fname, res_dir, res_ino);
 		/*
 		 * On success, or if the error was file not found,
 		 * return.  Otherwise, fall back to doing a search the
@@ -1555,7 +1587,8 @@ static struct buffer_head *__ext4_find_entry(struct inode *dir,
 		}
 		set_buffer_verified(bh);
 		i = search_dirblock(bh, dir, fname,
-			    block << EXT4_BLOCK_SIZE_BITS(sb), res_dir);
+			    block << EXT4_BLOCK_SIZE_BITS(sb), res_dir,
+			    res_ino);
 		if (i == 1) {
 			EXT4_I(dir)->i_dir_start_lookup = block;
 			ret = bh;
@@ -1603,7 +1636,7 @@ static struct buffer_head *ext4_find_entry(struct inode *dir,
 	if (err)
 		return ERR_PTR(err);
 
-	bh = __ext4_find_entry(dir, &fname, res_dir, inlined);
+	bh = __ext4_find_entry(dir, &fname, res_dir, NULL, inlined);
 
 	ext4_fname_free_filename(&fname);
 	return bh;
@@ -1611,10 +1644,11 @@ static struct buffer_head *ext4_find_entry(struct inode *dir,
 
 static struct buffer_head *ext4_lookup_entry(struct inode *dir,
 					     struct dentry *dentry,
-					     struct ext4_dir_entry_2 **res_dir)
+					     __u32 *res_ino)
 {
 	int err;
 	struct ext4_filename fname;
+	struct ext4_dir_entry_2 *de;
 	struct buffer_head *bh;
 
 	err = ext4_fname_prepare_lookup(dir, dentry, &fname);
@@ -1623,7 +1657,7 @@ static struct buffer_head *ext4_lookup_entry(struct inode *dir,
 	if (err)
 		return ERR_PTR(err);
 
-	bh = __ext4_find_entry(dir, &fname, res_dir, NULL);
+	bh = __ext4_find_entry(dir, &fname, &de, res_ino, NULL);
 
 	ext4_fname_free_filename(&fname);
 	return bh;
@@ -1631,7 +1665,7 @@ static struct buffer_head *ext4_lookup_entry(struct inode *dir,
 
 static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 			struct ext4_filename *fname,
-			struct ext4_dir_entry_2 **res_dir)
+			struct ext4_dir_entry_2 **res_dir, __u32 *res_ino)
 {
 	struct super_block * sb = dir->i_sb;
 	struct dx_frame frames[EXT4_HTREE_LEVEL], *frame;
@@ -1653,7 +1687,7 @@ static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 
 		retval = search_dirblock(bh, dir, fname,
 					 block << EXT4_BLOCK_SIZE_BITS(sb),
-					 res_dir);
+					 res_dir, res_ino);
 		if (retval == 1)
 			goto success;
 		brelse(bh);
@@ -1685,18 +1719,19 @@ static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 static struct dentry *ext4_lookup(struct inode *dir, struct dentry *dentry, unsigned int flags)
 {
 	struct inode *inode;
-	struct ext4_dir_entry_2 *de;
 	struct buffer_head *bh;
+	__u32 ino;
 
 	if (dentry->d_name.len > EXT4_NAME_LEN)
 		return ERR_PTR(-ENAMETOOLONG);
 
-	bh = ext4_lookup_entry(dir, dentry, &de);
+	down_read(&EXT4_I(dir)->i_htree_sem);
+	bh = ext4_lookup_entry(dir, dentry, &ino);
+	up_read(&EXT4_I(dir)->i_htree_sem);
 	if (IS_ERR(bh))
 		return ERR_CAST(bh);
 	inode = NULL;
 	if (bh) {
-		__u32 ino = le32_to_cpu(de->inode);
 		brelse(bh);
 		if (!ext4_valid_inum(dir->i_sb, ino)) {
 			EXT4_ERROR_INODE(dir, "bad inode number: %u", ino);
@@ -2102,6 +2137,7 @@ static int make_indexed_dir(handle_t *handle, struct ext4_filename *fname,
 		return PTR_ERR(bh2);
 	}
 	ext4_set_inode_flag(dir, EXT4_INODE_INDEX);
+	ext4_set_inode_flags(dir);
 	data2 = bh2->b_data;
 
 	memcpy(data2, de, len);
@@ -2167,6 +2203,62 @@ static int make_indexed_dir(handle_t *handle, struct ext4_filename *fname,
 	return retval;
 }
 
+/*
+ * Add an entry to an indexed directory without touching its index, for
+ * the common case where the leaf the name hashes to has room.  The caller
+ * holds i_htree_sem shared, so no leaf is split under us, and the leaf's
+ * dirblock lock serializes us against other creates and deletes in it.
+ * Racing creates of one name all probe the same leaf, so the whole leaf
+ * is searched for the name before it is added.
+ *
+ * Returns -ENOSPC if the leaf is full or the name's hash may continue
+ * into the next leaf; the caller then retries with i_htree_sem held
+ * exclusive.
+ */
+static int ext4_dx_add_entry_leaf(handle_t *handle,
+				  struct ext4_filename *fname,
+				  struct inode *dir, struct inode *inode)
+{
+	struct dx_frame frames[EXT4_HTREE_LEVEL], *frame;
+	struct ext4_dir_entry_2 *de;
+	struct buffer_head *bh;
+	ext4_lblk_t block;
+	int err;
+
+	frame = dx_probe(fname, dir, NULL, frames);
+	if (IS_ERR(frame))
+		return PTR_ERR(frame);
+	block = dx_get_block(frame->at);
+	err = ext4_htree_next_block(dir, fname->hinfo.hash, frame, frames,
+				    NULL);
+	if (err) {
+		if (err > 0)
+			err = -ENOSPC;
+		goto out;
+	}
+
+	bh = ext4_read_dirblock(dir, block, DIRENT_HTREE);
+	if (IS_ERR(bh)) {
+		err = PTR_ERR(bh);
+		goto out;
+	}
+	ext4_lock_dirblock(bh);
+	err = ext4_search_dir(bh, bh->b_data, dir->i_sb->s_blocksize, dir,
+			      fname, block << EXT4_BLOCK_SIZE_BITS(dir->i_sb),
+			      &de);
+	if (err > 0)
+		err = -EEXIST;
+	else if (err < 0)
+		err = ERR_BAD_DX_DIR;
+	else
+		err = add_dirent_to_buf(handle, fname, dir, inode, NULL, bh);
+	ext4_unlock_dirblock(bh);
+	brelse(bh);
+out:
+	dx_release(frames);
+	return err;
+}
+
 /*
  *	ext4_add_entry()
  *
@@ -2214,28 +2306,57 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	if (retval)
 		return retval;
 
+	if (IS_PARALLEL_CREATE(dir)) {
+		down_read(&EXT4_I(dir)->i_htree_sem);
+		retval = ext4_dx_add_entry_leaf(handle, &fname, dir, inode);
+		up_read(&EXT4_I(dir)->i_htree_sem);
+		if (retval != -ENOSPC && retval != ERR_BAD_DX_DIR)
+			goto out;
+	}
+
+	down_write(&EXT4_I(dir)->i_htree_sem);
+	if (ext4_test_inode_state(dir, EXT4_STATE_PARALLEL_CREATE)) {
+		/*
+		 * Creates may only hold i_rwsem shared here, so another one
+		 * may have added this name since the VFS looked it up.  This
+		 * holds even if an htree fallback has since cleared
+		 * S_PARALLEL_CREATE, so don't test the inode flag.
+		 */
+		bh = __ext4_find_entry(dir, &fname, &de, NULL, NULL);
+		if (IS_ERR(bh)) {
+			retval = PTR_ERR(bh);
+			bh = NULL;
+			goto out_unlock;
+		}
+		if (bh) {
+			retval = -EEXIST;
+			goto out_unlock;
+		}
+	}
+
 	if (ext4_has_inline_data(dir)) {
 		retval = ext4_try_add_inline_entry(handle, &fname, dir, inode);
 		if (retval < 0)
-			goto out;
+			goto out_unlock;
 		if (retval == 1) {
 			retval = 0;
-			goto out;
+			goto out_unlock;
 		}
 	}
 
 	if (is_dx(dir)) {
 		retval = ext4_dx_add_entry(handle, &fname, dir, inode);
 		if (!retval || (retval != ERR_BAD_DX_DIR))
-			goto out;
+			goto out_unlock;
 		/* Can we just ignore htree data? */
 		if (ext4_has_metadata_csum(sb)) {
 			EXT4_ERROR_INODE(dir,
 				"Directory has corrupted htree index.");
 			retval = -EFSCORRUPTED;
-			goto out;
+			goto out_unlock;
 		}
 		ext4_clear_inode_flag(dir, EXT4_INODE_INDEX);
+		ext4_set_inode_flags(dir);
 		dx_fallback++;
 		ext4_mark_inode_dirty(handle, dir);
 	}
@@ -2250,19 +2371,19 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 		if (IS_ERR(bh)) {
 			retval = PTR_ERR(bh);
 			bh = NULL;
-			goto out;
+			goto out_unlock;
 		}
 		retval = add_dirent_to_buf(handle, &fname, dir, inode,
 					   NULL, bh);
 		if (retval != -ENOSPC)
-			goto out;
+			goto out_unlock;
 
 		if (blocks == 1 && !dx_fallback &&
 		    ext4_has_feature_dir_index(sb)) {
 			retval = make_indexed_dir(handle, &fname, dir,
 						  inode, bh);
 			bh = NULL; /* make_indexed_dir releases bh */
-			goto out;
+			goto out_unlock;
 		}
 		brelse(bh);
 	}
@@ -2271,7 +2392,7 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	if (IS_ERR(bh)) {
 		retval = PTR_ERR(bh);
 		bh = NULL;
-		goto out;
+		goto out_unlock;
 	}
 	de = (struct ext4_dir_entry_2 *) bh->b_data;
 	de->inode = 0;
@@ -2281,6 +2402,8 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 		ext4_initialize_dirent_tail(bh, blocksize);
 
 	retval = add_dirent_to_buf(handle, &fname, dir, inode, de, bh);
+out_unlock:
+	up_write(&EXT4_I(dir)->i_htree_sem);
 out:
 	ext4_fname_free_filename(&fname);
 	brelse(bh);
@@ -2523,6 +2646,12 @@ static int ext4_delete_entry(handle_t *handle,
 	if (ext4_has_metadata_csum(dir->i_sb))
 		csum_size = sizeof(struct ext4_dir_entry_tail);
 
+	/*
+	 * ext4_generic_delete_entry() merges the entry into its predecessor,
+	 * so the walk and the update must not race with another deletion
+	 * from the same block.
+	 */
+	ext4_lock_dirblock(bh);
 	BUFFER_TRACE(bh, "get_write_access");
 	err = ext4_journal_get_write_access(handle, bh);
 	if (unlikely(err))
@@ -2539,8 +2668,10 @@ static int ext4_delete_entry(handle_t *handle,
 	if (unlikely(err))
 		goto out;
 
+	ext4_unlock_dirblock(bh);
 	return 0;
 out:
+	ext4_unlock_dirblock(bh);
 	if (err != -ENOENT)
 		ext4_std_error(dir->i_sb, err);
 	return err;
@@ -2559,6 +2690,7 @@ static int ext4_delete_entry(handle_t *handle,
  */
 static void ext4_inc_count(handle_t *handle, struct inode *inode)
 {
+	ext4_fc_mark_ineligible(inode, handle);
 	inc_nlink(inode);
 	if (is_dx(inode) &&
 	    (inode->i_nlink > EXT4_LINK_MAX || inode->i_nlink == 2))
@@ -2571,6 +2703,7 @@ static void ext4_inc_count(handle_t *handle, struct inode *inode)
  */
 static void ext4_dec_count(handle_t *handle, struct inode *inode)
 {
+	ext4_fc_mark_ineligible(inode, handle);
 	if (!S_ISDIR(inode->i_mode) || inode->i_nlink > 2)
 		drop_nlink(inode);
 }
@@ -2932,6 +3065,12 @@ int ext4_orphan_add(handle_t *handle, struct inode *inode)
 	if (!sbi->s_journal || is_bad_inode(inode))
 		return 0;
 
+	/*
+	 * The inode is linked in at the head of the list, so its own
+	 * i_dtime is the only inode field that changes.
+	 */
+	ext4_fc_mark_ineligible(inode, handle);
+
 	WARN_ON_ONCE(!(inode->i_state & (I_NEW | I_FREEING)) &&
 		     !inode_is_locked(inode));
 	/*
@@ -3022,6 +3161,8 @@ int ext4_orphan_del(handle_t *handle, struct inode *inode)
 	if (list_empty(&ei->i_orphan))
 		return 0;
 
+	ext4_fc_mark_ineligible(inode, handle);
+
 	if (handle) {
 		/* Grab inode buffer early before taking global s_orphan_lock */
 		err = ext4_reserve_inode_write(handle, inode, &iloc);
@@ -3061,6 +3202,8 @@ int ext4_orphan_del(handle_t *handle, struct inode *inode)
 
 		jbd_debug(4, "orphan inode %lu will point to %u\n",
 			  i_prev->i_ino, ino_next);
+		/* its i_dtime is the link we rewrite */
+		ext4_fc_mark_ineligible(i_prev, handle);
 		err = ext4_reserve_inode_write(handle, i_prev, &iloc2);
 		if (err) {
 			mutex_unlock(&sbi->s_orphan_lock);
@@ -3176,7 +3319,7 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	struct inode *inode;
 	struct buffer_head *bh;
 	struct ext4_dir_entry_2 *de;
-	handle_t *handle = NULL;
+	handle_t *handle;
 
 	if (unlikely(ext4_forced_shutdown(EXT4_SB(dir->i_sb))))
 		return -EIO;
@@ -3191,36 +3334,38 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	if (retval)
 		return retval;
 
-	retval = -ENOENT;
-	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL);
-	if (IS_ERR(bh))
-		return PTR_ERR(bh);
-	if (!bh)
-		goto end_unlink;
-
-	inode = d_inode(dentry);
-
-	retval = -EFSCORRUPTED;
-	if (le32_to_cpu(de->inode) != inode->i_ino)
-		goto end_unlink;
-
+	/*
+	 * The entry must not move to another block between finding and
+	 * deleting it, so i_htree_sem is held across both.  It ranks
+	 * below the journal handle, hence the handle is started first.
+	 */
 	handle = ext4_journal_start(dir, EXT4_HT_DIR,
 				    EXT4_DATA_TRANS_BLOCKS(dir->i_sb));
-	if (IS_ERR(handle)) {
-		retval = PTR_ERR(handle);
-		handle = NULL;
-		goto end_unlink;
-	}
-
-	if (IS_DIRSYNC(dir))
-		ext4_handle_sync(handle);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
 
-	retval = ext4_delete_entry(handle, dir, de, bh);
+	inode = d_inode(dentry);
+	down_read(&EXT4_I(dir)->i_htree_sem);
+	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL);
+	if (IS_ERR(bh)) {
+		retval = PTR_ERR(bh);
+		bh = NULL;
+	} else if (!bh) {
+		retval = -ENOENT;
+	} else if (le32_to_cpu(de->inode) != inode->i_ino) {
+		retval = -EFSCORRUPTED;
+	} else {
+		if (IS_DIRSYNC(dir))
+			ext4_handle_sync(handle);
+		retval = ext4_delete_entry(handle, dir, de, bh);
+	}
+	up_read(&EXT4_I(dir)->i_htree_sem);
 	if (retval)
 		goto end_unlink;
 	dir->i_ctime = dir->i_mtime = current_time(dir);
 	ext4_update_dx_flag(dir);
 	ext4_mark_inode_dirty(handle, dir);
+	ext4_fc_mark_ineligible(inode, handle);
 	if (inode->i_nlink == 0)
 		ext4_warning_inode(inode, "Deleting file '%.*s' with no links",
 				   dentry->d_name.len, dentry->d_name.name);
@@ -3244,8 +3389,7 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 
 end_unlink:
 	brelse(bh);
-	if (handle)
-		ext4_journal_stop(handle);
+	ext4_journal_stop(handle);
 	trace_ext4_unlink_exit(dentry, retval);
 	return retval;
 }
@@ -3831,6 +3975,8 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	 * Like most other Unix systems, set the ctime for inodes on a
 	 * rename.
 	 */
+	ext4_fc_mark_ineligible(old.inode, handle);
+	ext4_fc_mark_ineligible(new.inode, handle);
 	old.inode->i_ctime = current_time(old.inode);
 	ext4_mark_inode_dirty(handle, old.inode);
 
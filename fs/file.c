@@ -154,10 +154,13 @@ static int expand_fdtable(struct files_struct *files, unsigned int nr)
 	spin_unlock(&files->file_lock);
 	new_fdt = alloc_fdtable(nr);
 
-	/* make sure all __fd_install() have seen resize_in_progress
-	 * or have finished their rcu_read_lock_sched() section.
+	/* make sure all __fd_install() and alloc_fd_fast() have seen
+	 * resize_in_progress or have finished their rcu_read_lock_sched()
+	 * section.  ->count == 1 doesn't mean we are alone once ->borrowed
+	 * is set: io_uring workers allocate in req->files without holding a
+	 * reference.
 	 */
-	if (atomic_read(&files->count) > 1)
+	if (atomic_read(&files->count) > 1 || READ_ONCE(files->borrowed))
 		synchronize_rcu();
 
 	spin_lock(&files->file_lock);
@@ -225,28 +228,39 @@ static int expand_files(struct files_struct *files, unsigned int nr)
 	return expanded;
 }
 
+/*
+ * alloc_fd_fast() sets bits in ->open_fds and ->close_on_exec without
+ * ->file_lock, so the locked paths have to use atomic bitops on those
+ * words as well.  ->full_fds_bits is only ever touched under the lock.
+ */
 static inline void __set_close_on_exec(unsigned int fd, struct fdtable *fdt)
 {
-	__set_bit(fd, fdt->close_on_exec);
+	set_bit(fd, fdt->close_on_exec);
 }
 
 static inline void __clear_close_on_exec(unsigned int fd, struct fdtable *fdt)
 {
 	if (test_bit(fd, fdt->close_on_exec))
-		__clear_bit(fd, fdt->close_on_exec);
+		clear_bit(fd, fdt->close_on_exec);
 }
 
-static inline void __set_open_fd(unsigned int fd, struct fdtable *fdt)
+/*
+ * Mark @fd busy.  Returns true if it already was, which can happen if
+ * alloc_fd_fast() took it since the caller looked.
+ */
+static inline bool __test_and_set_open_fd(unsigned int fd, struct fdtable *fdt)
 {
-	__set_bit(fd, fdt->open_fds);
+	if (test_and_set_bit(fd, fdt->open_fds))
+		return true;
 	fd /= BITS_PER_LONG;
-	if (!~fdt->open_fds[fd])
+	if (!~READ_ONCE(fdt->open_fds[fd]))
 		__set_bit(fd, fdt->full_fds_bits);
+	return false;
 }
 
 static inline void __clear_open_fd(unsigned int fd, struct fdtable *fdt)
 {
-	__clear_bit(fd, fdt->open_fds);
+	clear_bit(fd, fdt->open_fds);
 	__clear_bit(fd / BITS_PER_LONG, fdt->full_fds_bits);
 }
 
@@ -285,6 +299,7 @@ struct files_struct *dup_fd(struct files_struct *oldf, int *errorp)
 
 	spin_lock_init(&newf->file_lock);
 	newf->resize_in_progress = false;
+	newf->borrowed = false;
 	init_waitqueue_head(&newf->resize_wait);
 	newf->next_fd = 0;
 	new_fdt = &newf->fdtab;
@@ -336,8 +351,29 @@ struct files_struct *dup_fd(struct files_struct *oldf, int *errorp)
 	new_fds = new_fdt->fd;
 
 	for (i = open_files; i != 0; i--) {
-		struct file *f = *old_fds++;
+		struct file *f = READ_ONCE(*old_fds);
+		unsigned int fd = open_files - i;
+
+		old_fds++;
+		/*
+		 * alloc_fd_fast() doesn't take oldf->file_lock, so a sibling
+		 * may have claimed and installed an fd after the bitmaps were
+		 * copied.  Leave it out rather than install a file under a
+		 * clear open_fds bit.
+		 */
+		if (f && !fd_is_open(fd, new_fdt))
+			f = NULL;
 		if (f) {
+			/*
+			 * The bitmap copy may also predate the close-on-exec
+			 * bit of a descriptor claimed that way.  It was set
+			 * before the file was published by fd_install(), so
+			 * now that we have seen the file, we see the bit.
+			 * Coupled with the release in rcu_assign_pointer().
+			 */
+			smp_rmb();
+			if (close_on_exec(fd, old_fdt))
+				__set_close_on_exec(fd, new_fdt);
 			get_file(f);
 		} else {
 			/*
@@ -346,7 +382,8 @@ struct files_struct *dup_fd(struct files_struct *oldf, int *errorp)
 			 * is partway through open().  So make sure that this
 			 * fd is available to the new process.
 			 */
-			__clear_open_fd(open_files - i, new_fdt);
+			__clear_close_on_exec(fd, new_fdt);
+			__clear_open_fd(fd, new_fdt);
 		}
 		rcu_assign_pointer(*new_fds++, f);
 	}
@@ -474,6 +511,57 @@ static unsigned int find_next_fd(struct fdtable *fdt, unsigned int start)
 	return find_next_zero_bit(fdt->open_fds, maxfd, start);
 }
 
+/*
+ * Lockless fast path of __alloc_fd(): try to take the descriptor that
+ * ->next_fd points at.  ->next_fd is a lower bound for the first free
+ * descriptor, so claiming exactly that one never skips a lower free slot.
+ * Anything else (a stale hint, a resize, @start above the hint) is left
+ * to the locked path.
+ *
+ * Like __fd_install(), this relies on expand_fdtable() waiting for
+ * rcu-sched readers after setting ->resize_in_progress, so a bit set
+ * here is always seen by copy_fdtable().
+ *
+ * Free descriptors have ->close_on_exec clear, so only O_CLOEXEC has to
+ * touch it.  The bit is set before the caller publishes the file with
+ * fd_install(); dup_fd() rechecks it once it has seen the file, so a
+ * racing fork can't hand the child the file without the bit.
+ */
+static int alloc_fd_fast(struct files_struct *files,
+			 unsigned start, unsigned end, unsigned flags)
+{
+	struct fdtable *fdt;
+	unsigned int fd;
+	int ret = -1;
+
+	rcu_read_lock_sched();
+	if (unlikely(files->resize_in_progress))
+		goto out;
+	/* coupled with smp_wmb() in expand_fdtable() */
+	smp_rmb();
+	fdt = rcu_dereference_sched(files->fdt);
+
+	for (;;) {
+		fd = READ_ONCE(files->next_fd);
+		if (fd < start || fd >= end || fd >= fdt->max_fds)
+			break;
+		if (!test_and_set_bit(fd, fdt->open_fds)) {
+			/* a racing close may have lowered it; keep that */
+			cmpxchg(&files->next_fd, fd, fd + 1);
+			if (flags & O_CLOEXEC)
+				__set_close_on_exec(fd, fdt);
+			ret = fd;
+			break;
+		}
+		/* Lost to another allocator?  Retry at the new hint. */
+		if (READ_ONCE(files->next_fd) == fd)
+			break;
+	}
+out:
+	rcu_read_unlock_sched();
+	return ret;
+}
+
 /*
  * allocate a file descriptor, mark it busy.
  */
@@ -484,6 +572,10 @@ int __alloc_fd(struct files_struct *files,
 	int error;
 	struct fdtable *fdt;
 
+	error = alloc_fd_fast(files, start, end, flags);
+	if (error >= 0)
+		return error;
+
 	spin_lock(&files->file_lock);
 repeat:
 	fdt = files_fdtable(files);
@@ -513,10 +605,12 @@ int __alloc_fd(struct files_struct *files,
 	if (error)
 		goto repeat;
 
+	if (__test_and_set_open_fd(fd, fdt))
+		goto repeat;
+
 	if (start <= files->next_fd)
 		files->next_fd = fd + 1;
 
-	__set_open_fd(fd, fdt);
 	if (flags & O_CLOEXEC)
 		__set_close_on_exec(fd, fdt);
 	else
@@ -549,6 +643,11 @@ EXPORT_SYMBOL(get_unused_fd_flags);
 static void __put_unused_fd(struct files_struct *files, unsigned int fd)
 {
 	struct fdtable *fdt = files_fdtable(files);
+	/*
+	 * Free descriptors always have ->close_on_exec clear, so that
+	 * alloc_fd_fast() only needs to set it for O_CLOEXEC.
+	 */
+	__clear_close_on_exec(fd, fdt);
 	__clear_open_fd(fd, fdt);
 	if (fd < files->next_fd)
 		files->next_fd = fd;
@@ -687,7 +786,10 @@ void do_close_on_exec(struct files_struct *files)
 		set = fdt->close_on_exec[i];
 		if (!set)
 			continue;
-		fdt->close_on_exec[i] = 0;
+		/*
+		 * __put_unused_fd() clears the bits of what we close.  Bits
+		 * without a file belong to an allocation still in flight.
+		 */
 		for ( ; set ; fd++, set >>= 1) {
 			struct file *file;
 			if (!(set & 1))
@@ -909,11 +1011,10 @@ __releases(&files->file_lock)
 	 */
 	fdt = files_fdtable(files);
 	tofree = fdt->fd[fd];
-	if (!tofree && fd_is_open(fd, fdt))
+	if (!tofree && __test_and_set_open_fd(fd, fdt))
 		goto Ebusy;
 	get_file(file);
 	rcu_assign_pointer(fdt->fd[fd], file);
-	__set_open_fd(fd, fdt);
 	if (flags & O_CLOEXEC)
 		__set_close_on_exec(fd, fdt);
 	else
@@ -82,6 +82,19 @@ static inline struct inode *wb_inode(struct list_head *head)
 
 EXPORT_TRACEPOINT_SYMBOL_GPL(wbc_writepage);
 
+/*
+ * io.weight of the cgroup owning @wb, sampled when @wb becomes dirty.  A
+ * changed weight takes effect the next time the wb goes clean and dirty.
+ */
+static unsigned int wb_io_weight(struct bdi_writeback *wb)
+{
+#ifdef CONFIG_CGROUP_WRITEBACK
+	if (wb != &wb->bdi->wb)
+		return blkcg_iocost_dfl_weight(css_to_blkcg(wb->blkcg_css));
+#endif
+	return CGROUP_WEIGHT_DFL;
+}
+
 static bool wb_io_lists_populated(struct bdi_writeback *wb)
 {
 	if (wb_has_dirty_io(wb)) {
@@ -91,6 +104,8 @@ static bool wb_io_lists_populated(struct bdi_writeback *wb)
 		WARN_ON_ONCE(!wb->avg_write_bandwidth);
 		atomic_long_add(wb->avg_write_bandwidth,
 				&wb->bdi->tot_write_bandwidth);
+		wb->dirty_weight = wb_io_weight(wb);
+		atomic_add(wb->dirty_weight, &global_wb_domain.tot_dirty_weight);
 		return true;
 	}
 }
@@ -102,6 +117,8 @@ static void wb_io_lists_depopulated(struct bdi_writeback *wb)
 		clear_bit(WB_has_dirty_io, &wb->state);
 		WARN_ON_ONCE(atomic_long_sub_return(wb->avg_write_bandwidth,
 					&wb->bdi->tot_write_bandwidth) < 0);
+		WARN_ON_ONCE(atomic_sub_return(wb->dirty_weight,
+				&global_wb_domain.tot_dirty_weight) < 0);
 	}
 }
 
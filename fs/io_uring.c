@@ -64,6 +64,7 @@
 #include <net/sock.h>
 #include <net/af_unix.h>
 #include <net/scm.h>
+#include <net/tcp.h>
 #include <linux/anon_inodes.h>
 #include <linux/sched/mm.h>
 #include <linux/uaccess.h>
@@ -72,6 +73,13 @@
 #include <linux/hugetlb.h>
 #include <linux/highmem.h>
 #include <linux/fs_struct.h>
+#include <linux/fadvise.h>
+#include <linux/task_work.h>
+#include <linux/futex.h>
+#include <linux/seq_file.h>
+#include <linux/splice.h>
+#include <linux/fsnotify.h>
+#include <net/busy_poll.h>
 
 #include <uapi/linux/io_uring.h>
 
@@ -163,6 +171,56 @@ struct io_mapped_ubuf {
 	unsigned int	nr_bvecs;
 };
 
+/*
+ * Buffer handed to the kernel with IORING_OP_PROVIDE_BUFFERS. Buffers of a
+ * group are kept on the list of the first one, which sits in the ctx idr.
+ */
+struct io_buffer {
+	struct list_head	list;
+	__u64			addr;
+	__s32			len;
+	__u16			bid;
+	__u16			bgid;
+};
+
+/*
+ * Files replaced in the fixed file table are only put once all requests that
+ * may have looked them up are done. Requests using a fixed file hold a
+ * reference to the node that was current at lookup time, and a replaced file
+ * is queued on the current node, which is then switched for a new one.
+ */
+struct fixed_file_ref_node {
+	struct percpu_ref		refs;
+	struct list_head		file_list;	/* struct io_file_put */
+	struct fixed_file_data		*file_data;
+	struct work_struct		work;
+};
+
+struct fixed_file_data {
+	struct io_ring_ctx		*ctx;
+	/* written under ->uring_lock, read under RCU */
+	struct fixed_file_ref_node	*node;
+	/* one reference per live node */
+	struct percpu_ref		refs;
+	struct completion		done;
+};
+
+struct io_file_put {
+	struct list_head	list;
+	struct file		*file;
+};
+
+/*
+ * Zero-copy send notifier. The network stack holds a reference for every
+ * skb using the pages, and a CQE with IORING_CQE_F_NOTIF is posted once the
+ * last one is gone.
+ */
+struct io_zc_notif {
+	struct ubuf_info	uarg;
+	struct io_ring_ctx	*ctx;
+	u64			user_data;
+};
+
 struct async_list {
 	spinlock_t		lock;
 	atomic_t		cnt;
@@ -173,6 +231,35 @@ struct async_list {
 	size_t			io_len;
 };
 
+/*
+ * SQ poll thread, possibly shared between rings. Rings asking for
+ * IORING_SETUP_SQ_SHARED are attached to an existing thread bound to the
+ * same CPU (or unbound) and created from the same cgroup, if one exists.
+ * The thread visits the attached rings round-robin.
+ */
+struct io_sq_data {
+	refcount_t		refs;
+	struct list_head	node;		/* on io_sqd_list if shared */
+
+	/* protects ->ctx_list and ->sq_thread_idle */
+	struct mutex		lock;
+	struct list_head	ctx_list;
+
+	struct task_struct	*thread;
+	struct wait_queue_head	wait;
+	struct completion	started;
+
+	unsigned		sq_thread_idle;
+	int			cpu;
+	struct cgroup		*cgrp;
+};
+
+static LIST_HEAD(io_sqd_list);
+static DEFINE_MUTEX(io_sqd_mutex);
+
+/* max number of NAPI contexts a ring busy polls */
+#define IO_NAPI_MAX_IDS		8
+
 struct io_ring_ctx {
 	struct {
 		struct percpu_ref	refs;
@@ -208,10 +295,15 @@ struct io_ring_ctx {
 
 	/* IO offload */
 	struct workqueue_struct	*sqo_wq[2];
-	struct task_struct	*sqo_thread;	/* if using sq thread polling */
+	struct io_sq_data	*sq_data;	/* if using sq thread polling */
+	struct list_head	sqd_list;	/* on sq_data->ctx_list */
+	unsigned		sq_inflight;
 	struct mm_struct	*sqo_mm;
-	wait_queue_head_t	sqo_wait;
-	struct completion	sqo_thread_started;
+
+	/* submission stats, shown in fdinfo */
+	u64			sq_submitted;
+	u64			sq_passes;
+	u64			sq_busy_ns;
 
 	struct {
 		unsigned		cached_cq_tail;
@@ -224,20 +316,46 @@ struct io_ring_ctx {
 		atomic_t		cq_timeouts;
 	} ____cacheline_aligned_in_smp;
 
+	/*
+	 * SQPOLL only: user word the SQ thread stores the CQ tail to, and
+	 * then does a private FUTEX_WAKE on, whenever completions were
+	 * posted. The last tail published is in cq_futex_tail.
+	 */
+	u32 __user		*cq_futex;
+	unsigned		cq_futex_tail;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/*
+	 * NAPI contexts of the sockets this ring did I/O on, busy polled for
+	 * up to napi_busy_poll_to usecs before sleeping for completions.
+	 * Ids are added under napi_lock and read locklessly.
+	 */
+	spinlock_t		napi_lock;
+	unsigned int		napi_busy_poll_to;
+	bool			napi_prefer_busy_poll;
+	unsigned int		nr_napi_ids;
+	unsigned int		napi_ids[IO_NAPI_MAX_IDS];
+#endif
+
 	struct io_rings	*rings;
 
 	/*
-	 * If used, fixed file set. Writers must ensure that ->refs is dead,
-	 * readers must ensure that ->refs is alive as long as the file* is
-	 * used. Only updated through io_uring_register(2).
+	 * If used, fixed file set. The table itself is only allocated and
+	 * freed through io_uring_register(2) with ->refs dead. Slots are
+	 * updated under ->uring_lock, see struct fixed_file_ref_node for how
+	 * readers keep the files alive.
 	 */
 	struct file		**user_files;
 	unsigned		nr_user_files;
+	struct fixed_file_data	*file_data;
 
 	/* if used, fixed mapped user buffers */
 	unsigned		nr_user_bufs;
 	struct io_mapped_ubuf	*user_bufs;
 
+	/* provided buffer groups, protected by ->uring_lock */
+	struct idr		io_buffer_idr;
+
 	struct user_struct	*user;
 
 	const struct cred	*creds;
@@ -270,6 +388,13 @@ struct io_ring_ctx {
 
 	struct list_head	task_list;
 	spinlock_t		task_lock;
+
+	/*
+	 * Requests that hold on to the submitter's file table, see
+	 * io_grab_files(). Protected by ->task_lock.
+	 */
+	struct list_head	inflight_list;
+	wait_queue_head_t	inflight_wait;
 };
 
 struct sqe_submit {
@@ -280,6 +405,8 @@ struct sqe_submit {
 	bool				needs_lock;
 	bool				needs_fixed_file;
 	u8				opcode;
+	struct file			*ring_file;
+	int				ring_fd;
 };
 
 /*
@@ -292,6 +419,8 @@ struct io_poll_iocb {
 	__poll_t			events;
 	bool				done;
 	bool				canceled;
+	/* internal poll: the wakeup may queue the request, under head->lock */
+	bool				armed;
 	struct wait_queue_entry		wait;
 };
 
@@ -336,6 +465,13 @@ struct io_kiocb {
 #define REQ_F_MUST_PUNT		4096	/* must be punted even for NONBLOCK */
 #define REQ_F_TIMEOUT_NOSEQ	8192	/* no timeout sequence */
 #define REQ_F_CANCEL		16384	/* cancel request */
+#define REQ_F_INFLIGHT		32768	/* on inflight list */
+#define REQ_F_POLLED		65536	/* retried from internal poll */
+#define REQ_F_BUFFER_SELECT	131072	/* pick a provided buffer */
+#define REQ_F_BUFFER_SELECTED	262144	/* holds ->kbuf */
+#define REQ_F_POLL_MULTI	524288	/* multishot poll */
+#define REQ_F_ZC_NOTIF		1048576	/* holds ->notif */
+#define REQ_F_BUF_WAITQ		2097152	/* buffered read waits on page lock */
 	unsigned long		fsize;
 	u64			user_data;
 	u32			result;
@@ -347,10 +483,31 @@ struct io_kiocb {
 	struct work_struct	work;
 	struct task_struct	*work_task;
 	struct list_head	task_list;
+	struct list_head	inflight_entry;
+
+	struct task_struct	*task;
+	struct callback_head	task_work;
+	/* hands the retry to a worker if the task doesn't run it in time */
+	struct timer_list	retry_timer;
+
+	/* ref node of the fixed file table, if we looked up a fixed file */
+	struct percpu_ref	*fixed_file_refs;
+
+	union {
+		struct io_buffer	*kbuf;
+		struct io_zc_notif	*notif;
+	};
+
+	/* page lock wait of a REQ_F_BUF_WAITQ read */
+	struct wait_page_queue	wpq;
 };
 
 #define IO_PLUG_THRESHOLD		2
 #define IO_IOPOLL_BATCH			8
+/* how long a woken request waits for its task before a worker takes it */
+#define IO_ASYNC_RETRY_TIMEOUT		(HZ / 100 + 1)
+/* multishot recv/accept completions posted before yielding to poll */
+#define IO_MULTISHOT_BATCH		32
 
 struct io_submit_state {
 	struct blk_plug		plug;
@@ -373,11 +530,23 @@ struct io_submit_state {
 };
 
 static void io_sq_wq_submit_work(struct work_struct *work);
+static bool io_arm_poll_handler(struct io_kiocb *req);
+static void io_async_retry_timeout(struct timer_list *t);
+static int io_async_buf_func(struct wait_queue_entry *wait, unsigned mode,
+			     int sync, void *arg);
 static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 ki_user_data,
 				 long res);
 static void __io_free_req(struct io_kiocb *req);
+static void io_zc_notif_drop(struct io_zc_notif *notif);
+static int __io_sqe_files_update(struct io_ring_ctx *ctx,
+				 struct io_uring_files_update *up,
+				 unsigned nr_args);
+static int io_install_fixed_file(struct io_kiocb *req, struct file *file,
+				 unsigned index);
+static struct file *io_file_get_fixed(struct io_kiocb *req, int fd);
 
 static struct kmem_cache *req_cachep;
+static struct kmem_cache *buf_cachep;
 
 static const struct file_operations io_uring_fops;
 
@@ -417,12 +586,14 @@ static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
 	}
 
 	ctx->flags = p->flags;
-	init_waitqueue_head(&ctx->sqo_wait);
+	INIT_LIST_HEAD(&ctx->sqd_list);
 	init_waitqueue_head(&ctx->cq_wait);
 	init_completion(&ctx->ctx_done);
-	init_completion(&ctx->sqo_thread_started);
 	mutex_init(&ctx->uring_lock);
 	init_waitqueue_head(&ctx->wait);
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	spin_lock_init(&ctx->napi_lock);
+#endif
 	for (i = 0; i < ARRAY_SIZE(ctx->pending_async); i++) {
 		spin_lock_init(&ctx->pending_async[i].lock);
 		INIT_LIST_HEAD(&ctx->pending_async[i].list);
@@ -435,6 +606,9 @@ static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
 	INIT_LIST_HEAD(&ctx->timeout_list);
 	INIT_LIST_HEAD(&ctx->task_list);
 	spin_lock_init(&ctx->task_lock);
+	INIT_LIST_HEAD(&ctx->inflight_list);
+	init_waitqueue_head(&ctx->inflight_wait);
+	idr_init(&ctx->io_buffer_idr);
 	return ctx;
 }
 
@@ -525,14 +699,13 @@ static inline void io_queue_async_work(struct io_ring_ctx *ctx,
 		switch (req->submit.opcode) {
 		case IORING_OP_WRITEV:
 		case IORING_OP_WRITE_FIXED:
+		case IORING_OP_WRITE:
 			rw = !(req->rw.ki_flags & IOCB_DIRECT);
 			break;
 		}
 	}
 
 	if (req->work.func == io_sq_wq_submit_work) {
-		req->files = current->files;
-
 		spin_lock_irqsave(&ctx->task_lock, flags);
 		list_add(&req->task_list, &ctx->task_list);
 		req->work_task = NULL;
@@ -603,8 +776,8 @@ static struct io_uring_cqe *io_get_cqring(struct io_ring_ctx *ctx)
 	return &rings->cqes[tail & ctx->cq_mask];
 }
 
-static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 ki_user_data,
-				 long res)
+static void __io_cqring_fill_event(struct io_ring_ctx *ctx, u64 ki_user_data,
+				   long res, unsigned int cflags)
 {
 	struct io_uring_cqe *cqe;
 
@@ -617,36 +790,105 @@ static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 ki_user_data,
 	if (cqe) {
 		WRITE_ONCE(cqe->user_data, ki_user_data);
 		WRITE_ONCE(cqe->res, res);
-		WRITE_ONCE(cqe->flags, 0);
+		WRITE_ONCE(cqe->flags, cflags);
 	} else {
 		WRITE_ONCE(ctx->rings->cq_overflow,
 				atomic_inc_return(&ctx->cached_cq_overflow));
 	}
 }
 
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 ki_user_data,
+				 long res)
+{
+	__io_cqring_fill_event(ctx, ki_user_data, res, 0);
+}
+
+/*
+ * Post a multishot completion flagged IORING_CQE_F_MORE, but only if that
+ * leaves room for the completion that ends the request. Otherwise nothing
+ * is posted, and the caller must end the request with @res as its final
+ * completion rather than have an overflow drop an fd or a buffer.
+ */
+static bool io_cqring_fill_more(struct io_ring_ctx *ctx, u64 ki_user_data,
+				long res, unsigned int cflags)
+{
+	struct io_rings *rings = ctx->rings;
+
+	if (ctx->cached_cq_tail - READ_ONCE(rings->cq.head) + 2 >
+	    rings->cq_ring_entries)
+		return false;
+	__io_cqring_fill_event(ctx, ki_user_data, res,
+				cflags | IORING_CQE_F_MORE);
+	return true;
+}
+
 static void io_cqring_ev_posted(struct io_ring_ctx *ctx)
 {
 	if (waitqueue_active(&ctx->wait))
 		wake_up(&ctx->wait);
-	if (waitqueue_active(&ctx->sqo_wait))
-		wake_up(&ctx->sqo_wait);
+	/* the SQ thread only cares to publish a registered CQ futex */
+	if (ctx->sq_data && READ_ONCE(ctx->cq_futex) &&
+	    waitqueue_active(&ctx->sq_data->wait))
+		wake_up(&ctx->sq_data->wait);
 	if (ctx->cq_ev_fd)
 		eventfd_signal(ctx->cq_ev_fd, 1);
 }
 
-static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
-				long res)
+static void __io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				  long res, unsigned int cflags)
 {
 	unsigned long flags;
 
 	spin_lock_irqsave(&ctx->completion_lock, flags);
-	io_cqring_fill_event(ctx, user_data, res);
+	__io_cqring_fill_event(ctx, user_data, res, cflags);
 	io_commit_cqring(ctx);
 	spin_unlock_irqrestore(&ctx->completion_lock, flags);
 
 	io_cqring_ev_posted(ctx);
 }
 
+static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				long res)
+{
+	__io_cqring_add_event(ctx, user_data, res, 0);
+}
+
+static bool io_cqring_add_more(struct io_ring_ctx *ctx, u64 user_data,
+			       long res, unsigned int cflags)
+{
+	unsigned long flags;
+	bool posted;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	posted = io_cqring_fill_more(ctx, user_data, res, cflags);
+	if (posted)
+		io_commit_cqring(ctx);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	if (posted)
+		io_cqring_ev_posted(ctx);
+	return posted;
+}
+
+/*
+ * Release the provided buffer a request consumed, and return the cqe flags
+ * that tell the application which one it was.
+ */
+static unsigned int io_put_kbuf(struct io_kiocb *req)
+{
+	struct io_buffer *kbuf = req->kbuf;
+	unsigned int cflags;
+
+	if (!(req->flags & REQ_F_BUFFER_SELECTED))
+		return 0;
+
+	cflags = IORING_CQE_F_BUFFER | (kbuf->bid << IORING_CQE_BUFFER_SHIFT);
+	req->flags &= ~REQ_F_BUFFER_SELECTED;
+	req->kbuf = NULL;
+	kmem_cache_free(buf_cachep, kbuf);
+	return cflags;
+}
+
 static struct io_kiocb *io_get_req(struct io_ring_ctx *ctx,
 				   struct io_submit_state *state)
 {
@@ -694,6 +936,17 @@ static struct io_kiocb *io_get_req(struct io_ring_ctx *ctx,
 	refcount_set(&req->refs, 2);
 	req->result = 0;
 	req->fs = NULL;
+	/* writes run under the submitter's limit, wherever they execute */
+	req->fsize = rlimit(RLIMIT_FSIZE);
+	/*
+	 * Cancellation matches on the submitter's file table. Requeues may
+	 * run from any context, so it's only ever recorded here.
+	 */
+	req->files = current->files;
+	req->task = NULL;
+	req->work_task = NULL;
+	timer_setup(&req->retry_timer, io_async_retry_timeout, 0);
+	req->fixed_file_refs = NULL;
 	return req;
 out:
 	percpu_ref_put(&ctx->refs);
@@ -709,11 +962,37 @@ static void io_free_req_many(struct io_ring_ctx *ctx, void **reqs, int *nr)
 	}
 }
 
+static void io_req_drop_files(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned long flags;
+
+	if (!(req->flags & REQ_F_INFLIGHT))
+		return;
+
+	spin_lock_irqsave(&ctx->task_lock, flags);
+	list_del(&req->inflight_entry);
+	req->flags &= ~REQ_F_INFLIGHT;
+	if (waitqueue_active(&ctx->inflight_wait))
+		wake_up(&ctx->inflight_wait);
+	spin_unlock_irqrestore(&ctx->task_lock, flags);
+	req->files = NULL;
+}
+
 static void __io_free_req(struct io_kiocb *req)
 {
+	io_req_drop_files(req);
 	io_req_put_fs(req);
 	if (req->file && !(req->flags & REQ_F_FIXED_FILE))
 		fput(req->file);
+	if (req->task)
+		put_task_struct(req->task);
+	if (req->fixed_file_refs)
+		percpu_ref_put(req->fixed_file_refs);
+	if (req->flags & REQ_F_BUFFER_SELECTED)
+		kmem_cache_free(buf_cachep, req->kbuf);
+	if (req->flags & REQ_F_ZC_NOTIF)
+		io_zc_notif_drop(req->notif);
 	percpu_ref_put(&req->ctx->refs);
 	kmem_cache_free(req_cachep, req);
 }
@@ -812,7 +1091,8 @@ static void io_iopoll_complete(struct io_ring_ctx *ctx, unsigned int *nr_events,
 		req = list_first_entry(done, struct io_kiocb, list);
 		list_del(&req->list);
 
-		io_cqring_fill_event(ctx, req->user_data, req->result);
+		__io_cqring_fill_event(ctx, req->user_data, req->result,
+					io_put_kbuf(req));
 		(*nr_events)++;
 
 		if (refcount_dec_and_test(&req->refs)) {
@@ -927,7 +1207,7 @@ static void io_iopoll_reap_events(struct io_ring_ctx *ctx)
 }
 
 static int io_iopoll_check(struct io_ring_ctx *ctx, unsigned *nr_events,
-			   long min)
+			   long min, ktime_t timeout)
 {
 	int iters = 0, ret = 0;
 
@@ -970,6 +1250,13 @@ static int io_iopoll_check(struct io_ring_ctx *ctx, unsigned *nr_events,
 		if (ret <= 0)
 			break;
 		ret = 0;
+
+		/* Absolute deadline from IORING_ENTER_EXT_ARG, as in waits */
+		if (!*nr_events && timeout != KTIME_MAX &&
+		    ktime_compare(ktime_get(), timeout) >= 0) {
+			ret = -ETIME;
+			break;
+		}
 	} while (min && !*nr_events && !need_resched());
 
 	mutex_unlock(&ctx->uring_lock);
@@ -999,7 +1286,7 @@ static void io_complete_rw(struct kiocb *kiocb, long res, long res2)
 
 	if ((req->flags & REQ_F_LINK) && res != req->result)
 		req->flags |= REQ_F_FAIL_LINK;
-	io_cqring_add_event(req->ctx, req->user_data, res);
+	__io_cqring_add_event(req->ctx, req->user_data, res, io_put_kbuf(req));
 	io_put_req(req);
 }
 
@@ -1125,9 +1412,6 @@ static int io_prep_rw(struct io_kiocb *req, const struct sqe_submit *s,
 	if (S_ISREG(file_inode(req->file)->i_mode))
 		req->flags |= REQ_F_ISREG;
 
-	if (force_nonblock)
-		req->fsize = rlimit(RLIMIT_FSIZE);
-
 	/*
 	 * If the file doesn't support async, mark it as REQ_F_MUST_PUNT so
 	 * we know to async punt it even if it was opened O_NONBLOCK
@@ -1163,6 +1447,13 @@ static int io_prep_rw(struct io_kiocb *req, const struct sqe_submit *s,
 	if (force_nonblock)
 		kiocb->ki_flags |= IOCB_NOWAIT;
 
+	/* let a buffered read queue a page lock wait instead of blocking */
+	if (force_nonblock && (req->flags & REQ_F_BUF_WAITQ)) {
+		init_waitqueue_func_entry(&req->wpq.wait, io_async_buf_func);
+		kiocb->ki_flags |= IOCB_WAITQ;
+		kiocb->ki_waitq = &req->wpq;
+	}
+
 	if (ctx->flags & IORING_SETUP_IOPOLL) {
 		if (!(kiocb->ki_flags & IOCB_DIRECT) ||
 		    !kiocb->ki_filp->f_op->iopoll)
@@ -1274,6 +1565,129 @@ static int io_import_fixed(struct io_ring_ctx *ctx, int rw,
 	return len;
 }
 
+/*
+ * Pick a buffer from the group in sqe->buf_group, clamping *len to its size.
+ * Buffers are only taken when the request is about to transfer data, and
+ * given back with io_kbuf_recycle() if it would block instead.
+ */
+static struct io_buffer *io_buffer_select(struct io_kiocb *req, size_t *len)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_buffer *kbuf, *head;
+	int bgid;
+
+	if (req->flags & REQ_F_BUFFER_SELECTED)
+		return req->kbuf;
+
+	bgid = READ_ONCE(req->submit.sqe->buf_group);
+
+	if (req->submit.needs_lock)
+		mutex_lock(&ctx->uring_lock);
+
+	lockdep_assert_held(&ctx->uring_lock);
+
+	head = idr_find(&ctx->io_buffer_idr, bgid);
+	if (head) {
+		if (!list_empty(&head->list)) {
+			kbuf = list_last_entry(&head->list, struct io_buffer,
+							list);
+			list_del(&kbuf->list);
+		} else {
+			kbuf = head;
+			idr_remove(&ctx->io_buffer_idr, bgid);
+		}
+		if (*len > kbuf->len)
+			*len = kbuf->len;
+		req->kbuf = kbuf;
+		req->flags |= REQ_F_BUFFER_SELECTED;
+	} else {
+		kbuf = ERR_PTR(-ENOBUFS);
+	}
+
+	if (req->submit.needs_lock)
+		mutex_unlock(&ctx->uring_lock);
+
+	return kbuf;
+}
+
+/*
+ * Give a selected buffer back to its group, so a request waiting for data
+ * doesn't hold on to one. If the group can't be recreated, keep it.
+ */
+static void io_kbuf_recycle(struct io_kiocb *req, bool needs_lock)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_buffer *kbuf = req->kbuf;
+	struct io_buffer *head;
+
+	if (!(req->flags & REQ_F_BUFFER_SELECTED))
+		return;
+
+	if (needs_lock)
+		mutex_lock(&ctx->uring_lock);
+
+	head = idr_find(&ctx->io_buffer_idr, kbuf->bgid);
+	if (head) {
+		list_add_tail(&kbuf->list, &head->list);
+	} else {
+		INIT_LIST_HEAD(&kbuf->list);
+		if (idr_alloc(&ctx->io_buffer_idr, kbuf, kbuf->bgid,
+			      kbuf->bgid + 1, GFP_KERNEL) < 0)
+			kbuf = NULL;
+	}
+	if (kbuf) {
+		req->flags &= ~REQ_F_BUFFER_SELECTED;
+		req->kbuf = NULL;
+	}
+
+	if (needs_lock)
+		mutex_unlock(&ctx->uring_lock);
+}
+
+/*
+ * IORING_OP_READV with a provided buffer: the single iovec only supplies
+ * the length, the base comes from the selected buffer.
+ */
+static ssize_t io_iov_buffer_select(struct io_kiocb *req, struct iovec *iov)
+{
+	const struct io_uring_sqe *sqe = req->submit.sqe;
+	void __user *uiov = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	struct io_buffer *kbuf;
+	size_t len;
+
+	if (READ_ONCE(sqe->len) != 1)
+		return -EINVAL;
+
+#ifdef CONFIG_COMPAT
+	if (req->ctx->compat) {
+		struct compat_iovec __user *ciov = uiov;
+		compat_ssize_t clen;
+
+		if (get_user(clen, &ciov->iov_len))
+			return -EFAULT;
+		if (clen < 0)
+			return -EINVAL;
+		len = clen;
+	} else
+#endif
+	{
+		struct iovec __user *u = uiov;
+
+		if (get_user(len, &u->iov_len))
+			return -EFAULT;
+		if ((ssize_t) len < 0)
+			return -EINVAL;
+	}
+
+	kbuf = io_buffer_select(req, &len);
+	if (IS_ERR(kbuf))
+		return PTR_ERR(kbuf);
+
+	iov[0].iov_base = u64_to_user_ptr(kbuf->addr);
+	iov[0].iov_len = len;
+	return len;
+}
+
 static ssize_t io_import_iovec(struct io_ring_ctx *ctx, int rw,
 			       struct io_kiocb *req, struct iovec **iovec,
 			       struct iov_iter *iter)
@@ -1294,6 +1708,33 @@ static ssize_t io_import_iovec(struct io_ring_ctx *ctx, int rw,
 	if (!req->submit.has_user)
 		return -EFAULT;
 
+	if (opcode == IORING_OP_READ || opcode == IORING_OP_WRITE) {
+		ssize_t ret;
+
+		if (req->flags & REQ_F_BUFFER_SELECT) {
+			struct io_buffer *kbuf;
+
+			kbuf = io_buffer_select(req, &sqe_len);
+			if (IS_ERR(kbuf))
+				return PTR_ERR(kbuf);
+			buf = u64_to_user_ptr(kbuf->addr);
+		}
+
+		ret = import_single_range(rw, buf, sqe_len, *iovec, iter);
+		*iovec = NULL;
+		return ret < 0 ? ret : sqe_len;
+	}
+
+	if (req->flags & REQ_F_BUFFER_SELECT) {
+		ssize_t ret;
+
+		ret = io_iov_buffer_select(req, *iovec);
+		if (ret >= 0)
+			iov_iter_init(iter, rw, *iovec, 1, ret);
+		*iovec = NULL;
+		return ret;
+	}
+
 #ifdef CONFIG_COMPAT
 	if (ctx->compat)
 		return compat_import_iovec(rw, buf, sqe_len, UIO_FASTIOV,
@@ -1458,6 +1899,20 @@ static int io_read(struct io_kiocb *req, const struct sqe_submit *s,
 		else
 			ret2 = -EINVAL;
 
+		/*
+		 * A waitq read stops short at the first page that isn't
+		 * uptodate yet, carry on to queue the wait for that page.
+		 */
+		if ((kiocb->ki_flags & IOCB_WAITQ) &&
+		    ret2 > 0 && ret2 < read_size) {
+			ssize_t ret3 = call_read_iter(file, kiocb, &iter);
+
+			if (ret3 == -EIOCBQUEUED)
+				ret2 = ret3;
+			else if (ret3 > 0)
+				ret2 += ret3;
+		}
+
 		/*
 		 * In case of a short read, punt to async. This can happen
 		 * if we have data partially cached. Alternatively we can
@@ -1470,8 +1925,14 @@ static int io_read(struct io_kiocb *req, const struct sqe_submit *s,
 		    (req->flags & REQ_F_ISREG) &&
 		    ret2 > 0 && ret2 < read_size)
 			ret2 = -EAGAIN;
+		/*
+		 * Queued on a page lock, io_async_buf_func() retries the
+		 * whole read once it is unlocked.
+		 */
+		if (ret2 == -EIOCBQUEUED && (kiocb->ki_flags & IOCB_WAITQ)) {
+			ret = -EIOCBQUEUED;
 		/* Catch -EAGAIN return for forced non-blocking submission */
-		if (!force_nonblock || ret2 != -EAGAIN) {
+		} else if (!force_nonblock || ret2 != -EAGAIN) {
 			io_rw_done(kiocb, ret2);
 		} else {
 			/*
@@ -1680,84 +2141,1101 @@ static int io_sync_file_range(struct io_kiocb *req,
 	return 0;
 }
 
-#if defined(CONFIG_NET)
-static int io_send_recvmsg(struct io_kiocb *req, const struct io_uring_sqe *sqe,
-			   bool force_nonblock,
-		   long (*fn)(struct socket *, struct user_msghdr __user *,
-				unsigned int))
+static int io_fallocate(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+			bool force_nonblock)
 {
-	struct socket *sock;
-	int ret;
+	loff_t offset, len;
+	int mode, ret;
+
+	if (!req->file)
+		return -EBADF;
 
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
 		return -EINVAL;
+	if (unlikely(sqe->ioprio || sqe->buf_index || sqe->rw_flags))
+		return -EINVAL;
 
-	sock = sock_from_file(req->file, &ret);
-	if (sock) {
-		struct user_msghdr __user *msg;
-		unsigned flags;
-
-		flags = READ_ONCE(sqe->msg_flags);
-		if (flags & MSG_DONTWAIT)
-			req->flags |= REQ_F_NOWAIT;
-		else if (force_nonblock)
-			flags |= MSG_DONTWAIT;
-
-#ifdef CONFIG_COMPAT
-		if (req->ctx->compat)
-			flags |= MSG_CMSG_COMPAT;
-#endif
+	/* fallocate always requires a blocking context */
+	if (force_nonblock)
+		return -EAGAIN;
 
-		msg = (struct user_msghdr __user *) (unsigned long)
-			READ_ONCE(sqe->addr);
+	offset = READ_ONCE(sqe->off);
+	len = READ_ONCE(sqe->addr);
+	mode = READ_ONCE(sqe->len);
 
-		ret = fn(sock, msg, flags);
-		if (force_nonblock && ret == -EAGAIN)
-			return ret;
-		if (ret == -ERESTARTSYS)
-			ret = -EINTR;
-	}
+	current->signal->rlim[RLIMIT_FSIZE].rlim_cur = req->fsize;
+	ret = vfs_fallocate(req->file, mode, offset, len);
+	current->signal->rlim[RLIMIT_FSIZE].rlim_cur = RLIM_INFINITY;
 
-	io_req_put_fs(req);
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
 	io_cqring_add_event(req->ctx, sqe->user_data, ret);
 	io_put_req(req);
 	return 0;
 }
-#endif
 
-static int io_sendmsg(struct io_kiocb *req, const struct io_uring_sqe *sqe,
-		      bool force_nonblock)
+/* open straight into a fixed file slot, without ever creating an fd */
+static int io_openat_fixed(struct io_kiocb *req, int dfd,
+			   const char __user *fname, int flags, umode_t mode,
+			   unsigned index)
 {
-#if defined(CONFIG_NET)
-	return io_send_recvmsg(req, sqe, force_nonblock, __sys_sendmsg_sock);
-#else
-	return -EOPNOTSUPP;
-#endif
-}
+	struct open_flags op;
+	struct filename *tmp;
+	struct file *file;
+	int ret;
 
-static int io_recvmsg(struct io_kiocb *req, const struct io_uring_sqe *sqe,
-		      bool force_nonblock)
-{
-#if defined(CONFIG_NET)
-	return io_send_recvmsg(req, sqe, force_nonblock, __sys_recvmsg_sock);
-#else
-	return -EOPNOTSUPP;
-#endif
-}
+	ret = build_open_flags(flags, mode, &op);
+	if (ret)
+		return ret;
 
-static void io_poll_remove_one(struct io_kiocb *req)
-{
-	struct io_poll_iocb *poll = &req->poll;
+	tmp = getname(fname);
+	if (IS_ERR(tmp))
+		return PTR_ERR(tmp);
 
-	spin_lock(&poll->head->lock);
-	WRITE_ONCE(poll->canceled, true);
-	if (!list_empty(&poll->wait.entry)) {
-		list_del_init(&poll->wait.entry);
-		io_queue_async_work(req->ctx, req);
-	}
-	spin_unlock(&poll->head->lock);
+	file = do_filp_open(dfd, tmp, &op);
+	putname(tmp);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
 
-	list_del_init(&req->list);
+	fsnotify_open(file);
+	return io_install_fixed_file(req, file, index);
+}
+
+static int io_openat(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		     bool force_nonblock)
+{
+	const char __user *fname;
+	unsigned file_index;
+	umode_t mode;
+	int dfd, flags;
+	long ret;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->ioprio || sqe->buf_index))
+		return -EINVAL;
+	if (unlikely(sqe->flags & IOSQE_FIXED_FILE))
+		return -EBADF;
+
+	/* path lookup and open may block, always punt to async context */
+	if (force_nonblock)
+		return -EAGAIN;
+
+	dfd = READ_ONCE(sqe->fd);
+	fname = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	mode = READ_ONCE(sqe->len);
+	flags = READ_ONCE(sqe->open_flags);
+	file_index = READ_ONCE(sqe->file_index);
+	if (force_o_largefile())
+		flags |= O_LARGEFILE;
+
+	/* a fixed file has no fd, so there's nothing to close on exec */
+	if (file_index && (flags & O_CLOEXEC)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (file_index)
+		ret = io_openat_fixed(req, dfd, fname, flags, mode,
+					file_index - 1);
+	else
+		ret = do_sys_open(dfd, fname, flags, mode);
+out:
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(req->ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+}
+
+static int io_close(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		    bool force_nonblock)
+{
+	unsigned file_index;
+	struct file *file;
+	int fd, ret;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->ioprio || sqe->off || sqe->addr || sqe->len ||
+		     sqe->rw_flags || sqe->buf_index))
+		return -EINVAL;
+	if (unlikely(sqe->flags & IOSQE_FIXED_FILE))
+		return -EBADF;
+
+	fd = READ_ONCE(sqe->fd);
+	file_index = READ_ONCE(sqe->file_index);
+	if (file_index) {
+		if (fd)
+			return -EINVAL;
+		ret = io_install_fixed_file(req, NULL, file_index - 1);
+		goto out;
+	}
+
+	/*
+	 * Don't allow closing the ring itself, and punt files with a
+	 * ->flush() handler to async context, as that may block.
+	 */
+	ret = 0;
+	rcu_read_lock();
+	file = fcheck(fd);
+	if (!file || file->f_op == &io_uring_fops)
+		ret = -EBADF;
+	else if (file->f_op->flush && force_nonblock)
+		ret = -EAGAIN;
+	rcu_read_unlock();
+	if (ret)
+		return ret;
+
+	ret = __close_fd_get_file(fd, &file);
+	if (file)
+		fput(file);
+	if (ret == -ENOENT)
+		ret = -EBADF;
+out:
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(req->ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+}
+
+static int io_files_update(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+			   bool force_nonblock)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_uring_files_update up;
+	int ret;
+
+	if (unlikely(ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->ioprio || sqe->rw_flags || sqe->buf_index))
+		return -EINVAL;
+
+	/* fget() and ->uring_lock may block, always punt to async context */
+	if (force_nonblock)
+		return -EAGAIN;
+
+	up.offset = READ_ONCE(sqe->off);
+	up.resv = 0;
+	up.fds = READ_ONCE(sqe->addr);
+
+	mutex_lock(&ctx->uring_lock);
+	ret = __io_sqe_files_update(ctx, &up, READ_ONCE(sqe->len));
+	mutex_unlock(&ctx->uring_lock);
+
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+}
+
+static int io_statx(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		    bool force_nonblock)
+{
+	struct statx __user *buffer;
+	const char __user *fname;
+	unsigned int mask;
+	unsigned flags;
+	int dfd, ret;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->ioprio || sqe->buf_index))
+		return -EINVAL;
+	if (unlikely(sqe->flags & IOSQE_FIXED_FILE))
+		return -EBADF;
+
+	/* path lookup may block, always punt to async context */
+	if (force_nonblock)
+		return -EAGAIN;
+
+	dfd = READ_ONCE(sqe->fd);
+	fname = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	buffer = u64_to_user_ptr(READ_ONCE(sqe->addr2));
+	mask = READ_ONCE(sqe->len);
+	flags = READ_ONCE(sqe->statx_flags);
+
+	ret = do_statx(dfd, fname, flags, mask, buffer);
+
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(req->ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+}
+
+static int io_fadvise(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		      bool force_nonblock)
+{
+	loff_t offset, len;
+	int advice, ret;
+
+	if (!req->file)
+		return -EBADF;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->ioprio || sqe->buf_index || sqe->addr))
+		return -EINVAL;
+
+	offset = READ_ONCE(sqe->off);
+	len = READ_ONCE(sqe->len);
+	advice = READ_ONCE(sqe->fadvise_advice);
+
+	/*
+	 * Only the hints that just update the file readahead state are
+	 * guaranteed not to block, anything else may start or wait for IO.
+	 */
+	if (force_nonblock) {
+		switch (advice) {
+		case POSIX_FADV_NORMAL:
+		case POSIX_FADV_RANDOM:
+		case POSIX_FADV_SEQUENTIAL:
+			break;
+		default:
+			return -EAGAIN;
+		}
+	}
+
+	ret = vfs_fadvise(req->file, offset, len, advice);
+
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(req->ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+}
+
+static int io_madvise(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		      bool force_nonblock)
+{
+#if defined(CONFIG_ADVISE_SYSCALLS) && defined(CONFIG_MMU)
+	unsigned long addr;
+	size_t len;
+	int advice, ret;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->ioprio || sqe->buf_index || sqe->off))
+		return -EINVAL;
+
+	/* madvise needs the mmap_sem, always punt to async context */
+	if (force_nonblock)
+		return -EAGAIN;
+
+	addr = READ_ONCE(sqe->addr);
+	len = READ_ONCE(sqe->len);
+	advice = READ_ONCE(sqe->fadvise_advice);
+
+	ret = do_madvise(addr, len, advice);
+
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(req->ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+/*
+ * IORING_OP_SPLICE and IORING_OP_TEE. req->file is the output, the input is
+ * in sqe->splice_fd_in, which may index the fixed file set.
+ */
+static int io_splice(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		     bool force_nonblock)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	bool tee = req->submit.opcode == IORING_OP_TEE;
+	loff_t off_in, off_out, *poff_in = NULL, *poff_out = NULL;
+	unsigned int flags;
+	struct file *in;
+	bool fixed;
+	size_t len;
+	long ret;
+	int fd;
+
+	if (unlikely(ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->ioprio || sqe->buf_index))
+		return -EINVAL;
+	flags = READ_ONCE(sqe->splice_flags);
+	if (unlikely(flags & ~(SPLICE_F_ALL | SPLICE_F_FD_IN_FIXED)))
+		return -EINVAL;
+	if (tee && (READ_ONCE(sqe->splice_off_in) || READ_ONCE(sqe->off)))
+		return -EINVAL;
+
+	/* splice may block on the pipe and on page cache IO, always punt */
+	if (force_nonblock)
+		return -EAGAIN;
+
+	fd = READ_ONCE(sqe->splice_fd_in);
+	fixed = flags & SPLICE_F_FD_IN_FIXED;
+	if (fixed) {
+		ret = -EBADF;
+		in = io_file_get_fixed(req, fd);
+		if (!in)
+			goto out;
+	} else {
+		ret = -EBADF;
+		in = fget(fd);
+		if (!in)
+			goto out;
+	}
+	flags &= ~SPLICE_F_FD_IN_FIXED;
+
+	len = READ_ONCE(sqe->len);
+	if (!(in->f_mode & FMODE_READ) || !(req->file->f_mode & FMODE_WRITE)) {
+		ret = -EBADF;
+	} else if (!len) {
+		ret = 0;
+	} else if (tee) {
+		ret = do_tee(in, req->file, len, flags);
+	} else {
+		off_in = READ_ONCE(sqe->splice_off_in);
+		off_out = READ_ONCE(sqe->off);
+		if (off_in != -1)
+			poff_in = &off_in;
+		if (off_out != -1)
+			poff_out = &off_out;
+		ret = do_splice(in, poff_in, req->file, poff_out, len, flags);
+	}
+
+	if (!fixed)
+		fput(in);
+out:
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+}
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/*
+ * Remember the NAPI context @sock receives on, if the ring busy polls. When
+ * the table is full, an old entry is replaced.
+ */
+static void io_napi_add(struct io_ring_ctx *ctx, struct socket *sock)
+{
+	unsigned int napi_id = READ_ONCE(sock->sk->sk_napi_id);
+	unsigned int i, nr;
+
+	if (!READ_ONCE(ctx->napi_busy_poll_to) || napi_id < MIN_NAPI_ID)
+		return;
+
+	spin_lock(&ctx->napi_lock);
+	nr = ctx->nr_napi_ids;
+	for (i = 0; i < nr; i++)
+		if (ctx->napi_ids[i] == napi_id)
+			goto out;
+	if (nr < IO_NAPI_MAX_IDS) {
+		WRITE_ONCE(ctx->napi_ids[nr], napi_id);
+		/* pairs with smp_rmb() in io_napi_poll() */
+		smp_wmb();
+		WRITE_ONCE(ctx->nr_napi_ids, nr + 1);
+	} else {
+		WRITE_ONCE(ctx->napi_ids[napi_id % IO_NAPI_MAX_IDS], napi_id);
+	}
+out:
+	spin_unlock(&ctx->napi_lock);
+}
+
+/* poll every NAPI context of @ctx once, returns false if there are none */
+static bool io_napi_poll(struct io_ring_ctx *ctx)
+{
+	unsigned int i, nr;
+
+	if (!READ_ONCE(ctx->napi_busy_poll_to))
+		return false;
+	nr = READ_ONCE(ctx->nr_napi_ids);
+	if (!nr)
+		return false;
+	smp_rmb();
+
+	for (i = 0; i < nr; i++)
+		napi_busy_loop(READ_ONCE(ctx->napi_ids[i]), NULL, NULL,
+			       READ_ONCE(ctx->napi_prefer_busy_poll),
+			       BUSY_POLL_BUDGET);
+	return true;
+}
+
+static int io_napi_register(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_napi curr = {
+		.busy_poll_to = READ_ONCE(ctx->napi_busy_poll_to),
+		.prefer_busy_poll = READ_ONCE(ctx->napi_prefer_busy_poll),
+	};
+	struct io_uring_napi napi;
+
+	if (copy_from_user(&napi, arg, sizeof(napi)))
+		return -EFAULT;
+	if (napi.pad[0] || napi.pad[1] || napi.pad[2] || napi.resv ||
+	    !napi.busy_poll_to)
+		return -EINVAL;
+	if (copy_to_user(arg, &curr, sizeof(curr)))
+		return -EFAULT;
+
+	WRITE_ONCE(ctx->napi_prefer_busy_poll, !!napi.prefer_busy_poll);
+	WRITE_ONCE(ctx->napi_busy_poll_to, napi.busy_poll_to);
+	return 0;
+}
+
+static int io_napi_unregister(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_napi curr = {
+		.busy_poll_to = READ_ONCE(ctx->napi_busy_poll_to),
+		.prefer_busy_poll = READ_ONCE(ctx->napi_prefer_busy_poll),
+	};
+
+	if (!curr.busy_poll_to)
+		return -ENXIO;
+	if (arg && copy_to_user(arg, &curr, sizeof(curr)))
+		return -EFAULT;
+
+	WRITE_ONCE(ctx->napi_busy_poll_to, 0);
+	WRITE_ONCE(ctx->napi_prefer_busy_poll, false);
+	spin_lock(&ctx->napi_lock);
+	WRITE_ONCE(ctx->nr_napi_ids, 0);
+	spin_unlock(&ctx->napi_lock);
+	return 0;
+}
+#else
+static inline void io_napi_add(struct io_ring_ctx *ctx, struct socket *sock)
+{
+}
+
+static inline bool io_napi_poll(struct io_ring_ctx *ctx)
+{
+	return false;
+}
+
+static int io_napi_register(struct io_ring_ctx *ctx, void __user *arg)
+{
+	return -EOPNOTSUPP;
+}
+
+static int io_napi_unregister(struct io_ring_ctx *ctx, void __user *arg)
+{
+	return -EOPNOTSUPP;
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
+#if defined(CONFIG_NET)
+static int io_send_recvmsg(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+			   bool force_nonblock,
+		   long (*fn)(struct socket *, struct user_msghdr __user *,
+				unsigned int))
+{
+	struct socket *sock;
+	int ret;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+
+	sock = sock_from_file(req->file, &ret);
+	if (sock) {
+		struct user_msghdr __user *msg;
+		unsigned flags;
+
+		io_napi_add(req->ctx, sock);
+		flags = READ_ONCE(sqe->msg_flags);
+		if (flags & MSG_DONTWAIT)
+			req->flags |= REQ_F_NOWAIT;
+		else if (force_nonblock)
+			flags |= MSG_DONTWAIT;
+
+#ifdef CONFIG_COMPAT
+		if (req->ctx->compat)
+			flags |= MSG_CMSG_COMPAT;
+#endif
+
+		msg = (struct user_msghdr __user *) (unsigned long)
+			READ_ONCE(sqe->addr);
+
+		ret = fn(sock, msg, flags);
+		if (force_nonblock && ret == -EAGAIN)
+			return ret;
+		if (ret == -ERESTARTSYS)
+			ret = -EINTR;
+	}
+
+	io_req_put_fs(req);
+	io_cqring_add_event(req->ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+}
+#endif
+
+static int io_sendmsg(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		      bool force_nonblock)
+{
+#if defined(CONFIG_NET)
+	return io_send_recvmsg(req, sqe, force_nonblock, __sys_sendmsg_sock);
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static int io_recvmsg(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		      bool force_nonblock)
+{
+#if defined(CONFIG_NET)
+	return io_send_recvmsg(req, sqe, force_nonblock, __sys_recvmsg_sock);
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+#if defined(CONFIG_NET)
+static int io_send_recv(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+			bool force_nonblock, int rw)
+{
+	unsigned int cflags, nr_posted = 0;
+	bool multishot = false;
+	struct socket *sock;
+	int ret;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (rw == READ) {
+		unsigned ioprio = READ_ONCE(sqe->ioprio);
+
+		if (ioprio & ~IORING_RECV_MULTISHOT)
+			return -EINVAL;
+		multishot = ioprio & IORING_RECV_MULTISHOT;
+		/* every message needs a buffer of its own */
+		if (multishot && !(req->flags & REQ_F_BUFFER_SELECT))
+			return -EINVAL;
+	}
+
+	sock = sock_from_file(req->file, &ret);
+	if (sock) {
+		void __user *buf;
+		struct msghdr msg;
+		struct iovec iov;
+		unsigned flags;
+		size_t len;
+
+		io_napi_add(req->ctx, sock);
+retry:
+		buf = (void __user *) (unsigned long) READ_ONCE(sqe->addr);
+		len = READ_ONCE(sqe->len);
+
+		if (req->flags & REQ_F_BUFFER_SELECT) {
+			struct io_buffer *kbuf;
+
+			kbuf = io_buffer_select(req, &len);
+			if (IS_ERR(kbuf)) {
+				ret = PTR_ERR(kbuf);
+				goto out;
+			}
+			buf = u64_to_user_ptr(kbuf->addr);
+		}
+
+		ret = import_single_range(rw, buf, len, &iov, &msg.msg_iter);
+		if (ret)
+			goto out;
+
+		msg.msg_name = NULL;
+		msg.msg_namelen = 0;
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
+		msg.msg_iocb = NULL;
+		msg.msg_ubuf = NULL;
+
+		flags = READ_ONCE(sqe->msg_flags);
+		if (flags & MSG_DONTWAIT)
+			req->flags |= REQ_F_NOWAIT;
+		else if (force_nonblock || multishot)
+			flags |= MSG_DONTWAIT;
+
+		if (rw == WRITE) {
+			msg.msg_flags = flags;
+			ret = sock_sendmsg(sock, &msg);
+		} else {
+			msg.msg_flags = 0;
+			ret = sock_recvmsg(sock, &msg, flags);
+		}
+		/*
+		 * Multishot: post this message and go again, until the socket
+		 * runs dry (and we get polled again) or hits EOF or an error.
+		 * A full CQ ends it, with this message as the final CQE. After
+		 * a batch, yield to the poll so we don't hog the submitter.
+		 */
+		if (multishot && ret > 0) {
+			cflags = io_put_kbuf(req);
+			if (!io_cqring_add_more(req->ctx, sqe->user_data, ret,
+						cflags))
+				goto done;
+			if (++nr_posted == IO_MULTISHOT_BATCH) {
+				if (!(req->flags & REQ_F_NOWAIT))
+					return -EAGAIN;
+				ret = -EAGAIN;
+				goto out;
+			}
+			cond_resched();
+			goto retry;
+		}
+		/* multishot never blocks, even from a worker, it's polled */
+		if (ret == -EAGAIN && (force_nonblock ||
+		    (multishot && !(req->flags & REQ_F_NOWAIT))))
+			return ret;
+		if (ret == -ERESTARTSYS)
+			ret = -EINTR;
+	}
+out:
+	cflags = io_put_kbuf(req);
+done:
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	__io_cqring_add_event(req->ctx, sqe->user_data, ret, cflags);
+	io_put_req(req);
+	return 0;
+}
+#endif
+
+static int io_send(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		   bool force_nonblock)
+{
+#if defined(CONFIG_NET)
+	return io_send_recv(req, sqe, force_nonblock, WRITE);
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static int io_recv(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		   bool force_nonblock)
+{
+#if defined(CONFIG_NET)
+	return io_send_recv(req, sqe, force_nonblock, READ);
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static void io_zc_notif_complete(struct ubuf_info *uarg, bool success)
+{
+	struct io_zc_notif *notif = container_of(uarg, struct io_zc_notif, uarg);
+	struct io_ring_ctx *ctx = notif->ctx;
+
+	__io_cqring_add_event(ctx, notif->user_data,
+				success ? 0 : IORING_NOTIF_USAGE_ZC_COPIED,
+				IORING_CQE_F_NOTIF);
+	percpu_ref_put(&ctx->refs);
+	kfree(notif);
+}
+
+/*
+ * Drop the reference of a request that never completed. The notification
+ * is only posted if the network stack still uses some of the pages.
+ */
+static void io_zc_notif_drop(struct io_zc_notif *notif)
+{
+#if defined(CONFIG_NET)
+	if (refcount_dec_and_test(&notif->uarg.refcnt)) {
+		percpu_ref_put(&notif->ctx->refs);
+		kfree(notif);
+	}
+#endif
+}
+
+#if defined(CONFIG_NET)
+static struct io_zc_notif *io_zc_notif_alloc(struct io_kiocb *req)
+{
+	struct io_zc_notif *notif;
+
+	notif = kzalloc(sizeof(*notif), GFP_KERNEL);
+	if (!notif)
+		return NULL;
+
+	notif->uarg.callback = io_zc_notif_complete;
+	notif->uarg.flags = UBUF_F_REFCOUNTED;
+	/* set by the protocol if it takes the pages rather than copying */
+	notif->uarg.zerocopy = 0;
+	refcount_set(&notif->uarg.refcnt, 1);
+	notif->ctx = req->ctx;
+	notif->user_data = req->user_data;
+	percpu_ref_get(&req->ctx->refs);
+	return notif;
+}
+#endif
+
+/*
+ * IORING_OP_SEND_ZC. Like IORING_OP_SEND, but the socket references the
+ * pages instead of copying them. The send result is posted with
+ * IORING_CQE_F_MORE, followed by an IORING_CQE_F_NOTIF completion once the
+ * buffer may be reused. Registered buffers are already pinned, and are
+ * used with IORING_RECVSEND_FIXED_BUF.
+ */
+static int io_send_zc(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		      bool force_nonblock)
+{
+#if defined(CONFIG_NET)
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned ioprio, flags;
+	struct socket *sock;
+	struct msghdr msg;
+	struct iovec iov;
+	int ret;
+
+	if (unlikely(ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	ioprio = READ_ONCE(sqe->ioprio);
+	if (ioprio & ~IORING_RECVSEND_FIXED_BUF)
+		return -EINVAL;
+	if (!(ioprio & IORING_RECVSEND_FIXED_BUF) && sqe->buf_index)
+		return -EINVAL;
+	flags = READ_ONCE(sqe->msg_flags);
+	if (flags & MSG_ZEROCOPY)
+		return -EINVAL;
+
+	sock = sock_from_file(req->file, &ret);
+	if (!sock)
+		goto out;
+	/*
+	 * Only TCP takes the pages of msg_ubuf. Other protocols, kTLS
+	 * included, would copy the data or pin the pages behind the
+	 * notification's back.
+	 */
+	ret = -EOPNOTSUPP;
+	if (READ_ONCE(sock->sk->sk_prot)->sendmsg != tcp_sendmsg)
+		goto out;
+	io_napi_add(ctx, sock);
+
+	if (ioprio & IORING_RECVSEND_FIXED_BUF) {
+		ret = io_import_fixed(ctx, WRITE, sqe, &msg.msg_iter);
+		if (ret < 0)
+			goto out;
+	} else {
+		void __user *buf = u64_to_user_ptr(READ_ONCE(sqe->addr));
+
+		ret = import_single_range(WRITE, buf, READ_ONCE(sqe->len),
+						&iov, &msg.msg_iter);
+		if (ret)
+			goto out;
+	}
+
+	/* kept across -EAGAIN, so a retry doesn't post a notification */
+	if (!(req->flags & REQ_F_ZC_NOTIF)) {
+		ret = -ENOMEM;
+		req->notif = io_zc_notif_alloc(req);
+		if (!req->notif)
+			goto out;
+		req->flags |= REQ_F_ZC_NOTIF;
+	}
+
+	msg.msg_name = NULL;
+	msg.msg_namelen = 0;
+	msg.msg_control = NULL;
+	msg.msg_controllen = 0;
+	msg.msg_iocb = NULL;
+	msg.msg_ubuf = &req->notif->uarg;
+
+	if (flags & MSG_DONTWAIT)
+		req->flags |= REQ_F_NOWAIT;
+	else if (force_nonblock)
+		flags |= MSG_DONTWAIT;
+
+	msg.msg_flags = flags | MSG_ZEROCOPY;
+	ret = sock_sendmsg(sock, &msg);
+	if (force_nonblock && ret == -EAGAIN)
+		return ret;
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	__io_cqring_add_event(ctx, sqe->user_data, ret, IORING_CQE_F_MORE);
+
+	/* our reference, the notification follows once the stack drops its */
+	req->flags &= ~REQ_F_ZC_NOTIF;
+	sock_zerocopy_put(&req->notif->uarg);
+	io_put_req(req);
+	return 0;
+out:
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static int io_accept(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		     bool force_nonblock)
+{
+#if defined(CONFIG_NET)
+	struct sockaddr __user *addr;
+	int __user *addr_len;
+	unsigned file_flags, ioprio, file_index, nr_posted = 0;
+	struct file *file;
+	int flags, ret;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	ioprio = READ_ONCE(sqe->ioprio);
+	if ((ioprio & ~IORING_ACCEPT_MULTISHOT) || sqe->len || sqe->buf_index)
+		return -EINVAL;
+
+	addr = (struct sockaddr __user *) (unsigned long) READ_ONCE(sqe->addr);
+	addr_len = (int __user *) (unsigned long) READ_ONCE(sqe->addr2);
+	flags = READ_ONCE(sqe->accept_flags);
+	/* multishot never blocks, even from a worker, it's polled */
+	file_flags = (force_nonblock || (ioprio & IORING_ACCEPT_MULTISHOT)) ?
+			O_NONBLOCK : 0;
+
+	file_index = READ_ONCE(sqe->file_index);
+	if (file_index) {
+		/* a fixed slot only takes one connection */
+		if (ioprio & IORING_ACCEPT_MULTISHOT)
+			return -EINVAL;
+		if (flags & ~SOCK_NONBLOCK)
+			return -EINVAL;
+		if (SOCK_NONBLOCK != O_NONBLOCK && (flags & SOCK_NONBLOCK))
+			flags = (flags & ~SOCK_NONBLOCK) | O_NONBLOCK;
+
+		file = do_accept(req->file, file_flags, addr, addr_len, flags);
+		if (IS_ERR(file))
+			ret = PTR_ERR(file);
+		else
+			ret = io_install_fixed_file(req, file, file_index - 1);
+		goto out;
+	}
+
+	/*
+	 * Multishot accept posts a CQE per connection and keeps going until
+	 * the backlog is empty, at which point it gets polled again. A full
+	 * CQ ends it, with the last connection in the final CQE, so that no
+	 * installed fd goes unreported.
+	 */
+	for (;;) {
+		ret = __sys_accept4_file(req->file, file_flags, addr, addr_len,
+						flags);
+		if (ret < 0 || !(ioprio & IORING_ACCEPT_MULTISHOT))
+			break;
+		if (!io_cqring_add_more(req->ctx, sqe->user_data, ret, 0))
+			break;
+		if (++nr_posted == IO_MULTISHOT_BATCH)
+			return -EAGAIN;
+		cond_resched();
+	}
+out:
+	if (ret == -EAGAIN && (file_flags & O_NONBLOCK))
+		return -EAGAIN;
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(req->ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static int io_connect(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		      bool force_nonblock)
+{
+#if defined(CONFIG_NET)
+	struct sockaddr_storage address;
+	struct sockaddr __user *addr;
+	unsigned file_flags;
+	int addr_len, ret;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (sqe->ioprio || sqe->len || sqe->buf_index || sqe->rw_flags)
+		return -EINVAL;
+
+	addr = (struct sockaddr __user *) (unsigned long) READ_ONCE(sqe->addr);
+	addr_len = READ_ONCE(sqe->addr2);
+
+	ret = move_addr_to_kernel(addr, addr_len, &address);
+	if (ret)
+		goto out;
+
+	file_flags = force_nonblock ? O_NONBLOCK : 0;
+	ret = __sys_connect_file(req->file, &address, addr_len, file_flags);
+	/* a non-blocking connect in progress completes once writable */
+	if ((ret == -EAGAIN || ret == -EINPROGRESS) && force_nonblock)
+		return -EAGAIN;
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+out:
+	io_req_put_fs(req);
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(req->ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static int __io_remove_buffers(struct io_ring_ctx *ctx, struct io_buffer *buf,
+			       int bgid, unsigned nbufs)
+{
+	unsigned i = 0;
+
+	/* shouldn't happen */
+	if (!nbufs)
+		return 0;
+
+	/* the head kbuf is the list itself */
+	while (!list_empty(&buf->list)) {
+		struct io_buffer *nxt;
+
+		nxt = list_first_entry(&buf->list, struct io_buffer, list);
+		list_del(&nxt->list);
+		kmem_cache_free(buf_cachep, nxt);
+		if (++i == nbufs)
+			return i;
+	}
+	i++;
+	kmem_cache_free(buf_cachep, buf);
+	idr_remove(&ctx->io_buffer_idr, bgid);
+
+	return i;
+}
+
+static int io_add_buffers(struct io_ring_ctx *ctx, __u64 addr, int len,
+			  int nbufs, int bid, int bgid)
+{
+	struct io_buffer *head, *buf;
+	int i;
+
+	head = idr_find(&ctx->io_buffer_idr, bgid);
+	for (i = 0; i < nbufs; i++) {
+		buf = kmem_cache_alloc(buf_cachep, GFP_KERNEL);
+		if (!buf)
+			break;
+
+		buf->addr = addr;
+		buf->len = len;
+		buf->bid = bid;
+		buf->bgid = bgid;
+		addr += len;
+		bid++;
+
+		if (head) {
+			list_add_tail(&buf->list, &head->list);
+			continue;
+		}
+
+		INIT_LIST_HEAD(&buf->list);
+		if (idr_alloc(&ctx->io_buffer_idr, buf, bgid, bgid + 1,
+			      GFP_KERNEL) < 0) {
+			kmem_cache_free(buf_cachep, buf);
+			break;
+		}
+		head = buf;
+	}
+
+	return i ? i : -ENOMEM;
+}
+
+/*
+ * IORING_OP_PROVIDE_BUFFERS hands sqe->fd buffers of sqe->len bytes each,
+ * starting at sqe->addr and numbered from sqe->off, to group sqe->buf_group.
+ */
+static int io_provide_buffers(struct io_kiocb *req,
+			      const struct io_uring_sqe *sqe)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	int nbufs, len, bid, bgid, ret;
+	u64 addr, off;
+
+	if (sqe->ioprio || sqe->rw_flags)
+		return -EINVAL;
+
+	nbufs = READ_ONCE(sqe->fd);
+	if (!nbufs || nbufs > USHRT_MAX)
+		return -EINVAL;
+	off = READ_ONCE(sqe->off);
+	if (off > USHRT_MAX || off + nbufs - 1 > USHRT_MAX)
+		return -E2BIG;
+	len = READ_ONCE(sqe->len);
+	if (len <= 0)
+		return -EINVAL;
+	addr = READ_ONCE(sqe->addr);
+	if (!access_ok(u64_to_user_ptr(addr), (unsigned long) len * nbufs))
+		return -EFAULT;
+	bid = off;
+	bgid = READ_ONCE(sqe->buf_group);
+
+	if (req->submit.needs_lock)
+		mutex_lock(&ctx->uring_lock);
+	ret = io_add_buffers(ctx, addr, len, nbufs, bid, bgid);
+	if (req->submit.needs_lock)
+		mutex_unlock(&ctx->uring_lock);
+
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+}
+
+/*
+ * IORING_OP_REMOVE_BUFFERS takes up to sqe->fd unused buffers back out of
+ * group sqe->buf_group, and returns how many it removed.
+ */
+static int io_remove_buffers(struct io_kiocb *req,
+			     const struct io_uring_sqe *sqe)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_buffer *head;
+	int nbufs, bgid, ret;
+
+	if (sqe->ioprio || sqe->rw_flags || sqe->addr || sqe->len || sqe->off)
+		return -EINVAL;
+
+	nbufs = READ_ONCE(sqe->fd);
+	if (!nbufs || nbufs > USHRT_MAX)
+		return -EINVAL;
+	bgid = READ_ONCE(sqe->buf_group);
+
+	if (req->submit.needs_lock)
+		mutex_lock(&ctx->uring_lock);
+	ret = -ENOENT;
+	head = idr_find(&ctx->io_buffer_idr, bgid);
+	if (head)
+		ret = __io_remove_buffers(ctx, head, bgid, nbufs);
+	if (req->submit.needs_lock)
+		mutex_unlock(&ctx->uring_lock);
+
+	if (ret < 0 && (req->flags & REQ_F_LINK))
+		req->flags |= REQ_F_FAIL_LINK;
+	io_cqring_add_event(ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+}
+
+static void io_poll_remove_one(struct io_kiocb *req)
+{
+	struct io_poll_iocb *poll = &req->poll;
+
+	spin_lock(&poll->head->lock);
+	WRITE_ONCE(poll->canceled, true);
+	if (!list_empty(&poll->wait.entry)) {
+		list_del_init(&poll->wait.entry);
+		/* internal poll: have the worker complete it as cancelled */
+		if (req->flags & REQ_F_POLLED)
+			req->flags |= REQ_F_CANCEL;
+		io_queue_async_work(req->ctx, req);
+	}
+	spin_unlock(&poll->head->lock);
+
+	list_del_init(&req->list);
 }
 
 static void io_poll_remove_all(struct io_ring_ctx *ctx)
@@ -1790,6 +3268,8 @@ static int io_poll_remove(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 
 	spin_lock_irq(&ctx->completion_lock);
 	list_for_each_entry_safe(poll_req, next, &ctx->cancel_list, list) {
+		if (poll_req->flags & REQ_F_POLLED)
+			continue;
 		if (READ_ONCE(sqe->addr) == poll_req->user_data) {
 			io_poll_remove_one(poll_req);
 			ret = 0;
@@ -1811,6 +3291,19 @@ static void io_poll_complete(struct io_ring_ctx *ctx, struct io_kiocb *req,
 	io_commit_cqring(ctx);
 }
 
+/*
+ * multishot poll: post an event, the request stays armed. Returns false if
+ * the CQ is too full, in which case the caller completes it instead.
+ */
+static bool io_poll_post_more(struct io_ring_ctx *ctx, struct io_kiocb *req,
+			      __poll_t mask)
+{
+	if (!io_cqring_fill_more(ctx, req->user_data, mangle_poll(mask), 0))
+		return false;
+	io_commit_cqring(ctx);
+	return true;
+}
+
 static void io_poll_complete_work(struct work_struct *work)
 {
 	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
@@ -1838,6 +3331,13 @@ static void io_poll_complete_work(struct work_struct *work)
 		spin_unlock_irq(&ctx->completion_lock);
 		goto out;
 	}
+	if ((req->flags & REQ_F_POLL_MULTI) && !READ_ONCE(poll->canceled) &&
+	    io_poll_post_more(ctx, req, mask)) {
+		add_wait_queue(poll->head, &poll->wait);
+		spin_unlock_irq(&ctx->completion_lock);
+		io_cqring_ev_posted(ctx);
+		goto out;
+	}
 	list_del_init(&req->list);
 	io_poll_complete(ctx, req, mask);
 	spin_unlock_irq(&ctx->completion_lock);
@@ -1862,6 +3362,30 @@ static int io_poll_wake(struct wait_queue_entry *wait, unsigned mode, int sync,
 	if (mask && !(mask & poll->events))
 		return 0;
 
+	if (req->flags & REQ_F_POLL_MULTI) {
+		/* stay on the waitqueue, unless we have to punt */
+		if (mask && spin_trylock_irqsave(&ctx->completion_lock, flags)) {
+			if (io_poll_post_more(ctx, req, mask)) {
+				spin_unlock_irqrestore(&ctx->completion_lock,
+							flags);
+				io_cqring_ev_posted(ctx);
+				return 1;
+			}
+			/* CQ full: this event ends it */
+			list_del_init(&poll->wait.entry);
+			list_del(&req->list);
+			io_poll_complete(ctx, req, mask);
+			spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+			io_cqring_ev_posted(ctx);
+			io_put_req(req);
+			return 1;
+		}
+		list_del_init(&poll->wait.entry);
+		io_queue_async_work(ctx, req);
+		return 1;
+	}
+
 	list_del_init(&poll->wait.entry);
 
 	if (mask && spin_trylock_irqsave(&ctx->completion_lock, flags)) {
@@ -1905,16 +3429,25 @@ static int io_poll_add(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 	struct io_ring_ctx *ctx = req->ctx;
 	struct io_poll_table ipt;
 	bool cancel = false;
+	bool multishot;
 	__poll_t mask;
+	u32 flags;
 	u16 events;
 
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
 		return -EINVAL;
-	if (sqe->addr || sqe->ioprio || sqe->off || sqe->len || sqe->buf_index)
+	if (sqe->addr || sqe->ioprio || sqe->off || sqe->buf_index)
+		return -EINVAL;
+	flags = READ_ONCE(sqe->len);
+	if (flags & ~IORING_POLL_ADD_MULTI)
 		return -EINVAL;
 	if (!poll->file)
 		return -EBADF;
 
+	multishot = flags & IORING_POLL_ADD_MULTI;
+	if (multishot)
+		req->flags |= REQ_F_POLL_MULTI;
+
 	req->submit.sqe = NULL;
 	INIT_WORK(&req->work, io_poll_complete_work);
 	events = READ_ONCE(sqe->poll_events);
@@ -1946,7 +3479,12 @@ static int io_poll_add(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 			ipt.error = 0;
 			mask = 0;
 		}
-		if (mask || ipt.error)
+		/* a multishot poll that couldn't be armed completes once */
+		if (ipt.error || cancel) {
+			multishot = false;
+			req->flags &= ~REQ_F_POLL_MULTI;
+		}
+		if ((mask && !multishot) || ipt.error)
 			list_del_init(&poll->wait.entry);
 		else if (cancel)
 			WRITE_ONCE(poll->canceled, true);
@@ -1956,13 +3494,35 @@ static int io_poll_add(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 	}
 	if (mask) { /* no async, we'd stolen it */
 		ipt.error = 0;
-		io_poll_complete(ctx, req, mask);
+		if (multishot && !io_poll_post_more(ctx, req, mask)) {
+			bool armed = true;
+
+			/*
+			 * CQ full: this event ends it, as in io_poll_wake().
+			 * Unless a wakeup has already punted it to a worker,
+			 * which then owns the completion.
+			 */
+			if (poll->head) {
+				spin_lock(&poll->head->lock);
+				armed = !list_empty(&poll->wait.entry);
+				list_del_init(&poll->wait.entry);
+				spin_unlock(&poll->head->lock);
+			}
+			if (armed) {
+				multishot = false;
+				list_del_init(&req->list);
+				io_poll_complete(ctx, req, mask);
+			}
+		} else if (!multishot) {
+			io_poll_complete(ctx, req, mask);
+		}
 	}
 	spin_unlock_irq(&ctx->completion_lock);
 
 	if (mask) {
 		io_cqring_ev_posted(ctx);
-		io_put_req(req);
+		if (!multishot)
+			io_put_req(req);
 	}
 	return ipt.error;
 }
@@ -2129,11 +3689,14 @@ static int __io_submit_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req,
 		ret = io_nop(req, req->user_data);
 		break;
 	case IORING_OP_READV:
-		if (unlikely(s->sqe->buf_index))
+	case IORING_OP_READ:
+		if (unlikely(s->sqe->buf_index &&
+			     !(req->flags & REQ_F_BUFFER_SELECT)))
 			return -EINVAL;
 		ret = io_read(req, s, force_nonblock);
 		break;
 	case IORING_OP_WRITEV:
+	case IORING_OP_WRITE:
 		if (unlikely(s->sqe->buf_index))
 			return -EINVAL;
 		ret = io_write(req, s, force_nonblock);
@@ -2165,6 +3728,52 @@ static int __io_submit_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req,
 	case IORING_OP_TIMEOUT:
 		ret = io_timeout(req, s->sqe);
 		break;
+	case IORING_OP_FALLOCATE:
+		ret = io_fallocate(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_OPENAT:
+		ret = io_openat(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_CLOSE:
+		ret = io_close(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_FILES_UPDATE:
+		ret = io_files_update(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_STATX:
+		ret = io_statx(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_FADVISE:
+		ret = io_fadvise(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_MADVISE:
+		ret = io_madvise(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_ACCEPT:
+		ret = io_accept(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_CONNECT:
+		ret = io_connect(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_SEND:
+		ret = io_send(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_RECV:
+		ret = io_recv(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_PROVIDE_BUFFERS:
+		ret = io_provide_buffers(req, s->sqe);
+		break;
+	case IORING_OP_REMOVE_BUFFERS:
+		ret = io_remove_buffers(req, s->sqe);
+		break;
+	case IORING_OP_SPLICE:
+	case IORING_OP_TEE:
+		ret = io_splice(req, s->sqe, force_nonblock);
+		break;
+	case IORING_OP_SEND_ZC:
+		ret = io_send_zc(req, s->sqe, force_nonblock);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -2194,9 +3803,11 @@ static struct async_list *io_async_list_from_req(struct io_ring_ctx *ctx,
 	switch (req->submit.opcode) {
 	case IORING_OP_READV:
 	case IORING_OP_READ_FIXED:
+	case IORING_OP_READ:
 		return &ctx->pending_async[READ];
 	case IORING_OP_WRITEV:
 	case IORING_OP_WRITE_FIXED:
+	case IORING_OP_WRITE:
 		return &ctx->pending_async[WRITE];
 	default:
 		return NULL;
@@ -2209,16 +3820,36 @@ static inline bool io_req_needs_user(struct io_kiocb *req)
 		req->submit.opcode == IORING_OP_WRITE_FIXED);
 }
 
+/*
+ * Multishot requests would never let a worker go, so they are always issued
+ * non-blocking and wait for their socket through an internal poll.
+ */
+static bool io_req_multishot(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = req->submit.sqe;
+
+	switch (req->submit.opcode) {
+	case IORING_OP_RECV:
+		return READ_ONCE(sqe->ioprio) & IORING_RECV_MULTISHOT;
+	case IORING_OP_ACCEPT:
+		return READ_ONCE(sqe->ioprio) & IORING_ACCEPT_MULTISHOT;
+	default:
+		return false;
+	}
+}
+
 static void io_sq_wq_submit_work(struct work_struct *work)
 {
 	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
 	struct fs_struct *old_fs_struct = current->fs;
+	struct files_struct *old_files = current->files;
 	struct io_ring_ctx *ctx = req->ctx;
 	struct mm_struct *cur_mm = NULL;
 	struct async_list *async_list;
 	const struct cred *old_cred;
 	LIST_HEAD(req_list);
 	mm_segment_t old_fs;
+	bool rearm;
 	int ret;
 
 	old_cred = override_creds(ctx->creds);
@@ -2233,6 +3864,7 @@ static void io_sq_wq_submit_work(struct work_struct *work)
 
 		/* Ensure we clear previously set non-block flag */
 		req->rw.ki_flags &= ~IOCB_NOWAIT;
+		rearm = false;
 
 		if ((req->fs && req->fs != current->fs) ||
 		    (!req->fs && current->fs != old_fs_struct)) {
@@ -2270,6 +3902,16 @@ static void io_sq_wq_submit_work(struct work_struct *work)
 				goto end_req;
 			}
 
+			/*
+			 * Only borrow the file table once we know that
+			 * io_uring_cancel_files() will wait for us.
+			 */
+			if (req->flags & REQ_F_INFLIGHT) {
+				task_lock(current);
+				current->files = req->files;
+				task_unlock(current);
+			}
+
 			s->has_user = cur_mm != NULL;
 			s->needs_lock = true;
 			do {
@@ -2282,25 +3924,55 @@ static void io_sq_wq_submit_work(struct work_struct *work)
 				 */
 				if (ret != -EAGAIN)
 					break;
+				/*
+				 * A multishot request ran its socket dry, wait
+				 * for more through poll instead of spinning.
+				 */
+				if (io_req_multishot(req)) {
+					io_kbuf_recycle(req, true);
+					rearm = true;
+					break;
+				}
 				cond_resched();
 			} while (1);
 		}
 end_req:
+		if (current->files != old_files) {
+			task_lock(current);
+			current->files = old_files;
+			task_unlock(current);
+		}
+		if (!rearm)
+			io_req_drop_files(req);
+
+		/* cancellation mustn't signal us once we're done with it */
 		spin_lock_irq(&ctx->task_lock);
 		list_del_init(&req->task_list);
+		req->work_task = NULL;
 		spin_unlock_irq(&ctx->task_lock);
 
+		/*
+		 * Once armed the wakeup owns the request, its files and the sqe
+		 * copy. If it became ready meanwhile, just queue it again.
+		 */
+		if (rearm) {
+			if (!io_arm_poll_handler(req))
+				io_queue_async_work(ctx, req);
+			goto next;
+		}
+
 		/* drop submission reference */
 		io_put_req(req);
 
 		if (ret) {
-			io_cqring_add_event(ctx, sqe->user_data, ret);
+			__io_cqring_add_event(ctx, sqe->user_data, ret,
+						io_put_kbuf(req));
 			io_put_req(req);
 		}
 
 		/* async context always use a copy of the sqe */
 		kfree(sqe);
-
+next:
 		/* req from defer and link list needn't decrease async cnt */
 		if (flags & (REQ_F_IO_DRAINED | REQ_F_LINK_DONE))
 			goto out;
@@ -2368,95 +4040,564 @@ static void io_sq_wq_submit_work(struct work_struct *work)
 }
 
 /*
- * See if we can piggy back onto previously submitted work, that is still
- * running. We currently only allow this if the new request is sequential
- * to the previous one we punted.
+ * See if we can piggy back onto previously submitted work, that is still
+ * running. We currently only allow this if the new request is sequential
+ * to the previous one we punted.
+ */
+static bool io_add_to_prev_work(struct async_list *list, struct io_kiocb *req)
+{
+	bool ret;
+
+	if (!list)
+		return false;
+	if (!(req->flags & REQ_F_SEQ_PREV))
+		return false;
+	if (!atomic_read(&list->cnt))
+		return false;
+
+	ret = true;
+	spin_lock(&list->lock);
+	list_add_tail(&req->list, &list->list);
+	/*
+	 * Ensure we see a simultaneous modification from io_sq_wq_submit_work()
+	 */
+	smp_mb();
+	if (!atomic_read(&list->cnt)) {
+		list_del_init(&req->list);
+		ret = false;
+	}
+
+	if (ret) {
+		struct io_ring_ctx *ctx = req->ctx;
+
+		spin_lock_irq(&ctx->task_lock);
+		list_add(&req->task_list, &ctx->task_list);
+		req->work_task = NULL;
+		spin_unlock_irq(&ctx->task_lock);
+	}
+	spin_unlock(&list->lock);
+	return ret;
+}
+
+static bool io_op_needs_file(struct io_kiocb *req)
+{
+	switch (req->submit.opcode) {
+	case IORING_OP_NOP:
+	case IORING_OP_POLL_REMOVE:
+	case IORING_OP_TIMEOUT:
+	case IORING_OP_OPENAT:
+	case IORING_OP_CLOSE:
+	case IORING_OP_STATX:
+	case IORING_OP_MADVISE:
+	case IORING_OP_PROVIDE_BUFFERS:
+	case IORING_OP_REMOVE_BUFFERS:
+	case IORING_OP_FILES_UPDATE:
+		return false;
+	default:
+		return true;
+	}
+}
+
+static bool io_op_can_select_buffer(struct io_kiocb *req)
+{
+	switch (req->submit.opcode) {
+	case IORING_OP_READV:
+	case IORING_OP_READ:
+	case IORING_OP_RECV:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Opcodes that resolve or install file descriptors, and hence need to run
+ * with the submitter's file table even if they are punted to async context.
+ *
+ * This is decided from the opcode alone.  Direct descriptors and fixed
+ * splice input don't touch the file table, but sqe->file_index and
+ * sqe->splice_flags still live in the shared SQ ring here and are read
+ * again when the request runs, so they can't be trusted to skip it.
+ */
+static bool io_op_needs_files(struct io_kiocb *req)
+{
+	switch (req->submit.opcode) {
+	case IORING_OP_OPENAT:
+	case IORING_OP_STATX:
+	case IORING_OP_FILES_UPDATE:
+	case IORING_OP_CLOSE:
+	case IORING_OP_ACCEPT:
+	case IORING_OP_SPLICE:
+	case IORING_OP_TEE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Opcodes that may look up paths, and hence need the submitter's root and
+ * working directory in async context.
+ */
+static bool io_op_needs_fs(struct io_kiocb *req)
+{
+	switch (req->submit.opcode) {
+	case IORING_OP_OPENAT:
+	case IORING_OP_STATX:
+#if defined(CONFIG_NET)
+	case IORING_OP_SENDMSG:
+	case IORING_OP_RECVMSG:
+	case IORING_OP_CONNECT:
+#endif
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int io_grab_files(struct io_ring_ctx *ctx, struct io_kiocb *req,
+			 const struct sqe_submit *s)
+{
+	int ret = -EBADF;
+
+	/* SQPOLL submissions don't have a file table to borrow */
+	if (!s->ring_file)
+		return -EBADF;
+
+	rcu_read_lock();
+	spin_lock_irq(&ctx->task_lock);
+	/*
+	 * We use the f_ops->flush() handler to ensure that we can flush
+	 * out work accessing these files if the fd is closed. Check if
+	 * the fd has changed since we started down this path, and disallow
+	 * this operation if it has.
+	 */
+	if (fcheck(s->ring_fd) == s->ring_file) {
+		list_add(&req->inflight_entry, &ctx->inflight_list);
+		req->flags |= REQ_F_INFLIGHT;
+		req->files = current->files;
+		/*
+		 * The worker won't hold a reference, tell expand_fdtable()
+		 * it can't trust ->count anymore. Set by the owner, so it is
+		 * seen by its own resizes; it stays set for good.
+		 */
+		if (!READ_ONCE(req->files->borrowed))
+			WRITE_ONCE(req->files->borrowed, true);
+		ret = 0;
+	}
+	spin_unlock_irq(&ctx->task_lock);
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static int io_grab_fs(struct io_kiocb *req)
+{
+	spin_lock(&current->fs->lock);
+	if (!current->fs->in_exec) {
+		req->fs = current->fs;
+		req->fs->users++;
+	}
+	spin_unlock(&current->fs->lock);
+
+	return req->fs ? 0 : -EAGAIN;
+}
+
+/*
+ * Look up fixed file @fd, pinning the current ref node for the lifetime of
+ * the request if it doesn't hold one yet.
+ */
+static struct file *io_file_get_fixed(struct io_kiocb *req, int fd)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct fixed_file_ref_node *node;
+
+	if (unlikely(!ctx->file_data || (unsigned) fd >= ctx->nr_user_files))
+		return NULL;
+
+	if (!req->fixed_file_refs) {
+		rcu_read_lock();
+		do {
+			node = READ_ONCE(ctx->file_data->node);
+		} while (!percpu_ref_tryget_live(&node->refs));
+		rcu_read_unlock();
+		req->fixed_file_refs = &node->refs;
+		/* pairs with smp_store_release() in io_fixed_file_switch_node() */
+		smp_rmb();
+	}
+
+	fd = array_index_nospec(fd, ctx->nr_user_files);
+	return READ_ONCE(ctx->user_files[fd]);
+}
+
+static int io_req_set_file(struct io_ring_ctx *ctx, const struct sqe_submit *s,
+			   struct io_submit_state *state, struct io_kiocb *req)
+{
+	unsigned flags;
+	int fd;
+
+	flags = READ_ONCE(s->sqe->flags);
+	fd = READ_ONCE(s->sqe->fd);
+
+	if (flags & IOSQE_IO_DRAIN)
+		req->flags |= REQ_F_IO_DRAIN;
+	/*
+	 * All io need record the previous position, if LINK vs DARIN,
+	 * it can be used to mark the position of the first IO in the
+	 * link list.
+	 */
+	req->sequence = s->sequence;
+
+	if (!io_op_needs_file(req))
+		return 0;
+
+	if (flags & IOSQE_FIXED_FILE) {
+		req->file = io_file_get_fixed(req, fd);
+		if (unlikely(!req->file))
+			return -EBADF;
+		req->flags |= REQ_F_FIXED_FILE;
+	} else {
+		if (s->needs_fixed_file)
+			return -EBADF;
+		req->file = io_file_get(state, fd);
+		if (unlikely(!req->file))
+			return -EBADF;
+	}
+
+	return 0;
+}
+
+/*
+ * Network requests that would block aren't handed to a worker thread.
+ * Instead we arm an internal poll on the socket, and reissue the request
+ * from the submitting task (through task_work) once it becomes ready.
+ */
+static __poll_t io_op_poll_events(struct io_kiocb *req)
+{
+	switch (req->submit.opcode) {
+	case IORING_OP_RECVMSG:
+	case IORING_OP_RECV:
+	case IORING_OP_ACCEPT:
+		return EPOLLIN | EPOLLRDNORM;
+	case IORING_OP_SENDMSG:
+	case IORING_OP_SEND:
+	case IORING_OP_SEND_ZC:
+	case IORING_OP_CONNECT:
+		return EPOLLOUT | EPOLLWRNORM;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Take an internally polled request off the cancel list, returns true if
+ * io_poll_remove_one() got to it first.
+ */
+static bool io_async_poll_disarm(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	bool canceled;
+
+	spin_lock_irq(&ctx->completion_lock);
+	canceled = READ_ONCE(req->poll.canceled);
+	list_del_init(&req->list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	return canceled;
+}
+
+/*
+ * Reissue @req from the submitting task, after it was woken by its file or
+ * page. A non-zero @ret fails it instead.
+ */
+static void io_async_retry(struct io_kiocb *req, int ret)
+{
+	const struct io_uring_sqe *sqe = req->submit.sqe;
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (!ret) {
+		/* we don't hold ->uring_lock here */
+		req->submit.needs_lock = true;
+		ret = __io_submit_sqe(ctx, req, &req->submit, true);
+		if (ret == -EAGAIN || ret == -EIOCBQUEUED) {
+			io_kbuf_recycle(req, true);
+			/* waiting on another page, or polled again */
+			if (ret == -EIOCBQUEUED || io_arm_poll_handler(req))
+				return;
+			/* raced with readiness, let a worker block on it */
+			INIT_WORK(&req->work, io_sq_wq_submit_work);
+			io_queue_async_work(ctx, req);
+			return;
+		}
+	}
+
+	/* drop submission reference */
+	io_put_req(req);
+
+	if (ret) {
+		__io_cqring_add_event(ctx, sqe->user_data, ret,
+					io_put_kbuf(req));
+		if (req->flags & REQ_F_LINK)
+			req->flags |= REQ_F_FAIL_LINK;
+		io_put_req(req);
+	}
+
+	/* the retry path always uses a copy of the sqe */
+	kfree(sqe);
+}
+
+static void io_async_task_func(struct callback_head *cb)
+{
+	struct io_kiocb *req = container_of(cb, struct io_kiocb, task_work);
+	int ret = 0;
+
+	/* we own the retry now, see io_async_retry_timeout() */
+	del_timer_sync(&req->retry_timer);
+
+	if (io_async_poll_disarm(req) || (req->flags & REQ_F_CANCEL) ||
+	    (current->flags & PF_EXITING))
+		ret = -ECANCELED;
+
+	io_async_retry(req, ret);
+}
+
+static void io_async_buf_retry(struct callback_head *cb)
+{
+	struct io_kiocb *req = container_of(cb, struct io_kiocb, task_work);
+	int ret = 0;
+
+	del_timer_sync(&req->retry_timer);
+
+	if ((req->flags & REQ_F_CANCEL) || (current->flags & PF_EXITING))
+		ret = -ECANCELED;
+
+	io_async_retry(req, ret);
+}
+
+/*
+ * There's no submitting task to run the retry, or it is exiting or blocked
+ * and can't run task_work, hand the request to a worker instead.
+ */
+static void io_async_fallback_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+
+	if (io_async_poll_disarm(req))
+		req->flags |= REQ_F_CANCEL;
+
+	INIT_WORK(&req->work, io_sq_wq_submit_work);
+	io_queue_async_work(req->ctx, req);
+}
+
+/*
+ * Hand a woken request to a worker, a polled one needs disarming first while
+ * a page wait has nothing to undo.
+ */
+static void io_async_punt(struct io_kiocb *req)
+{
+	if (req->task_work.func == io_async_task_func)
+		INIT_WORK(&req->work, io_async_fallback_work);
+	else
+		INIT_WORK(&req->work, io_sq_wq_submit_work);
+	io_queue_async_work(req->ctx, req);
+}
+
+/*
+ * The submitting task didn't get to the retry in time, most likely because
+ * it's blocked in some other syscall. Take the task_work back and have a
+ * worker do it instead, unless the task is already running it.
+ */
+static void io_async_retry_timeout(struct timer_list *t)
+{
+	struct io_kiocb *req = from_timer(req, t, retry_timer);
+
+	if (task_work_cancel_cb(req->task, &req->task_work))
+		io_async_punt(req);
+}
+
+/*
+ * Retry a woken request from its submitting task, which can only run the
+ * task_work once it heads back to userspace or waits on the ring. If it
+ * doesn't within IO_ASYNC_RETRY_TIMEOUT, or is exiting, a worker takes over.
+ */
+static void io_async_task_queue(struct io_kiocb *req, task_work_func_t func)
+{
+	init_task_work(&req->task_work, func);
+
+	/* polled from a worker or the SQ thread, there's no task to run it */
+	if (!req->task) {
+		io_async_punt(req);
+		return;
+	}
+
+	/* armed first, the task_work may run and free the request any time */
+	mod_timer(&req->retry_timer, jiffies + IO_ASYNC_RETRY_TIMEOUT);
+	if (unlikely(task_work_add(req->task, &req->task_work, true))) {
+		del_timer(&req->retry_timer);
+		io_async_punt(req);
+		return;
+	}
+	wake_up_process(req->task);
+}
+
+static int io_async_buf_func(struct wait_queue_entry *wait, unsigned mode,
+			     int sync, void *arg)
+{
+	struct wait_page_queue *wpq = container_of(wait,
+					struct wait_page_queue, wait);
+	struct io_kiocb *req = container_of(wpq, struct io_kiocb, wpq);
+	struct wait_page_key *key = arg;
+	int ret;
+
+	ret = wake_page_match(wpq, key);
+	if (ret != 1)
+		return ret;
+
+	list_del_init(&wait->entry);
+	io_async_task_queue(req, io_async_buf_retry);
+	return 1;
+}
+
+/*
+ * Buffered reads from files that support it can wait for the page cache
+ * from a page lock callback, rather than from a blocked worker.
  */
-static bool io_add_to_prev_work(struct async_list *list, struct io_kiocb *req)
+static bool io_rw_should_retry(struct io_kiocb *req)
 {
-	bool ret;
+	struct kiocb *kiocb = &req->rw;
 
-	if (!list)
+	switch (req->submit.opcode) {
+	case IORING_OP_READV:
+	case IORING_OP_READ:
+	case IORING_OP_READ_FIXED:
+		break;
+	default:
 		return false;
-	if (!(req->flags & REQ_F_SEQ_PREV))
+	}
+
+	/* the SQ thread has no user context to run the retry from */
+	if (req->ctx->flags & IORING_SETUP_SQPOLL)
 		return false;
-	if (!atomic_read(&list->cnt))
+	if (req->flags & (REQ_F_NOWAIT | REQ_F_MUST_PUNT | REQ_F_BUF_WAITQ))
+		return false;
+	if (kiocb->ki_flags & IOCB_DIRECT)
 		return false;
+	return (req->file->f_mode & FMODE_BUF_RASYNC) &&
+		req->file->f_op->read_iter;
+}
 
-	ret = true;
-	spin_lock(&list->lock);
-	list_add_tail(&req->list, &list->list);
-	/*
-	 * Ensure we see a simultaneous modification from io_sq_wq_submit_work()
-	 */
-	smp_mb();
-	if (!atomic_read(&list->cnt)) {
-		list_del_init(&req->list);
-		ret = false;
-	}
+/*
+ * Reissue a read that got -EAGAIN with a page lock wait queued instead.
+ * Returns -EIOCBQUEUED if the wait got queued, -EAGAIN if a worker has to
+ * take it, or the result the read completed with. The request must already
+ * carry its own copy of the sqe.
+ */
+static int io_arm_buf_retry(struct io_kiocb *req)
+{
+	int ret;
 
-	if (ret) {
-		struct io_ring_ctx *ctx = req->ctx;
+	if (!io_rw_should_retry(req))
+		return -EAGAIN;
 
-		req->files = current->files;
+	if (!req->task)
+		req->task = get_task_struct(current);
+	req->flags |= REQ_F_BUF_WAITQ;
 
-		spin_lock_irq(&ctx->task_lock);
-		list_add(&req->task_list, &ctx->task_list);
-		req->work_task = NULL;
-		spin_unlock_irq(&ctx->task_lock);
-	}
-	spin_unlock(&list->lock);
+	ret = __io_submit_sqe(req->ctx, req, &req->submit, true);
+	if (ret == -EAGAIN || ret == -EIOCBQUEUED)
+		io_kbuf_recycle(req, req->submit.needs_lock);
+	if (ret == -EAGAIN)
+		req->flags &= ~REQ_F_BUF_WAITQ;
 	return ret;
 }
 
-static bool io_op_needs_file(struct io_kiocb *req)
+static int io_async_wake(struct wait_queue_entry *wait, unsigned mode,
+			 int sync, void *key)
 {
-	switch (req->submit.opcode) {
-	case IORING_OP_NOP:
-	case IORING_OP_POLL_REMOVE:
-	case IORING_OP_TIMEOUT:
-		return false;
-	default:
-		return true;
-	}
+	struct io_poll_iocb *poll = container_of(wait, struct io_poll_iocb,
+							wait);
+	struct io_kiocb *req = container_of(poll, struct io_kiocb, poll);
+	__poll_t mask = key_to_poll(key);
+
+	/* for instances that support it check for an event match first: */
+	if (mask && !(mask & poll->events))
+		return 0;
+
+	list_del_init(&poll->wait.entry);
+	/* still arming, io_arm_poll_handler() will see it woken and keep it */
+	if (unlikely(!poll->armed))
+		return 1;
+	io_async_task_queue(req, io_async_task_func);
+	return 1;
 }
 
-static int io_req_set_file(struct io_ring_ctx *ctx, const struct sqe_submit *s,
-			   struct io_submit_state *state, struct io_kiocb *req)
+/*
+ * Arm an internal poll for a request that got -EAGAIN. Returns false if
+ * the request can't be polled, or became ready while arming, in which
+ * case the caller punts it to a worker. The request must already carry
+ * its own copy of the sqe.
+ */
+static bool io_arm_poll_handler(struct io_kiocb *req)
 {
-	unsigned flags;
-	int fd;
-
-	flags = READ_ONCE(s->sqe->flags);
-	fd = READ_ONCE(s->sqe->fd);
+	struct io_poll_iocb *poll = &req->poll;
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_poll_table ipt;
+	bool armed = false;
+	__poll_t events, mask;
 
-	if (flags & IOSQE_IO_DRAIN)
-		req->flags |= REQ_F_IO_DRAIN;
 	/*
-	 * All io need record the previous position, if LINK vs DARIN,
-	 * it can be used to mark the position of the first IO in the
-	 * link list.
+	 * The SQPOLL thread has no user context to run the retry from, only
+	 * multishot requests are polled there and their wakeup goes to a
+	 * worker.
 	 */
-	req->sequence = s->sequence;
+	if ((ctx->flags & IORING_SETUP_SQPOLL) && !io_req_multishot(req))
+		return false;
+	events = io_op_poll_events(req);
+	if (!events || !req->file->f_op->poll)
+		return false;
 
-	if (!io_op_needs_file(req))
-		return 0;
+	if (!req->task && !(ctx->flags & IORING_SETUP_SQPOLL) &&
+	    !(current->flags & PF_WQ_WORKER))
+		req->task = get_task_struct(current);
+	req->flags |= REQ_F_POLLED;
+	INIT_WORK(&req->work, io_sq_wq_submit_work);
 
-	if (flags & IOSQE_FIXED_FILE) {
-		if (unlikely(!ctx->user_files ||
-		    (unsigned) fd >= ctx->nr_user_files))
-			return -EBADF;
-		req->file = ctx->user_files[fd];
-		req->flags |= REQ_F_FIXED_FILE;
-	} else {
-		if (s->needs_fixed_file)
-			return -EBADF;
-		req->file = io_file_get(state, fd);
-		if (unlikely(!req->file))
-			return -EBADF;
+	poll->events = events | EPOLLERR | EPOLLHUP;
+	poll->head = NULL;
+	poll->done = false;
+	poll->canceled = false;
+	poll->armed = false;
+
+	ipt.pt._qproc = io_poll_queue_proc;
+	ipt.pt._key = poll->events;
+	ipt.req = req;
+	ipt.error = -EINVAL;
+
+	INIT_LIST_HEAD(&poll->wait.entry);
+	init_waitqueue_func_entry(&poll->wait, io_async_wake);
+	INIT_LIST_HEAD(&req->list);
+
+	mask = vfs_poll(req->file, &ipt.pt) & poll->events;
+
+	spin_lock_irq(&ctx->completion_lock);
+	if (likely(poll->head)) {
+		spin_lock(&poll->head->lock);
+		/*
+		 * Until ->armed is set a wakeup leaves the request to us, so
+		 * nobody else can queue it while we still look at it.
+		 */
+		if (!list_empty(&poll->wait.entry) && !mask && !ipt.error) {
+			list_add_tail(&req->list, &ctx->cancel_list);
+			poll->armed = true;
+			armed = true;
+		} else {
+			list_del_init(&poll->wait.entry);
+		}
+		spin_unlock(&poll->head->lock);
 	}
+	spin_unlock_irq(&ctx->completion_lock);
 
-	return 0;
+	return armed;
 }
 
 static int __io_queue_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req,
@@ -2466,6 +4607,10 @@ static int __io_queue_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req,
 
 	ret = __io_submit_sqe(ctx, req, s, true);
 
+	/* don't pin a provided buffer while waiting for the file */
+	if (ret == -EAGAIN)
+		io_kbuf_recycle(req, s->needs_lock);
+
 	/*
 	 * We async punt it if the file wasn't marked NOWAIT, or if the file
 	 * doesn't support non-blocking read/write attempts
@@ -2480,6 +4625,20 @@ static int __io_queue_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req,
 
 			s->sqe = sqe_copy;
 			memcpy(&req->submit, s, sizeof(*s));
+
+			if (!(req->flags & REQ_F_MUST_PUNT)) {
+				if (io_arm_poll_handler(req))
+					return 0;
+				ret = io_arm_buf_retry(req);
+				if (ret == -EIOCBQUEUED)
+					return 0;
+				if (ret != -EAGAIN) {
+					/* completed after all */
+					kfree(sqe_copy);
+					goto done;
+				}
+			}
+
 			list = io_async_list_from_req(ctx, req);
 			if (!io_add_to_prev_work(list, req)) {
 				if (list)
@@ -2496,12 +4655,14 @@ static int __io_queue_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req,
 		}
 	}
 
+done:
 	/* drop submission reference */
 	io_put_req(req);
 
 	/* and drop final reference, if we failed */
 	if (ret) {
-		io_cqring_add_event(ctx, req->user_data, ret);
+		__io_cqring_add_event(ctx, req->user_data, ret,
+					io_put_kbuf(req));
 		if (req->flags & REQ_F_LINK)
 			req->flags |= REQ_F_FAIL_LINK;
 		io_put_req(req);
@@ -2569,7 +4730,8 @@ static int io_queue_link_head(struct io_ring_ctx *ctx, struct io_kiocb *req,
 	return 0;
 }
 
-#define SQE_VALID_FLAGS	(IOSQE_FIXED_FILE|IOSQE_IO_DRAIN|IOSQE_IO_LINK)
+#define SQE_VALID_FLAGS	(IOSQE_FIXED_FILE|IOSQE_IO_DRAIN|IOSQE_IO_LINK|	\
+				IOSQE_BUFFER_SELECT)
 
 static void io_submit_sqe(struct io_ring_ctx *ctx, struct sqe_submit *s,
 			  struct io_submit_state *state, struct io_kiocb **link)
@@ -2602,22 +4764,24 @@ static void io_submit_sqe(struct io_ring_ctx *ctx, struct sqe_submit *s,
 
 	req->user_data = s->sqe->user_data;
 
-#if defined(CONFIG_NET)
-	switch (req->submit.opcode) {
-	case IORING_OP_SENDMSG:
-	case IORING_OP_RECVMSG:
-		spin_lock(&current->fs->lock);
-		if (!current->fs->in_exec) {
-			req->fs = current->fs;
-			req->fs->users++;
-		}
-		spin_unlock(&current->fs->lock);
-		if (!req->fs) {
-			ret = -EAGAIN;
+	if (s->sqe->flags & IOSQE_BUFFER_SELECT) {
+		if (!io_op_can_select_buffer(req)) {
+			ret = -EINVAL;
 			goto err_req;
 		}
+		req->flags |= REQ_F_BUFFER_SELECT;
+	}
+
+	if (io_op_needs_files(req)) {
+		ret = io_grab_files(ctx, req, s);
+		if (ret)
+			goto err_req;
+	}
+	if (io_op_needs_fs(req)) {
+		ret = io_grab_fs(req);
+		if (ret)
+			goto err_req;
 	}
-#endif
 
 	/*
 	 * If we already have a head request, queue this one for async
@@ -2781,6 +4945,8 @@ static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int nr,
 			s.has_user = has_user;
 			s.needs_lock = true;
 			s.needs_fixed_file = true;
+			s.ring_file = NULL;
+			s.ring_fd = -1;
 			io_submit_sqe(ctx, &s, statep, &link);
 			submitted++;
 		}
@@ -2794,139 +4960,228 @@ static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int nr,
 	return submitted;
 }
 
+static void io_sq_thread_drop_mm(struct mm_struct **cur_mm)
+{
+	if (*cur_mm) {
+		unuse_mm(*cur_mm);
+		mmput(*cur_mm);
+		*cur_mm = NULL;
+	}
+}
+
+/*
+ * Switch the SQ thread to the mm of the ring owner, dropping the one of
+ * the previous ring visited. Returns false if the owner's mm is gone.
+ */
+static bool io_sq_thread_acquire_mm(struct io_ring_ctx *ctx,
+				    struct mm_struct **cur_mm)
+{
+	if (*cur_mm == ctx->sqo_mm)
+		return true;
+
+	io_sq_thread_drop_mm(cur_mm);
+	if (!mmget_not_zero(ctx->sqo_mm))
+		return false;
+	use_mm(ctx->sqo_mm);
+	*cur_mm = ctx->sqo_mm;
+	return true;
+}
+
+static bool io_sq_cq_futex_pending(struct io_ring_ctx *ctx)
+{
+	return READ_ONCE(ctx->cq_futex) &&
+		READ_ONCE(ctx->cached_cq_tail) != ctx->cq_futex_tail;
+}
+
+/*
+ * Publish new completions to the registered CQ futex word, grabbing the
+ * ring owner's mm if we don't hold it already. Returns true if the word
+ * was updated.
+ */
+static bool io_sq_cq_futex_notify(struct io_ring_ctx *ctx,
+				  struct mm_struct **cur_mm)
+{
+	u32 __user *uaddr = READ_ONCE(ctx->cq_futex);
+	unsigned tail = READ_ONCE(ctx->cached_cq_tail);
+
+	if (!uaddr || tail == ctx->cq_futex_tail)
+		return false;
+
+	if (!io_sq_thread_acquire_mm(ctx, cur_mm))
+		return false;
+
+	ctx->cq_futex_tail = tail;
+	if (put_user(tail, uaddr))
+		return false;
+	do_futex(uaddr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, INT_MAX, NULL, NULL,
+			0, 0);
+	return true;
+}
+
+/*
+ * Max number of SQEs the SQ thread takes from one ring per pass, if it's
+ * serving more than one. Keeps a busy ring from starving the others.
+ */
+#define IORING_SQPOLL_CAP_ENTRIES	8
+
+/*
+ * One pass of the SQ thread over @ctx: reap polled completions and submit
+ * up to @budget new SQEs. Returns true if the ring still has work pending.
+ */
+static bool __io_sq_thread(struct io_ring_ctx *ctx, unsigned budget,
+			   struct mm_struct **cur_mm)
+{
+	const struct cred *old_cred;
+	unsigned int to_submit;
+	bool mm_fault;
+	u64 start;
+
+	old_cred = override_creds(ctx->creds);
+
+	if (ctx->sq_inflight) {
+		unsigned nr_events = 0;
+
+		if (ctx->flags & IORING_SETUP_IOPOLL) {
+			/*
+			 * sq_inflight is the count of the maximum possible
+			 * entries we submitted, but it can be smaller if we
+			 * dropped some of them. If we don't have poll entries
+			 * available, then we know that we have nothing left to
+			 * poll for. Reset the inflight count to zero in that
+			 * case.
+			 */
+			mutex_lock(&ctx->uring_lock);
+			if (!list_empty(&ctx->poll_list))
+				io_iopoll_getevents(ctx, &nr_events, 0);
+			else
+				ctx->sq_inflight = 0;
+			mutex_unlock(&ctx->uring_lock);
+		} else {
+			/*
+			 * Normal IO, just pretend everything completed.
+			 * We don't have to poll completions for that.
+			 */
+			nr_events = ctx->sq_inflight;
+		}
+
+		ctx->sq_inflight -= min(nr_events, ctx->sq_inflight);
+	}
+
+	to_submit = io_sqring_entries(ctx);
+	if (to_submit) {
+		start = ktime_get_ns();
+
+		/* Unless all new commands are FIXED regions, grab mm */
+		mm_fault = !io_sq_thread_acquire_mm(ctx, cur_mm);
+
+		to_submit = min3(to_submit, ctx->sq_entries, budget);
+		to_submit = io_submit_sqes(ctx, to_submit, !mm_fault, mm_fault);
+		ctx->sq_inflight += to_submit;
+
+		/* Commit SQ ring head once we've consumed all SQEs */
+		io_commit_sqring(ctx);
+
+		ctx->sq_submitted += to_submit;
+		ctx->sq_passes++;
+		ctx->sq_busy_ns += ktime_get_ns() - start;
+	}
+
+	/* spin on the ring's sockets too, rather than wait for their irqs */
+	io_napi_poll(ctx);
+
+	io_sq_cq_futex_notify(ctx, cur_mm);
+	revert_creds(old_cred);
+
+	return to_submit || ctx->sq_inflight;
+}
+
 static int io_sq_thread(void *data)
 {
-	struct io_ring_ctx *ctx = data;
+	struct io_sq_data *sqd = data;
 	struct mm_struct *cur_mm = NULL;
-	const struct cred *old_cred;
+	struct io_ring_ctx *ctx;
+	unsigned long timeout = 0;
 	mm_segment_t old_fs;
 	DEFINE_WAIT(wait);
-	unsigned inflight;
-	unsigned long timeout;
 
-	complete(&ctx->sqo_thread_started);
+	complete(&sqd->started);
 
 	old_fs = get_fs();
 	set_fs(USER_DS);
-	old_cred = override_creds(ctx->creds);
 
-	timeout = inflight = 0;
+	/*
+	 * ->lock is held while visiting the rings, and dropped whenever we
+	 * reschedule or sleep so rings can be attached and detached.
+	 */
+	mutex_lock(&sqd->lock);
 	while (!kthread_should_park()) {
-		bool mm_fault = false;
-		unsigned int to_submit;
-
-		if (inflight) {
-			unsigned nr_events = 0;
+		unsigned budget = IORING_SQPOLL_CAP_ENTRIES;
+		bool busy = false, needs_sched;
 
-			if (ctx->flags & IORING_SETUP_IOPOLL) {
-				/*
-				 * inflight is the count of the maximum possible
-				 * entries we submitted, but it can be smaller
-				 * if we dropped some of them. If we don't have
-				 * poll entries available, then we know that we
-				 * have nothing left to poll for. Reset the
-				 * inflight count to zero in that case.
-				 */
-				mutex_lock(&ctx->uring_lock);
-				if (!list_empty(&ctx->poll_list))
-					io_iopoll_getevents(ctx, &nr_events, 0);
-				else
-					inflight = 0;
-				mutex_unlock(&ctx->uring_lock);
-			} else {
-				/*
-				 * Normal IO, just pretend everything completed.
-				 * We don't have to poll completions for that.
-				 */
-				nr_events = inflight;
-			}
+		if (list_is_singular(&sqd->ctx_list))
+			budget = UINT_MAX;
 
-			inflight -= nr_events;
-			if (!inflight)
-				timeout = jiffies + ctx->sq_thread_idle;
-		}
+		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
+			busy |= __io_sq_thread(ctx, budget, &cur_mm);
 
-		to_submit = io_sqring_entries(ctx);
-		if (!to_submit) {
-			/*
-			 * Drop cur_mm before scheduling, we can't hold it for
-			 * long periods (or over schedule()). Do this before
-			 * adding ourselves to the waitqueue, as the unuse/drop
-			 * may sleep.
-			 */
-			if (cur_mm) {
-				unuse_mm(cur_mm);
-				mmput(cur_mm);
-				cur_mm = NULL;
-			}
+		if (busy)
+			timeout = jiffies + sqd->sq_thread_idle;
 
-			/*
-			 * We're polling. If we're within the defined idle
-			 * period, then let us spin without work before going
-			 * to sleep.
-			 */
-			if (inflight || !time_after(jiffies, timeout)) {
-				cond_resched();
-				continue;
-			}
+		/*
+		 * We're polling. If we're within the defined idle period, then
+		 * let us spin without work before going to sleep. Drop cur_mm
+		 * if we're idle, we can't hold it for long periods (or over
+		 * schedule()). Do this before adding ourselves to the
+		 * waitqueue, as the unuse/drop may sleep.
+		 */
+		if (!busy)
+			io_sq_thread_drop_mm(&cur_mm);
+		if (busy || !time_after(jiffies, timeout)) {
+			mutex_unlock(&sqd->lock);
+			cond_resched();
+			mutex_lock(&sqd->lock);
+			continue;
+		}
 
-			prepare_to_wait(&ctx->sqo_wait, &wait,
-						TASK_INTERRUPTIBLE);
+		prepare_to_wait(&sqd->wait, &wait, TASK_INTERRUPTIBLE);
 
+		needs_sched = true;
+		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list) {
 			/* Tell userspace we may need a wakeup call */
 			ctx->rings->sq_flags |= IORING_SQ_NEED_WAKEUP;
 			/* make sure to read SQ tail after writing flags */
 			smp_mb();
 
-			to_submit = io_sqring_entries(ctx);
-			if (!to_submit) {
-				if (kthread_should_park()) {
-					finish_wait(&ctx->sqo_wait, &wait);
-					break;
-				}
-				if (signal_pending(current))
-					flush_signals(current);
-				schedule();
-				finish_wait(&ctx->sqo_wait, &wait);
-
-				ctx->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
-				continue;
-			}
-			finish_wait(&ctx->sqo_wait, &wait);
-
-			ctx->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
+			/* also wake for completions not yet published */
+			if (io_sqring_entries(ctx) ||
+			    io_sq_cq_futex_pending(ctx))
+				needs_sched = false;
 		}
 
-		/* Unless all new commands are FIXED regions, grab mm */
-		if (!cur_mm) {
-			mm_fault = !mmget_not_zero(ctx->sqo_mm);
-			if (!mm_fault) {
-				use_mm(ctx->sqo_mm);
-				cur_mm = ctx->sqo_mm;
-			}
+		if (needs_sched && !kthread_should_park()) {
+			if (signal_pending(current))
+				flush_signals(current);
+			mutex_unlock(&sqd->lock);
+			schedule();
+			mutex_lock(&sqd->lock);
 		}
+		finish_wait(&sqd->wait, &wait);
 
-		to_submit = min(to_submit, ctx->sq_entries);
-		inflight += io_submit_sqes(ctx, to_submit, cur_mm != NULL,
-					   mm_fault);
-
-		/* Commit SQ ring head once we've consumed all SQEs */
-		io_commit_sqring(ctx);
+		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
+			ctx->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
 	}
+	mutex_unlock(&sqd->lock);
 
+	io_sq_thread_drop_mm(&cur_mm);
 	set_fs(old_fs);
-	if (cur_mm) {
-		unuse_mm(cur_mm);
-		mmput(cur_mm);
-	}
-	revert_creds(old_cred);
 
 	kthread_parkme();
 
 	return 0;
 }
 
-static int io_ring_submit(struct io_ring_ctx *ctx, unsigned int to_submit)
+static int io_ring_submit(struct io_ring_ctx *ctx, unsigned int to_submit,
+			  struct file *ring_file, int ring_fd)
 {
 	struct io_submit_state state, *statep = NULL;
 	struct io_kiocb *link = NULL;
@@ -2971,6 +5226,8 @@ static int io_ring_submit(struct io_ring_ctx *ctx, unsigned int to_submit)
 		s.has_user = true;
 		s.needs_lock = false;
 		s.needs_fixed_file = false;
+		s.ring_file = ring_file;
+		s.ring_fd = ring_fd;
 		submit++;
 		io_submit_sqe(ctx, &s, statep, &link);
 	}
@@ -2981,6 +5238,7 @@ static int io_ring_submit(struct io_ring_ctx *ctx, unsigned int to_submit)
 		io_submit_state_end(statep);
 
 	io_commit_sqring(ctx);
+	ctx->sq_submitted += submit;
 
 	return submit;
 }
@@ -3020,9 +5278,46 @@ static int io_wake_function(struct wait_queue_entry *curr, unsigned int mode,
 /*
  * Wait until events become available, if we don't already have some. The
  * application must reap them itself, as they reside on the shared cq ring.
+ * The waitqueue callback only wakes us once min_events are there, and
+ * @timeout is an absolute CLOCK_MONOTONIC deadline, or KTIME_MAX.
  */
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/*
+ * Busy poll the NAPI contexts of @ctx until enough events are posted, the
+ * registered busy poll time or @timeout runs out, or we should schedule.
+ */
+static void io_napi_busy_wait(struct io_ring_ctx *ctx,
+			      struct io_wait_queue *iowq, ktime_t timeout)
+{
+	unsigned int busy_poll_to = READ_ONCE(ctx->napi_busy_poll_to);
+	u64 end;
+
+	if (!busy_poll_to)
+		return;
+
+	end = ktime_get_ns() + (u64) busy_poll_to * NSEC_PER_USEC;
+	if (timeout != KTIME_MAX)
+		end = min_t(u64, end, ktime_to_ns(timeout));
+
+	while (io_napi_poll(ctx)) {
+		if (current->task_works)
+			task_work_run();
+		if (io_should_wake(iowq) || signal_pending(current) ||
+		    need_resched() || ktime_get_ns() >= end)
+			break;
+	}
+}
+#else
+static inline void io_napi_busy_wait(struct io_ring_ctx *ctx,
+				     struct io_wait_queue *iowq,
+				     ktime_t timeout)
+{
+}
+#endif
+
 static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
-			  const sigset_t __user *sig, size_t sigsz)
+			  const sigset_t __user *sig, size_t sigsz,
+			  ktime_t timeout)
 {
 	struct io_wait_queue iowq = {
 		.wq = {
@@ -3036,6 +5331,9 @@ static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
 	struct io_rings *rings = ctx->rings;
 	int ret;
 
+	/* poll retries may post the events we are about to wait for */
+	if (current->task_works)
+		task_work_run();
 	if (io_cqring_events(rings) >= min_events)
 		return 0;
 
@@ -3054,12 +5352,25 @@ static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
 
 	ret = 0;
 	iowq.nr_timeouts = atomic_read(&ctx->cq_timeouts);
+	io_napi_busy_wait(ctx, &iowq, timeout);
 	do {
 		prepare_to_wait_exclusive(&ctx->wait, &iowq.wq,
 						TASK_INTERRUPTIBLE);
+		if (current->task_works) {
+			__set_current_state(TASK_RUNNING);
+			task_work_run();
+			continue;
+		}
 		if (io_should_wake(&iowq))
 			break;
-		schedule();
+		if (timeout != KTIME_MAX) {
+			if (!schedule_hrtimeout(&timeout, HRTIMER_MODE_ABS)) {
+				ret = -ETIME;
+				break;
+			}
+		} else {
+			schedule();
+		}
 		if (signal_pending(current)) {
 			ret = -ERESTARTSYS;
 			break;
@@ -3088,15 +5399,26 @@ static void __io_sqe_files_unregister(struct io_ring_ctx *ctx)
 	int i;
 
 	for (i = 0; i < ctx->nr_user_files; i++)
-		fput(ctx->user_files[i]);
+		if (ctx->user_files[i])
+			fput(ctx->user_files[i]);
 #endif
 }
 
 static int io_sqe_files_unregister(struct io_ring_ctx *ctx)
 {
-	if (!ctx->user_files)
+	struct fixed_file_data *data = ctx->file_data;
+
+	if (!data)
 		return -ENXIO;
 
+	/* wait for the files of replaced slots to be put */
+	percpu_ref_kill(&data->node->refs);
+	percpu_ref_kill(&data->refs);
+	wait_for_completion(&data->done);
+	percpu_ref_exit(&data->refs);
+	kfree(data);
+	ctx->file_data = NULL;
+
 	__io_sqe_files_unregister(ctx);
 	kfree(ctx->user_files);
 	ctx->user_files = NULL;
@@ -3104,19 +5426,122 @@ static int io_sqe_files_unregister(struct io_ring_ctx *ctx)
 	return 0;
 }
 
+static void io_put_sq_data(struct io_sq_data *sqd)
+{
+	mutex_lock(&io_sqd_mutex);
+	if (!refcount_dec_and_test(&sqd->refs)) {
+		mutex_unlock(&io_sqd_mutex);
+		return;
+	}
+	list_del(&sqd->node);
+	mutex_unlock(&io_sqd_mutex);
+
+	wait_for_completion(&sqd->started);
+	/*
+	 * The park is a bit of a work-around, without it we get
+	 * warning spews on shutdown with SQPOLL set and affinity
+	 * set to a single CPU.
+	 */
+	kthread_park(sqd->thread);
+	kthread_stop(sqd->thread);
+#ifdef CONFIG_CGROUPS
+	cgroup_put(sqd->cgrp);
+#endif
+	kfree(sqd);
+}
+
+/* the SQ thread idles as long as the most patient ring asked for */
+static void io_sqd_update_thread_idle(struct io_sq_data *sqd)
+{
+	struct io_ring_ctx *ctx;
+	unsigned sq_thread_idle = 0;
+
+	list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
+		sq_thread_idle = max(sq_thread_idle, ctx->sq_thread_idle);
+	sqd->sq_thread_idle = sq_thread_idle;
+}
+
 static void io_sq_thread_stop(struct io_ring_ctx *ctx)
 {
-	if (ctx->sqo_thread) {
-		wait_for_completion(&ctx->sqo_thread_started);
-		/*
-		 * The park is a bit of a work-around, without it we get
-		 * warning spews on shutdown with SQPOLL set and affinity
-		 * set to a single CPU.
-		 */
-		kthread_park(ctx->sqo_thread);
-		kthread_stop(ctx->sqo_thread);
-		ctx->sqo_thread = NULL;
+	struct io_sq_data *sqd = ctx->sq_data;
+
+	if (sqd) {
+		/* the thread holds ->lock while it's looking at the ring */
+		mutex_lock(&sqd->lock);
+		list_del_init(&ctx->sqd_list);
+		io_sqd_update_thread_idle(sqd);
+		mutex_unlock(&sqd->lock);
+
+		ctx->sq_data = NULL;
+		io_put_sq_data(sqd);
+	}
+}
+
+/*
+ * Find the shared SQ thread for @cpu (-1 if unbound) and the cgroup of the
+ * caller, or set up a new one. The thread is created but not yet woken.
+ */
+static struct io_sq_data *io_get_sq_data(struct io_uring_params *p, int cpu)
+{
+	struct cgroup *cgrp = NULL;
+	struct io_sq_data *sqd;
+	int ret;
+
+	mutex_lock(&io_sqd_mutex);
+#ifdef CONFIG_CGROUPS
+	rcu_read_lock();
+	cgrp = task_dfl_cgroup(current);
+	cgroup_get(cgrp);
+	rcu_read_unlock();
+#endif
+	if (p->flags & IORING_SETUP_SQ_SHARED) {
+		list_for_each_entry(sqd, &io_sqd_list, node) {
+			if (sqd->cpu != cpu || sqd->cgrp != cgrp)
+				continue;
+			refcount_inc(&sqd->refs);
+			goto out;
+		}
+	}
+
+	ret = -ENOMEM;
+	sqd = kzalloc(sizeof(*sqd), GFP_KERNEL);
+	if (!sqd)
+		goto err;
+
+	refcount_set(&sqd->refs, 1);
+	INIT_LIST_HEAD(&sqd->node);
+	mutex_init(&sqd->lock);
+	INIT_LIST_HEAD(&sqd->ctx_list);
+	init_waitqueue_head(&sqd->wait);
+	init_completion(&sqd->started);
+	sqd->cpu = cpu;
+
+	if (cpu >= 0)
+		sqd->thread = kthread_create_on_cpu(io_sq_thread, sqd, cpu,
+							"io_uring-sq");
+	else
+		sqd->thread = kthread_create(io_sq_thread, sqd, "io_uring-sq");
+	if (IS_ERR(sqd->thread)) {
+		ret = PTR_ERR(sqd->thread);
+		kfree(sqd);
+		goto err;
 	}
+
+	/* hand our cgroup reference over to the new thread */
+	sqd->cgrp = cgrp;
+	cgrp = NULL;
+	if (p->flags & IORING_SETUP_SQ_SHARED)
+		list_add(&sqd->node, &io_sqd_list);
+out:
+#ifdef CONFIG_CGROUPS
+	if (cgrp)
+		cgroup_put(cgrp);
+#endif
+	mutex_unlock(&io_sqd_mutex);
+	return sqd;
+err:
+	sqd = ERR_PTR(ret);
+	goto out;
 }
 
 static void io_finish_async(struct io_ring_ctx *ctx)
@@ -3125,112 +5550,460 @@ static void io_finish_async(struct io_ring_ctx *ctx)
 
 	io_sq_thread_stop(ctx);
 
-	for (i = 0; i < ARRAY_SIZE(ctx->sqo_wq); i++) {
-		if (ctx->sqo_wq[i]) {
-			destroy_workqueue(ctx->sqo_wq[i]);
-			ctx->sqo_wq[i] = NULL;
+	for (i = 0; i < ARRAY_SIZE(ctx->sqo_wq); i++) {
+		if (ctx->sqo_wq[i]) {
+			destroy_workqueue(ctx->sqo_wq[i]);
+			ctx->sqo_wq[i] = NULL;
+		}
+	}
+}
+
+#if defined(CONFIG_UNIX)
+static void io_destruct_skb(struct sk_buff *skb)
+{
+	struct io_ring_ctx *ctx = skb->sk->sk_user_data;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->sqo_wq); i++)
+		if (ctx->sqo_wq[i])
+			flush_workqueue(ctx->sqo_wq[i]);
+
+	unix_destruct_scm(skb);
+}
+
+/*
+ * Ensure the UNIX gc is aware of our file set, so we are certain that
+ * the io_uring can be safely unregistered on process exit, even if we have
+ * loops in the file referencing.
+ */
+static int __io_sqe_files_scm(struct io_ring_ctx *ctx, int nr, int offset)
+{
+	struct sock *sk = ctx->ring_sock->sk;
+	struct scm_fp_list *fpl;
+	struct sk_buff *skb;
+	int i, nr_files;
+
+	fpl = kzalloc(sizeof(*fpl), GFP_KERNEL);
+	if (!fpl)
+		return -ENOMEM;
+
+	skb = alloc_skb(0, GFP_KERNEL);
+	if (!skb) {
+		kfree(fpl);
+		return -ENOMEM;
+	}
+
+	skb->sk = sk;
+
+	nr_files = 0;
+	fpl->user = get_uid(ctx->user);
+	for (i = 0; i < nr; i++) {
+		struct file *file = ctx->user_files[i + offset];
+
+		if (!file)
+			continue;
+		fpl->fp[nr_files] = get_file(file);
+		unix_inflight(fpl->user, fpl->fp[nr_files]);
+		nr_files++;
+	}
+
+	if (nr_files) {
+		fpl->max = SCM_MAX_FD;
+		fpl->count = nr_files;
+		UNIXCB(skb).fp = fpl;
+		skb->destructor = io_destruct_skb;
+		refcount_add(skb->truesize, &sk->sk_wmem_alloc);
+		skb_queue_head(&sk->sk_receive_queue, skb);
+
+		for (i = 0; i < nr_files; i++)
+			fput(fpl->fp[i]);
+	} else {
+		kfree_skb(skb);
+		free_uid(fpl->user);
+		kfree(fpl);
+	}
+
+	return 0;
+}
+
+/*
+ * If UNIX sockets are enabled, fd passing can cause a reference cycle which
+ * causes regular reference counting to break down. We rely on the UNIX
+ * garbage collection to take care of this problem for us.
+ */
+static int io_sqe_files_scm(struct io_ring_ctx *ctx)
+{
+	unsigned left, total;
+	int ret = 0;
+
+	total = 0;
+	left = ctx->nr_user_files;
+	while (left) {
+		unsigned this_files = min_t(unsigned, left, SCM_MAX_FD);
+
+		ret = __io_sqe_files_scm(ctx, this_files, total);
+		if (ret)
+			break;
+		left -= this_files;
+		total += this_files;
+	}
+
+	if (!ret)
+		return 0;
+
+	while (total < ctx->nr_user_files) {
+		if (ctx->user_files[total])
+			fput(ctx->user_files[total]);
+		total++;
+	}
+
+	return ret;
+}
+
+/*
+ * Hand the table's reference to a newly installed file over to the ring
+ * socket, merging it into the SCM_RIGHTS set of an existing skb if there's
+ * room.
+ */
+static int io_ring_file_add(struct io_ring_ctx *ctx, struct file *file,
+			    unsigned index)
+{
+	struct sock *sock = ctx->ring_sock->sk;
+	struct sk_buff_head *head = &sock->sk_receive_queue;
+	struct sk_buff *skb;
+
+	spin_lock_irq(&head->lock);
+	skb = skb_peek(head);
+	if (skb) {
+		struct scm_fp_list *fpl = UNIXCB(skb).fp;
+
+		if (fpl->count < SCM_MAX_FD) {
+			__skb_unlink(skb, head);
+			spin_unlock_irq(&head->lock);
+			fpl->fp[fpl->count] = get_file(file);
+			unix_inflight(fpl->user, fpl->fp[fpl->count]);
+			fpl->count++;
+			spin_lock_irq(&head->lock);
+			__skb_queue_head(head, skb);
+		} else {
+			skb = NULL;
+		}
+	}
+	spin_unlock_irq(&head->lock);
+
+	if (skb) {
+		fput(file);
+		return 0;
+	}
+
+	return __io_sqe_files_scm(ctx, 1, index);
+}
+
+/* drop the reference to a file that left the table, see io_ring_file_add() */
+static void io_ring_file_put(struct io_ring_ctx *ctx, struct file *file)
+{
+	struct sock *sock = ctx->ring_sock->sk;
+	struct sk_buff_head list, *head = &sock->sk_receive_queue;
+	struct sk_buff *skb;
+	int i;
+
+	__skb_queue_head_init(&list);
+
+	/*
+	 * Find the skb that holds this file in its SCM_RIGHTS. When found,
+	 * remove this entry and rearrange the file array.
+	 */
+	while ((skb = skb_dequeue(head)) != NULL) {
+		struct scm_fp_list *fp = UNIXCB(skb).fp;
+
+		for (i = 0; i < fp->count; i++) {
+			int left;
+
+			if (fp->fp[i] != file)
+				continue;
+
+			unix_notinflight(fp->user, fp->fp[i]);
+			left = fp->count - 1 - i;
+			if (left) {
+				memmove(&fp->fp[i], &fp->fp[i + 1],
+						left * sizeof(struct file *));
+			}
+			fp->count--;
+			fput(file);
+			file = NULL;
+			break;
+		}
+
+		if (fp->count)
+			__skb_queue_tail(&list, skb);
+		else
+			kfree_skb(skb);
+		if (!file)
+			break;
+	}
+
+	spin_lock_irq(&head->lock);
+	while ((skb = __skb_dequeue(&list)) != NULL)
+		__skb_queue_tail(head, skb);
+	spin_unlock_irq(&head->lock);
+}
+#else
+static int io_sqe_files_scm(struct io_ring_ctx *ctx)
+{
+	return 0;
+}
+
+static int io_ring_file_add(struct io_ring_ctx *ctx, struct file *file,
+			    unsigned index)
+{
+	return 0;
+}
+
+static void io_ring_file_put(struct io_ring_ctx *ctx, struct file *file)
+{
+	fput(file);
+}
+#endif
+
+static void io_file_put_work(struct work_struct *work)
+{
+	struct fixed_file_ref_node *ref_node;
+	struct fixed_file_data *file_data;
+	struct io_file_put *pfile, *tmp;
+
+	ref_node = container_of(work, struct fixed_file_ref_node, work);
+	file_data = ref_node->file_data;
+
+	list_for_each_entry_safe(pfile, tmp, &ref_node->file_list, list) {
+		list_del(&pfile->list);
+		io_ring_file_put(file_data->ctx, pfile->file);
+		kfree(pfile);
+	}
+
+	percpu_ref_exit(&ref_node->refs);
+	kfree(ref_node);
+	percpu_ref_put(&file_data->refs);
+}
+
+static void io_file_ref_node_zero(struct percpu_ref *ref)
+{
+	struct fixed_file_ref_node *ref_node;
+
+	ref_node = container_of(ref, struct fixed_file_ref_node, refs);
+	/* may be called from RCU callback context, putting files can sleep */
+	queue_work(system_wq, &ref_node->work);
+}
+
+static void io_file_data_ref_zero(struct percpu_ref *ref)
+{
+	struct fixed_file_data *data;
+
+	data = container_of(ref, struct fixed_file_data, refs);
+	complete(&data->done);
+}
+
+static struct fixed_file_ref_node *io_alloc_file_ref_node(struct io_ring_ctx *ctx)
+{
+	struct fixed_file_ref_node *ref_node;
+
+	ref_node = kzalloc(sizeof(*ref_node), GFP_KERNEL);
+	if (!ref_node)
+		return NULL;
+
+	if (percpu_ref_init(&ref_node->refs, io_file_ref_node_zero, 0,
+			    GFP_KERNEL)) {
+		kfree(ref_node);
+		return NULL;
+	}
+	INIT_LIST_HEAD(&ref_node->file_list);
+	INIT_WORK(&ref_node->work, io_file_put_work);
+	ref_node->file_data = ctx->file_data;
+	return ref_node;
+}
+
+static void io_free_file_ref_node(struct fixed_file_ref_node *ref_node)
+{
+	percpu_ref_exit(&ref_node->refs);
+	kfree(ref_node);
+}
+
+/*
+ * Make @ref_node the current node. The files queued on the old one are put
+ * once the requests that looked them up are gone.
+ */
+static void io_fixed_file_switch_node(struct io_ring_ctx *ctx,
+				      struct fixed_file_ref_node *ref_node)
+{
+	struct fixed_file_data *data = ctx->file_data;
+	struct fixed_file_ref_node *old = data->node;
+
+	percpu_ref_get(&data->refs);
+	/* pairs with smp_rmb() in io_file_get_fixed() */
+	smp_store_release(&data->node, ref_node);
+	percpu_ref_kill(&old->refs);
+}
+
+/*
+ * Install @file, or clear the slot if it's NULL, consuming the caller's
+ * reference. A file previously in the slot is queued on the current ref
+ * node, and the caller has to switch to *new_node once done updating.
+ * Called with ->uring_lock held.
+ */
+static int io_fixed_file_set(struct io_ring_ctx *ctx, unsigned index,
+			     struct file *file,
+			     struct fixed_file_ref_node **new_node)
+{
+	struct file *old = ctx->user_files[index];
+	struct io_file_put *pfile;
+	int ret;
+
+	/* see io_sqe_files_register() */
+	ret = -EBADF;
+	if (file && file->f_op == &io_uring_fops)
+		goto err;
+
+	if (old) {
+		ret = -ENOMEM;
+		if (!*new_node) {
+			*new_node = io_alloc_file_ref_node(ctx);
+			if (!*new_node)
+				goto err;
+		}
+		pfile = kmalloc(sizeof(*pfile), GFP_KERNEL);
+		if (!pfile)
+			goto err;
+		pfile->file = old;
+		list_add(&pfile->list, &ctx->file_data->node->file_list);
+		WRITE_ONCE(ctx->user_files[index], NULL);
+	}
+
+	if (file) {
+		WRITE_ONCE(ctx->user_files[index], file);
+		ret = io_ring_file_add(ctx, file, index);
+		if (ret) {
+			WRITE_ONCE(ctx->user_files[index], NULL);
+			goto err;
 		}
 	}
+	return 0;
+err:
+	if (file)
+		fput(file);
+	return ret;
 }
 
-#if defined(CONFIG_UNIX)
-static void io_destruct_skb(struct sk_buff *skb)
+static void io_fixed_file_update_done(struct io_ring_ctx *ctx,
+				      struct fixed_file_ref_node *new_node)
 {
-	struct io_ring_ctx *ctx = skb->sk->sk_user_data;
-	int i;
-
-	for (i = 0; i < ARRAY_SIZE(ctx->sqo_wq); i++)
-		if (ctx->sqo_wq[i])
-			flush_workqueue(ctx->sqo_wq[i]);
-
-	unix_destruct_scm(skb);
+	if (!new_node)
+		return;
+	if (list_empty(&ctx->file_data->node->file_list))
+		io_free_file_ref_node(new_node);
+	else
+		io_fixed_file_switch_node(ctx, new_node);
 }
 
-/*
- * Ensure the UNIX gc is aware of our file set, so we are certain that
- * the io_uring can be safely unregistered on process exit, even if we have
- * loops in the file referencing.
- */
-static int __io_sqe_files_scm(struct io_ring_ctx *ctx, int nr, int offset)
+static int __io_sqe_files_update(struct io_ring_ctx *ctx,
+				 struct io_uring_files_update *up,
+				 unsigned nr_args)
 {
-	struct sock *sk = ctx->ring_sock->sk;
-	struct scm_fp_list *fpl;
-	struct sk_buff *skb;
-	int i;
-
-	fpl = kzalloc(sizeof(*fpl), GFP_KERNEL);
-	if (!fpl)
-		return -ENOMEM;
+	struct fixed_file_ref_node *new_node = NULL;
+	__s32 __user *fds;
+	unsigned done;
+	int fd, ret = 0;
 
-	skb = alloc_skb(0, GFP_KERNEL);
-	if (!skb) {
-		kfree(fpl);
-		return -ENOMEM;
-	}
+	if (!ctx->file_data)
+		return -ENXIO;
+	if (!nr_args)
+		return -EINVAL;
+	if (check_add_overflow(up->offset, nr_args, &done))
+		return -EOVERFLOW;
+	if (done > ctx->nr_user_files)
+		return -EINVAL;
 
-	skb->sk = sk;
-	skb->destructor = io_destruct_skb;
+	fds = u64_to_user_ptr(up->fds);
+	for (done = 0; done < nr_args; done++) {
+		struct file *file = NULL;
+		unsigned index;
 
-	fpl->user = get_uid(ctx->user);
-	for (i = 0; i < nr; i++) {
-		fpl->fp[i] = get_file(ctx->user_files[i + offset]);
-		unix_inflight(fpl->user, fpl->fp[i]);
+		ret = -EFAULT;
+		if (copy_from_user(&fd, &fds[done], sizeof(fd)))
+			break;
+		if (fd != -1) {
+			ret = -EBADF;
+			file = fget(fd);
+			if (!file)
+				break;
+		}
+		index = array_index_nospec(up->offset + done,
+					   ctx->nr_user_files);
+		ret = io_fixed_file_set(ctx, index, file, &new_node);
+		if (ret)
+			break;
 	}
 
-	fpl->max = fpl->count = nr;
-	UNIXCB(skb).fp = fpl;
-	refcount_add(skb->truesize, &sk->sk_wmem_alloc);
-	skb_queue_head(&sk->sk_receive_queue, skb);
+	io_fixed_file_update_done(ctx, new_node);
+	return done ? done : ret;
+}
 
-	for (i = 0; i < nr; i++)
-		fput(fpl->fp[i]);
+static int io_sqe_files_update(struct io_ring_ctx *ctx, void __user *arg,
+			       unsigned nr_args)
+{
+	struct io_uring_files_update up;
 
-	return 0;
+	if (copy_from_user(&up, arg, sizeof(up)))
+		return -EFAULT;
+	if (up.resv)
+		return -EINVAL;
+
+	return __io_sqe_files_update(ctx, &up, nr_args);
 }
 
 /*
- * If UNIX sockets are enabled, fd passing can cause a reference cycle which
- * causes regular reference counting to break down. We rely on the UNIX
- * garbage collection to take care of this problem for us.
+ * Put a file opened or accepted by @req into fixed slot @index, rather than
+ * into the file table, or clear the slot if @file is NULL. Consumes the
+ * file reference.
  */
-static int io_sqe_files_scm(struct io_ring_ctx *ctx)
+static int io_install_fixed_file(struct io_kiocb *req, struct file *file,
+				 unsigned index)
 {
-	unsigned left, total;
-	int ret = 0;
-
-	total = 0;
-	left = ctx->nr_user_files;
-	while (left) {
-		unsigned this_files = min_t(unsigned, left, SCM_MAX_FD);
+	struct io_ring_ctx *ctx = req->ctx;
+	struct fixed_file_ref_node *new_node = NULL;
+	bool needs_lock = req->submit.needs_lock;
+	int ret;
 
-		ret = __io_sqe_files_scm(ctx, this_files, total);
-		if (ret)
-			break;
-		left -= this_files;
-		total += this_files;
-	}
+	if (needs_lock)
+		mutex_lock(&ctx->uring_lock);
 
-	if (!ret)
-		return 0;
+	ret = -ENXIO;
+	if (!ctx->file_data)
+		goto err;
+	ret = -EINVAL;
+	if (index >= ctx->nr_user_files)
+		goto err;
+	index = array_index_nospec(index, ctx->nr_user_files);
 
-	while (total < ctx->nr_user_files) {
-		fput(ctx->user_files[total]);
-		total++;
-	}
+	ret = -EBADF;
+	if (!file && !ctx->user_files[index])
+		goto err;
 
+	ret = io_fixed_file_set(ctx, index, file, &new_node);
+	io_fixed_file_update_done(ctx, new_node);
+	goto out;
+err:
+	if (file)
+		fput(file);
+out:
+	if (needs_lock)
+		mutex_unlock(&ctx->uring_lock);
 	return ret;
 }
-#else
-static int io_sqe_files_scm(struct io_ring_ctx *ctx)
-{
-	return 0;
-}
-#endif
 
 static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
 				 unsigned nr_args)
 {
 	__s32 __user *fds = (__s32 __user *) arg;
+	struct fixed_file_data *data;
 	int fd, ret = 0;
 	unsigned i;
 
@@ -3241,17 +6014,44 @@ static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
 	if (nr_args > IORING_MAX_FIXED_FILES)
 		return -EMFILE;
 
-	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
-	if (!ctx->user_files)
+	data = kzalloc(sizeof(*data), GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+	data->ctx = ctx;
+	init_completion(&data->done);
+	if (percpu_ref_init(&data->refs, io_file_data_ref_zero, 0,
+			    GFP_KERNEL)) {
+		kfree(data);
 		return -ENOMEM;
+	}
+	ctx->file_data = data;
+
+	data->node = io_alloc_file_ref_node(ctx);
+	if (!data->node) {
+		ret = -ENOMEM;
+		goto err_data;
+	}
+	/* the node's reference, the initial one is dropped at unregister */
+	percpu_ref_get(&data->refs);
+
+	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
+	if (!ctx->user_files) {
+		ret = -ENOMEM;
+		goto err_node;
+	}
 
 	for (i = 0; i < nr_args; i++) {
 		ret = -EFAULT;
 		if (copy_from_user(&fd, &fds[i], sizeof(fd)))
 			break;
+		/* allow sparse sets, slots can be filled in later */
+		if (fd == -1) {
+			ctx->nr_user_files++;
+			ret = 0;
+			continue;
+		}
 
 		ctx->user_files[i] = fget(fd);
-
 		ret = -EBADF;
 		if (!ctx->user_files[i])
 			break;
@@ -3264,6 +6064,7 @@ static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
 		 */
 		if (ctx->user_files[i]->f_op == &io_uring_fops) {
 			fput(ctx->user_files[i]);
+			ctx->user_files[i] = NULL;
 			break;
 		}
 		ctx->nr_user_files++;
@@ -3272,18 +6073,29 @@ static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
 
 	if (ret) {
 		for (i = 0; i < ctx->nr_user_files; i++)
-			fput(ctx->user_files[i]);
-
+			if (ctx->user_files[i])
+				fput(ctx->user_files[i]);
 		kfree(ctx->user_files);
 		ctx->user_files = NULL;
 		ctx->nr_user_files = 0;
-		return ret;
+		goto err_node;
 	}
 
 	ret = io_sqe_files_scm(ctx);
 	if (ret)
 		io_sqe_files_unregister(ctx);
-
+	return ret;
+err_node:
+	if (data->node) {
+		percpu_ref_kill(&data->node->refs);
+		data->node = NULL;
+	}
+err_data:
+	percpu_ref_kill(&data->refs);
+	wait_for_completion(&data->done);
+	percpu_ref_exit(&data->refs);
+	kfree(data);
+	ctx->file_data = NULL;
 	return ret;
 }
 
@@ -3296,6 +6108,9 @@ static int io_sq_offload_start(struct io_ring_ctx *ctx,
 	ctx->sqo_mm = current->mm;
 
 	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		struct io_sq_data *sqd;
+		int cpu = -1;
+
 		ret = -EPERM;
 		if (!capable(CAP_SYS_ADMIN))
 			goto err;
@@ -3305,29 +6120,31 @@ static int io_sq_offload_start(struct io_ring_ctx *ctx,
 			ctx->sq_thread_idle = HZ;
 
 		if (p->flags & IORING_SETUP_SQ_AFF) {
-			int cpu = p->sq_thread_cpu;
+			cpu = p->sq_thread_cpu;
 
 			ret = -EINVAL;
 			if (cpu >= nr_cpu_ids)
 				goto err;
 			if (!cpu_online(cpu))
 				goto err;
-
-			ctx->sqo_thread = kthread_create_on_cpu(io_sq_thread,
-							ctx, cpu,
-							"io_uring-sq");
-		} else {
-			ctx->sqo_thread = kthread_create(io_sq_thread, ctx,
-							"io_uring-sq");
 		}
-		if (IS_ERR(ctx->sqo_thread)) {
-			ret = PTR_ERR(ctx->sqo_thread);
-			ctx->sqo_thread = NULL;
+
+		sqd = io_get_sq_data(p, cpu);
+		if (IS_ERR(sqd)) {
+			ret = PTR_ERR(sqd);
 			goto err;
 		}
-		wake_up_process(ctx->sqo_thread);
-	} else if (p->flags & IORING_SETUP_SQ_AFF) {
-		/* Can't have SQ_AFF without SQPOLL */
+		ctx->sq_data = sqd;
+
+		mutex_lock(&sqd->lock);
+		list_add_tail(&ctx->sqd_list, &sqd->ctx_list);
+		io_sqd_update_thread_idle(sqd);
+		mutex_unlock(&sqd->lock);
+
+		/* starts a new thread, or kicks an existing one */
+		wake_up_process(sqd->thread);
+	} else if (p->flags & (IORING_SETUP_SQ_AFF | IORING_SETUP_SQ_SHARED)) {
+		/* Can't have SQ_AFF or SQ_SHARED without SQPOLL */
 		ret = -EINVAL;
 		goto err;
 	}
@@ -3639,6 +6456,35 @@ static int io_sqe_buffer_register(struct io_ring_ctx *ctx, void __user *arg,
 	return ret;
 }
 
+static int io_cq_futex_register(struct io_ring_ctx *ctx, void __user *arg)
+{
+	u32 __user *uaddr = arg;
+
+	/* only the SQ thread can publish completions from user context */
+	if (!(ctx->flags & IORING_SETUP_SQPOLL))
+		return -EINVAL;
+	if (ctx->cq_futex)
+		return -EBUSY;
+	if (!IS_ALIGNED((unsigned long) uaddr, sizeof(u32)) ||
+	    !access_ok(uaddr, sizeof(u32)))
+		return -EFAULT;
+
+	ctx->cq_futex_tail = ctx->cached_cq_tail;
+	if (put_user(ctx->cq_futex_tail, uaddr))
+		return -EFAULT;
+	WRITE_ONCE(ctx->cq_futex, uaddr);
+	return 0;
+}
+
+static int io_cq_futex_unregister(struct io_ring_ctx *ctx)
+{
+	if (!ctx->cq_futex)
+		return -ENXIO;
+
+	WRITE_ONCE(ctx->cq_futex, NULL);
+	return 0;
+}
+
 static int io_eventfd_register(struct io_ring_ctx *ctx, void __user *arg)
 {
 	__s32 __user *fds = arg;
@@ -3671,6 +6517,21 @@ static int io_eventfd_unregister(struct io_ring_ctx *ctx)
 	return -ENXIO;
 }
 
+static int __io_destroy_buffers(int id, void *p, void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	struct io_buffer *buf = p;
+
+	__io_remove_buffers(ctx, buf, id, -1U);
+	return 0;
+}
+
+static void io_destroy_buffers(struct io_ring_ctx *ctx)
+{
+	idr_for_each(&ctx->io_buffer_idr, __io_destroy_buffers, ctx);
+	idr_destroy(&ctx->io_buffer_idr);
+}
+
 static void io_ring_ctx_free(struct io_ring_ctx *ctx)
 {
 	io_finish_async(ctx);
@@ -3681,6 +6542,7 @@ static void io_ring_ctx_free(struct io_ring_ctx *ctx)
 	io_sqe_buffer_unregister(ctx);
 	io_sqe_files_unregister(ctx);
 	io_eventfd_unregister(ctx);
+	io_destroy_buffers(ctx);
 
 #if defined(CONFIG_UNIX)
 	if (ctx->ring_sock) {
@@ -3757,6 +6619,79 @@ static void io_cancel_async_work(struct io_ring_ctx *ctx,
 	spin_unlock_irq(&ctx->task_lock);
 }
 
+/*
+ * Internally polled requests that borrowed @files may wait on their socket
+ * for good, a multishot accept for one. Take them off the poll and have a
+ * worker complete them cancelled, rather than waiting for them. Only those
+ * on the inflight list use the table, the rest merely recorded it and are
+ * left alone.
+ */
+static void io_poll_remove_files(struct io_ring_ctx *ctx,
+				 struct files_struct *files)
+{
+	struct io_kiocb *req, *tmp;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_for_each_entry_safe(req, tmp, &ctx->cancel_list, list) {
+		if ((req->flags & (REQ_F_POLLED | REQ_F_INFLIGHT)) ==
+		    (REQ_F_POLLED | REQ_F_INFLIGHT) && req->files == files)
+			io_poll_remove_one(req);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+/*
+ * Cancel and wait for async requests that borrowed @files, so the file table
+ * can't go away under a running worker. Requests that haven't started yet
+ * just get marked, they will see REQ_F_CANCEL before touching the table.
+ */
+static void io_uring_cancel_files(struct io_ring_ctx *ctx,
+				  struct files_struct *files)
+{
+	DEFINE_WAIT(wait);
+
+	io_poll_remove_files(ctx, files);
+
+	while (!list_empty_careful(&ctx->inflight_list)) {
+		struct io_kiocb *req;
+		bool running = false;
+
+		spin_lock_irq(&ctx->task_lock);
+		list_for_each_entry(req, &ctx->inflight_list, inflight_entry) {
+			if (req->files != files)
+				continue;
+
+			/* pairs with smp_mb() (A) in io_sq_wq_submit_work() */
+			smp_store_mb(req->flags, req->flags | REQ_F_CANCEL);
+			if (req->work_task) {
+				send_sig(SIGINT, req->work_task, 1);
+				running = true;
+			}
+		}
+		if (running)
+			prepare_to_wait(&ctx->inflight_wait, &wait,
+					TASK_UNINTERRUPTIBLE);
+		spin_unlock_irq(&ctx->task_lock);
+
+		if (!running)
+			break;
+		schedule();
+		finish_wait(&ctx->inflight_wait, &wait);
+	}
+}
+
+/*
+ * Internally polled requests are retried from task_work of the submitter,
+ * which may well be the task waiting here for them. Keep running it.
+ */
+static void io_ring_wait_refs(struct io_ring_ctx *ctx)
+{
+	while (!wait_for_completion_timeout(&ctx->ctx_done, HZ / 20)) {
+		if (current->task_works)
+			task_work_run();
+	}
+}
+
 static void io_ring_ctx_wait_and_kill(struct io_ring_ctx *ctx)
 {
 	mutex_lock(&ctx->uring_lock);
@@ -3767,7 +6702,7 @@ static void io_ring_ctx_wait_and_kill(struct io_ring_ctx *ctx)
 	io_kill_timeouts(ctx);
 	io_poll_remove_all(ctx);
 	io_iopoll_reap_events(ctx);
-	wait_for_completion(&ctx->ctx_done);
+	io_ring_wait_refs(ctx);
 	io_ring_ctx_free(ctx);
 }
 
@@ -3777,6 +6712,7 @@ static int io_uring_flush(struct file *file, void *data)
 
 	if (fatal_signal_pending(current) || (current->flags & PF_EXITING))
 		io_cancel_async_work(ctx, data);
+	io_uring_cancel_files(ctx, data);
 
 	return 0;
 }
@@ -3819,16 +6755,53 @@ static int io_uring_mmap(struct file *file, struct vm_area_struct *vma)
 	return remap_pfn_range(vma, vma->vm_start, pfn, sz, vma->vm_page_prot);
 }
 
+/*
+ * With IORING_ENTER_EXT_ARG, @sig points to a struct io_uring_getevents_arg
+ * and @sigsz is its size. Unpack the real sigset and the wait deadline.
+ */
+static int io_get_ext_arg(unsigned flags, const sigset_t __user **sig,
+			  size_t *sigsz, ktime_t *timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct timespec64 ts;
+
+	if (*sigsz != sizeof(arg))
+		return -EINVAL;
+	if (copy_from_user(&arg, *sig, sizeof(arg)))
+		return -EFAULT;
+	if (arg.pad)
+		return -EINVAL;
+
+	*sig = u64_to_user_ptr(arg.sigmask);
+	*sigsz = arg.sigmask_sz;
+
+	if (arg.ts) {
+		if (get_timespec64(&ts, u64_to_user_ptr(arg.ts)))
+			return -EFAULT;
+		if (!timespec64_valid(&ts))
+			return -EINVAL;
+		*timeout = timespec64_to_ktime(ts);
+		if (!(flags & IORING_ENTER_ABS_TIMER))
+			*timeout = ktime_add_safe(ktime_get(), *timeout);
+	}
+
+	return 0;
+}
+
 SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 		u32, min_complete, u32, flags, const sigset_t __user *, sig,
 		size_t, sigsz)
 {
 	struct io_ring_ctx *ctx;
+	ktime_t timeout = KTIME_MAX;
 	long ret = -EBADF;
 	int submitted = 0;
 	struct fd f;
 
-	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP |
+		      IORING_ENTER_EXT_ARG | IORING_ENTER_ABS_TIMER))
+		return -EINVAL;
+	if ((flags & IORING_ENTER_ABS_TIMER) && !(flags & IORING_ENTER_EXT_ARG))
 		return -EINVAL;
 
 	f = fdget(fd);
@@ -3849,16 +6822,23 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 	 * Just return the requested submit count, and wake the thread if
 	 * we were asked to.
 	 */
+	/* A bad argument must fail the call before anything is submitted */
+	if (flags & IORING_ENTER_EXT_ARG) {
+		ret = io_get_ext_arg(flags, &sig, &sigsz, &timeout);
+		if (ret)
+			goto out;
+	}
+
 	ret = 0;
 	if (ctx->flags & IORING_SETUP_SQPOLL) {
 		if (flags & IORING_ENTER_SQ_WAKEUP)
-			wake_up(&ctx->sqo_wait);
+			wake_up(&ctx->sq_data->wait);
 		submitted = to_submit;
 	} else if (to_submit) {
 		to_submit = min(to_submit, ctx->sq_entries);
 
 		mutex_lock(&ctx->uring_lock);
-		submitted = io_ring_submit(ctx, to_submit);
+		submitted = io_ring_submit(ctx, to_submit, f.file, fd);
 		mutex_unlock(&ctx->uring_lock);
 
 		if (submitted != to_submit)
@@ -3870,9 +6850,11 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 		min_complete = min(min_complete, ctx->cq_entries);
 
 		if (ctx->flags & IORING_SETUP_IOPOLL) {
-			ret = io_iopoll_check(ctx, &nr_events, min_complete);
+			ret = io_iopoll_check(ctx, &nr_events, min_complete,
+						timeout);
 		} else {
-			ret = io_cqring_wait(ctx, min_complete, sig, sigsz);
+			ret = io_cqring_wait(ctx, min_complete, sig, sigsz,
+						timeout);
 		}
 	}
 
@@ -3883,7 +6865,33 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 	return submitted ? submitted : ret;
 }
 
+#ifdef CONFIG_PROC_FS
+static void io_uring_show_fdinfo(struct seq_file *m, struct file *f)
+{
+	struct io_ring_ctx *ctx = f->private_data;
+	struct io_sq_data *sqd = ctx->sq_data;
+	struct io_rings *r = ctx->rings;
+
+	seq_printf(m, "SqHead:\t%u\n", READ_ONCE(r->sq.head));
+	seq_printf(m, "SqTail:\t%u\n", READ_ONCE(r->sq.tail));
+	seq_printf(m, "CqHead:\t%u\n", READ_ONCE(r->cq.head));
+	seq_printf(m, "CqTail:\t%u\n", READ_ONCE(r->cq.tail));
+	seq_printf(m, "SqSubmitted:\t%llu\n", READ_ONCE(ctx->sq_submitted));
+	if (!sqd)
+		return;
+
+	seq_printf(m, "SqThread:\t%d\n", task_pid_nr(sqd->thread));
+	seq_printf(m, "SqThreadCpu:\t%d\n", sqd->cpu);
+	seq_printf(m, "SqThreadRings:\t%u\n", refcount_read(&sqd->refs));
+	seq_printf(m, "SqPasses:\t%llu\n", READ_ONCE(ctx->sq_passes));
+	seq_printf(m, "SqBusyNs:\t%llu\n", READ_ONCE(ctx->sq_busy_ns));
+}
+#endif
+
 static const struct file_operations io_uring_fops = {
+#ifdef CONFIG_PROC_FS
+	.show_fdinfo	= io_uring_show_fdinfo,
+#endif
 	.release	= io_uring_release,
 	.flush		= io_uring_flush,
 	.mmap		= io_uring_mmap,
@@ -4061,7 +7069,8 @@ static int io_uring_create(unsigned entries, struct io_uring_params *p)
 	if (ret < 0)
 		goto err;
 
-	p->features = IORING_FEAT_SINGLE_MMAP;
+	p->features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_FAST_POLL |
+			IORING_FEAT_EXT_ARG;
 	return ret;
 err:
 	io_ring_ctx_wait_and_kill(ctx);
@@ -4087,7 +7096,7 @@ static long io_uring_setup(u32 entries, struct io_uring_params __user *params)
 	}
 
 	if (p.flags & ~(IORING_SETUP_IOPOLL | IORING_SETUP_SQPOLL |
-			IORING_SETUP_SQ_AFF))
+			IORING_SETUP_SQ_AFF | IORING_SETUP_SQ_SHARED))
 		return -EINVAL;
 
 	ret = io_uring_create(entries, &p);
@@ -4106,6 +7115,22 @@ SYSCALL_DEFINE2(io_uring_setup, u32, entries,
 	return io_uring_setup(entries, params);
 }
 
+/*
+ * File table updates don't need the ring idle, the ref nodes keep replaced
+ * files alive for the requests still using them.
+ */
+static bool io_register_op_must_quiesce(int op)
+{
+	switch (op) {
+	case IORING_REGISTER_FILES_UPDATE:
+	case IORING_REGISTER_NAPI:
+	case IORING_UNREGISTER_NAPI:
+		return false;
+	default:
+		return true;
+	}
+}
+
 static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 			       void __user *arg, unsigned nr_args)
 	__releases(ctx->uring_lock)
@@ -4121,18 +7146,21 @@ static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 	if (percpu_ref_is_dying(&ctx->refs))
 		return -ENXIO;
 
-	percpu_ref_kill(&ctx->refs);
+	if (io_register_op_must_quiesce(opcode)) {
+		percpu_ref_kill(&ctx->refs);
 
-	/*
-	 * Drop uring mutex before waiting for references to exit. If another
-	 * thread is currently inside io_uring_enter() it might need to grab
-	 * the uring_lock to make progress. If we hold it here across the drain
-	 * wait, then we can deadlock. It's safe to drop the mutex here, since
-	 * no new references will come in after we've killed the percpu ref.
-	 */
-	mutex_unlock(&ctx->uring_lock);
-	wait_for_completion(&ctx->ctx_done);
-	mutex_lock(&ctx->uring_lock);
+		/*
+		 * Drop uring mutex before waiting for references to exit. If
+		 * another thread is currently inside io_uring_enter() it might
+		 * need to grab the uring_lock to make progress. If we hold it
+		 * here across the drain wait, then we can deadlock. It's safe
+		 * to drop the mutex here, since no new references will come in
+		 * after we've killed the percpu ref.
+		 */
+		mutex_unlock(&ctx->uring_lock);
+		io_ring_wait_refs(ctx);
+		mutex_lock(&ctx->uring_lock);
+	}
 
 	switch (opcode) {
 	case IORING_REGISTER_BUFFERS:
@@ -4153,6 +7181,9 @@ static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 			break;
 		ret = io_sqe_files_unregister(ctx);
 		break;
+	case IORING_REGISTER_FILES_UPDATE:
+		ret = io_sqe_files_update(ctx, arg, nr_args);
+		break;
 	case IORING_REGISTER_EVENTFD:
 		ret = -EINVAL;
 		if (nr_args != 1)
@@ -4165,14 +7196,40 @@ static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 			break;
 		ret = io_eventfd_unregister(ctx);
 		break;
+	case IORING_REGISTER_CQ_FUTEX:
+		ret = -EINVAL;
+		if (nr_args != 1)
+			break;
+		ret = io_cq_futex_register(ctx, arg);
+		break;
+	case IORING_UNREGISTER_CQ_FUTEX:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = io_cq_futex_unregister(ctx);
+		break;
+	case IORING_REGISTER_NAPI:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_napi_register(ctx, arg);
+		break;
+	case IORING_UNREGISTER_NAPI:
+		ret = -EINVAL;
+		if (nr_args != 1)
+			break;
+		ret = io_napi_unregister(ctx, arg);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
 	}
 
-	/* bring the ctx back to life */
-	reinit_completion(&ctx->ctx_done);
-	percpu_ref_reinit(&ctx->refs);
+	if (io_register_op_must_quiesce(opcode)) {
+		/* bring the ctx back to life */
+		reinit_completion(&ctx->ctx_done);
+		percpu_ref_reinit(&ctx->refs);
+	}
 	return ret;
 }
 
@@ -4204,6 +7261,7 @@ SYSCALL_DEFINE4(io_uring_register, unsigned int, fd, unsigned int, opcode,
 static int __init io_uring_init(void)
 {
 	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+	buf_cachep = KMEM_CACHE(io_buffer, SLAB_PANIC);
 	return 0;
 };
 __initcall(io_uring_init);
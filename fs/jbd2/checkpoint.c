@@ -20,6 +20,7 @@
 #include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/sched/mm.h>
 #include <trace/events/jbd2.h>
 
 /*
@@ -377,6 +378,65 @@ int jbd2_log_do_checkpoint(journal_t *journal)
 	return (result < 0) ? result : 0;
 }
 
+/*
+ * Queue a background checkpoint if the free log space has dropped below
+ * the low watermark.  Called by the commit code once a transaction has
+ * been added to the checkpoint list.
+ */
+void jbd2_log_queue_checkpoint(journal_t *journal)
+{
+	bool low;
+
+	read_lock(&journal->j_state_lock);
+	low = !(journal->j_flags & (JBD2_UNMOUNT | JBD2_ABORT)) &&
+	      jbd2_log_space_left(journal) < jbd2_checkpoint_low_wm(journal);
+	read_unlock(&journal->j_state_lock);
+
+	if (low)
+		queue_work(system_unbound_wq, &journal->j_checkpoint_work);
+}
+
+/*
+ * Checkpoint old transactions until the free log space is back above the
+ * high watermark, so that writers rarely have to do it themselves in
+ * __jbd2_log_wait_for_space().
+ */
+void jbd2_checkpoint_work(struct work_struct *work)
+{
+	journal_t *journal = container_of(work, journal_t, j_checkpoint_work);
+	unsigned int nofs_flags;
+	unsigned long space_left;
+	bool empty;
+
+	/*
+	 * Reclaim must not recurse into the filesystem: a new handle could
+	 * end up waiting for the checkpoint mutex we hold.
+	 */
+	nofs_flags = memalloc_nofs_save();
+	mutex_lock_io(&journal->j_checkpoint_mutex);
+	while (!is_journal_aborted(journal)) {
+		read_lock(&journal->j_state_lock);
+		space_left = jbd2_log_space_left(journal);
+		read_unlock(&journal->j_state_lock);
+		if (space_left >= jbd2_checkpoint_high_wm(journal))
+			break;
+
+		spin_lock(&journal->j_list_lock);
+		empty = journal->j_checkpoint_transactions == NULL;
+		spin_unlock(&journal->j_list_lock);
+		if (empty)
+			break;
+
+		if (jbd2_log_do_checkpoint(journal) < 0)
+			break;
+		cond_resched();
+	}
+	/* Release the log space of the transactions checkpointed last */
+	jbd2_cleanup_journal_tail(journal);
+	mutex_unlock(&journal->j_checkpoint_mutex);
+	memalloc_nofs_restore(nofs_flags);
+}
+
 /*
  * Check the list of checkpoint transactions for the journal to see if
  * we have already got rid of any since the last update of the log tail
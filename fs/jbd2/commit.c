@@ -393,6 +393,17 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	 * all outstanding updates to complete.
 	 */
 
+	/* Let a running fast commit finish and keep new ones out */
+	write_lock(&journal->j_state_lock);
+	while (journal->j_flags & JBD2_FAST_COMMIT_ONGOING) {
+		write_unlock(&journal->j_state_lock);
+		wait_event(journal->j_fc_wait,
+			   !(journal->j_flags & JBD2_FAST_COMMIT_ONGOING));
+		write_lock(&journal->j_state_lock);
+	}
+	journal->j_flags |= JBD2_FULL_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+
 	/* Do we need to erase the effects of a prior jbd2_journal_flush? */
 	if (journal->j_flags & JBD2_FLUSHED) {
 		jbd_debug(3, "super block updated\n");
@@ -1101,6 +1112,9 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	J_ASSERT(commit_transaction == journal->j_committing_transaction);
 	journal->j_commit_sequence = commit_transaction->t_tid;
 	journal->j_committing_transaction = NULL;
+	/* Fast commit blocks of this transaction are obsolete now */
+	journal->j_fc_off = 0;
+	journal->j_flags &= ~JBD2_FULL_COMMIT_ONGOING;
 	commit_time = ktime_to_ns(ktime_sub(ktime_get(), start_time));
 
 	/*
@@ -1114,6 +1128,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 		journal->j_average_commit_time = commit_time;
 
 	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
 
 	if (journal->j_commit_callback)
 		journal->j_commit_callback(journal, commit_transaction);
@@ -1134,6 +1149,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	spin_unlock(&journal->j_list_lock);
 	write_unlock(&journal->j_state_lock);
 	wake_up(&journal->j_wait_done_commit);
+	jbd2_log_queue_checkpoint(journal);
 
 	/*
 	 * Calculate overall stats
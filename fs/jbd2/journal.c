@@ -84,6 +84,9 @@ EXPORT_SYMBOL(jbd2_log_wait_commit);
 EXPORT_SYMBOL(jbd2_log_start_commit);
 EXPORT_SYMBOL(jbd2_journal_start_commit);
 EXPORT_SYMBOL(jbd2_journal_force_commit_nested);
+EXPORT_SYMBOL(jbd2_fc_begin_commit);
+EXPORT_SYMBOL(jbd2_fc_end_commit);
+EXPORT_SYMBOL(jbd2_fc_get_buf);
 EXPORT_SYMBOL(jbd2_journal_wipe);
 EXPORT_SYMBOL(jbd2_journal_blocks_per_page);
 EXPORT_SYMBOL(jbd2_journal_invalidatepage);
@@ -764,6 +767,98 @@ int jbd2_complete_transaction(journal_t *journal, tid_t tid)
 }
 EXPORT_SYMBOL(jbd2_complete_transaction);
 
+/*
+ * Fast commits let the client log a compact description of the changes
+ * made by the running transaction into a small area at the end of the
+ * journal, without committing the transaction itself.  Only one fast
+ * commit may be in flight at a time, and none while a full commit is
+ * running: the full commit makes all fast commit blocks of its
+ * transaction obsolete and restarts the area from the beginning.
+ */
+
+/*
+ * Start a fast commit for transaction @tid.  Returns 0 if the caller now
+ * owns the fast commit area, -EALREADY if @tid has been committed in the
+ * meantime, or another error if a full commit is needed instead.
+ */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid)
+{
+	if (!jbd2_has_feature_fast_commit(journal))
+		return -EOPNOTSUPP;
+
+	write_lock(&journal->j_state_lock);
+	while (1) {
+		if (!tid_gt(tid, journal->j_commit_sequence)) {
+			write_unlock(&journal->j_state_lock);
+			return -EALREADY;
+		}
+		/*
+		 * Fast commit blocks are only looked at by recovery when the
+		 * log is not empty, and only for the running transaction.
+		 */
+		if (is_journal_aborted(journal) ||
+		    (journal->j_flags & JBD2_FLUSHED) ||
+		    !journal->j_running_transaction ||
+		    journal->j_running_transaction->t_tid != tid) {
+			write_unlock(&journal->j_state_lock);
+			return -EINVAL;
+		}
+		if (!(journal->j_flags & (JBD2_FAST_COMMIT_ONGOING |
+					  JBD2_FULL_COMMIT_ONGOING)))
+			break;
+		write_unlock(&journal->j_state_lock);
+		wait_event(journal->j_fc_wait,
+			   !(journal->j_flags & (JBD2_FAST_COMMIT_ONGOING |
+						 JBD2_FULL_COMMIT_ONGOING)));
+		write_lock(&journal->j_state_lock);
+	}
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	return 0;
+}
+
+/*
+ * Stop a fast commit started by jbd2_fc_begin_commit() and let waiting
+ * fast and full commits proceed.
+ */
+int jbd2_fc_end_commit(journal_t *journal)
+{
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
+	return 0;
+}
+
+/*
+ * Return the next unused block of the fast commit area.  Must be called
+ * between jbd2_fc_begin_commit() and jbd2_fc_end_commit().
+ */
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out)
+{
+	unsigned long long pblock;
+	unsigned long blocknr;
+	struct buffer_head *bh;
+	int ret;
+
+	*bh_out = NULL;
+	if (journal->j_fc_first + journal->j_fc_off >= journal->j_fc_last)
+		return -ENOSPC;
+
+	blocknr = journal->j_fc_first + journal->j_fc_off;
+	ret = jbd2_journal_bmap(journal, blocknr, &pblock);
+	if (ret)
+		return ret;
+
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+
+	journal->j_fc_off++;
+	*bh_out = bh;
+	return 0;
+}
+
 /*
  * Log buffer allocation routines:
  */
@@ -1128,8 +1223,10 @@ static journal_t *journal_init_common(struct block_device *bdev,
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
 	init_waitqueue_head(&journal->j_wait_reserved);
+	init_waitqueue_head(&journal->j_fc_wait);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
+	INIT_WORK(&journal->j_checkpoint_work, jbd2_checkpoint_work);
 	spin_lock_init(&journal->j_revoke_lock);
 	spin_lock_init(&journal->j_list_lock);
 	rwlock_init(&journal->j_state_lock);
@@ -1282,6 +1379,27 @@ static void journal_fail_superblock (journal_t *journal)
  * subsequent use.
  */
 
+static int journal_init_fast_commit(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long num_fc_blks = be32_to_cpu(sb->s_num_fc_blks);
+
+	if (!num_fc_blks)
+		num_fc_blks = JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+	if (journal->j_last < journal->j_first + num_fc_blks +
+			      JBD2_MIN_JOURNAL_BLOCKS) {
+		printk(KERN_ERR "JBD2: Journal too short for %lu fast commit "
+		       "blocks.\n", num_fc_blks);
+		return -EINVAL;
+	}
+
+	journal->j_fc_last = journal->j_last;
+	journal->j_last = journal->j_fc_last - num_fc_blks;
+	journal->j_fc_first = journal->j_last;
+	journal->j_fc_off = 0;
+	return 0;
+}
+
 static int journal_reset(journal_t *journal)
 {
 	journal_superblock_t *sb = journal->j_superblock;
@@ -1298,6 +1416,13 @@ static int journal_reset(journal_t *journal)
 
 	journal->j_first = first;
 	journal->j_last = last;
+	if (jbd2_has_feature_fast_commit(journal) &&
+	    journal_init_fast_commit(journal)) {
+		journal_fail_superblock(journal);
+		return -EINVAL;
+	}
+	first = journal->j_first;
+	last = journal->j_last;
 
 	journal->j_head = first;
 	journal->j_tail = first;
@@ -1631,6 +1756,8 @@ static int load_superblock(journal_t *journal)
 	journal->j_last = be32_to_cpu(sb->s_maxlen);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
+	if (jbd2_has_feature_fast_commit(journal))
+		return journal_init_fast_commit(journal);
 	return 0;
 }
 
@@ -1724,6 +1851,9 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_running_transaction)
 		jbd2_journal_commit_transaction(journal);
 
+	/* Nothing queues background checkpoints past this point */
+	cancel_work_sync(&journal->j_checkpoint_work);
+
 	/* Force any old transactions to disk */
 
 	/* Totally anal locking here... */
@@ -1920,6 +2050,36 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 			~cpu_to_be32(JBD2_FEATURE_INCOMPAT_CSUM_V2 |
 				     JBD2_FEATURE_INCOMPAT_CSUM_V3);
 
+	/*
+	 * Carve the fast commit area out of the end of the log.  This is only
+	 * possible while the log does not reach into that area yet, which is
+	 * the case right after the journal has been loaded.
+	 */
+	if (INCOMPAT_FEATURE_ON(JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		unsigned long last = journal->j_last;
+
+		write_lock(&journal->j_state_lock);
+		if (!sb->s_num_fc_blks)
+			sb->s_num_fc_blks =
+				cpu_to_be32(JBD2_DEFAULT_FAST_COMMIT_BLOCKS);
+		if (journal_init_fast_commit(journal) ||
+		    journal->j_head < journal->j_tail ||
+		    journal->j_head >= journal->j_last) {
+			journal->j_last = last;
+			write_unlock(&journal->j_state_lock);
+			unlock_buffer(journal->j_sb_buffer);
+			printk(KERN_ERR "JBD2: Cannot enable fast commits.\n");
+			return 0;
+		}
+		journal->j_free -= last - journal->j_last;
+		/*
+		 * Fast commits must not be written before the feature is on
+		 * disk; the next full commit rewrites the superblock.
+		 */
+		journal->j_flags |= JBD2_FLUSHED;
+		write_unlock(&journal->j_state_lock);
+	}
+
 	sb->s_feature_compat    |= cpu_to_be32(compat);
 	sb->s_feature_ro_compat |= cpu_to_be32(ro);
 	sb->s_feature_incompat  |= cpu_to_be32(incompat);
@@ -35,7 +35,6 @@ struct recovery_info
 	int		nr_revoke_hits;
 };
 
-enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
 static int do_one_pass(journal_t *journal,
 				struct recovery_info *info, enum passtype pass);
 static int scan_revoke_records(journal_t *, struct buffer_head *,
@@ -171,6 +170,48 @@ static int jread(struct buffer_head **bhp, journal_t *journal,
 	return 0;
 }
 
+/*
+ * Hand the fast commit area to the client.  Fast commit blocks are only
+ * valid for the transaction right after the last one found committed in
+ * the log; the client checks that against the tid it finds in each block.
+ */
+static int fc_do_one_pass(journal_t *journal,
+			  struct recovery_info *info, enum passtype pass)
+{
+	unsigned int expected_commit_id = info->end_transaction;
+	unsigned long next_fc_block;
+	struct buffer_head *bh;
+	int err = 0;
+
+	if (!journal->j_fc_replay_callback)
+		return 0;
+
+	next_fc_block = journal->j_fc_first;
+	while (next_fc_block < journal->j_fc_last) {
+		jbd_debug(3, "Fast commit replay: next block %ld\n",
+			  next_fc_block);
+		err = jread(&bh, journal, next_fc_block);
+		if (err) {
+			jbd_debug(3, "Fast commit replay: read error\n");
+			break;
+		}
+
+		err = journal->j_fc_replay_callback(journal, bh, pass,
+					next_fc_block - journal->j_fc_first,
+					expected_commit_id);
+		brelse(bh);
+		next_fc_block++;
+		if (err < 0 || err == JBD2_FC_REPLAY_STOP)
+			break;
+		err = 0;
+	}
+
+	if (err)
+		jbd_debug(3, "Fast commit replay failed, err = %d\n", err);
+
+	return err < 0 ? err : 0;
+}
+
 static int jbd2_descriptor_block_csum_verify(journal_t *j, void *buf)
 {
 	struct jbd2_journal_block_tail *tail;
@@ -801,6 +842,12 @@ static int do_one_pass(journal_t *journal,
 	}
 	if (block_error && success == 0)
 		success = -EIO;
+
+	if (jbd2_has_feature_fast_commit(journal) && pass != PASS_REVOKE) {
+		err = fc_do_one_pass(journal, info, pass);
+		if (err && success == 0)
+			success = err;
+	}
 	return success;
 
  failed:
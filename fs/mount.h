@@ -5,6 +5,8 @@
 #include <linux/ns_common.h>
 #include <linux/fs_pin.h>
 
+struct mount_event;
+
 struct mnt_namespace {
 	atomic_t		count;
 	struct ns_common	ns;
@@ -17,8 +19,13 @@ struct mnt_namespace {
 	u64 event;
 	unsigned int		mounts; /* # of mounts in the namespace */
 	unsigned int		pending_mounts;
+	struct mount_event	*events;	/* change ring, NULL until read */
+	u64			events_head;	/* # of changes recorded */
 } __randomize_layout;
 
+/* Size of the mount change ring, must be a power of two */
+#define MNT_NS_EVENTS	256
+
 struct mnt_pcp {
 	int mnt_count;
 	int mnt_writers;
@@ -129,6 +136,10 @@ static inline void unlock_mount_hash(void)
 	write_sequnlock(&mount_lock);
 }
 
+extern int mnt_ns_enable_events(struct mnt_namespace *ns, u64 *head);
+extern int mnt_ns_read_events(struct mnt_namespace *ns, u64 *pos,
+			      struct mount_event *buf, int nr);
+
 struct proc_mounts {
 	struct mnt_namespace *ns;
 	struct path root;
@@ -607,6 +607,32 @@ static void terminate_walk(struct nameidata *nd)
 	nd->depth = 0;
 }
 
+/*
+ * How often lookups drop out of rcu-walk before completing, and how often
+ * they had to be restarted from scratch in ref-walk mode. Exposed through
+ * /proc/sys/fs/rcu-walk-state to find out what defeats rcu-walk.
+ */
+static DEFINE_PER_CPU(unsigned long, nr_rcu_walk_unlazy);
+static DEFINE_PER_CPU(unsigned long, nr_rcu_walk_restart);
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+int proc_nr_rcu_walk(struct ctl_table *table, int write, void __user *buffer,
+		     size_t *lenp, loff_t *ppos)
+{
+	struct ctl_table t = *table;
+	unsigned long stat[2] = { 0, 0 };
+	int i;
+
+	for_each_possible_cpu(i) {
+		stat[0] += per_cpu(nr_rcu_walk_unlazy, i);
+		stat[1] += per_cpu(nr_rcu_walk_restart, i);
+	}
+	t.data = stat;
+	t.maxlen = sizeof(stat);
+	return proc_doulongvec_minmax(&t, write, buffer, lenp, ppos);
+}
+#endif
+
 /* path_put is needed afterwards regardless of success or failure */
 static bool legitimize_path(struct nameidata *nd,
 			    struct path *path, unsigned seq)
@@ -659,17 +685,17 @@ static bool legitimize_root(struct nameidata *nd)
  */
 
 /**
- * unlazy_walk - try to switch to ref-walk mode.
+ * __unlazy_walk - try to switch to ref-walk mode.
  * @nd: nameidata pathwalk data
  * Returns: 0 on success, -ECHILD on failure
  *
- * unlazy_walk attempts to legitimize the current nd->path and nd->root
+ * __unlazy_walk attempts to legitimize the current nd->path and nd->root
  * for ref-walk mode.
  * Must be called from rcu-walk context.
- * Nothing should touch nameidata between unlazy_walk() failure and
+ * Nothing should touch nameidata between __unlazy_walk() failure and
  * terminate_walk().
  */
-static int unlazy_walk(struct nameidata *nd)
+static int __unlazy_walk(struct nameidata *nd)
 {
 	struct dentry *parent = nd->path.dentry;
 
@@ -694,6 +720,16 @@ static int unlazy_walk(struct nameidata *nd)
 	return -ECHILD;
 }
 
+/*
+ * Same as __unlazy_walk(), for callers leaving rcu-walk before the walk
+ * is complete, which is accounted for.
+ */
+static int unlazy_walk(struct nameidata *nd)
+{
+	this_cpu_inc(nr_rcu_walk_unlazy);
+	return __unlazy_walk(nd);
+}
+
 /**
  * unlazy_child - try to switch to ref-walk mode.
  * @nd: nameidata pathwalk data
@@ -711,6 +747,8 @@ static int unlazy_child(struct nameidata *nd, struct dentry *dentry, unsigned se
 {
 	BUG_ON(!(nd->flags & LOOKUP_RCU));
 
+	this_cpu_inc(nr_rcu_walk_unlazy);
+
 	nd->flags &= ~LOOKUP_RCU;
 	if (unlikely(!legitimize_links(nd)))
 		goto out2;
@@ -778,7 +816,7 @@ static int complete_walk(struct nameidata *nd)
 	if (nd->flags & LOOKUP_RCU) {
 		if (!(nd->flags & LOOKUP_ROOT))
 			nd->root.mnt = NULL;
-		if (unlikely(unlazy_walk(nd)))
+		if (unlikely(__unlazy_walk(nd)))
 			return -ECHILD;
 	}
 
@@ -1683,16 +1721,90 @@ static struct dentry *lookup_slow(const struct qstr *name,
 	return res;
 }
 
+/*
+ * A directory everybody may search, without ->permission(), access ACL or
+ * LSM inode_permission hook, grants MAY_EXEC to any cred. Cache that in
+ * inode->i_opflags so that lookups through it skip inode_permission(). The
+ * mode is rechecked on every use, ACL updates clear the flag. Outside of
+ * rcu-walk (no MAY_NOT_BLOCK in @mask) an access ACL that isn't cached yet
+ * is read in first. Returns true if the flag is set.
+ */
+static bool inode_cache_may_exec(struct inode *inode, int mask)
+{
+	if (!S_ISDIR(inode->i_mode) || (inode->i_mode & S_IXUGO) != S_IXUGO)
+		return false;
+	if (inode->i_opflags & IOP_FASTPERM_MAY_EXEC)
+		return true;
+	if (!(inode->i_opflags & IOP_FASTPERM) ||
+	    !security_inode_permission_trivial())
+		return false;
+	if (IS_POSIXACL(inode) && !(mask & MAY_NOT_BLOCK) &&
+	    is_uncached_acl(READ_ONCE(inode->i_acl))) {
+		struct posix_acl *acl = get_acl(inode, ACL_TYPE_ACCESS);
+
+		if (IS_ERR(acl))
+			return false;
+		posix_acl_release(acl);
+	}
+
+	/* Pairs with inode_forget_may_exec() */
+	spin_lock(&inode->i_lock);
+	if (!IS_POSIXACL(inode) || !READ_ONCE(inode->i_acl))
+		inode->i_opflags |= IOP_FASTPERM_MAY_EXEC;
+	spin_unlock(&inode->i_lock);
+	return inode->i_opflags & IOP_FASTPERM_MAY_EXEC;
+}
+
+/**
+ * inode_stack_may_exec - cache the search permission of a stacked directory
+ * @inode:	directory of a stacking filesystem, e.g. overlayfs
+ * @realinode:	the underlying directory its ->permission() checks as well
+ * @mask:	mask of the MAY_EXEC check that just passed on both
+ *
+ * The stacking filesystem calls this from ->permission(). If anybody may
+ * search @realinode whatever the creds, and @inode is searchable by
+ * everybody going by its mode, lookups skip ->permission() of @inode as
+ * well. The access ACL of @inode must be that of @realinode, and changing
+ * it must call inode_forget_may_exec() on @inode.
+ */
+void inode_stack_may_exec(struct inode *inode, struct inode *realinode,
+			  int mask)
+{
+	if (!S_ISDIR(inode->i_mode) || (inode->i_mode & S_IXUGO) != S_IXUGO)
+		return;
+	if (!inode_cache_may_exec(realinode, mask))
+		return;
+
+	/* Pairs with inode_forget_may_exec() on either inode */
+	spin_lock(&inode->i_lock);
+	if (READ_ONCE(realinode->i_opflags) & IOP_FASTPERM_MAY_EXEC)
+		inode->i_opflags |= IOP_FASTPERM_MAY_EXEC;
+	spin_unlock(&inode->i_lock);
+}
+EXPORT_SYMBOL(inode_stack_may_exec);
+
 static inline int may_lookup(struct nameidata *nd)
 {
+	struct inode *inode = nd->inode;
+	int err;
+
+	if (likely(inode->i_opflags & IOP_FASTPERM_MAY_EXEC) &&
+	    likely((READ_ONCE(inode->i_mode) & S_IXUGO) == S_IXUGO))
+		return 0;
+
 	if (nd->flags & LOOKUP_RCU) {
-		int err = inode_permission(nd->inode, MAY_EXEC|MAY_NOT_BLOCK);
+		err = inode_permission(inode, MAY_EXEC|MAY_NOT_BLOCK);
 		if (err != -ECHILD)
-			return err;
+			goto out;
 		if (unlazy_walk(nd))
 			return -ECHILD;
 	}
-	return inode_permission(nd->inode, MAY_EXEC);
+	err = inode_permission(inode, MAY_EXEC);
+out:
+	if (!err)
+		inode_cache_may_exec(inode, nd->flags & LOOKUP_RCU ?
+					    MAY_NOT_BLOCK : 0);
+	return err;
 }
 
 static inline int handle_dots(struct nameidata *nd, int type)
@@ -2337,8 +2449,10 @@ int filename_lookup(int dfd, struct filename *name, unsigned flags,
 	}
 	set_nameidata(&nd, dfd, name);
 	retval = path_lookupat(&nd, flags | LOOKUP_RCU, path);
-	if (unlikely(retval == -ECHILD))
+	if (unlikely(retval == -ECHILD)) {
+		this_cpu_inc(nr_rcu_walk_restart);
 		retval = path_lookupat(&nd, flags, path);
+	}
 	if (unlikely(retval == -ESTALE))
 		retval = path_lookupat(&nd, flags | LOOKUP_REVAL, path);
 
@@ -2377,8 +2491,10 @@ static struct filename *filename_parentat(int dfd, struct filename *name,
 		return name;
 	set_nameidata(&nd, dfd, name);
 	retval = path_parentat(&nd, flags | LOOKUP_RCU, parent);
-	if (unlikely(retval == -ECHILD))
+	if (unlikely(retval == -ECHILD)) {
+		this_cpu_inc(nr_rcu_walk_restart);
 		retval = path_parentat(&nd, flags, parent);
+	}
 	if (unlikely(retval == -ESTALE))
 		retval = path_parentat(&nd, flags | LOOKUP_REVAL, parent);
 	if (likely(!retval)) {
@@ -2706,8 +2822,10 @@ filename_mountpoint(int dfd, struct filename *name, struct path *path,
 		return PTR_ERR(name);
 	set_nameidata(&nd, dfd, name);
 	error = path_mountpoint(&nd, flags | LOOKUP_RCU, path);
-	if (unlikely(error == -ECHILD))
+	if (unlikely(error == -ECHILD)) {
+		this_cpu_inc(nr_rcu_walk_restart);
 		error = path_mountpoint(&nd, flags, path);
+	}
 	if (unlikely(error == -ESTALE))
 		error = path_mountpoint(&nd, flags | LOOKUP_REVAL, path);
 	if (likely(!error))
@@ -3254,6 +3372,7 @@ static int do_last(struct nameidata *nd,
 	int open_flag = op->open_flag;
 	bool will_truncate = (open_flag & O_TRUNC) != 0;
 	bool got_write = false;
+	bool shared;
 	int acc_mode = op->acc_mode;
 	unsigned seq;
 	struct inode *inode;
@@ -3310,15 +3429,22 @@ static int do_last(struct nameidata *nd,
 		 * dropping this one anyway.
 		 */
 	}
-	if (open_flag & O_CREAT)
-		inode_lock(dir->d_inode);
-	else
+	/*
+	 * Directories marked S_PARALLEL_CREATE cope with concurrent creates
+	 * themselves and fail all but one of them with -EEXIST, which is
+	 * only the right answer for O_EXCL.
+	 */
+	shared = !(open_flag & O_CREAT) ||
+		 ((open_flag & O_EXCL) && IS_PARALLEL_CREATE(dir->d_inode));
+	if (shared)
 		inode_lock_shared(dir->d_inode);
-	error = lookup_open(nd, &path, file, op, got_write);
-	if (open_flag & O_CREAT)
-		inode_unlock(dir->d_inode);
 	else
+		inode_lock(dir->d_inode);
+	error = lookup_open(nd, &path, file, op, got_write);
+	if (shared)
 		inode_unlock_shared(dir->d_inode);
+	else
+		inode_unlock(dir->d_inode);
 
 	if (error)
 		goto out;
@@ -3556,8 +3682,10 @@ struct file *do_filp_open(int dfd, struct filename *pathname,
 
 	set_nameidata(&nd, dfd, pathname);
 	filp = path_openat(&nd, op, flags | LOOKUP_RCU);
-	if (unlikely(filp == ERR_PTR(-ECHILD)))
+	if (unlikely(filp == ERR_PTR(-ECHILD))) {
+		this_cpu_inc(nr_rcu_walk_restart);
 		filp = path_openat(&nd, op, flags);
+	}
 	if (unlikely(filp == ERR_PTR(-ESTALE)))
 		filp = path_openat(&nd, op, flags | LOOKUP_REVAL);
 	restore_nameidata();
@@ -3584,8 +3712,10 @@ struct file *do_file_open_root(struct dentry *dentry, struct vfsmount *mnt,
 
 	set_nameidata(&nd, -1, filename);
 	file = path_openat(&nd, op, flags | LOOKUP_RCU);
-	if (unlikely(file == ERR_PTR(-ECHILD)))
+	if (unlikely(file == ERR_PTR(-ECHILD))) {
+		this_cpu_inc(nr_rcu_walk_restart);
 		file = path_openat(&nd, op, flags);
+	}
 	if (unlikely(file == ERR_PTR(-ESTALE)))
 		file = path_openat(&nd, op, flags | LOOKUP_REVAL);
 	restore_nameidata();
@@ -3958,7 +4088,8 @@ SYSCALL_DEFINE1(rmdir, const char __user *, pathname)
  * @dentry:	victim
  * @delegated_inode: returns victim inode, if the inode is delegated.
  *
- * The caller must hold dir->i_mutex.
+ * The caller must hold dir->i_mutex.  Filesystems which set
+ * FS_PARALLEL_UNLINK may also be called with it held shared.
  *
  * If vfs_unlink discovers a delegation, it will return -EWOULDBLOCK and
  * return a reference to the inode in delegated_inode.  The caller
@@ -4028,6 +4159,7 @@ long do_unlinkat(int dfd, struct filename *name)
 	struct inode *inode = NULL;
 	struct inode *delegated_inode = NULL;
 	unsigned int lookup_flags = 0;
+	bool shared;
 retry:
 	name = filename_parentat(dfd, name, lookup_flags, &path, &last, &type);
 	if (IS_ERR(name))
@@ -4040,9 +4172,20 @@ long do_unlinkat(int dfd, struct filename *name)
 	error = mnt_want_write(path.mnt);
 	if (error)
 		goto exit1;
+	/*
+	 * Filesystems which serialize concurrent unlinks in the same
+	 * directory themselves let them run in parallel.  Lookups are
+	 * done the way lookup_slow() does them then.
+	 */
+	shared = path.dentry->d_sb->s_type->fs_flags & FS_PARALLEL_UNLINK;
 retry_deleg:
-	inode_lock_nested(path.dentry->d_inode, I_MUTEX_PARENT);
-	dentry = __lookup_hash(&last, path.dentry, lookup_flags);
+	if (shared) {
+		inode_lock_shared_nested(path.dentry->d_inode, I_MUTEX_PARENT);
+		dentry = __lookup_slow(&last, path.dentry, lookup_flags);
+	} else {
+		inode_lock_nested(path.dentry->d_inode, I_MUTEX_PARENT);
+		dentry = __lookup_hash(&last, path.dentry, lookup_flags);
+	}
 	error = PTR_ERR(dentry);
 	if (!IS_ERR(dentry)) {
 		/* Why not before? Because we want correct error value */
@@ -4059,7 +4202,10 @@ long do_unlinkat(int dfd, struct filename *name)
 exit2:
 		dput(dentry);
 	}
-	inode_unlock(path.dentry->d_inode);
+	if (shared)
+		inode_unlock_shared(path.dentry->d_inode);
+	else
+		inode_unlock(path.dentry->d_inode);
 	if (inode)
 		iput(inode);	/* truncate the inode here */
 	inode = NULL;
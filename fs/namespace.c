@@ -795,6 +795,78 @@ static void touch_mnt_namespace(struct mnt_namespace *ns)
 	}
 }
 
+/*
+ * Record a change to @mnt in its namespace's change ring, if anyone has
+ * asked for it.  vfsmount lock must be held for write.
+ */
+static void mnt_notify(struct mount *mnt, unsigned int type)
+{
+	struct mnt_namespace *ns = mnt->mnt_ns;
+	struct mount_event *ev;
+
+	if (!ns || !ns->events)
+		return;
+
+	ev = &ns->events[ns->events_head & (MNT_NS_EVENTS - 1)];
+	ev->seq = ns->events_head++;
+	ev->mnt_id = mnt->mnt_id;
+	ev->type = type;
+}
+
+/*
+ * Start recording changes to @ns and return the current position in its
+ * change stream in @head.
+ */
+int mnt_ns_enable_events(struct mnt_namespace *ns, u64 *head)
+{
+	struct mount_event *events = NULL;
+
+	if (!READ_ONCE(ns->events)) {
+		events = kcalloc(MNT_NS_EVENTS, sizeof(*events), GFP_KERNEL);
+		if (!events)
+			return -ENOMEM;
+	}
+
+	lock_mount_hash();
+	if (!ns->events) {
+		ns->events = events;
+		events = NULL;
+	}
+	*head = ns->events_head;
+	unlock_mount_hash();
+
+	kfree(events);
+	return 0;
+}
+
+/*
+ * Copy up to @nr change records from position @pos on into @buf and advance
+ * @pos.  If the ring has wrapped past @pos, a single MOUNT_EVENT_OVERFLOW
+ * record is returned instead and @pos skips to the newest change.
+ */
+int mnt_ns_read_events(struct mnt_namespace *ns, u64 *pos,
+		       struct mount_event *buf, int nr)
+{
+	u64 head;
+	int i = 0;
+
+	read_seqlock_excl(&mount_lock);
+	head = ns->events_head;
+	if (head - *pos > MNT_NS_EVENTS) {
+		buf[0].seq = *pos;
+		buf[0].mnt_id = -1;
+		buf[0].type = MOUNT_EVENT_OVERFLOW;
+		*pos = head;
+		i = 1;
+	} else {
+		for (; i < nr && *pos != head; i++, (*pos)++)
+			buf[i] = ns->events[*pos & (MNT_NS_EVENTS - 1)];
+	}
+	read_sequnlock_excl(&mount_lock);
+
+	return i;
+}
+
 /*
  * vfsmount lock must be held for write
  */
@@ -891,8 +963,10 @@ static void commit_tree(struct mount *mnt)
 	BUG_ON(parent == mnt);
 
 	list_add_tail(&head, &mnt->mnt_list);
-	list_for_each_entry(m, &head, mnt_list)
+	list_for_each_entry(m, &head, mnt_list) {
 		m->mnt_ns = n;
+		mnt_notify(m, MOUNT_EVENT_ATTACH);
+	}
 
 	list_splice(&head, n->list.prev);
 
@@ -1466,6 +1540,7 @@ static void umount_tree(struct mount *mnt, enum umount_tree_flags how)
 		list_del_init(&p->mnt_list);
 		ns = p->mnt_ns;
 		if (ns) {
+			mnt_notify(p, MOUNT_EVENT_DETACH);
 			ns->mounts--;
 			__touch_mnt_namespace(ns);
 		}
@@ -2123,6 +2198,7 @@ static int attach_recursive_mnt(struct mount *source_mnt,
 	if (moving) {
 		unhash_mnt(source_mnt);
 		attach_mnt(source_mnt, dest_mnt, dest_mp);
+		mnt_notify(source_mnt, MOUNT_EVENT_MOVE);
 		touch_mnt_namespace(source_mnt->mnt_ns);
 	} else {
 		if (source_mnt->mnt_ns) {
@@ -2492,6 +2568,7 @@ static void set_mount_attributes(struct mount *mnt, unsigned int mnt_flags)
 	lock_mount_hash();
 	mnt_flags |= mnt->mnt.mnt_flags & ~MNT_USER_SETTABLE_MASK;
 	mnt->mnt.mnt_flags = mnt_flags;
+	mnt_notify(mnt, MOUNT_EVENT_SETATTR);
 	touch_mnt_namespace(mnt->mnt_ns);
 	unlock_mount_hash();
 }
@@ -3192,6 +3269,7 @@ static void free_mnt_ns(struct mnt_namespace *ns)
 		ns_free_inum(&ns->ns);
 	dec_mnt_namespaces(ns->ucounts);
 	put_user_ns(ns->user_ns);
+	kfree(ns->events);
 	kfree(ns);
 }
 
@@ -3593,6 +3671,164 @@ SYSCALL_DEFINE5(move_mount,
 	return ret;
 }
 
+static u64 mnt_flags_to_attr(int mnt_flags)
+{
+	u64 attr = 0;
+
+	if (mnt_flags & MNT_READONLY)
+		attr |= MOUNT_ATTR_RDONLY;
+	if (mnt_flags & MNT_NOSUID)
+		attr |= MOUNT_ATTR_NOSUID;
+	if (mnt_flags & MNT_NODEV)
+		attr |= MOUNT_ATTR_NODEV;
+	if (mnt_flags & MNT_NOEXEC)
+		attr |= MOUNT_ATTR_NOEXEC;
+	if (mnt_flags & MNT_NODIRATIME)
+		attr |= MOUNT_ATTR_NODIRATIME;
+
+	if (mnt_flags & MNT_NOATIME)
+		attr |= MOUNT_ATTR_NOATIME;
+	else if (!(mnt_flags & MNT_RELATIME))
+		attr |= MOUNT_ATTR_STRICTATIME;
+
+	return attr;
+}
+
+/*
+ * Append @s to the string area of @sm, which has room for @size bytes.
+ * ->size grows even when @s doesn't fit, so that it ends up holding the
+ * size the caller needs.
+ */
+static void mntstat_string(struct mntstat *sm, size_t size, u32 *field,
+			   const char *s)
+{
+	size_t len = strlen(s) + 1;
+	size_t used = sm->size - sizeof(*sm);
+
+	if (used + len <= size) {
+		memcpy(sm->str + used, s, len);
+		*field = used;
+	}
+	sm->size += len;
+}
+
+/*
+ * Fill in @sm for @m, as seen from @root.  @buf is PATH_MAX bytes of
+ * scratch space.  namespace_sem must be held.
+ */
+static int do_mntstat(struct mount *m, const struct path *root,
+		      struct mntstat *sm, size_t size, char *buf)
+{
+	struct vfsmount *mnt = &m->mnt;
+	struct super_block *sb = mnt->mnt_sb;
+	struct path mnt_path = { .dentry = mnt->mnt_root, .mnt = mnt };
+	char *p;
+
+	/* Mounts outside of a chroot jail are hidden, as in mountinfo */
+	p = __d_path(&mnt_path, root, buf, PATH_MAX);
+	if (!p)
+		return -ENOENT;
+	if (IS_ERR(p))
+		return PTR_ERR(p);
+	mntstat_string(sm, size, &sm->mnt_point, p);
+
+	p = dentry_path_raw(mnt->mnt_root, buf, PATH_MAX);
+	if (IS_ERR(p))
+		return PTR_ERR(p);
+	mntstat_string(sm, size, &sm->mnt_root, p);
+
+	mntstat_string(sm, size, &sm->fs_type, sb->s_type->name);
+
+	sm->mnt_id = m->mnt_id;
+	sm->mnt_parent_id = m->mnt_parent->mnt_id;
+	sm->mnt_attr = mnt_flags_to_attr(mnt->mnt_flags);
+
+	if (IS_MNT_SHARED(m)) {
+		sm->mnt_propagation |= MS_SHARED;
+		sm->mnt_peer_group = m->mnt_group_id;
+	}
+	if (IS_MNT_SLAVE(m)) {
+		int dom = get_dominating_id(m, root);
+
+		sm->mnt_propagation |= MS_SLAVE;
+		sm->mnt_master = m->mnt_master->mnt_group_id;
+		if (dom != sm->mnt_master)
+			sm->propagate_from = dom;
+	}
+	if (IS_MNT_UNBINDABLE(m))
+		sm->mnt_propagation |= MS_UNBINDABLE;
+	if (!sm->mnt_propagation)
+		sm->mnt_propagation = MS_PRIVATE;
+
+	sm->sb_dev_major = MAJOR(sb->s_dev);
+	sm->sb_dev_minor = MINOR(sb->s_dev);
+	sm->sb_magic = sb->s_magic;
+	sm->sb_flags = sb->s_flags & (SB_RDONLY | SB_SYNCHRONOUS |
+				      SB_DIRSYNC | SB_LAZYTIME);
+	return 0;
+}
+
+/*
+ * Return the attributes of the mount with id @mnt_id in the caller's mount
+ * namespace, i.e. the binary equivalent of its /proc/self/mountinfo line.
+ * This lets a caller that saw a change on /proc/<pid>/mountevents look at
+ * the affected mounts without reading the whole of mountinfo.  If @bufsize
+ * is too small, -EOVERFLOW is returned and @buf->size says what it takes.
+ */
+SYSCALL_DEFINE4(mntstat, int, mnt_id, struct mntstat __user *, buf,
+		size_t, bufsize, unsigned int, flags)
+{
+	struct mnt_namespace *ns = current->nsproxy->mnt_ns;
+	struct mntstat *sm;
+	struct mount *m, *found = NULL;
+	struct path root;
+	size_t size;
+	char *tmp;
+	int ret;
+
+	if (flags)
+		return -EINVAL;
+	if (bufsize < sizeof(*sm))
+		return -EINVAL;
+
+	/* Two paths and a filesystem name is all there is to return */
+	size = min_t(size_t, bufsize - sizeof(*sm), 2 * PATH_MAX + NAME_MAX);
+	sm = kvzalloc(sizeof(*sm) + size, GFP_KERNEL);
+	if (!sm)
+		return -ENOMEM;
+	sm->size = sizeof(*sm);
+
+	tmp = __getname();
+	if (!tmp) {
+		kvfree(sm);
+		return -ENOMEM;
+	}
+
+	get_fs_root(current->fs, &root);
+	down_read(&namespace_sem);
+	list_for_each_entry(m, &ns->list, mnt_list) {
+		if (m->mnt_id == mnt_id) {
+			found = m;
+			break;
+		}
+	}
+	ret = found ? do_mntstat(found, &root, sm, size, tmp) : -ENOENT;
+	up_read(&namespace_sem);
+	path_put(&root);
+	__putname(tmp);
+
+	/* too small: tell the caller how much it takes */
+	if (!ret && sm->size > sizeof(*sm) + size) {
+		ret = -EOVERFLOW;
+		if (put_user(sm->size, &buf->size))
+			ret = -EFAULT;
+	} else if (!ret && copy_to_user(buf, sm, sm->size)) {
+		ret = -EFAULT;
+	}
+	kvfree(sm);
+	return ret;
+}
+
 /*
  * Return true if path is reachable from root
  *
@@ -3721,6 +3957,8 @@ SYSCALL_DEFINE2(pivot_root, const char __user *, new_root,
 	/* mount new_root on / */
 	attach_mnt(new_mnt, root_parent, root_mp);
 	mnt_add_count(root_parent, -1);
+	mnt_notify(root_mnt, MOUNT_EVENT_MOVE);
+	mnt_notify(new_mnt, MOUNT_EVENT_MOVE);
 	touch_mnt_namespace(current->nsproxy->mnt_ns);
 	/* A moved mount should not expire automatically */
 	list_del_init(&new_mnt->mnt_expire);
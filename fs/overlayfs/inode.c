@@ -298,6 +298,8 @@ int ovl_permission(struct inode *inode, int mask)
 	}
 	err = inode_permission(realinode, mask);
 	revert_creds(old_cred);
+	if (!err && (mask & MAY_EXEC) && S_ISDIR(inode->i_mode))
+		inode_stack_may_exec(inode, realinode, mask);
 
 	return err;
 }
@@ -918,6 +918,9 @@ ovl_posix_acl_xattr_set(const struct xattr_handler *handler,
 	err = ovl_xattr_set(dentry, inode, handler->name, value, size, flags);
 	if (!err)
 		ovl_copyattr(ovl_inode_real(inode), inode);
+	/* Our access ACL is the real one, see inode_stack_may_exec() */
+	if (handler->flags == ACL_TYPE_ACCESS)
+		inode_forget_may_exec(inode);
 
 	return err;
 
@@ -57,6 +57,13 @@ unsigned int pipe_max_size = 1048576;
 unsigned long pipe_user_pages_hard;
 unsigned long pipe_user_pages_soft = PIPE_DEF_BUFFERS * INR_OPEN_CUR;
 
+/*
+ * Large writes are copied into compound pages of up to this order, so that
+ * one pipe_buffer (and one copy, one wakeup, one splice segment) covers
+ * several pages of data.
+ */
+#define PIPE_MAX_BUF_ORDER	3
+
 /*
  * We use a start+len construction, which provides full use of the 
  * allocated memory.
@@ -144,7 +151,7 @@ static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
 	 * temporary page, let's keep track of it as a one-deep
 	 * allocation cache. (Otherwise just release our reference to it)
 	 */
-	if (page_count(page) == 1 && !pipe->tmp_page)
+	if (page_count(page) == 1 && !pipe->tmp_page && !PageCompound(page))
 		pipe->tmp_page = page;
 	else
 		put_page(page);
@@ -155,7 +162,8 @@ static int anon_pipe_buf_steal(struct pipe_inode_info *pipe,
 {
 	struct page *page = buf->page;
 
-	if (page_count(page) == 1) {
+	/* Compound buffers can't be handed out as a single page */
+	if (page_count(page) == 1 && !PageCompound(page)) {
 		memcg_kmem_uncharge(page, 0);
 		__SetPageLocked(page);
 		return 0;
@@ -278,6 +286,24 @@ void pipe_buf_mark_unmergeable(struct pipe_buffer *buf)
 		buf->ops = &anon_pipe_buf_nomerge_ops;
 }
 
+/**
+ * pipe_buf_nr_pages - pages a buffer takes up in its pipe
+ * @buf:	the buffer
+ *
+ * Description:
+ *	pipe_write() may queue compound pages, every other buffer counts as
+ *	one page. Whoever adds a buffer to a pipe or takes one out adjusts
+ *	pipe->pages_used by this, under the pipe lock and before the buffer
+ *	is released.
+ */
+unsigned int pipe_buf_nr_pages(const struct pipe_buffer *buf)
+{
+	if (buf->flags & PIPE_BUF_FLAG_COMPOUND)
+		return compound_nr(buf->page);
+	return 1;
+}
+EXPORT_SYMBOL_GPL(pipe_buf_nr_pages);
+
 static bool pipe_buf_can_merge(struct pipe_buffer *buf)
 {
 	return buf->ops == &anon_pipe_buf_ops;
@@ -335,6 +361,7 @@ pipe_read(struct kiocb *iocb, struct iov_iter *to)
 			}
 
 			if (!buf->len) {
+				pipe->pages_used -= pipe_buf_nr_pages(buf);
 				pipe_buf_release(pipe, buf);
 				curbuf = (curbuf + 1) & (pipe->buffers - 1);
 				pipe->curbuf = curbuf;
@@ -390,6 +417,44 @@ static inline int is_packetized(struct file *file)
 	return (file->f_flags & O_DIRECT) != 0;
 }
 
+/*
+ * Once compound buffers are queued the pipe can fill up before its slots
+ * do, so pipe_write() and pipe_poll() go by the pages queued as well.
+ */
+static bool pipe_has_room(struct pipe_inode_info *pipe)
+{
+	return READ_ONCE(pipe->nrbufs) < pipe->buffers &&
+	       READ_ONCE(pipe->pages_used) < pipe->buffers;
+}
+
+/*
+ * Try to allocate a compound page for the next @len bytes of a write.
+ * pipe_write() keeps the pipe within its nominal size of pipe->buffers
+ * pages, compound buffers included, so that F_GETPIPE_SZ and the
+ * per-user page accounting keep meaning what they say. Returns NULL if
+ * the write is too small, the pipe too full, or no high-order page is
+ * available; the caller then falls back to an order-0 page.
+ */
+static struct page *pipe_alloc_high_order(struct pipe_inode_info *pipe,
+					  size_t len)
+{
+	unsigned int used, order;
+
+	if (len < 2 * PAGE_SIZE)
+		return NULL;
+
+	used = pipe->pages_used;
+	order = min_t(unsigned int, PIPE_MAX_BUF_ORDER, ilog2(len >> PAGE_SHIFT));
+	while (order && used + (1U << order) > pipe->buffers)
+		order--;
+	if (!order)
+		return NULL;
+
+	/* Lowmem only: the copy helpers map compound pages as one range */
+	return alloc_pages(GFP_USER | __GFP_ACCOUNT | __GFP_COMP |
+			   __GFP_NORETRY | __GFP_NOWARN, order);
+}
+
 static ssize_t
 pipe_write(struct kiocb *iocb, struct iov_iter *from)
 {
@@ -420,7 +485,8 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 		struct pipe_buffer *buf = pipe->bufs + lastbuf;
 		int offset = buf->offset + buf->len;
 
-		if (pipe_buf_can_merge(buf) && offset + chars <= PAGE_SIZE) {
+		if (pipe_buf_can_merge(buf) &&
+		    offset + chars <= page_size(buf->page)) {
 			ret = pipe_buf_confirm(pipe, buf);
 			if (ret)
 				goto out;
@@ -447,12 +513,18 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 			break;
 		}
 		bufs = pipe->nrbufs;
-		if (bufs < pipe->buffers) {
+		if (pipe_has_room(pipe)) {
 			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
-			struct page *page = pipe->tmp_page;
+			struct page *page = NULL;
+			size_t size;
 			int copied;
 
+			if (!is_packetized(filp))
+				page = pipe_alloc_high_order(pipe,
+							     iov_iter_count(from));
+			if (!page)
+				page = pipe->tmp_page;
 			if (!page) {
 				page = alloc_page(GFP_HIGHUSER | __GFP_ACCOUNT);
 				if (unlikely(!page)) {
@@ -461,14 +533,17 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 				}
 				pipe->tmp_page = page;
 			}
+			size = page_size(page);
 			/* Always wake up, even if the copy fails. Otherwise
 			 * we lock up (O_NONBLOCK-)readers that sleep due to
 			 * syscall merging.
 			 * FIXME! Is this really true?
 			 */
 			do_wakeup = 1;
-			copied = copy_page_from_iter(page, 0, PAGE_SIZE, from);
-			if (unlikely(copied < PAGE_SIZE && iov_iter_count(from))) {
+			copied = copy_page_from_iter(page, 0, size, from);
+			if (unlikely(copied < size && iov_iter_count(from))) {
+				if (page != pipe->tmp_page)
+					put_page(page);
 				if (!ret)
 					ret = -EFAULT;
 				break;
@@ -481,17 +556,21 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 			buf->offset = 0;
 			buf->len = copied;
 			buf->flags = 0;
+			if (PageCompound(page))
+				buf->flags = PIPE_BUF_FLAG_COMPOUND;
 			if (is_packetized(filp)) {
 				buf->ops = &packet_pipe_buf_ops;
 				buf->flags = PIPE_BUF_FLAG_PACKET;
 			}
+			pipe->pages_used += pipe_buf_nr_pages(buf);
 			pipe->nrbufs = ++bufs;
-			pipe->tmp_page = NULL;
+			if (page == pipe->tmp_page)
+				pipe->tmp_page = NULL;
 
 			if (!iov_iter_count(from))
 				break;
 		}
-		if (bufs < pipe->buffers)
+		if (pipe_has_room(pipe))
 			continue;
 		if (filp->f_flags & O_NONBLOCK) {
 			if (!ret)
@@ -570,7 +649,8 @@ pipe_poll(struct file *filp, poll_table *wait)
 	}
 
 	if (filp->f_mode & FMODE_WRITE) {
-		mask |= (nrbufs < pipe->buffers) ? EPOLLOUT | EPOLLWRNORM : 0;
+		if (pipe_has_room(pipe))
+			mask |= EPOLLOUT | EPOLLWRNORM;
 		/*
 		 * Most Unices do not set EPOLLERR for FIFOs but on Linux they
 		 * behave exactly like pipes for poll().
@@ -1101,12 +1181,12 @@ static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long arg)
 	}
 
 	/*
-	 * We can shrink the pipe, if arg >= pipe->nrbufs. Since we don't
+	 * We can shrink the pipe, if arg >= pipe->pages_used. Since we don't
 	 * expect a lot of shrink+grow operations, just free and allocate
 	 * again like we would do for growing. If the pipe currently
-	 * contains more buffers than arg, then return busy.
+	 * contains more pages than arg, then return busy.
 	 */
-	if (nr_pages < pipe->nrbufs) {
+	if (nr_pages < pipe->pages_used) {
 		ret = -EBUSY;
 		goto out_revert_acct;
 	}
@@ -66,6 +66,8 @@ void set_cached_acl(struct inode *inode, int type, struct posix_acl *acl)
 	struct posix_acl *old;
 
 	old = xchg(p, posix_acl_dup(acl));
+	if (type == ACL_TYPE_ACCESS)
+		inode_forget_may_exec(inode);
 	if (!is_uncached_acl(old))
 		posix_acl_release(old);
 }
@@ -83,6 +85,8 @@ static void __forget_cached_acl(struct posix_acl **p)
 void forget_cached_acl(struct inode *inode, int type)
 {
 	__forget_cached_acl(acl_by_type(inode, type));
+	if (type == ACL_TYPE_ACCESS)
+		inode_forget_may_exec(inode);
 }
 EXPORT_SYMBOL(forget_cached_acl);
 
@@ -90,6 +94,7 @@ void forget_all_cached_acls(struct inode *inode)
 {
 	__forget_cached_acl(&inode->i_acl);
 	__forget_cached_acl(&inode->i_default_acl);
+	inode_forget_may_exec(inode);
 }
 EXPORT_SYMBOL(forget_all_cached_acls);
 
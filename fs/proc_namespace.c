@@ -1,6 +1,6 @@
 // SPDX-License-Identifier: GPL-2.0
 /*
- * fs/proc_namespace.c - handling of /proc/<pid>/{mounts,mountinfo,mountstats}
+ * fs/proc_namespace.c - handling of /proc/<pid>/{mounts,mountinfo,mountstats,mountevents}
  *
  * In fact, that's a piece of procfs; it's *almost* isolated from
  * the rest of fs/proc, but has rather close relationships with
@@ -12,6 +12,7 @@
 #include <linux/security.h>
 #include <linux/fs_struct.h>
 #include <linux/sched/task.h>
+#include <uapi/linux/mount.h>
 
 #include "proc/internal.h" /* only for get_proc_task() in ->open() */
 
@@ -231,6 +232,11 @@ static int show_vfsstat(struct seq_file *m, struct vfsmount *mnt)
 	}
 
 	seq_putc(m, '\n');
+
+	/* unused negative dentries of the superblock */
+	if (!err)
+		seq_printf(m, "\tdentries: negative %lld\n",
+			   percpu_counter_sum_positive(&sb->s_nr_dentry_negative));
 out:
 	return err;
 }
@@ -337,3 +343,124 @@ const struct file_operations proc_mountstats_operations = {
 	.llseek		= seq_lseek,
 	.release	= mounts_release,
 };
+
+/*
+ * /proc/<pid>/mountevents: a stream of struct mount_event records naming
+ * the mounts that changed since the file was opened, so that watchers can
+ * pick up changes with mntstat() instead of rereading mountinfo.
+ */
+struct proc_mountevents {
+	struct mnt_namespace *ns;
+	u64 pos;
+};
+
+static int mountevents_open(struct inode *inode, struct file *file)
+{
+	struct task_struct *task = get_proc_task(inode);
+	struct proc_mountevents *p;
+	struct nsproxy *nsp;
+	int ret;
+
+	if (!task)
+		return -EINVAL;
+
+	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	if (!p) {
+		put_task_struct(task);
+		return -ENOMEM;
+	}
+
+	task_lock(task);
+	nsp = task->nsproxy;
+	if (nsp && nsp->mnt_ns) {
+		p->ns = nsp->mnt_ns;
+		get_mnt_ns(p->ns);
+	}
+	task_unlock(task);
+	put_task_struct(task);
+
+	ret = -EINVAL;
+	if (!p->ns)
+		goto err_free;
+
+	ret = mnt_ns_enable_events(p->ns, &p->pos);
+	if (ret)
+		goto err_put_ns;
+
+	file->private_data = p;
+	return 0;
+
+ err_put_ns:
+	put_mnt_ns(p->ns);
+ err_free:
+	kfree(p);
+	return ret;
+}
+
+static ssize_t mountevents_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct proc_mountevents *p = file->private_data;
+	struct mount_event events[16];
+	size_t copied = 0;
+	int nr, ret;
+
+	if (count < sizeof(events[0]))
+		return -EINVAL;
+
+	for (;;) {
+		nr = min_t(size_t, ARRAY_SIZE(events),
+			   (count - copied) / sizeof(events[0]));
+		if (!nr)
+			break;
+
+		nr = mnt_ns_read_events(p->ns, &p->pos, events, nr);
+		if (nr) {
+			if (copy_to_user(buf + copied, events,
+					 nr * sizeof(events[0])))
+				return copied ? copied : -EFAULT;
+			copied += nr * sizeof(events[0]);
+			continue;
+		}
+
+		if (copied)
+			break;
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(p->ns->poll,
+				READ_ONCE(p->ns->events_head) != p->pos);
+		if (ret)
+			return ret;
+	}
+
+	return copied;
+}
+
+static __poll_t mountevents_poll(struct file *file, poll_table *wait)
+{
+	struct proc_mountevents *p = file->private_data;
+
+	poll_wait(file, &p->ns->poll, wait);
+
+	if (READ_ONCE(p->ns->events_head) != p->pos)
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+static int mountevents_release(struct inode *inode, struct file *file)
+{
+	struct proc_mountevents *p = file->private_data;
+
+	put_mnt_ns(p->ns);
+	kfree(p);
+	return 0;
+}
+
+const struct file_operations proc_mountevents_operations = {
+	.open		= mountevents_open,
+	.read		= mountevents_read,
+	.llseek		= no_llseek,
+	.release	= mountevents_release,
+	.poll		= mountevents_poll,
+};
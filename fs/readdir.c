@@ -21,9 +21,15 @@
 #include <linux/unistd.h>
 #include <linux/compat.h>
 #include <linux/uaccess.h>
+#include <linux/namei.h>
+#include <linux/slab.h>
+#include <linux/fs_struct.h>
+#include <linux/mount.h>
 
 #include <asm/unaligned.h>
 
+#include "internal.h"
+
 /*
  * Note the "unsafe_put_user() semantics: we goto a
  * label for errors.
@@ -395,6 +401,270 @@ SYSCALL_DEFINE3(getdents64, unsigned int, fd,
 	return ksys_getdents64(fd, dirent, count);
 }
 
+/*
+ * getdents_statx() gathers names with ->iterate_shared() into a kernel
+ * buffer first and only then looks them up, with the directory unlocked,
+ * so that ->lookup() of an entry missing from the dcache does not nest
+ * inside the readdir locking.
+ */
+#define GETDENTS_STATX_BUFSIZE	(4 * PAGE_SIZE)
+
+struct getdents_statx_entry {
+	u64		ino;
+	loff_t		offset;
+	unsigned int	d_type;
+	int		namlen;
+	char		name[];
+};
+
+struct getdents_statx_callback {
+	struct dir_context ctx;
+	char *kbuf;
+	unsigned int kused;
+	unsigned int count;
+	int nr;
+	bool kfull;
+	int error;
+};
+
+static int filldir_statx(struct dir_context *ctx, const char *name, int namlen,
+			 loff_t offset, u64 ino, unsigned int d_type)
+{
+	struct getdents_statx_callback *buf =
+		container_of(ctx, struct getdents_statx_callback, ctx);
+	struct getdents_statx_entry *ent;
+	int reclen = ALIGN(offsetof(struct dirent_statx, d_name) + namlen + 1,
+		sizeof(u64));
+	int klen = ALIGN(sizeof(*ent) + namlen + 1, sizeof(u64));
+
+	buf->error = verify_dirent_name(name, namlen);
+	if (unlikely(buf->error))
+		return buf->error;
+	buf->error = -EINVAL;	/* only used if we fail.. */
+	if (reclen > buf->count)
+		return -EINVAL;
+	if (klen > GETDENTS_STATX_BUFSIZE - buf->kused) {
+		buf->kfull = true;
+		return -EINVAL;
+	}
+	if (buf->nr && signal_pending(current))
+		return -EINTR;
+
+	ent = (void *)buf->kbuf + buf->kused;
+	ent->ino = ino;
+	ent->offset = offset;
+	ent->d_type = d_type;
+	ent->namlen = namlen;
+	memcpy(ent->name, name, namlen);
+	ent->name[namlen] = '\0';
+
+	buf->kused += klen;
+	buf->count -= reclen;
+	buf->nr++;
+	return 0;
+}
+
+/* ".." the way a path walk sees it: across mounts, but not above the root */
+static void getdents_statx_dotdot(struct path *path)
+{
+	struct dentry *parent;
+	struct path root;
+
+	get_fs_root(current->fs, &root);
+	while (!path_equal(path, &root) &&
+	       path->dentry == path->mnt->mnt_root) {
+		if (!follow_up(path))
+			break;
+	}
+	if (!path_equal(path, &root)) {
+		parent = dget_parent(path->dentry);
+		dput(path->dentry);
+		path->dentry = parent;
+	}
+	path_put(&root);
+}
+
+/*
+ * Resolve @ent the way statx(dirfd, name, AT_SYMLINK_NOFOLLOW) would,
+ * except that automount points are not triggered. That includes needing
+ * search permission on the directory, for "." and ".." as well.
+ */
+static int getdents_statx_lookup(struct file *file,
+				 struct getdents_statx_entry *ent,
+				 struct path *path)
+{
+	struct dentry *dentry;
+	int error;
+
+	error = inode_permission(file_inode(file), MAY_EXEC);
+	if (error)
+		return error;
+
+	/*
+	 * "." is the directory itself, even if something has since been
+	 * mounted on it: a path walk doesn't cross mounts on ".", and
+	 * neither does statx(fd, ".").
+	 */
+	*path = file->f_path;
+	if (ent->name[0] == '.' && ent->namlen == 1) {
+		path_get(path);
+		return 0;
+	}
+	if (ent->name[0] == '.' && ent->namlen == 2 && ent->name[1] == '.') {
+		path_get(path);
+		getdents_statx_dotdot(path);
+	} else {
+		dentry = lookup_one_len_unlocked(ent->name, path->dentry,
+						 ent->namlen);
+		if (IS_ERR(dentry))
+			return PTR_ERR(dentry);
+		path->dentry = dentry;
+		mntget(path->mnt);
+	}
+	/* report what is mounted on the entry, not the covered inode */
+	while (d_mountpoint(path->dentry) && follow_down_one(path))
+		;
+	return 0;
+}
+
+static int getdents_statx_emit(struct file *file,
+			       struct getdents_statx_entry *ent, loff_t d_off,
+			       struct dirent_statx __user *dirent,
+			       unsigned int mask, unsigned int flags)
+{
+	int reclen = ALIGN(offsetof(struct dirent_statx, d_name) +
+			   ent->namlen + 1, sizeof(u64));
+	struct kstat stat;
+	struct path path;
+	int error;
+
+	error = getdents_statx_lookup(file, ent, &path);
+	if (!error) {
+		error = -ENOENT;
+		if (d_really_is_positive(path.dentry))
+			error = vfs_getattr(&path, &stat, mask, flags);
+		path_put(&path);
+	}
+
+	/* An entry we failed to stat is still returned, with no attributes */
+	if (error) {
+		if (clear_user(&dirent->d_stx, sizeof(dirent->d_stx)))
+			return -EFAULT;
+	} else if (cp_statx(&stat, &dirent->d_stx)) {
+		return -EFAULT;
+	}
+	if (clear_user(dirent->__spare0, sizeof(dirent->__spare0)))
+		return -EFAULT;
+
+	if (!user_access_begin(dirent, reclen))
+		return -EFAULT;
+	unsafe_put_user(ent->ino, &dirent->d_ino, efault_end);
+	unsafe_put_user(d_off, &dirent->d_off, efault_end);
+	unsafe_put_user(reclen, &dirent->d_reclen, efault_end);
+	unsafe_put_user(ent->d_type, &dirent->d_type, efault_end);
+	unsafe_copy_dirent_name(dirent->d_name, ent->name, ent->namlen,
+				efault_end);
+	user_access_end();
+	return reclen;
+
+efault_end:
+	user_access_end();
+	return -EFAULT;
+}
+
+/**
+ * sys_getdents_statx - read directory entries along with their attributes
+ * @fd: directory to read
+ * @dirent: buffer for struct dirent_statx records
+ * @count: size of @dirent
+ * @mask: STATX_* attributes wanted, as for statx()
+ * @flags: AT_STATX_* synchronisation flags, as for statx()
+ *
+ * Works like getdents64(), each entry also carrying what statx() with
+ * AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT would return for it: a mountpoint
+ * reports the root of what is mounted on it, ".." crosses mounts the way a
+ * path walk does, and "." reports @fd's own directory, as statx(@fd, ".")
+ * does.  Returns the number of bytes filled in, 0 at the end of the
+ * directory.
+ */
+SYSCALL_DEFINE5(getdents_statx, unsigned int, fd,
+		struct dirent_statx __user *, dirent, unsigned int, count,
+		unsigned int, mask, unsigned int, flags)
+{
+	struct getdents_statx_callback buf = {
+		.ctx.actor = filldir_statx,
+		.count = count,
+	};
+	struct dirent_statx __user *cur = dirent;
+	struct fd f;
+	int error;
+
+	if (mask & STATX__RESERVED)
+		return -EINVAL;
+	if (flags & ~AT_STATX_SYNC_TYPE)
+		return -EINVAL;
+	if ((flags & AT_STATX_SYNC_TYPE) == AT_STATX_SYNC_TYPE)
+		return -EINVAL;
+	if (!access_ok(dirent, count))
+		return -EFAULT;
+
+	buf.kbuf = kmalloc(GETDENTS_STATX_BUFSIZE, GFP_KERNEL);
+	if (!buf.kbuf)
+		return -ENOMEM;
+
+	f = fdget_pos(fd);
+	if (!f.file) {
+		error = -EBADF;
+		goto out_free;
+	}
+
+	do {
+		unsigned int pos;
+
+		buf.kused = 0;
+		buf.nr = 0;
+		buf.kfull = false;
+		error = iterate_dir(f.file, &buf.ctx);
+		if (error >= 0)
+			error = buf.error;
+		if (!buf.nr)
+			break;
+
+		for (pos = 0; pos < buf.kused; ) {
+			struct getdents_statx_entry *ent = (void *)buf.kbuf + pos;
+			struct getdents_statx_entry *next;
+			loff_t d_off = buf.ctx.pos;
+			int reclen;
+
+			pos += ALIGN(sizeof(*ent) + ent->namlen + 1, sizeof(u64));
+			if (pos < buf.kused) {
+				next = (void *)buf.kbuf + pos;
+				d_off = next->offset;
+			}
+
+			reclen = getdents_statx_emit(f.file, ent, d_off, cur,
+						     mask, flags);
+			if (reclen < 0) {
+				/* Resume at the entry we failed to return */
+				f.file->f_pos = ent->offset;
+				f.file->f_version = 0;
+				error = reclen;
+				goto out_put;
+			}
+			cur = (void __user *)cur + reclen;
+		}
+		error = 0;
+	} while (buf.kfull && !fatal_signal_pending(current));
+
+out_put:
+	if (cur != dirent)
+		error = (void __user *)cur - (void __user *)dirent;
+	fdput_pos(f);
+out_free:
+	kfree(buf.kbuf);
+	return error;
+}
+
 #ifdef CONFIG_COMPAT
 struct compat_old_linux_dirent {
 	compat_ulong_t	d_ino;
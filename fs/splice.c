@@ -207,6 +207,7 @@ ssize_t splice_to_pipe(struct pipe_inode_info *pipe,
 		buf->ops = spd->ops;
 		buf->flags = 0;
 
+		pipe->pages_used += pipe_buf_nr_pages(buf);
 		pipe->nrbufs++;
 		page_nr++;
 		ret += buf->len;
@@ -238,6 +239,7 @@ ssize_t add_to_pipe(struct pipe_inode_info *pipe, struct pipe_buffer *buf)
 	} else {
 		int newbuf = (pipe->curbuf + pipe->nrbufs) & (pipe->buffers - 1);
 		pipe->bufs[newbuf] = *buf;
+		pipe->pages_used += pipe_buf_nr_pages(buf);
 		pipe->nrbufs++;
 		return buf->len;
 	}
@@ -510,6 +512,7 @@ static int splice_from_pipe_feed(struct pipe_inode_info *pipe, struct splice_des
 		sd->total_len -= ret;
 
 		if (!buf->len) {
+			pipe->pages_used -= pipe_buf_nr_pages(buf);
 			pipe_buf_release(pipe, buf);
 			pipe->curbuf = (pipe->curbuf + 1) & (pipe->buffers - 1);
 			pipe->nrbufs--;
@@ -757,6 +760,7 @@ iter_file_splice_write(struct pipe_inode_info *pipe, struct file *out,
 			if (ret >= buf->len) {
 				ret -= buf->len;
 				buf->len = 0;
+				pipe->pages_used -= pipe_buf_nr_pages(buf);
 				pipe_buf_release(pipe, buf);
 				pipe->curbuf = (pipe->curbuf + 1) & (pipe->buffers - 1);
 				pipe->nrbufs--;
@@ -993,6 +997,7 @@ ssize_t splice_direct_to_actor(struct file *in, struct splice_desc *sd,
 
 done:
 	pipe->nrbufs = pipe->curbuf = 0;
+	pipe->pages_used = 0;
 	file_accessed(in);
 	return bytes;
 
@@ -1097,9 +1102,8 @@ static int splice_pipe_to_pipe(struct pipe_inode_info *ipipe,
 /*
  * Determine where to splice to/from.
  */
-static long do_splice(struct file *in, loff_t __user *off_in,
-		      struct file *out, loff_t __user *off_out,
-		      size_t len, unsigned int flags)
+long do_splice(struct file *in, loff_t *off_in, struct file *out,
+	       loff_t *off_out, size_t len, unsigned int flags)
 {
 	struct pipe_inode_info *ipipe;
 	struct pipe_inode_info *opipe;
@@ -1135,8 +1139,7 @@ static long do_splice(struct file *in, loff_t __user *off_in,
 		if (off_out) {
 			if (!(out->f_mode & FMODE_PWRITE))
 				return -EINVAL;
-			if (copy_from_user(&offset, off_out, sizeof(loff_t)))
-				return -EFAULT;
+			offset = *off_out;
 		} else {
 			offset = out->f_pos;
 		}
@@ -1160,8 +1163,8 @@ static long do_splice(struct file *in, loff_t __user *off_in,
 
 		if (!off_out)
 			out->f_pos = offset;
-		else if (copy_to_user(off_out, &offset, sizeof(loff_t)))
-			ret = -EFAULT;
+		else
+			*off_out = offset;
 
 		return ret;
 	}
@@ -1172,8 +1175,7 @@ static long do_splice(struct file *in, loff_t __user *off_in,
 		if (off_in) {
 			if (!(in->f_mode & FMODE_PREAD))
 				return -EINVAL;
-			if (copy_from_user(&offset, off_in, sizeof(loff_t)))
-				return -EFAULT;
+			offset = *off_in;
 		} else {
 			offset = in->f_pos;
 		}
@@ -1197,14 +1199,51 @@ static long do_splice(struct file *in, loff_t __user *off_in,
 			wakeup_pipe_readers(opipe);
 		if (!off_in)
 			in->f_pos = offset;
-		else if (copy_to_user(off_in, &offset, sizeof(loff_t)))
-			ret = -EFAULT;
+		else
+			*off_in = offset;
 
 		return ret;
 	}
 
 	return -EINVAL;
 }
+EXPORT_SYMBOL_GPL(do_splice);
+
+static long __do_splice(struct file *in, loff_t __user *off_in,
+			struct file *out, loff_t __user *off_out,
+			size_t len, unsigned int flags)
+{
+	loff_t offset_in, offset_out;
+	loff_t *poff_in = NULL, *poff_out = NULL;
+	long ret;
+
+	if (get_pipe_info(in) && off_in)
+		return -ESPIPE;
+	if (get_pipe_info(out) && off_out)
+		return -ESPIPE;
+
+	if (off_in) {
+		if (copy_from_user(&offset_in, off_in, sizeof(loff_t)))
+			return -EFAULT;
+		poff_in = &offset_in;
+	}
+	if (off_out) {
+		if (copy_from_user(&offset_out, off_out, sizeof(loff_t)))
+			return -EFAULT;
+		poff_out = &offset_out;
+	}
+
+	ret = do_splice(in, poff_in, out, poff_out, len, flags);
+	if (ret < 0)
+		return ret;
+
+	if (off_in && copy_to_user(off_in, poff_in, sizeof(loff_t)))
+		return -EFAULT;
+	if (off_out && copy_to_user(off_out, poff_out, sizeof(loff_t)))
+		return -EFAULT;
+
+	return ret;
+}
 
 static int iter_to_pipe(struct iov_iter *from,
 			struct pipe_inode_info *pipe,
@@ -1432,9 +1471,9 @@ SYSCALL_DEFINE6(splice, int, fd_in, loff_t __user *, off_in,
 			out = fdget(fd_out);
 			if (out.file) {
 				if (out.file->f_mode & FMODE_WRITE)
-					error = do_splice(in.file, off_in,
-							  out.file, off_out,
-							  len, flags);
+					error = __do_splice(in.file, off_in,
+							    out.file, off_out,
+							    len, flags);
 				fdput(out);
 			}
 		}
@@ -1595,7 +1634,9 @@ static int splice_pipe_to_pipe(struct pipe_inode_info *ipipe,
 			 */
 			*obuf = *ibuf;
 			ibuf->ops = NULL;
+			opipe->pages_used += pipe_buf_nr_pages(obuf);
 			opipe->nrbufs++;
+			ipipe->pages_used -= pipe_buf_nr_pages(obuf);
 			ipipe->curbuf = (ipipe->curbuf + 1) & (ipipe->buffers - 1);
 			ipipe->nrbufs--;
 			input_wakeup = true;
@@ -1620,6 +1661,7 @@ static int splice_pipe_to_pipe(struct pipe_inode_info *ipipe,
 			pipe_buf_mark_unmergeable(obuf);
 
 			obuf->len = len;
+			opipe->pages_used += pipe_buf_nr_pages(obuf);
 			opipe->nrbufs++;
 			ibuf->offset += obuf->len;
 			ibuf->len -= obuf->len;
@@ -1702,6 +1744,7 @@ static int link_pipe(struct pipe_inode_info *ipipe,
 		if (obuf->len > len)
 			obuf->len = len;
 
+		opipe->pages_used += pipe_buf_nr_pages(obuf);
 		opipe->nrbufs++;
 		ret += obuf->len;
 		len -= obuf->len;
@@ -1733,8 +1776,7 @@ static int link_pipe(struct pipe_inode_info *ipipe,
  * The 'flags' used are the SPLICE_F_* variants, currently the only
  * applicable one is SPLICE_F_NONBLOCK.
  */
-static long do_tee(struct file *in, struct file *out, size_t len,
-		   unsigned int flags)
+long do_tee(struct file *in, struct file *out, size_t len, unsigned int flags)
 {
 	struct pipe_inode_info *ipipe = get_pipe_info(in);
 	struct pipe_inode_info *opipe = get_pipe_info(out);
@@ -1762,6 +1804,7 @@ static long do_tee(struct file *in, struct file *out, size_t len,
 
 	return ret;
 }
+EXPORT_SYMBOL_GPL(do_tee);
 
 SYSCALL_DEFINE4(tee, int, fdin, int, fdout, size_t, len, unsigned int, flags)
 {
@@ -84,7 +84,8 @@ static unsigned long super_cache_scan(struct shrinker *shrink,
 		fs_objects = sb->s_op->nr_cached_objects(sb, sc);
 
 	inodes = list_lru_shrink_count(&sb->s_inode_lru, sc);
-	dentries = list_lru_shrink_count(&sb->s_dentry_lru, sc);
+	dentries = list_lru_shrink_count(&sb->s_dentry_lru, sc) +
+		   list_lru_shrink_count(&sb->s_dentry_negative_lru, sc);
 	total_objects = dentries + inodes + fs_objects + 1;
 	if (!total_objects)
 		total_objects = 1;
@@ -145,6 +146,7 @@ static unsigned long super_cache_count(struct shrinker *shrink,
 		total_objects = sb->s_op->nr_cached_objects(sb, sc);
 
 	total_objects += list_lru_shrink_count(&sb->s_dentry_lru, sc);
+	total_objects += list_lru_shrink_count(&sb->s_dentry_negative_lru, sc);
 	total_objects += list_lru_shrink_count(&sb->s_inode_lru, sc);
 
 	if (!total_objects)
@@ -162,6 +164,7 @@ static void destroy_super_work(struct work_struct *work)
 
 	for (i = 0; i < SB_FREEZE_LEVELS; i++)
 		percpu_free_rwsem(&s->s_writers.rw_sem[i]);
+	percpu_counter_destroy(&s->s_nr_dentry_negative);
 	kfree(s);
 }
 
@@ -179,6 +182,7 @@ static void destroy_unused_super(struct super_block *s)
 		return;
 	up_write(&s->s_umount);
 	list_lru_destroy(&s->s_dentry_lru);
+	list_lru_destroy(&s->s_dentry_negative_lru);
 	list_lru_destroy(&s->s_inode_lru);
 	security_sb_free(s);
 	put_user_ns(s->s_user_ns);
@@ -271,8 +275,12 @@ static struct super_block *alloc_super(struct file_system_type *type, int flags,
 		goto fail;
 	if (list_lru_init_memcg(&s->s_dentry_lru, &s->s_shrink))
 		goto fail;
+	if (list_lru_init_memcg(&s->s_dentry_negative_lru, &s->s_shrink))
+		goto fail;
 	if (list_lru_init_memcg(&s->s_inode_lru, &s->s_shrink))
 		goto fail;
+	if (percpu_counter_init(&s->s_nr_dentry_negative, 0, GFP_KERNEL))
+		goto fail;
 	return s;
 
 fail:
@@ -290,6 +298,7 @@ static void __put_super(struct super_block *s)
 	if (!--s->s_count) {
 		list_del_init(&s->s_list);
 		WARN_ON(s->s_dentry_lru.node);
+		WARN_ON(s->s_dentry_negative_lru.node);
 		WARN_ON(s->s_inode_lru.node);
 		WARN_ON(!list_empty(&s->s_mounts));
 		security_sb_free(s);
@@ -340,6 +349,7 @@ void deactivate_locked_super(struct super_block *s)
 		 * the lru lists right now.
 		 */
 		list_lru_destroy(&s->s_dentry_lru);
+		list_lru_destroy(&s->s_dentry_negative_lru);
 		list_lru_destroy(&s->s_inode_lru);
 
 		put_filesystem(fs);
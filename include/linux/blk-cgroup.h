@@ -891,4 +891,13 @@ static inline bool blk_cgroup_mergeable(struct request *rq, struct bio *bio) { r
 
 #endif	/* CONFIG_BLOCK */
 #endif	/* CONFIG_BLK_CGROUP */
+
+#ifdef CONFIG_BLK_CGROUP_IOCOST
+u32 blkcg_iocost_dfl_weight(struct blkcg *blkcg);
+#else
+static inline u32 blkcg_iocost_dfl_weight(struct blkcg *blkcg)
+{
+	return CGROUP_WEIGHT_DFL;
+}
+#endif
 #endif	/* _BLK_CGROUP_H */
@@ -25,6 +25,7 @@
 #include <linux/stddef.h>
 #include <linux/mutex.h>
 #include <linux/timer.h>
+#include <linux/workqueue.h>
 #include <linux/slab.h>
 #include <linux/bit_spinlock.h>
 #include <crypto/hash.h>
@@ -67,6 +68,7 @@ extern void *jbd2_alloc(size_t size, gfp_t flags);
 extern void jbd2_free(void *ptr, size_t size);
 
 #define JBD2_MIN_JOURNAL_BLOCKS 1024
+#define JBD2_DEFAULT_FAST_COMMIT_BLOCKS 256
 
 #ifdef __KERNEL__
 
@@ -262,7 +264,10 @@ typedef struct journal_superblock_s
 /* 0x0050 */
 	__u8	s_checksum_type;	/* checksum type */
 	__u8	s_padding2[3];
-	__u32	s_padding[42];
+/* 0x0054 */
+	__u32	s_padding[41];
+/* 0x00F8 */
+	__be32	s_num_fc_blks;		/* Number of fast commit blocks */
 	__be32	s_checksum;		/* crc32c(superblock) */
 
 /* 0x0100 */
@@ -288,6 +293,8 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 #define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
 #define JBD2_FEATURE_INCOMPAT_CSUM_V3		0x00000010
+/* Not upstream's fast commit (0x20), whose area has another format */
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x80000000
 
 /* See "journal feature predicate functions" below */
 
@@ -298,7 +305,8 @@ typedef struct journal_superblock_s
 					JBD2_FEATURE_INCOMPAT_64BIT | \
 					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
 					JBD2_FEATURE_INCOMPAT_CSUM_V2 | \
-					JBD2_FEATURE_INCOMPAT_CSUM_V3)
+					JBD2_FEATURE_INCOMPAT_CSUM_V3 | \
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -756,6 +764,11 @@ jbd2_time_diff(unsigned long start, unsigned long end)
 
 #define JBD2_NR_BATCH	64
 
+enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
+
+#define JBD2_FC_REPLAY_STOP	0
+#define JBD2_FC_REPLAY_CONTINUE	1
+
 /**
  * struct journal_s - The journal_s type is the concrete type associated with
  *     journal_t.
@@ -854,6 +867,13 @@ struct journal_s
 	 */
 	wait_queue_head_t	j_wait_updates;
 
+	/**
+	 * @j_fc_wait:
+	 *
+	 * Wait queue to wait for completion of a fast or full commit.
+	 */
+	wait_queue_head_t	j_fc_wait;
+
 	/**
 	 * @j_wait_reserved:
 	 *
@@ -878,6 +898,14 @@ struct journal_s
 	 */
 	struct buffer_head	*j_chkpt_bhs[JBD2_NR_BATCH];
 
+	/**
+	 * @j_checkpoint_work:
+	 *
+	 * Background checkpoint, queued at the end of a commit once the
+	 * free log space drops below jbd2_checkpoint_low_wm().
+	 */
+	struct work_struct	j_checkpoint_work;
+
 	/**
 	 * @j_head:
 	 *
@@ -918,6 +946,31 @@ struct journal_s
 	 */
 	unsigned long		j_last;
 
+	/**
+	 * @j_fc_first:
+	 *
+	 * The block number of the first fast commit block in the journal
+	 * [j_state_lock].
+	 */
+	unsigned long		j_fc_first;
+
+	/**
+	 * @j_fc_off:
+	 *
+	 * Number of fast commit blocks already used by the running
+	 * transaction.  Only touched by the fast commit owner (see
+	 * %JBD2_FAST_COMMIT_ONGOING) and reset at the end of a full commit.
+	 */
+	unsigned long		j_fc_off;
+
+	/**
+	 * @j_fc_last:
+	 *
+	 * The block number one beyond the last fast commit block in the
+	 * journal [j_state_lock].
+	 */
+	unsigned long		j_fc_last;
+
 	/**
 	 * @j_dev: Device where we store the journal.
 	 */
@@ -1161,6 +1214,20 @@ struct journal_s
 	 */
 	void *j_private;
 
+	/**
+	 * @j_fc_replay_callback:
+	 *
+	 * Client callback invoked for every block of the fast commit area
+	 * during the scan and replay passes of recovery.  @expected_tid is
+	 * the first transaction which was not found committed in the log.
+	 * Returns %JBD2_FC_REPLAY_CONTINUE to look at the next block,
+	 * %JBD2_FC_REPLAY_STOP to end the pass or a negative error.
+	 */
+	int (*j_fc_replay_callback)(struct journal_s *journal,
+				    struct buffer_head *bh,
+				    enum passtype pass, int off,
+				    tid_t expected_tid);
+
 	/**
 	 * @j_chksum_driver:
 	 *
@@ -1258,6 +1325,7 @@ JBD2_FEATURE_INCOMPAT_FUNCS(64bit,		64BIT)
 JBD2_FEATURE_INCOMPAT_FUNCS(async_commit,	ASYNC_COMMIT)
 JBD2_FEATURE_INCOMPAT_FUNCS(csum2,		CSUM_V2)
 JBD2_FEATURE_INCOMPAT_FUNCS(csum3,		CSUM_V3)
+JBD2_FEATURE_INCOMPAT_FUNCS(fast_commit,	FAST_COMMIT)
 
 /*
  * Journal flag definitions
@@ -1272,6 +1340,8 @@ JBD2_FEATURE_INCOMPAT_FUNCS(csum3,		CSUM_V3)
 						 * data write error in ordered
 						 * mode */
 #define JBD2_REC_ERR	0x080	/* The errno in the sb has been recorded */
+#define JBD2_FAST_COMMIT_ONGOING	0x100	/* Fast commit is ongoing */
+#define JBD2_FULL_COMMIT_ONGOING	0x200	/* Full commit is ongoing */
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1432,6 +1502,9 @@ extern int	   jbd2_journal_clear_err  (journal_t *);
 extern int	   jbd2_journal_bmap(journal_t *, unsigned long, unsigned long long *);
 extern int	   jbd2_journal_force_commit(journal_t *);
 extern int	   jbd2_journal_force_commit_nested(journal_t *);
+extern int	   jbd2_fc_begin_commit(journal_t *journal, tid_t tid);
+extern int	   jbd2_fc_end_commit(journal_t *journal);
+extern int	   jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out);
 extern int	   jbd2_journal_inode_ranged_write(handle_t *handle,
 			struct jbd2_inode *inode, loff_t start_byte,
 			loff_t length);
@@ -1520,6 +1593,8 @@ int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
 int jbd2_transaction_committed(journal_t *journal, tid_t tid);
 int jbd2_complete_transaction(journal_t *journal, tid_t tid);
 int jbd2_log_do_checkpoint(journal_t *journal);
+void jbd2_log_queue_checkpoint(journal_t *journal);
+void jbd2_checkpoint_work(struct work_struct *work);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
 void __jbd2_log_wait_for_space(journal_t *journal);
@@ -1620,6 +1695,22 @@ static inline unsigned long jbd2_log_space_left(journal_t *journal)
 	return max_t(long, free, 0);
 }
 
+/*
+ * Background checkpointing starts once fewer than two transactions' worth
+ * of log space is left, well before __jbd2_log_wait_for_space() would make
+ * a writer checkpoint synchronously, and stops once another transaction's
+ * worth has been freed.
+ */
+static inline unsigned long jbd2_checkpoint_low_wm(journal_t *journal)
+{
+	return 2 * jbd2_space_needed(journal);
+}
+
+static inline unsigned long jbd2_checkpoint_high_wm(journal_t *journal)
+{
+	return 3 * jbd2_space_needed(journal);
+}
+
 /*
  * Definitions which augment the buffer_head layer
  */
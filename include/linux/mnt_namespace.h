@@ -17,6 +17,7 @@ extern int is_current_mnt_ns(struct vfsmount *mnt);
 extern const struct file_operations proc_mounts_operations;
 extern const struct file_operations proc_mountinfo_operations;
 extern const struct file_operations proc_mountstats_operations;
+extern const struct file_operations proc_mountevents_operations;
 
 #endif
 #endif
@@ -457,6 +457,8 @@ enum {
  * false on data copy or out of memory error caused by data copy attempt.
  * The ctx field is used to track device context.
  * The desc field is used to track userspace buffer index.
+ * With UBUF_F_REFCOUNTED, the callback runs once the last skb referencing
+ * the ubuf_info is gone, like for MSG_ZEROCOPY, rather than once per skb.
  */
 struct ubuf_info {
 	void (*callback)(struct ubuf_info *, bool zerocopy_success);
@@ -473,6 +475,7 @@ struct ubuf_info {
 		};
 	};
 	refcount_t refcnt;
+	u8 flags;
 
 	struct mmpin {
 		struct user_struct *user;
@@ -480,6 +483,8 @@ struct ubuf_info {
 	} mmp;
 };
 
+#define UBUF_F_REFCOUNTED	0x1
+
 #define skb_uarg(SKB)	((struct ubuf_info *)(skb_shinfo(SKB)->destructor_arg))
 
 int mm_account_pinned_pages(struct mmpin *mmp, size_t size);
@@ -499,6 +504,12 @@ void sock_zerocopy_put_abort(struct ubuf_info *uarg, bool have_uref);
 
 void sock_zerocopy_callback(struct ubuf_info *uarg, bool success);
 
+static inline bool sock_zerocopy_refcounted(struct ubuf_info *uarg)
+{
+	return uarg->callback == sock_zerocopy_callback ||
+	       (uarg->flags & UBUF_F_REFCOUNTED);
+}
+
 int skb_zerocopy_iter_dgram(struct sk_buff *skb, struct msghdr *msg, int len);
 int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
 			     struct msghdr *msg, int len,
@@ -1453,7 +1464,7 @@ static inline void skb_zcopy_clear(struct sk_buff *skb, bool zerocopy)
 	if (uarg) {
 		if (skb_zcopy_is_nouarg(skb)) {
 			/* no notification callback */
-		} else if (uarg->callback == sock_zerocopy_callback) {
+		} else if (sock_zerocopy_refcounted(uarg)) {
 			uarg->zerocopy = uarg->zerocopy && zerocopy;
 			sock_zerocopy_put(uarg);
 		} else {
@@ -2745,7 +2756,7 @@ static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
 	if (likely(!skb_zcopy(skb)))
 		return 0;
 	if (!skb_zcopy_is_nouarg(skb) &&
-	    skb_uarg(skb)->callback == sock_zerocopy_callback)
+	    sock_zerocopy_refcounted(skb_uarg(skb)))
 		return 0;
 	return skb_copy_ubufs(skb, gfp_mask);
 }
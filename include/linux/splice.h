@@ -93,4 +93,8 @@ extern long do_splice_from(struct pipe_inode_info *pipe, struct file *out,
 extern long do_splice_to(struct file *in, loff_t *ppos,
 			 struct pipe_inode_info *pipe, size_t len,
 			 unsigned int flags);
+extern long do_splice(struct file *in, loff_t *off_in, struct file *out,
+		      loff_t *off_out, size_t len, unsigned int flags);
+extern long do_tee(struct file *in, struct file *out, size_t len,
+		   unsigned int flags);
 #endif
@@ -69,6 +69,8 @@ struct rseq;
 union bpf_attr;
 struct io_uring_params;
 struct clone_args;
+struct dirent_statx;
+struct mntstat;
 
 #include <linux/types.h>
 #include <linux/aio_abi.h>
@@ -453,6 +455,10 @@ asmlinkage long sys_quotactl(unsigned int cmd, const char __user *special,
 asmlinkage long sys_getdents64(unsigned int fd,
 				struct linux_dirent64 __user *dirent,
 				unsigned int count);
+asmlinkage long sys_getdents_statx(unsigned int fd,
+				   struct dirent_statx __user *dirent,
+				   unsigned int count, unsigned int mask,
+				   unsigned int flags);
 
 /* fs/read_write.c */
 asmlinkage long sys_llseek(unsigned int fd, unsigned long offset_high,
@@ -997,6 +1003,8 @@ asmlinkage long sys_fsconfig(int fs_fd, unsigned int cmd, const char __user *key
 			     const void __user *value, int aux);
 asmlinkage long sys_fsmount(int fs_fd, unsigned int flags, unsigned int ms_flags);
 asmlinkage long sys_fspick(int dfd, const char __user *path, unsigned int flags);
+asmlinkage long sys_mntstat(int mnt_id, struct mntstat __user *buf,
+			    size_t bufsize, unsigned int flags);
 asmlinkage long sys_pidfd_send_signal(int pidfd, int sig,
 				       siginfo_t __user *info,
 				       unsigned int flags);
@@ -15,6 +15,7 @@ init_task_work(struct callback_head *twork, task_work_func_t func)
 
 int task_work_add(struct task_struct *task, struct callback_head *twork, bool);
 struct callback_head *task_work_cancel(struct task_struct *, task_work_func_t);
+bool task_work_cancel_cb(struct task_struct *, struct callback_head *);
 void task_work_run(void);
 
 static inline void exit_task_work(struct task_struct *task)
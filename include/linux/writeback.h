@@ -162,6 +162,14 @@ struct wb_domain {
 	 */
 	unsigned long dirty_limit_tstamp;
 	unsigned long dirty_limit;
+
+	/*
+	 * Sum of the io.weight of the wbs with dirty inodes, on any bdi.
+	 * Only maintained for global_wb_domain, where it sizes the dirty
+	 * share each cgroup wb is guaranteed regardless of its writeout
+	 * fraction.
+	 */
+	atomic_t tot_dirty_weight;
 };
 
 /**
@@ -851,8 +851,17 @@ __SYSCALL(__NR_pidfd_open, sys_pidfd_open)
 __SYSCALL(__NR_clone3, sys_clone3)
 #endif
 
+/*
+ * Syscalls not in mainline Linux.  They start at 512, above the numbers
+ * mainline has allocated, so that its syscalls are never run as ours.
+ */
+#define __NR_getdents_statx 512
+__SYSCALL(__NR_getdents_statx, sys_getdents_statx)
+#define __NR_mntstat 513
+__SYSCALL(__NR_mntstat, sys_mntstat)
+
 #undef __NR_syscalls
-#define __NR_syscalls 436
+#define __NR_syscalls 514
 
 /*
  * 32 bit systems traditionally used different
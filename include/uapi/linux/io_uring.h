@@ -19,8 +19,14 @@ struct io_uring_sqe {
 	__u8	flags;		/* IOSQE_ flags */
 	__u16	ioprio;		/* ioprio for the request */
 	__s32	fd;		/* file descriptor to do IO on */
-	__u64	off;		/* offset into file */
-	__u64	addr;		/* pointer to buffer or iovecs */
+	union {
+		__u64	off;	/* offset into file */
+		__u64	addr2;
+	};
+	union {
+		__u64	addr;	/* pointer to buffer or iovecs */
+		__u64	splice_off_in;
+	};
 	__u32	len;		/* buffer size or number of iovecs */
 	union {
 		__kernel_rwf_t	rw_flags;
@@ -29,10 +35,29 @@ struct io_uring_sqe {
 		__u32		sync_range_flags;
 		__u32		msg_flags;
 		__u32		timeout_flags;
+		__u32		open_flags;
+		__u32		statx_flags;
+		__u32		fadvise_advice;
+		__u32		accept_flags;
+		__u32		splice_flags;
 	};
 	__u64	user_data;	/* data to be passed back at completion time */
 	union {
-		__u16	buf_index;	/* index into fixed buffers, if used */
+		struct {
+			/* pack this to avoid bogus arm OABI complaints */
+			union {
+				/* index into fixed buffers, if used */
+				__u16	buf_index;
+				/* for grouped buffer selection */
+				__u16	buf_group;
+			} __attribute__((packed));
+			__u16	__pad1;
+			union {
+				__s32	splice_fd_in;
+				/* openat/accept: fixed slot + 1, if non-zero */
+				__u32	file_index;
+			};
+		};
 		__u64	__pad2[3];
 	};
 };
@@ -43,6 +68,7 @@ struct io_uring_sqe {
 #define IOSQE_FIXED_FILE	(1U << 0)	/* use fixed fileset */
 #define IOSQE_IO_DRAIN		(1U << 1)	/* issue after inflight IO */
 #define IOSQE_IO_LINK		(1U << 2)	/* links next sqe */
+#define IOSQE_BUFFER_SELECT	(1U << 5)	/* select buffer from sqe->buf_group */
 
 /*
  * io_uring_setup() flags
@@ -51,6 +77,9 @@ struct io_uring_sqe {
 #define IORING_SETUP_SQPOLL	(1U << 1)	/* SQ poll thread */
 #define IORING_SETUP_SQ_AFF	(1U << 2)	/* sq_thread_cpu is valid */
 
+/* Not in mainline, numbered away from its flags */
+#define IORING_SETUP_SQ_SHARED	(1U << 31)	/* share SQ thread per cpu/cgroup */
+
 #define IORING_OP_NOP		0
 #define IORING_OP_READV		1
 #define IORING_OP_WRITEV	2
@@ -63,12 +92,75 @@ struct io_uring_sqe {
 #define IORING_OP_SENDMSG	9
 #define IORING_OP_RECVMSG	10
 #define IORING_OP_TIMEOUT	11
+#define IORING_OP_ACCEPT	13
+#define IORING_OP_CONNECT	16
+#define IORING_OP_FALLOCATE	17
+#define IORING_OP_OPENAT	18
+#define IORING_OP_CLOSE		19
+#define IORING_OP_FILES_UPDATE	20
+#define IORING_OP_STATX		21
+#define IORING_OP_READ		22
+#define IORING_OP_WRITE		23
+#define IORING_OP_FADVISE	24
+#define IORING_OP_MADVISE	25
+#define IORING_OP_SEND		26
+#define IORING_OP_RECV		27
+#define IORING_OP_SPLICE	30
+#define IORING_OP_PROVIDE_BUFFERS	31
+#define IORING_OP_REMOVE_BUFFERS	32
+#define IORING_OP_TEE		33
+#define IORING_OP_SEND_ZC	47
 
 /*
  * sqe->fsync_flags
  */
 #define IORING_FSYNC_DATASYNC	(1U << 0)
 
+/*
+ * sqe->splice_flags
+ * extends splice(2) flags
+ */
+#define SPLICE_F_FD_IN_FIXED	(1U << 31) /* the last bit of __u32 */
+
+/*
+ * POLL_ADD flags, stored in sqe->len
+ *
+ * IORING_POLL_ADD_MULTI	Multishot poll. Posts a CQE for every event
+ *				and stays armed until cancelled.
+ */
+#define IORING_POLL_ADD_MULTI	(1U << 0)
+
+/*
+ * accept flags, stored in sqe->ioprio
+ *
+ * IORING_ACCEPT_MULTISHOT	Keep accepting, posting a CQE per connection.
+ */
+#define IORING_ACCEPT_MULTISHOT	(1U << 0)
+
+/*
+ * recv flags, stored in sqe->ioprio
+ *
+ * IORING_RECV_MULTISHOT	Keep receiving, posting a CQE per message.
+ *				Requires IOSQE_BUFFER_SELECT.
+ */
+#define IORING_RECV_MULTISHOT	(1U << 1)
+
+/*
+ * send_zc flags, stored in sqe->ioprio
+ *
+ * IORING_RECVSEND_FIXED_BUF	Send from the registered buffer in
+ *				sqe->buf_index.
+ */
+#define IORING_RECVSEND_FIXED_BUF	(1U << 2)
+
+/*
+ * cqe->res of an IORING_CQE_F_NOTIF completion
+ *
+ * IORING_NOTIF_USAGE_ZC_COPIED	The data was copied after all, the send
+ *				wasn't zero-copy.
+ */
+#define IORING_NOTIF_USAGE_ZC_COPIED	(1U << 31)
+
 /*
  * IO completion data structure (Completion Queue Entry)
  */
@@ -78,6 +170,22 @@ struct io_uring_cqe {
 	__u32	flags;
 };
 
+/*
+ * cqe->flags
+ *
+ * IORING_CQE_F_BUFFER	If set, the upper 16 bits are the buffer ID
+ * IORING_CQE_F_MORE	If set, the request stays armed and more CQEs follow
+ * IORING_CQE_F_NOTIF	Zero-copy send notification, the pages of the send
+ *			with the same user_data may be reused
+ */
+#define IORING_CQE_F_BUFFER		(1U << 0)
+#define IORING_CQE_F_MORE		(1U << 1)
+#define IORING_CQE_F_NOTIF		(1U << 3)
+
+enum {
+	IORING_CQE_BUFFER_SHIFT		= 16,
+};
+
 /*
  * Magic offsets for the application to mmap the data it needs
  */
@@ -120,6 +228,21 @@ struct io_cqring_offsets {
  */
 #define IORING_ENTER_GETEVENTS	(1U << 0)
 #define IORING_ENTER_SQ_WAKEUP	(1U << 1)
+#define IORING_ENTER_EXT_ARG	(1U << 3)
+#define IORING_ENTER_ABS_TIMER	(1U << 5)
+
+/*
+ * Argument for io_uring_enter(2) with IORING_ENTER_EXT_ARG set, passed in
+ * place of the sigset, with its size as the last argument. ts, if set,
+ * points to a struct __kernel_timespec to wait for at most, or until, with
+ * IORING_ENTER_ABS_TIMER (CLOCK_MONOTONIC).
+ */
+struct io_uring_getevents_arg {
+	__u64	sigmask;
+	__u32	sigmask_sz;
+	__u32	pad;
+	__u64	ts;
+};
 
 /*
  * Passed in for io_uring_setup(2). Copied back with updated info on success
@@ -140,6 +263,8 @@ struct io_uring_params {
  * io_uring_params->features flags
  */
 #define IORING_FEAT_SINGLE_MMAP		(1U << 0)
+#define IORING_FEAT_FAST_POLL		(1U << 5)
+#define IORING_FEAT_EXT_ARG		(1U << 8)
 
 /*
  * io_uring_register(2) opcodes and arguments
@@ -150,5 +275,36 @@ struct io_uring_params {
 #define IORING_UNREGISTER_FILES		3
 #define IORING_REGISTER_EVENTFD		4
 #define IORING_UNREGISTER_EVENTFD	5
+#define IORING_REGISTER_FILES_UPDATE	6
+#define IORING_REGISTER_NAPI		27
+#define IORING_UNREGISTER_NAPI		28
+
+/* Not in mainline, numbered away from its opcodes */
+#define IORING_REGISTER_CQ_FUTEX	0x8000
+#define IORING_UNREGISTER_CQ_FUTEX	0x8001
+
+/*
+ * Argument of IORING_REGISTER_FILES_UPDATE, and of IORING_OP_FILES_UPDATE
+ * through sqe->off and sqe->addr. An fd of -1 clears the slot.
+ */
+struct io_uring_files_update {
+	__u32 offset;
+	__u32 resv;
+	__aligned_u64 /* __s32 * */ fds;
+};
+
+/*
+ * Argument of IORING_REGISTER_NAPI: how long to busy poll the NAPI contexts
+ * of the ring's sockets before sleeping for completions. The previous
+ * settings are copied back, and IORING_UNREGISTER_NAPI copies them back too
+ * if given an argument. A nonzero prefer_busy_poll asks the device to defer
+ * its interrupts while the ring busy polls, as SO_PREFER_BUSY_POLL does.
+ */
+struct io_uring_napi {
+	__u32	busy_poll_to;	/* usecs */
+	__u8	prefer_busy_poll;
+	__u8	pad[3];
+	__u64	resv;
+};
 
 #endif
@@ -117,4 +117,50 @@ enum fsconfig_command {
 #define MOUNT_ATTR_STRICTATIME	0x00000020 /* - Always perform atime updates */
 #define MOUNT_ATTR_NODIRATIME	0x00000080 /* Do not update directory access times */
 
+/*
+ * Buffer filled in by mntstat().  String fields hold the offset of a NUL
+ * terminated string in str[].  Numeric ids match those in
+ * /proc/<pid>/mountinfo and are 0 where mountinfo omits the field.
+ */
+struct mntstat {
+	__u32 size;		/* Bytes filled in, including str[]; on
+				 * EOVERFLOW only this is set, to the
+				 * buffer size needed */
+	__u32 __spare1;
+	__u64 mnt_attr;		/* MOUNT_ATTR_* */
+	__u64 mnt_propagation;	/* MS_SHARED, MS_SLAVE, MS_PRIVATE, MS_UNBINDABLE */
+	__s32 mnt_id;
+	__s32 mnt_parent_id;
+	__s32 mnt_peer_group;	/* shared:N */
+	__s32 mnt_master;	/* master:N */
+	__s32 propagate_from;	/* propagate_from:N */
+	__u32 sb_dev_major;
+	__u32 sb_dev_minor;
+	__u32 sb_flags;		/* MS_RDONLY, MS_SYNCHRONOUS, MS_DIRSYNC, MS_LAZYTIME */
+	__u64 sb_magic;
+	__u32 fs_type;		/* Filesystem type name */
+	__u32 mnt_root;		/* Root of the mount within its filesystem */
+	__u32 mnt_point;	/* Mount point, relative to the caller's root */
+	__u32 __spare2;
+	__u64 __spare3[8];
+	char str[0];
+};
+
+/*
+ * Records read from /proc/<pid>/mountevents.  @seq numbers the changes to
+ * the mount namespace; a MOUNT_EVENT_OVERFLOW record means changes were
+ * lost and the reader should rescan.
+ */
+struct mount_event {
+	__u64 seq;
+	__s32 mnt_id;		/* -1 for MOUNT_EVENT_OVERFLOW */
+	__u32 type;
+};
+
+#define MOUNT_EVENT_ATTACH	1	/* Mount added to the namespace */
+#define MOUNT_EVENT_DETACH	2	/* Mount removed from the namespace */
+#define MOUNT_EVENT_MOVE	3	/* Mount moved to a new mount point */
+#define MOUNT_EVENT_SETATTR	4	/* Mount attributes changed */
+#define MOUNT_EVENT_OVERFLOW	5	/* Records were lost */
+
 #endif /* _UAPI_LINUX_MOUNT_H */
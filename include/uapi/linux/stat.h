@@ -170,5 +170,20 @@ struct statx {
 
 #define STATX_ATTR_AUTOMOUNT		0x00001000 /* Dir: Automount trigger */
 
+/*
+ * Directory entry as returned by getdents_statx(2): the getdents64() entry
+ * followed by the statx() attributes of the file it names. d_stx.stx_mask
+ * is zero when the attributes could not be retrieved, e.g. because the
+ * entry went away in between.
+ */
+struct dirent_statx {
+	__u64	d_ino;		/* Inode number */
+	__s64	d_off;		/* Offset of the next entry */
+	__u16	d_reclen;	/* Length of this record */
+	__u8	d_type;		/* DT_* type of the entry */
+	__u8	__spare0[5];
+	struct statx d_stx;	/* Attributes of the entry */
+	char	d_name[0];	/* NUL-terminated name */
+};
 
 #endif /* _UAPI_LINUX_STAT_H */
@@ -1832,6 +1832,18 @@ static struct ctl_table fs_table[] = {
 		.mode		= 0444,
 		.proc_handler	= proc_nr_dentry,
 	},
+	{
+		.procname	= "negative-dentry-limit",
+		.data		= &sysctl_negative_dentry_limit,
+		.maxlen		= sizeof(sysctl_negative_dentry_limit),
+		.mode		= 0644,
+		.proc_handler	= proc_doulongvec_minmax,
+	},
+	{
+		.procname	= "rcu-walk-state",
+		.mode		= 0444,
+		.proc_handler	= proc_nr_rcu_walk,
+	},
 	{
 		.procname	= "overflowuid",
 		.data		= &fs_overflowuid,
@@ -397,6 +397,7 @@ static size_t copy_page_to_iter_pipe(struct page *page, size_t offset, size_t by
 	if (idx == pipe->curbuf && pipe->nrbufs)
 		return 0;
 	pipe->nrbufs++;
+	pipe->pages_used++;
 	buf->ops = &page_cache_pipe_buf_ops;
 	buf->flags = 0;
 	get_page(buf->page = page);
@@ -524,6 +525,7 @@ static size_t push_pipe(struct iov_iter *i, size_t size,
 		if (!page)
 			break;
 		pipe->nrbufs++;
+		pipe->pages_used++;
 		pipe->bufs[idx].ops = &default_pipe_buf_ops;
 		pipe->bufs[idx].flags = 0;
 		pipe->bufs[idx].page = page;
@@ -1004,6 +1006,7 @@ static inline void pipe_truncate(struct iov_iter *i)
 			nrbufs++;
 		}
 		while (pipe->nrbufs > nrbufs) {
+			pipe->pages_used -= pipe_buf_nr_pages(&pipe->bufs[idx]);
 			pipe_buf_release(pipe, &pipe->bufs[idx]);
 			idx = next_idx(idx, pipe);
 			pipe->nrbufs--;
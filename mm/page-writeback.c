@@ -782,6 +782,25 @@ static unsigned long __wb_calc_thresh(struct dirty_throttle_control *dtc)
 	wb_min_max_ratio(dtc->wb, &wb_min_ratio, &wb_max_ratio);
 
 	wb_thresh += (thresh * wb_min_ratio) / 100;
+
+	/*
+	 * The writeout fraction favours whoever completes the most IO, so
+	 * a cgroup that streams writes to a device would otherwise squeeze
+	 * the share of every other cgroup wb on it to near zero and get
+	 * them throttled alongside it. Guarantee each dirty cgroup wb half
+	 * of its io.weight share among the dirty wbs of all bdis, so the
+	 * floors add up to at most half of @thresh however many devices
+	 * are dirty. Root wbs keep their plain writeout fraction.
+	 */
+	if (dom == &global_wb_domain && dtc->wb != &dtc->wb->bdi->wb &&
+	    wb_has_dirty_io(dtc->wb)) {
+		int tot = atomic_read(&dom->tot_dirty_weight);
+		u64 share = (u64)thresh * dtc->wb->dirty_weight;
+
+		if (tot > 0)
+			wb_thresh = max(wb_thresh, div_u64(share, 2 * tot));
+	}
+
 	if (wb_thresh > (thresh * wb_max_ratio) / 100)
 		wb_thresh = thresh * wb_max_ratio / 100;
 
@@ -1551,6 +1570,23 @@ static inline void wb_dirty_limits(struct dirty_throttle_control *dtc)
 	}
 }
 
+/*
+ * Charge time spent sleeping in balance_dirty_pages() to the global and
+ * the per-cgroup dirty_throttle_ms counters. With cgroup writeback the
+ * cgroup is the one owning @wb, which is the one dirtying the pages.
+ */
+static void wb_account_dirty_throttle(struct bdi_writeback *wb,
+				      unsigned long slept)
+{
+	unsigned int msecs = jiffies_to_msecs(slept);
+
+	count_vm_events(DIRTY_THROTTLE_MS, msecs);
+#ifdef CONFIG_CGROUP_WRITEBACK
+	count_memcg_events(mem_cgroup_from_css(wb->memcg_css),
+			   DIRTY_THROTTLE_MS, msecs);
+#endif
+}
+
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
  * data.  It looks at the number of dirty pages in the machine and will force
@@ -1780,6 +1816,7 @@ static void balance_dirty_pages(struct bdi_writeback *wb,
 		__set_current_state(TASK_KILLABLE);
 		wb->dirty_sleep = now;
 		io_schedule_timeout(pause);
+		wb_account_dirty_throttle(wb, jiffies - now);
 
 		current->dirty_paused_when = now + pause;
 		current->nr_dirtied = 0;
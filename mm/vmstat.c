@@ -1198,6 +1198,7 @@ const char * const vmstat_text[] = {
 	"pgscan_kswapd",
 	"pgscan_direct",
 	"pgscan_direct_throttle",
+	"dirty_throttle_ms",
 
 #ifdef CONFIG_NUMA
 	"zone_reclaim_failed",
@@ -1153,6 +1153,10 @@ struct ubuf_info *sock_zerocopy_realloc(struct sock *sk, size_t size,
 			return NULL;
 		}
 
+		/* the tail skb may carry another user's uarg (msg_ubuf) */
+		if (uarg->callback != sock_zerocopy_callback)
+			goto new_alloc;
+
 		bytelen = uarg->bytelen + size;
 		if (uarg->len == USHRT_MAX - 1 || bytelen > byte_limit) {
 			/* TCP can create new skb to attach new uarg */
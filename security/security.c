@@ -1300,6 +1300,15 @@ int security_inode_permission(struct inode *inode, int mask)
 }
 EXPORT_SYMBOL_GPL(security_inode_permission);
 
+/*
+ * Tells whether security_inode_permission() always grants access, i.e. no
+ * LSM implements the hook. Used by the VFS to cache permission results.
+ */
+bool security_inode_permission_trivial(void)
+{
+	return hlist_empty(&security_hook_heads.inode_permission);
+}
+
 int security_inode_setattr(struct dentry *dentry, struct iattr *attr)
 {
 	int ret;
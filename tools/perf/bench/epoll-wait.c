@@ -38,7 +38,11 @@
  * is not what we want to stress. The size of the fdmap can be adjusted
  * by the user; enlarging the value will increase the chances of
  * epoll_wait(2) blocking as the lineal writer thread will take "longer",
- * at least at a high level.
+ * at least at a high level. With --writers, several writer threads
+ * share the work, each one writing to the fdmaps of its own subset of
+ * the workers; this stresses the concurrent ready-list insertion path
+ * of a single epoll instance. With --randomize, each writer shuffles the
+ * order of its own workers and of their fdmaps.
  *
  * Note that because fds are private to each thread, this workload does
  * not stress scenarios where multiple tasks are awoken per ready IO; ie:
@@ -110,6 +114,9 @@ static bool multiq; /* use an epoll instance per thread */
 /* amount of fds to monitor, per thread */
 static unsigned int nfds = 64;
 
+/* amount of threads writing to the fdmaps */
+static unsigned int nwriters = 1;
+
 static pthread_mutex_t thread_lock;
 static unsigned int threads_starting;
 static struct stats throughput_stats;
@@ -130,6 +137,7 @@ static const struct option options[] = {
 	OPT_UINTEGER('f', "nfds",    &nfds,  "Specify amount of file descriptors to monitor for each thread"),
 	OPT_BOOLEAN( 'n', "noaffinity",  &noaffinity,   "Disables CPU affinity"),
 	OPT_BOOLEAN('R', "randomize", &randomize,   "Enable random write behaviour (default is lineal)"),
+	OPT_UINTEGER('w', "writers", &nwriters, "Specify amount of writer threads (default is 1)"),
 	OPT_BOOLEAN( 'v', "verbose", &__verbose, "Verbose mode"),
 
 	/* epoll specific options */
@@ -364,25 +372,43 @@ static int do_threads(struct worker *worker, struct perf_cpu_map *cpu)
 	return ret;
 }
 
+struct writer {
+	unsigned int id;
+	pthread_t thread;
+	struct worker *worker;
+};
+
 static void *writerfn(void *p)
 {
-	struct worker *worker = p;
+	struct writer *wr = p;
+	struct worker *worker = wr->worker;
+	unsigned int *order, nr = 0;
 	size_t i, j, iter;
 	const uint64_t val = 1;
 	ssize_t sz;
 	struct timespec ts = { .tv_sec = 0,
 			       .tv_nsec = 500 };
 
-	printinfo("starting writer-thread: doing %s writes ...\n",
-		  randomize? "random":"lineal");
+	/*
+	 * The worker array is shared by all writers, so each one shuffles
+	 * its own list of worker indices instead.
+	 */
+	order = calloc(nthreads / nwriters + 1, sizeof(*order));
+	if (!order)
+		err(EXIT_FAILURE, "calloc");
+	for (i = wr->id; i < nthreads; i += nwriters)
+		order[nr++] = i;
+
+	printinfo("starting writer-thread %d: doing %s writes ...\n",
+		  wr->id, randomize? "random":"lineal");
 
 	for (iter = 0; !wdone; iter++) {
 		if (randomize) {
-			shuffle((void *)worker, nthreads, sizeof(*worker));
+			shuffle((void *)order, nr, sizeof(*order));
 		}
 
-		for (i = 0; i < nthreads; i++) {
-			struct worker *w = &worker[i];
+		for (i = 0; i < nr; i++) {
+			struct worker *w = &worker[order[i]];
 
 			if (randomize) {
 				shuffle((void *)w->fdmap, nfds, sizeof(int));
@@ -398,26 +424,20 @@ static void *writerfn(void *p)
 		nanosleep(&ts, NULL);
 	}
 
-	printinfo("exiting writer-thread (total full-loops: %zd)\n", iter);
+	printinfo("exiting writer-thread %d (total full-loops: %zd)\n",
+		  wr->id, iter);
+	free(order);
 	return NULL;
 }
 
-static int cmpworker(const void *p1, const void *p2)
-{
-
-	struct worker *w1 = (struct worker *) p1;
-	struct worker *w2 = (struct worker *) p2;
-	return w1->tid > w2->tid;
-}
-
 int bench_epoll_wait(int argc, const char **argv)
 {
 	int ret = 0;
 	struct sigaction act;
 	unsigned int i;
 	struct worker *worker = NULL;
+	struct writer *writer = NULL;
 	struct perf_cpu_map *cpu;
-	pthread_t wthread;
 	struct rlimit rl, prevrl;
 
 	argc = parse_options(argc, argv, options, bench_epoll_wait_usage, 0);
@@ -459,6 +479,13 @@ int bench_epoll_wait(int argc, const char **argv)
 		goto errmem;
 	}
 
+	if (!nwriters || nwriters > nthreads)
+		nwriters = nthreads;
+
+	writer = calloc(nwriters, sizeof(*writer));
+	if (!writer)
+		goto errmem;
+
 	if (getrlimit(RLIMIT_NOFILE, &prevrl))
 		err(EXIT_FAILURE, "getrlimit");
 	rl.rlim_cur = rl.rlim_max = nfds * nthreads * 2 + 50;
@@ -468,8 +495,9 @@ int bench_epoll_wait(int argc, const char **argv)
 		err(EXIT_FAILURE, "setrlimit");
 
 	printf("Run summary [PID %d]: %d threads monitoring%s on "
-	       "%d file-descriptors for %d secs.\n\n",
-	       getpid(), nthreads, oneshot ? " (EPOLLONESHOT semantics)": "", nfds, nsecs);
+	       "%d file-descriptors for %d secs, %d writer(s).\n\n",
+	       getpid(), nthreads, oneshot ? " (EPOLLONESHOT semantics)": "", nfds, nsecs,
+	       nwriters);
 
 	init_stats(&throughput_stats);
 	pthread_mutex_init(&thread_lock, NULL);
@@ -490,13 +518,17 @@ int bench_epoll_wait(int argc, const char **argv)
 
 	/*
 	 * At this point the workers should be blocked waiting for read events
-	 * to become ready. Launch the writer which will constantly be writing
+	 * to become ready. Launch the writers which will constantly be writing
 	 * to each thread's fdmap.
 	 */
-	ret = pthread_create(&wthread, NULL, writerfn,
-			     (void *)(struct worker *) worker);
-	if (ret)
-		err(EXIT_FAILURE, "pthread_create");
+	for (i = 0; i < nwriters; i++) {
+		writer[i].id = i;
+		writer[i].worker = worker;
+		ret = pthread_create(&writer[i].thread, NULL, writerfn,
+				     (void *)&writer[i]);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
 
 	sleep(nsecs);
 	toggle_done(0, NULL, NULL);
@@ -504,19 +536,18 @@ int bench_epoll_wait(int argc, const char **argv)
 
 	sleep(1); /* meh */
 	wdone = true;
-	ret = pthread_join(wthread, NULL);
-	if (ret)
-		err(EXIT_FAILURE, "pthread_join");
+	for (i = 0; i < nwriters; i++) {
+		ret = pthread_join(writer[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+	free(writer);
 
 	/* cleanup & report results */
 	pthread_cond_destroy(&thread_parent);
 	pthread_cond_destroy(&thread_worker);
 	pthread_mutex_destroy(&thread_lock);
 
-	/* sort the array back before reporting */
-	if (randomize)
-		qsort(worker, nthreads, sizeof(struct worker), cmpworker);
-
 	for (i = 0; i < nthreads; i++) {
 		unsigned long t = worker[i].ops / bench__runtime.tv_sec;
 